@@ -19,6 +19,7 @@
 
 #include <sys/types.h>
 
+#include <deque>
 #include <forward_list>
 #include <map>
 #include <memory>
@@ -37,43 +38,14 @@ namespace trace_processor {
 const base::PlatformProcessId kNullProcessId = 0;
 
 // Contains processed node graphs for each process and in the global space.
-// This class is also the arena which owns the nodes of the graph.
 class PERFETTO_EXPORT GlobalNodeGraph {
  public:
+  class Process;
   class Node;
   class Edge;
   class PreOrderIterator;
   class PostOrderIterator;
 
-  // Graph of nodes either associated with a process or with
-  // the shared space.
-  class PERFETTO_EXPORT Process {
-   public:
-    Process(base::PlatformProcessId pid, GlobalNodeGraph* global_graph);
-    ~Process();
-
-    // Creates a node in the node graph which is associated with the
-    // given |id|, |path| and |weak|ness and returns it.
-    GlobalNodeGraph::Node* CreateNode(MemoryAllocatorNodeId id,
-                                      const std::string& path,
-                                      bool weak);
-
-    // Returns the node in the graph at the given |path| or nullptr
-    // if no such node exists in the provided |graph|.
-    GlobalNodeGraph::Node* FindNode(const std::string& path);
-
-    base::PlatformProcessId pid() const { return pid_; }
-    GlobalNodeGraph* global_graph() const { return global_graph_; }
-    GlobalNodeGraph::Node* root() const { return root_; }
-
-   private:
-    base::PlatformProcessId pid_;
-    GlobalNodeGraph* global_graph_;
-    GlobalNodeGraph::Node* root_;
-    Process(const Process&) = delete;
-    Process& operator=(const Process&) = delete;
-  };
-
   // A single node in the graph of allocator nodes associated with a
   // certain path and containing the entries for this path.
   class PERFETTO_EXPORT Node {
@@ -189,6 +161,8 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     }
 
    private:
+    friend class GlobalNodeGraph;
+
     GlobalNodeGraph::Process* node_graph_;
     Node* const parent_;
     MemoryAllocatorNodeId id_;
@@ -203,6 +177,10 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     double cumulative_owned_coefficient_ = 1;
     double cumulative_owning_coefficient_ = 1;
 
+    // The id of the last NodesInDepthFirst*Order() traversal which visited
+    // this node.
+    uint32_t traversal_id_ = 0;
+
     GlobalNodeGraph::Edge* owns_edge_;
     std::vector<GlobalNodeGraph::Edge*> owned_by_edges_;
 
@@ -228,6 +206,49 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     const int priority_;
   };
 
+  // Graph of nodes either associated with a process or with
+  // the shared space. This class is also the arena which owns the nodes of
+  // the graph, so the graphs of different processes can be populated
+  // concurrently.
+  class PERFETTO_EXPORT Process {
+   public:
+    Process(base::PlatformProcessId pid, GlobalNodeGraph* global_graph);
+    ~Process();
+
+    // Creates a node in the node graph which is associated with the
+    // given |id|, |path| and |weak|ness and returns it. If |id| is not empty,
+    // the node is also added to the nodes_by_id() map of the global graph,
+    // which is shared by all the process graphs.
+    GlobalNodeGraph::Node* CreateNode(MemoryAllocatorNodeId id,
+                                      const std::string& path,
+                                      bool weak);
+
+    // Returns the node in the graph at the given |path| or nullptr
+    // if no such node exists in the provided |graph|.
+    GlobalNodeGraph::Node* FindNode(const std::string& path);
+
+    base::PlatformProcessId pid() const { return pid_; }
+    GlobalNodeGraph* global_graph() const { return global_graph_; }
+    GlobalNodeGraph::Node* root() const { return root_; }
+
+    // Returns the number of nodes created in this graph, including the ones
+    // which have since been removed from the tree.
+    size_t node_count() const { return nodes_.size(); }
+
+   private:
+    friend class GlobalNodeGraph::Node;
+
+    // Creates a node in the arena for the given |parent|.
+    GlobalNodeGraph::Node* CreateNodeInArena(GlobalNodeGraph::Node* parent);
+
+    base::PlatformProcessId pid_;
+    GlobalNodeGraph* global_graph_;
+    std::deque<GlobalNodeGraph::Node> nodes_;
+    GlobalNodeGraph::Node* root_;
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+  };
+
   // An iterator-esque class which yields nodes in a depth-first pre order.
   class PERFETTO_EXPORT PreOrderIterator {
    public:
@@ -276,6 +297,10 @@ class PERFETTO_EXPORT GlobalNodeGraph {
   // and edge priority.
   void AddNodeOwnershipEdge(Node* owner, Node* owned, int priority);
 
+  // Associates |node| with its id in nodes_by_id(), unless the id is empty or
+  // already associated with another node.
+  void AddToNodesById(Node* node);
+
   // Returns an iterator which yields nodes in the nodes in this graph in
   // pre-order. That is, children and owners of nodes are returned after the
   // node itself.
@@ -286,6 +311,13 @@ class PERFETTO_EXPORT GlobalNodeGraph {
   // node itself.
   PostOrderIterator VisitInDepthFirstPostOrder();
 
+  // Return all the nodes of this graph in the order in which they are yielded
+  // by VisitInDepthFirstPreOrder() and VisitInDepthFirstPostOrder(). Instead
+  // of keeping a set of the visited nodes these mark the nodes themselves, so
+  // they are much cheaper but two of them cannot run concurrently.
+  std::vector<Node*> NodesInDepthFirstPreOrder();
+  std::vector<Node*> NodesInDepthFirstPostOrder();
+
   const IdNodeMap& nodes_by_id() const { return nodes_by_id_; }
   GlobalNodeGraph::Process* shared_memory_graph() const {
     return shared_memory_graph_.get();
@@ -296,16 +328,15 @@ class PERFETTO_EXPORT GlobalNodeGraph {
   const std::forward_list<Edge>& edges() const { return all_edges_; }
 
  private:
-  // Creates a node in the arena which is associated with the given
-  // |process_graph| and for the given |parent|.
-  Node* CreateNode(GlobalNodeGraph::Process* process_graph,
-                   GlobalNodeGraph::Node* parent);
+  // Returns the roots of the graphs, in the order in which they are pushed on
+  // the stack of the depth-first traversals.
+  std::vector<Node*> TraversalRoots() const;
 
-  std::forward_list<Node> all_nodes_;
   std::forward_list<Edge> all_edges_;
   IdNodeMap nodes_by_id_;
   std::unique_ptr<GlobalNodeGraph::Process> shared_memory_graph_;
   ProcessNodeGraphMap process_node_graphs_;
+  uint32_t last_traversal_id_ = 0;
   GlobalNodeGraph(const GlobalNodeGraph&) = delete;
   GlobalNodeGraph& operator=(const GlobalNodeGraph&) = delete;
 };
@@ -23,6 +23,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/proc_utils.h"
 #include "perfetto/ext/trace_processor/importers/memory_tracker/graph.h"
@@ -52,9 +53,22 @@ class PERFETTO_EXPORT GraphProcessor {
  private:
   friend class GraphProcessorTest;
 
-  static void CollectAllocatorNodes(const RawProcessMemoryNode& source,
-                                    GlobalNodeGraph* global_graph,
-                                    GlobalNodeGraph::Process* process_graph);
+  // Creates the nodes of |source| which belong to |process_graph| (i.e. all
+  // but the global ones) and appends them to |nodes|, with nullptr for the
+  // global ones. Only touches |process_graph| so can be called for different
+  // processes concurrently.
+  static void CollectProcessAllocatorNodes(
+      const RawProcessMemoryNode& source,
+      GlobalNodeGraph::Process* process_graph,
+      std::vector<GlobalNodeGraph::Node*>* nodes);
+
+  // Creates the global nodes of |source| in the shared graph and adds all its
+  // nodes to the id map, in order. |nodes| are the nodes created for |source|
+  // by CollectProcessAllocatorNodes().
+  static void CollectAllocatorNodes(
+      const RawProcessMemoryNode& source,
+      GlobalNodeGraph* global_graph,
+      const std::vector<GlobalNodeGraph::Node*>& nodes);
 
   static void AddEdges(const RawProcessMemoryNode& source,
                        GlobalNodeGraph* global_graph);
@@ -17,6 +17,7 @@
 #ifndef INCLUDE_PERFETTO_PROFILING_PPROF_BUILDER_H_
 #define INCLUDE_PERFETTO_PROFILING_PPROF_BUILDER_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -63,6 +64,17 @@ bool TraceToPprof(trace_processor::TraceProcessor* tp,
                   uint64_t pid = 0,
                   const std::vector<uint64_t>& timestamps = {});
 
+// Like the above, but passes each profile to |on_profile| as soon as it is
+// complete instead of collecting all of them. The profiles are built on
+// multiple threads; |on_profile| is called on the calling thread, in the same
+// order in which the profiles are appended to |output| above.
+bool TraceToPprof(trace_processor::TraceProcessor* tp,
+                  const std::function<void(SerializedProfile)>& on_profile,
+                  ConversionMode mode = ConversionMode::kHeapProfile,
+                  uint64_t flags = 0,
+                  uint64_t pid = 0,
+                  const std::vector<uint64_t>& timestamps = {});
+
 }  // namespace trace_to_text
 }  // namespace perfetto
 
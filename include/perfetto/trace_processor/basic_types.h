@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/export.h"
 #include "perfetto/base/logging.h"
@@ -106,6 +107,28 @@ struct PERFETTO_EXPORT Config {
   // the trace before that event. See the ennu documenetation for more details.
   DropFtraceDataBefore drop_ftrace_data_before =
       DropFtraceDataBefore::kTracingStarted;
+
+  // When non-zero, enables streaming mode for traces which are unbounded (e.g.
+  // a live trace read from a pipe): while parsing, rows of the high-volume
+  // event tables (sched_slice, counter, instant and raw) with a timestamp more
+  // than this many nanoseconds older than the newest event seen so far are
+  // evicted in bulk so memory use stays bounded. Evicted rows are no longer
+  // visible to queries; the ids of the remaining rows are unchanged.
+  int64_t streaming_horizon_ns = 0;
+
+  // Arg keys (e.g. "args.name") whose values are materialized into columns of
+  // the experimental_slice_with_args and experimental_raw_with_args tables
+  // (the slice and raw tables extended with one nullable column per key). This
+  // allows to filter and sort on frequently used args without calling
+  // EXTRACT_ARG for each row. Note: EXTRACT_ARG automatically speeds up the
+  // lookups of the keys it is called with often, even if not listed here.
+  std::vector<std::string> materialized_arg_keys;
+
+  // When set to true, the time spent in each phase of ingestion is broken down
+  // by the type of data being processed and exposed in the
+  // experimental_ingest_profile table. Off by default as the bookkeeping adds
+  // some overhead to the ingestion of every event.
+  bool profile_ingestion = false;
 };
 
 // Represents a dynamically typed value returned by SQL.
@@ -64,6 +64,11 @@ class PERFETTO_EXPORT Iterator {
   // Returns the status of the iterator.
   util::Status Status();
 
+  // Returns the index of this iterator's query in the queries executed since
+  // the trace processor was created. This is the query_id of its profile in
+  // the experimental_query_profile table, if it was profiled.
+  uint32_t QueryId();
+
  private:
   friend class QueryResultSerializer;
 
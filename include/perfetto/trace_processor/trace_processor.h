@@ -106,6 +106,16 @@ class PERFETTO_EXPORT TraceProcessor : public TraceProcessorStorage {
   virtual util::Status DisableAndReadMetatrace(
       std::vector<uint8_t>* trace_proto) = 0;
 
+  // Enables or disables the profiling of the queries executed from now on.
+  // For each query profiled, the plans chosen by SQLite to read the virtual
+  // tables, the rows scanned and returned and the time spent in each of them
+  // are recorded in the experimental_query_profile table. Profiling slows
+  // down queries so it is disabled by default.
+  virtual void SetQueryProfilingEnabled(bool enabled) = 0;
+
+  // Returns whether the queries executed from now on are profiled.
+  virtual bool IsQueryProfilingEnabled() = 0;
+
   // Gets all the currently loaded proto descriptors used in metric computation.
   // This includes all compiled-in binary descriptors, and all proto descriptors
   // loaded by trace processor shell at runtime. The message is encoded as
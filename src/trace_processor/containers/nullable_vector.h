@@ -84,9 +84,11 @@ class NullableVector : public NullableVectorBase {
 
   // Returns the optional value at |idx| or base::nullopt if the value is null.
   base::Optional<T> Get(uint32_t idx) const {
+    PERFETTO_DCHECK(idx >= evicted_);
     if (mode_ == Mode::kDense) {
       bool contains = valid_.Contains(idx);
-      return contains ? base::Optional<T>(data_[idx]) : base::nullopt;
+      return contains ? base::Optional<T>(data_[idx - evicted_])
+                      : base::nullopt;
     } else {
       auto opt_idx = valid_.IndexOf(idx);
       return opt_idx ? base::Optional<T>(data_[*opt_idx]) : base::nullopt;
@@ -103,12 +105,16 @@ class NullableVector : public NullableVectorBase {
   // GetNonNull(1) = 2
   // GetNonNull(2) = 4
   // ...
+  //
+  // Non-null entries freed by EvictBefore still count towards |ordinal|.
   T GetNonNull(uint32_t ordinal) const {
+    PERFETTO_DCHECK(ordinal >= evicted_non_null_);
+    uint32_t live_ordinal = ordinal - evicted_non_null_;
     if (mode_ == Mode::kDense) {
-      return data_[valid_.Get(ordinal)];
+      return data_[valid_.Get(live_ordinal) - evicted_];
     } else {
-      PERFETTO_DCHECK(ordinal < data_.size());
-      return data_[ordinal];
+      PERFETTO_DCHECK(live_ordinal < data_.size());
+      return data_[live_ordinal];
     }
   }
 
@@ -137,11 +143,12 @@ class NullableVector : public NullableVectorBase {
 
   // Sets the value at |idx| to the given |val|.
   void Set(uint32_t idx, T val) {
+    PERFETTO_DCHECK(idx >= evicted_);
     if (mode_ == Mode::kDense) {
       if (!valid_.Contains(idx)) {
         valid_.Insert(idx);
       }
-      data_[idx] = val;
+      data_[idx - evicted_] = val;
     } else {
       auto opt_idx = valid_.IndexOf(idx);
 
@@ -159,6 +166,33 @@ class NullableVector : public NullableVectorBase {
     }
   }
 
+  // Frees the storage of all the values at indices before |idx|. Indices at or
+  // after |idx| are unchanged; accessing any of the freed indices afterwards
+  // is invalid. Callers are expected to reject the ids of evicted rows before
+  // they are turned into indices (see IdColumn::IndexOf).
+  //
+  // This is intended for evicting the oldest rows of a table in bulk: the
+  // values are erased from the front of the storage, which only releases the
+  // memory of the chunks which become empty.
+  void EvictBefore(uint32_t idx) {
+    PERFETTO_DCHECK(idx <= size_);
+    if (idx <= evicted_)
+      return;
+
+    // Counting the valid entries before and after the intersection gives the
+    // number of non-null values in the evicted range; in sparse mode, those
+    // are exactly the values at the front of |data_|.
+    uint32_t valid_before = valid_.size();
+    valid_.Intersect(RowMap(idx, size_));
+    uint32_t evicted_non_null = valid_before - valid_.size();
+    uint32_t evicted_count =
+        mode_ == Mode::kDense ? idx - evicted_ : evicted_non_null;
+    data_.erase(data_.begin(),
+                data_.begin() + static_cast<ptrdiff_t>(evicted_count));
+    evicted_ = idx;
+    evicted_non_null_ += evicted_non_null;
+  }
+
   // Returns the size of the NullableVector; this includes any null values.
   uint32_t size() const { return size_; }
 
@@ -173,6 +207,14 @@ class NullableVector : public NullableVectorBase {
   std::deque<T> data_;
   RowMap valid_;
   uint32_t size_ = 0;
+
+  // The number of indices at the start of this NullableVector whose values
+  // were freed by EvictBefore and how many of those values were non-null.
+  // Lookups by index go through |valid_|, which already excludes the freed
+  // entries, so these are only needed to translate indices into |data_|
+  // directly.
+  uint32_t evicted_ = 0;
+  uint32_t evicted_non_null_ = 0;
 };
 
 }  // namespace trace_processor
@@ -98,6 +98,66 @@ TEST(NullableVector, Dense) {
   ASSERT_EQ(sv.GetNonNull(2), 2);
 }
 
+TEST(NullableVector, EvictBeforeSparse) {
+  NullableVector<int64_t> sv;
+  sv.Append(0);
+  sv.AppendNull();
+  sv.Append(2);
+  sv.Append(3);
+  sv.AppendNull();
+  sv.Append(5);
+
+  sv.EvictBefore(3);
+  ASSERT_EQ(sv.size(), 6u);
+  ASSERT_EQ(sv.Get(3), 3);
+  ASSERT_EQ(sv.Get(4), base::nullopt);
+  ASSERT_EQ(sv.Get(5), 5);
+
+  // Evicted non-null values still count towards the ordinal.
+  ASSERT_EQ(sv.GetNonNull(2), 3);
+  ASSERT_EQ(sv.GetNonNull(3), 5);
+
+  sv.Append(6);
+  sv.Set(4, 44);
+  ASSERT_EQ(sv.Get(4), 44);
+  ASSERT_EQ(sv.Get(5), 5);
+  ASSERT_EQ(sv.Get(6), 6);
+
+  // Evicting before an already evicted index is a no-op.
+  sv.EvictBefore(1);
+  ASSERT_EQ(sv.Get(3), 3);
+
+  sv.EvictBefore(7);
+  ASSERT_EQ(sv.size(), 7u);
+  sv.Append(7);
+  ASSERT_EQ(sv.Get(7), 7);
+}
+
+TEST(NullableVector, EvictBeforeDense) {
+  auto sv = NullableVector<int64_t>::Dense();
+  sv.Append(0);
+  sv.AppendNull();
+  sv.Append(2);
+  sv.Append(3);
+  sv.AppendNull();
+  sv.Append(5);
+
+  sv.EvictBefore(2);
+  ASSERT_EQ(sv.size(), 6u);
+  ASSERT_EQ(sv.Get(2), 2);
+  ASSERT_EQ(sv.Get(3), 3);
+  ASSERT_EQ(sv.Get(4), base::nullopt);
+  ASSERT_EQ(sv.Get(5), 5);
+
+  ASSERT_EQ(sv.GetNonNull(1), 2);
+  ASSERT_EQ(sv.GetNonNull(3), 5);
+
+  sv.Set(4, 4);
+  ASSERT_EQ(sv.Get(4), 4);
+  ASSERT_EQ(sv.GetNonNull(3), 4);
+  ASSERT_EQ(sv.GetNonNull(4), 5);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -472,5 +472,32 @@ const RowMap& Column::row_map() const {
   return table_->row_maps_[row_map_idx_];
 }
 
+uint32_t Column::evicted_row_count() const {
+  return table_->evicted_row_count_;
+}
+
+void Column::EvictBefore(uint32_t row) {
+  switch (type_) {
+    case ColumnType::kInt32:
+      mutable_nullable_vector<int32_t>()->EvictBefore(row);
+      break;
+    case ColumnType::kUint32:
+      mutable_nullable_vector<uint32_t>()->EvictBefore(row);
+      break;
+    case ColumnType::kInt64:
+      mutable_nullable_vector<int64_t>()->EvictBefore(row);
+      break;
+    case ColumnType::kDouble:
+      mutable_nullable_vector<double>()->EvictBefore(row);
+      break;
+    case ColumnType::kString:
+      mutable_nullable_vector<StringPool::Id>()->EvictBefore(row);
+      break;
+    case ColumnType::kId:
+      // Id columns have no storage.
+      break;
+  }
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
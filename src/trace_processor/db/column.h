@@ -220,7 +220,7 @@ class Column {
       case ColumnType::kInt64:
       case ColumnType::kDouble:
       case ColumnType::kString: {
-        for (uint32_t i = 0; i < row_map().size(); i++) {
+        for (uint32_t i = evicted_row_count(); i < row_map().size(); i++) {
           if (compare::SqlValue(Get(i), value) == 0)
             return i;
         }
@@ -229,6 +229,10 @@ class Column {
       case ColumnType::kId: {
         if (value.type != SqlValue::Type::kLong)
           return base::nullopt;
+        // The ids of evicted rows are never reused but their rows can no
+        // longer be read.
+        if (value.long_value < evicted_row_count())
+          return base::nullopt;
         return row_map().IndexOf(static_cast<uint32_t>(value.long_value));
       }
     }
@@ -302,13 +306,14 @@ class Column {
   // Returns the minimum value in this column. Returns nullopt if this column
   // is empty.
   base::Optional<SqlValue> Min() const {
-    if (row_map().empty())
+    uint32_t first = evicted_row_count();
+    if (row_map().size() == first)
       return base::nullopt;
 
     if (IsSorted())
-      return Get(0);
+      return Get(first);
 
-    Iterator b(this, 0);
+    Iterator b(this, first);
     Iterator e(this, row_map().size());
     return *std::min_element(b, e, &compare::SqlValueComparator);
   }
@@ -316,13 +321,14 @@ class Column {
   // Returns the minimum value in this column. Returns nullopt if this column
   // is empty.
   base::Optional<SqlValue> Max() const {
-    if (row_map().empty())
+    uint32_t first = evicted_row_count();
+    if (row_map().size() == first)
       return base::nullopt;
 
     if (IsSorted())
       return Get(row_map().size() - 1);
 
-    Iterator b(this, 0);
+    Iterator b(this, first);
     Iterator e(this, row_map().size());
     return *std::max_element(b, e, &compare::SqlValueComparator);
   }
@@ -344,6 +350,10 @@ class Column {
   // between |Table| and |Column|.
   const RowMap& row_map() const;
 
+  // Returns the number of rows at the start of the table which were evicted
+  // (see Table::EvictRowsBefore) and so must not be read.
+  uint32_t evicted_row_count() const;
+
   // Returns the name of the column.
   const char* name() const { return name_; }
 
@@ -392,8 +402,9 @@ class Column {
   // Returns the JoinKey for this Column.
   JoinKey join_key() const { return JoinKey{col_idx_in_table_}; }
 
-  // Returns an iterator to the first entry in this column.
-  Iterator begin() const { return Iterator(this, 0); }
+  // Returns an iterator to the first entry in this column which was not
+  // evicted.
+  Iterator begin() const { return Iterator(this, evicted_row_count()); }
 
   // Returns an iterator pointing beyond the last entry in this column.
   Iterator end() const { return Iterator(this, row_map().size()); }
@@ -451,6 +462,10 @@ class Column {
   Column(const Column&) = delete;
   Column& operator=(const Column&) = delete;
 
+  // Frees the storage of the values of all the rows before |row|. Should only
+  // be called by Table::EvictRowsBefore.
+  void EvictBefore(uint32_t row);
+
   // Gets the value of the Column at the given |row|.
   SqlValue GetAtIdx(uint32_t idx) const {
     switch (type_) {
@@ -486,7 +501,10 @@ class Column {
     PERFETTO_DCHECK(IsSorted());
     PERFETTO_DCHECK(value.type == type());
 
-    Iterator b(this, 0);
+    // Evicted rows must not be read so the search starts after them; the
+    // offsets computed below are relative to |first|.
+    uint32_t first = evicted_row_count();
+    Iterator b(this, first);
     Iterator e(this, row_map().size());
     switch (op) {
       case FilterOp::kEq: {
@@ -494,31 +512,31 @@ class Column {
             b, std::lower_bound(b, e, value, &compare::SqlValueComparator));
         uint32_t end = std::distance(
             b, std::upper_bound(b, e, value, &compare::SqlValueComparator));
-        rm->Intersect(RowMap(beg, end));
+        rm->Intersect(RowMap(first + beg, first + end));
         return true;
       }
       case FilterOp::kLe: {
         uint32_t end = std::distance(
             b, std::upper_bound(b, e, value, &compare::SqlValueComparator));
-        rm->Intersect(RowMap(0, end));
+        rm->Intersect(RowMap(first, first + end));
         return true;
       }
       case FilterOp::kLt: {
         uint32_t end = std::distance(
             b, std::lower_bound(b, e, value, &compare::SqlValueComparator));
-        rm->Intersect(RowMap(0, end));
+        rm->Intersect(RowMap(first, first + end));
         return true;
       }
       case FilterOp::kGe: {
         uint32_t beg = std::distance(
             b, std::lower_bound(b, e, value, &compare::SqlValueComparator));
-        rm->Intersect(RowMap(beg, row_map().size()));
+        rm->Intersect(RowMap(first + beg, row_map().size()));
         return true;
       }
       case FilterOp::kGt: {
         uint32_t beg = std::distance(
             b, std::upper_bound(b, e, value, &compare::SqlValueComparator));
-        rm->Intersect(RowMap(beg, row_map().size()));
+        rm->Intersect(RowMap(first + beg, row_map().size()));
         return true;
       }
       case FilterOp::kNe:
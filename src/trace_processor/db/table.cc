@@ -36,6 +36,7 @@ Table::Table(StringPool* pool, const Table* parent) : string_pool_(pool) {
 
 Table& Table::operator=(Table&& other) noexcept {
   row_count_ = other.row_count_;
+  evicted_row_count_ = other.evicted_row_count_;
   string_pool_ = other.string_pool_;
 
   row_maps_ = std::move(other.row_maps_);
@@ -48,12 +49,26 @@ Table& Table::operator=(Table&& other) noexcept {
 
 Table Table::Copy() const {
   Table table = CopyExceptRowMaps();
+  table.evicted_row_count_ = evicted_row_count_;
   for (const RowMap& rm : row_maps_) {
     table.row_maps_.emplace_back(rm.Copy());
   }
   return table;
 }
 
+void Table::EvictRowsBefore(uint32_t row) {
+  PERFETTO_DCHECK(row <= row_count_);
+  PERFETTO_DCHECK(row_maps_.size() == 1 && row_maps_[0].IsRange() &&
+                  row_maps_[0].size() == row_count_);
+  if (row <= evicted_row_count_)
+    return;
+
+  for (Column& col : columns_) {
+    col.EvictBefore(row);
+  }
+  evicted_row_count_ = row;
+}
+
 Table Table::CopyExceptRowMaps() const {
   Table table(string_pool_, nullptr);
   table.row_count_ = row_count_;
@@ -74,8 +89,9 @@ Table Table::Sort(const std::vector<Order>& od) const {
   if (od.size() == 1 && first_col.IsSorted() && !od.front().desc)
     return Copy();
 
-  // Build an index vector with all the indices for the first |size_| rows.
-  std::vector<uint32_t> idx(row_count_);
+  // Build an index vector with all the indices for the first |size_| rows,
+  // skipping any evicted rows.
+  std::vector<uint32_t> idx(row_count_ - evicted_row_count_);
 
   if (od.size() == 1 && first_col.IsSorted()) {
     // We special case a single constraint in descending order as this
@@ -83,7 +99,7 @@ Table Table::Sort(const std::vector<Order>& od) const {
     // more efficient as this column is already sorted so we simply need
     // to reverse the order of this column.
     PERFETTO_DCHECK(od.front().desc);
-    std::iota(idx.rbegin(), idx.rend(), 0);
+    std::iota(idx.rbegin(), idx.rend(), evicted_row_count_);
   } else {
     // As our data is columnar, it's always more efficient to sort one column
     // at a time rather than try and sort lexiographically all at once.
@@ -115,7 +131,7 @@ Table Table::Sort(const std::vector<Order>& od) const {
     // worthwhile. This also needs changes to the constraint modification logic
     // in DbSqliteTable which currently eliminates constraints on sorted
     // columns.
-    std::iota(idx.begin(), idx.end(), 0);
+    std::iota(idx.begin(), idx.end(), evicted_row_count_);
     for (auto it = od.rbegin(); it != od.rend(); ++it) {
       columns_[it->col_idx].StableSort(it->desc, &idx);
     }
@@ -125,6 +141,7 @@ Table Table::Sort(const std::vector<Order>& od) const {
   // RowMap.
   Table table = CopyExceptRowMaps();
   RowMap rm(std::move(idx));
+  table.row_count_ = rm.size();
   for (const RowMap& map : row_maps_) {
     table.row_maps_.emplace_back(map.SelectRows(rm));
     PERFETTO_DCHECK(table.row_maps_.back().size() == table.row_count());
@@ -147,6 +164,8 @@ Table Table::Sort(const std::vector<Order>& od) const {
 Table Table::LookupJoin(JoinKey left, const Table& other, JoinKey right) {
   // The join table will have the same size and RowMaps as the left (this)
   // table because the left column is indexing the right table.
+  PERFETTO_CHECK(evicted_row_count_ == 0);
+
   Table table(string_pool_, nullptr);
   table.row_count_ = row_count_;
   for (const RowMap& rm : row_maps_) {
@@ -172,7 +191,12 @@ Table Table::LookupJoin(JoinKey left, const Table& other, JoinKey right) {
   for (uint32_t i = 0; i < row_count_; ++i) {
     SqlValue val = left_col.Get(i);
     PERFETTO_CHECK(val.type != SqlValue::Type::kNull);
-    indices[i] = right_col.IndexOf(val).value();
+    base::Optional<uint32_t> opt_idx = right_col.IndexOf(val);
+    if (!opt_idx) {
+      PERFETTO_FATAL("LookupJoin: no row of %s matches row %u (evicted?)",
+                     right_col.name(), i);
+    }
+    indices[i] = *opt_idx;
   }
 
   // Apply the computed RowMap to each of the right RowMaps, adding it to the
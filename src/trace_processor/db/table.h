@@ -110,7 +110,9 @@ class Table {
   RowMap FilterToRowMap(
       const std::vector<Constraint>& cs,
       RowMap::OptimizeFor optimize_for = RowMap::OptimizeFor::kMemory) const {
-    RowMap rm(0, row_count_, optimize_for);
+    // Evicted rows are never returned, whatever the constraints, so that
+    // their storage is never read.
+    RowMap rm(evicted_row_count_, row_count_, optimize_for);
     for (const Constraint& c : cs) {
       columns_[c.col_idx].FilterInto(c.op, c.value, &rm);
     }
@@ -214,7 +216,19 @@ class Table {
   // Creates a copy of this table.
   Table Copy() const;
 
+  // Frees the storage of all the rows before |row|. Evicted rows are excluded
+  // from filtering, sorting and the Min/Max of columns but keep their place in
+  // the table: the row indices (and so ids) of all other rows are unchanged and
+  // |row_count()| still includes evicted rows.
+  //
+  // This is only valid for tables whose RowMaps are the identity and which
+  // are not the parent of another table: i.e. root tables where no other
+  // table, or tracker, will access the evicted rows. Eviction is meant to
+  // happen in bulk; see NullableVector::EvictBefore.
+  void EvictRowsBefore(uint32_t row);
+
   uint32_t row_count() const { return row_count_; }
+  uint32_t evicted_row_count() const { return evicted_row_count_; }
   const std::vector<RowMap>& row_maps() const { return row_maps_; }
 
  protected:
@@ -224,6 +238,12 @@ class Table {
   std::vector<Column> columns_;
   uint32_t row_count_ = 0;
 
+  // The number of rows at the start of the table which were evicted by
+  // EvictRowsBefore. Tables derived by filtering or sorting never contain
+  // evicted rows so this is only non-zero for the evicted table and copies
+  // of it.
+  uint32_t evicted_row_count_ = 0;
+
   StringPool* string_pool_ = nullptr;
 
  private:
@@ -65,6 +65,48 @@ TEST(TableTest, ExtendingTableTwice) {
   ASSERT_TRUE(filtered_table.GetColumnByName("b")->Max().has_value());
 }
 
+TEST(TableTest, EvictRowsBefore) {
+  StringPool pool;
+  TestEventTable table{&pool, nullptr};
+
+  for (uint32_t i = 0; i < kColumnCount; ++i)
+    table.Insert(TestEventTable::Row(i, kColumnCount - i));
+  table.EvictRowsBefore(1000);
+
+  // Evicted rows keep their place: ids and row indices are stable.
+  ASSERT_EQ(table.row_count(), kColumnCount);
+  ASSERT_EQ(table.evicted_row_count(), 1000u);
+  ASSERT_EQ(table.ts()[1000], 1000);
+  ASSERT_EQ(table.id()[1000].value, 1000u);
+
+  // Evicted rows are excluded from filtering.
+  Table filtered = table.Filter({});
+  ASSERT_EQ(filtered.row_count(), kColumnCount - 1000);
+  filtered = table.Filter({table.ts().lt(1010)});
+  ASSERT_EQ(filtered.row_count(), 10u);
+  filtered = table.Filter({table.arg_set_id().gt(0)});
+  ASSERT_EQ(filtered.row_count(), kColumnCount - 1000);
+  filtered = table.Filter({table.id().eq(5)});
+  ASSERT_EQ(filtered.row_count(), 0u);
+
+  // ... and sorting.
+  Table sorted = table.Sort({table.arg_set_id().ascending()});
+  ASSERT_EQ(sorted.row_count(), kColumnCount - 1000);
+  const auto& sorted_ts = sorted.GetTypedColumnByName<int64_t>("ts");
+  ASSERT_EQ(sorted_ts[0], kColumnCount - 1);
+  ASSERT_EQ(sorted_ts[sorted.row_count() - 1], 1000);
+
+  // ... and min/max.
+  ASSERT_EQ(table.ts().Min()->AsLong(), 1000);
+  ASSERT_EQ(table.arg_set_id().Max()->AsLong(), kColumnCount - 1000);
+
+  // Rows inserted after an eviction are appended as usual.
+  auto id = table.Insert(TestEventTable::Row(kColumnCount, 0)).id;
+  ASSERT_EQ(id.value, kColumnCount);
+  ASSERT_EQ(table.ts()[kColumnCount], kColumnCount);
+  ASSERT_EQ(table.Filter({}).row_count(), kColumnCount - 1000 + 1);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -161,7 +161,11 @@ struct TypedColumn : public Column {
 template <typename Id>
 struct IdColumn : public Column {
   Id operator[](uint32_t row) const { return Id(row_map().Get(row)); }
+  // Returns the row of |id|, or base::nullopt if there is no such row or if
+  // it was evicted.
   base::Optional<uint32_t> IndexOf(Id id) const {
+    if (id.value < evicted_row_count())
+      return base::nullopt;
     return row_map().IndexOf(id.value);
   }
 
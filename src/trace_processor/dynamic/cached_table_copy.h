@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_CACHED_TABLE_COPY_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_CACHED_TABLE_COPY_H_
+
+#include <memory>
+
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Copy of a table kept in the cache of a dynamic table generator.
+// A copy references the columns of the table it was copied from, so the
+// cached table is kept alive for as long as the copy is: the generator can
+// then evict it from its cache while a query is still reading the copy.
+class CachedTableCopy : public Table {
+ public:
+  explicit CachedTableCopy(std::shared_ptr<const Table> table)
+      : Table(table->Copy()), table_(std::move(table)) {}
+
+ private:
+  std::shared_ptr<const Table> table_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_CACHED_TABLE_COPY_H_
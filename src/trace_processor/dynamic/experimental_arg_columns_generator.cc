@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_arg_columns_generator.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+
+namespace perfetto {
+namespace trace_processor {
+
+ExperimentalArgColumnsGenerator::ExperimentalArgColumnsGenerator(
+    std::string table_name,
+    const Table* table,
+    Table::Schema table_schema,
+    MaterializedArgs* materialized_args,
+    const std::vector<std::string>& keys)
+    : table_name_(std::move(table_name)),
+      table_(table),
+      table_schema_(std::move(table_schema)),
+      materialized_args_(materialized_args) {
+  auto has_column = [this](const std::string& name) {
+    const auto& cols = table_schema_.columns;
+    auto it = std::find_if(cols.begin(), cols.end(),
+                           [&name](const Table::Schema::Column& col) {
+                             return col.name == name;
+                           });
+    if (it != cols.end())
+      return true;
+    return std::any_of(
+        columns_.begin(), columns_.end(),
+        [&name](const ArgColumn& col) { return col.name == name; });
+  };
+  for (const std::string& key : keys) {
+    std::string name = ColumnNameForKey(key);
+    if (has_column(name)) {
+      PERFETTO_ELOG("Cannot add arg column for key %s to %s: column %s exists",
+                    key.c_str(), table_name_.c_str(), name.c_str());
+      continue;
+    }
+    columns_.emplace_back();
+    columns_.back().key = key;
+    columns_.back().name = std::move(name);
+  }
+}
+
+ExperimentalArgColumnsGenerator::~ExperimentalArgColumnsGenerator() = default;
+
+Table::Schema ExperimentalArgColumnsGenerator::CreateSchema() {
+  Table::Schema schema = table_schema_;
+  for (const ArgColumn& col : columns_) {
+    // The type of the values is only known once the trace is parsed so don't
+    // declare one: like with EXTRACT_ARG, SQLite will then compare the values
+    // as they are.
+    schema.columns.emplace_back(Table::Schema::Column{
+        col.name, SqlValue::Type::kNull, false /* is_id */,
+        false /* is_sorted */, false /* is_hidden */});
+  }
+  return schema;
+}
+
+std::string ExperimentalArgColumnsGenerator::TableName() {
+  return table_name_;
+}
+
+uint32_t ExperimentalArgColumnsGenerator::EstimateRowCount() {
+  return table_->row_count();
+}
+
+util::Status ExperimentalArgColumnsGenerator::ValidateConstraints(
+    const QueryConstraints&) {
+  return util::OkStatus();
+}
+
+std::unique_ptr<Table> ExperimentalArgColumnsGenerator::ComputeTable(
+    const std::vector<Constraint>&,
+    const std::vector<Order>&) {
+  util::Status status = UpdateColumns();
+  if (!status.ok()) {
+    PERFETTO_ELOG("%s: %s", table_name_.c_str(), status.c_message());
+    return nullptr;
+  }
+
+  Table t = table_->Copy();
+  for (ArgColumn& col : columns_) {
+    switch (col.column.type) {
+      case SqlValue::Type::kLong:
+        t = t.ExtendWithColumn(
+            col.name.c_str(), col.column.long_values.get(),
+            TypedColumn<base::Optional<int64_t>>::default_flags());
+        break;
+      case SqlValue::Type::kDouble:
+        t = t.ExtendWithColumn(
+            col.name.c_str(), col.column.double_values.get(),
+            TypedColumn<base::Optional<double>>::default_flags());
+        break;
+      case SqlValue::Type::kString:
+        t = t.ExtendWithColumn(
+            col.name.c_str(), col.column.string_values.get(),
+            TypedColumn<base::Optional<StringPool::Id>>::default_flags());
+        break;
+      case SqlValue::Type::kNull:
+      case SqlValue::Type::kBytes:
+        PERFETTO_FATAL("Unexpected column type");
+    }
+  }
+  return std::unique_ptr<Table>(new Table(std::move(t)));
+}
+
+util::Status ExperimentalArgColumnsGenerator::UpdateColumns() {
+  // Both the table and the args table keep growing while a trace is parsed
+  // (and the table can have old rows evicted when a trace is streamed) so
+  // recompute the columns whenever either of them has changed size.
+  uint32_t arg_row_count =
+      materialized_args_->storage()->arg_table().row_count();
+  if (columns_valid_ && table_row_count_ == table_->row_count() &&
+      table_evicted_row_count_ == table_->evicted_row_count() &&
+      arg_row_count_ == arg_row_count) {
+    return util::OkStatus();
+  }
+
+  columns_valid_ = false;
+  for (ArgColumn& col : columns_) {
+    util::Status status = materialized_args_->MaterializeColumn(
+        *table_, col.key.c_str(), &col.column);
+    if (!status.ok())
+      return status;
+  }
+  columns_valid_ = true;
+  table_row_count_ = table_->row_count();
+  table_evicted_row_count_ = table_->evicted_row_count();
+  arg_row_count_ = arg_row_count;
+  return util::OkStatus();
+}
+
+// static
+std::string ExperimentalArgColumnsGenerator::ColumnNameForKey(
+    const std::string& key) {
+  std::string name = key;
+  for (char& c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)))
+      c = '_';
+  }
+  if (name.empty() || isdigit(static_cast<unsigned char>(name[0])))
+    name.insert(0, "_");
+  return name;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_ARG_COLUMNS_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_ARG_COLUMNS_GENERATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/materialized_args.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Exposes a table with an arg_set_id column (e.g. slice or raw) extended with
+// one column for each of the given arg keys, holding the value of the key in
+// the arg set of the row (or null if the arg set doesn't have the key).
+//
+// This allows to filter and sort on the values of frequently used args using
+// the db::Column paths instead of calling EXTRACT_ARG for every row. The
+// columns are computed once and recomputed only when the table or the args
+// table have changed.
+//
+// The columns are named after the key with all the characters which are not
+// valid in a SQL identifier replaced by '_' (e.g. "args.name" -> "args_name").
+class ExperimentalArgColumnsGenerator
+    : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  ExperimentalArgColumnsGenerator(std::string table_name,
+                                  const Table* table,
+                                  Table::Schema table_schema,
+                                  MaterializedArgs* materialized_args,
+                                  const std::vector<std::string>& keys);
+  virtual ~ExperimentalArgColumnsGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>&,
+                                      const std::vector<Order>&) override;
+
+  // public + static for testing
+  static std::string ColumnNameForKey(const std::string& key);
+
+ private:
+  struct ArgColumn {
+    std::string key;
+    std::string name;
+    MaterializedArgs::Column column;
+  };
+
+  util::Status UpdateColumns();
+
+  const std::string table_name_;
+  const Table* const table_;
+  const Table::Schema table_schema_;
+  MaterializedArgs* const materialized_args_;
+  std::vector<ArgColumn> columns_;
+
+  // The sizes of |table_| and the args table when |columns_| were computed.
+  bool columns_valid_ = false;
+  uint32_t table_row_count_ = 0;
+  uint32_t table_evicted_row_count_ = 0;
+  uint32_t arg_row_count_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_ARG_COLUMNS_GENERATOR_H_
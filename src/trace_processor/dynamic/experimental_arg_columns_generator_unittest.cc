@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_arg_columns_generator.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+ArgSetId AddIntArgSet(TraceStorage* storage, const char* key, int64_t value) {
+  auto id = static_cast<ArgSetId>(storage->arg_table().row_count() + 1);
+  storage->StartArgSet(id);
+  tables::ArgTable::Row row;
+  row.arg_set_id = id;
+  row.key = storage->InternString(key);
+  row.flat_key = row.key;
+  row.int_value = value;
+  row.value_type = storage->GetIdForVariadicType(Variadic::Type::kInt);
+  storage->mutable_arg_table()->Insert(row);
+  return id;
+}
+
+void AddSlice(TraceStorage* storage, ArgSetId arg_set_id) {
+  tables::SliceTable::Row row;
+  row.arg_set_id = arg_set_id;
+  storage->mutable_slice_table()->Insert(row);
+}
+
+TEST(ExperimentalArgColumnsGenerator, ColumnNameForKey) {
+  ASSERT_EQ(ExperimentalArgColumnsGenerator::ColumnNameForKey("args.name"),
+            "args_name");
+  ASSERT_EQ(ExperimentalArgColumnsGenerator::ColumnNameForKey("debug.a[0].b"),
+            "debug_a_0__b");
+  ASSERT_EQ(ExperimentalArgColumnsGenerator::ColumnNameForKey("0x"), "_0x");
+}
+
+TEST(ExperimentalArgColumnsGenerator, ExtendsTable) {
+  TraceStorage storage;
+  MaterializedArgs args(&storage);
+  // "name" clashes with a column of the slice table so is skipped.
+  ExperimentalArgColumnsGenerator generator(
+      "slice_with_args", &storage.slice_table(), tables::SliceTable::Schema(),
+      &args, {"args.a", "args.b", "name"});
+
+  Table::Schema schema = generator.CreateSchema();
+  ASSERT_EQ(schema.columns.size(),
+            tables::SliceTable::Schema().columns.size() + 2);
+  ASSERT_EQ(schema.columns[schema.columns.size() - 2].name, "args_a");
+  ASSERT_EQ(schema.columns.back().name, "args_b");
+
+  AddSlice(&storage, AddIntArgSet(&storage, "args.a", 10));
+  AddSlice(&storage, AddIntArgSet(&storage, "args.b", 20));
+
+  std::unique_ptr<Table> table = generator.ComputeTable({}, {});
+  ASSERT_TRUE(table);
+  ASSERT_EQ(table->row_count(), 2u);
+  const Column* a = table->GetColumnByName("args_a");
+  const Column* b = table->GetColumnByName("args_b");
+  ASSERT_EQ(a->Get(0).AsLong(), 10);
+  ASSERT_TRUE(a->Get(1).is_null());
+  ASSERT_TRUE(b->Get(0).is_null());
+  ASSERT_EQ(b->Get(1).AsLong(), 20);
+
+  // Filtering goes through the materialized column.
+  Table filtered = table->Filter({a->eq_value(SqlValue::Long(10))});
+  ASSERT_EQ(filtered.row_count(), 1u);
+
+  // New slices and args are picked up.
+  AddSlice(&storage, AddIntArgSet(&storage, "args.a", 30));
+  table = generator.ComputeTable({}, {});
+  ASSERT_EQ(table->row_count(), 3u);
+  ASSERT_EQ(table->GetColumnByName("args_a")->Get(2).AsLong(), 30);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
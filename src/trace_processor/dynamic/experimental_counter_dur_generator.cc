@@ -51,88 +51,53 @@ util::Status ExperimentalCounterDurGenerator::ValidateConstraints(
 std::unique_ptr<Table> ExperimentalCounterDurGenerator::ComputeTable(
     const std::vector<Constraint>&,
     const std::vector<Order>&) {
-  if (!dur_column_) {
-    dur_column_.reset(
-        new NullableVector<int64_t>(ComputeDurColumn(*counter_table_)));
-    delta_column_.reset(
-        new NullableVector<double>(ComputeDeltaColumn(*counter_table_)));
-  }
-
-  Table t = counter_table_
-                ->ExtendWithColumn("dur", std::move(dur_column_.get()),
-                                   TypedColumn<int64_t>::default_flags())
-                .ExtendWithColumn("delta", std::move(delta_column_.get()),
-                                  TypedColumn<int64_t>::default_flags());
-
-  return std::unique_ptr<Table>(new Table(t.Copy()));
+  // The counter table keeps growing (and has old rows evicted) when a trace is
+  // streamed so update the columns whenever it has changed.
+  UpdateColumns();
+
+  // The columns are dense so the dur and delta of the last counter of each
+  // track are set in O(1) when the next one is added.
+  uint32_t flags = TypedColumn<int64_t>::default_flags() | Column::Flag::kDense;
+  Table t = counter_table_->ExtendWithColumn("dur", &dur_column_, flags)
+                .ExtendWithColumn("delta", &delta_column_, flags);
+  return std::unique_ptr<Table>(new Table(std::move(t)));
 }
 
-// static
-NullableVector<int64_t> ExperimentalCounterDurGenerator::ComputeDurColumn(
-    const Table& table) {
-  // Keep track of the last seen row for each track id.
-  std::unordered_map<TrackId, uint32_t> last_row_for_track_id;
-  NullableVector<int64_t> dur;
-
-  const auto* ts_col =
-      TypedColumn<int64_t>::FromColumn(table.GetColumnByName("ts"));
-  const auto* track_id_col =
-      TypedColumn<tables::CounterTrackTable::Id>::FromColumn(
-          table.GetColumnByName("track_id"));
-
-  for (uint32_t i = 0; i < table.row_count(); ++i) {
-    // Check if we already have a previous row for the current track id.
-    TrackId track_id = (*track_id_col)[i];
-    auto it = last_row_for_track_id.find(track_id);
-    if (it == last_row_for_track_id.end()) {
-      // This means we don't have any row - start tracking this row for the
-      // future.
-      last_row_for_track_id.emplace(track_id, i);
-    } else {
-      // This means we have an previous row for the current track id. Update
-      // the duration of the previous row to be up to the current ts.
-      uint32_t old_row = it->second;
-      it->second = i;
-      dur.Set(old_row, (*ts_col)[i] - (*ts_col)[old_row]);
+void ExperimentalCounterDurGenerator::UpdateColumns() {
+  const auto& ts_col = counter_table_->ts();
+  const auto& track_id_col = counter_table_->track_id();
+  const auto& value_col = counter_table_->value();
+
+  // Rows evicted before they were seen have no data so just mark them as
+  // null.
+  uint32_t first_row = counter_table_->evicted_row_count();
+  while (dur_column_.size() < first_row) {
+    dur_column_.AppendNull();
+    delta_column_.AppendNull();
+  }
+
+  for (uint32_t i = dur_column_.size(); i < counter_table_->row_count(); ++i) {
+    uint32_t track_id = track_id_col[i].value;
+    if (track_id >= last_row_by_track_.size())
+      last_row_by_track_.resize(track_id + 1);
+
+    // If we have a previous row for the current track id, update its duration
+    // to be up to the current ts. Its values may have been evicted since.
+    base::Optional<LastRow>& last = last_row_by_track_[track_id];
+    if (last && last->row >= first_row) {
+      dur_column_.Set(last->row, ts_col[i] - last->ts);
+      delta_column_.Set(last->row, value_col[i] - last->value);
     }
+    last = LastRow{i, ts_col[i], value_col[i]};
+
     // Append -1 to mark this event as not having been finished. On a later
     // row, we may set this to have the correct value.
-    dur.Append(-1);
+    dur_column_.Append(-1);
+    delta_column_.Append(0);
   }
-  return dur;
-}
 
-// static
-NullableVector<double> ExperimentalCounterDurGenerator::ComputeDeltaColumn(
-    const Table& table) {
-  // Keep track of the last seen row for each track id.
-  std::unordered_map<TrackId, uint32_t> last_row_for_track_id;
-  NullableVector<double> delta;
-
-  const auto* value_col =
-      TypedColumn<double>::FromColumn(table.GetColumnByName("value"));
-  const auto* track_id_col =
-      TypedColumn<tables::CounterTrackTable::Id>::FromColumn(
-          table.GetColumnByName("track_id"));
-
-  for (uint32_t i = 0; i < table.row_count(); ++i) {
-    // Check if we already have a previous row for the current track id.
-    TrackId track_id = (*track_id_col)[i];
-    auto it = last_row_for_track_id.find(track_id);
-    if (it == last_row_for_track_id.end()) {
-      // This means we don't have any row - start tracking this row for the
-      // future.
-      last_row_for_track_id.emplace(track_id, i);
-    } else {
-      // This means we have an previous row for the current track id. Update
-      // the duration of the previous row to be up to the current ts.
-      uint32_t old_row = it->second;
-      it->second = i;
-      delta.Set(old_row, (*value_col)[i] - (*value_col)[old_row]);
-    }
-    delta.Append(0);
-  }
-  return delta;
+  dur_column_.EvictBefore(first_row);
+  delta_column_.EvictBefore(first_row);
 }
 
 }  // namespace trace_processor
@@ -17,6 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_COUNTER_DUR_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_COUNTER_DUR_GENERATOR_H_
 
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -24,6 +27,13 @@
 namespace perfetto {
 namespace trace_processor {
 
+// Dynamic table extending the counter table with the duration of each
+// counter (until the next one of its track) and the delta of its value with
+// the next one.
+// The table is a view over the counter table: its columns share the storage
+// of the counter table and the dur and delta columns are only computed for
+// the rows added since the previous query, so they are not copied or
+// recomputed when the table is queried repeatedly while a trace is streamed.
 class ExperimentalCounterDurGenerator
     : public DbSqliteTable::DynamicTableGenerator {
  public:
@@ -37,14 +47,25 @@ class ExperimentalCounterDurGenerator
   std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>&,
                                       const std::vector<Order>&) override;
 
-  // public + static for testing
-  static NullableVector<int64_t> ComputeDurColumn(const Table& table);
-  static NullableVector<double> ComputeDeltaColumn(const Table& table);
-
  private:
+  // The last counter of a track, whose dur and delta are not known until the
+  // next counter of the track is added.
+  struct LastRow {
+    uint32_t row;
+    int64_t ts;
+    double value;
+  };
+
+  // Computes the dur and delta of the rows added to the counter table since
+  // the previous call and frees the values of the rows evicted from it.
+  void UpdateColumns();
+
   const tables::CounterTable* counter_table_ = nullptr;
-  std::unique_ptr<NullableVector<int64_t>> dur_column_;
-  std::unique_ptr<NullableVector<double>> delta_column_;
+  NullableVector<int64_t> dur_column_ = NullableVector<int64_t>::Dense();
+  NullableVector<double> delta_column_ = NullableVector<double>::Dense();
+
+  // Indexed by track id.
+  std::vector<base::Optional<LastRow>> last_row_by_track_;
 };
 
 }  // namespace trace_processor
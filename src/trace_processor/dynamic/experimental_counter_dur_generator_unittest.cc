@@ -22,10 +22,13 @@ namespace perfetto {
 namespace trace_processor {
 namespace {
 
-tables::CounterTable::Row CounterRow(int64_t ts, uint32_t track_id) {
+tables::CounterTable::Row CounterRow(int64_t ts,
+                                     uint32_t track_id,
+                                     double value = 0) {
   tables::CounterTable::Row row;
   row.ts = ts;
   row.track_id = tables::TrackTable::Id{track_id};
+  row.value = value;
   return row;
 }
 
@@ -40,15 +43,51 @@ TEST(ExperimentalCounterDurGenerator, SmokeDur) {
   table.Insert(CounterRow(105 /* ts */, 2 /* track_id */));
   table.Insert(CounterRow(110 /* ts */, 2 /* track_id */));
 
-  auto dur = ExperimentalCounterDurGenerator::ComputeDurColumn(table);
-  ASSERT_EQ(dur.size(), table.row_count());
+  ExperimentalCounterDurGenerator generator(table);
+  auto res = generator.ComputeTable({}, {});
+  const Column* dur = res->GetColumnByName("dur");
+  ASSERT_EQ(res->row_count(), table.row_count());
 
-  ASSERT_EQ(dur.GetNonNull(0), 5);
-  ASSERT_EQ(dur.GetNonNull(1), 3);
-  ASSERT_EQ(dur.GetNonNull(2), -1);
-  ASSERT_EQ(dur.GetNonNull(3), -1);
-  ASSERT_EQ(dur.GetNonNull(4), 5);
-  ASSERT_EQ(dur.GetNonNull(5), -1);
+  ASSERT_EQ(dur->Get(0).AsLong(), 5);
+  ASSERT_EQ(dur->Get(1).AsLong(), 3);
+  ASSERT_EQ(dur->Get(2).AsLong(), -1);
+  ASSERT_EQ(dur->Get(3).AsLong(), -1);
+  ASSERT_EQ(dur->Get(4).AsLong(), 5);
+  ASSERT_EQ(dur->Get(5).AsLong(), -1);
+}
+
+TEST(ExperimentalCounterDurGenerator, Streaming) {
+  StringPool pool;
+  tables::CounterTable table(&pool, nullptr);
+  ExperimentalCounterDurGenerator generator(table);
+
+  table.Insert(CounterRow(100 /* ts */, 1 /* track_id */, 10 /* value */));
+  table.Insert(CounterRow(102 /* ts */, 2 /* track_id */, 20 /* value */));
+  auto res = generator.ComputeTable({}, {});
+  ASSERT_EQ(res->row_count(), 2u);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(0).AsLong(), -1);
+
+  // The dur and delta of the previous counters are updated when the next ones
+  // are added.
+  table.Insert(CounterRow(105 /* ts */, 1 /* track_id */, 15 /* value */));
+  table.Insert(CounterRow(107 /* ts */, 3 /* track_id */, 30 /* value */));
+  res = generator.ComputeTable({}, {});
+  ASSERT_EQ(res->row_count(), 4u);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(0).AsLong(), 5);
+  ASSERT_EQ(res->GetColumnByName("delta")->Get(0).AsDouble(), 5);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(1).AsLong(), -1);
+
+  // Once rows are evicted, only the dur and delta of the rows left are
+  // updated.
+  table.EvictRowsBefore(3);
+  table.Insert(CounterRow(110 /* ts */, 2 /* track_id */, 22 /* value */));
+  table.Insert(CounterRow(111 /* ts */, 3 /* track_id */, 28 /* value */));
+  res = generator.ComputeTable({}, {});
+  ASSERT_EQ(res->row_count(), 6u);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(3).AsLong(), 4);
+  ASSERT_EQ(res->GetColumnByName("delta")->Get(3).AsDouble(), -2);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(4).AsLong(), -1);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(5).AsLong(), -1);
 }
 
 }  // namespace
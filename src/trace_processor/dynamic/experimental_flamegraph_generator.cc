@@ -16,7 +16,10 @@
 
 #include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
 
+#include <unordered_map>
+
 #include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/dynamic/cached_table_copy.h"
 
 #include "src/trace_processor/importers/proto/heap_graph_tracker.h"
 #include "src/trace_processor/importers/proto/heap_profile_tracker.h"
@@ -35,6 +38,14 @@ ExperimentalFlamegraphGenerator::InputValues GetFlamegraphInputValues(
     return c.col_idx == static_cast<uint32_t>(T::ColumnIndex::ts) &&
            c.op == FilterOp::kEq;
   };
+  auto ts_upper_fn = [](const Constraint& c) {
+    return c.col_idx == static_cast<uint32_t>(T::ColumnIndex::ts) &&
+           (c.op == FilterOp::kLe || c.op == FilterOp::kLt);
+  };
+  auto ts_lower_fn = [](const Constraint& c) {
+    return c.col_idx == static_cast<uint32_t>(T::ColumnIndex::ts) &&
+           (c.op == FilterOp::kGe || c.op == FilterOp::kGt);
+  };
   auto upid_fn = [](const Constraint& c) {
     return c.col_idx == static_cast<uint32_t>(T::ColumnIndex::upid) &&
            c.op == FilterOp::kEq;
@@ -55,18 +66,34 @@ ExperimentalFlamegraphGenerator::InputValues GetFlamegraphInputValues(
 
   // We should always have valid iterators here because BestIndex should only
   // allow the constraint set to be chosen when we have an equality constraint
-  // on both ts and upid.
-  PERFETTO_CHECK(ts_it != cs.end());
+  // on both ts and upid (or a range constraint on ts).
   PERFETTO_CHECK(upid_it != cs.end());
   PERFETTO_CHECK(profile_type_it != cs.end());
 
-  int64_t ts = ts_it->value.AsLong();
+  int64_t ts;
+  base::Optional<int64_t> start_ts;
+  if (ts_it != cs.end()) {
+    ts = ts_it->value.AsLong();
+  } else {
+    auto upper_it = std::find_if(cs.begin(), cs.end(), ts_upper_fn);
+    auto lower_it = std::find_if(cs.begin(), cs.end(), ts_lower_fn);
+    PERFETTO_CHECK(upper_it != cs.end() && lower_it != cs.end());
+
+    // Convert the bounds to start_ts < ts <= end_ts. The rows of the table
+    // have ts = end_ts so they still match the constraints.
+    ts = upper_it->value.AsLong();
+    if (upper_it->op == FilterOp::kLt)
+      ts--;
+    start_ts = lower_it->value.AsLong();
+    if (lower_it->op == FilterOp::kGe)
+      (*start_ts)--;
+  }
   UniquePid upid = static_cast<UniquePid>(upid_it->value.AsLong());
   std::string profile_type = profile_type_it->value.AsString();
   std::string focus_str =
       focus_str_it != cs.end() ? focus_str_it->value.AsString() : "";
-  return ExperimentalFlamegraphGenerator::InputValues{ts, upid, profile_type,
-                                                      focus_str};
+  return ExperimentalFlamegraphGenerator::InputValues{
+      ts, upid, profile_type, focus_str, start_ts};
 }
 
 class Matcher {
@@ -100,12 +127,25 @@ std::vector<FocusedState> ComputeFocusedState(
   // ptr. Root trees (no parents) will have a null parent ptr.
   std::vector<FocusedState> focused(table.row_count());
 
+  // Many nodes have the same name (e.g. the same function called from
+  // different callsites) so only match each name once.
+  std::unordered_map<StringId, bool> name_matches;
+  auto matches = [&](uint32_t row) {
+    auto it = name_matches.find(table.name()[row]);
+    if (it == name_matches.end()) {
+      bool match =
+          focus_matcher.matches(table.name().GetString(row).ToStdString());
+      it = name_matches.emplace(table.name()[row], match).first;
+    }
+    return it->second;
+  };
+
   for (uint32_t i = 0; i < table.row_count(); ++i) {
     auto parent_id = table.parent_id()[i];
     // Constraint: all descendants MUST come after their parents.
     PERFETTO_DCHECK(!parent_id.has_value() || *parent_id < table.id()[i]);
 
-    if (focus_matcher.matches(table.name().GetString(i).ToStdString())) {
+    if (matches(i)) {
       // Mark as focused
       focused[i] = FocusedState::kFocusedPropagating;
       auto current = parent_id;
@@ -139,34 +179,35 @@ struct CumulativeCounts {
 };
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     TraceStorage* storage,
-    std::unique_ptr<ExperimentalFlamegraphNodesTable> in,
+    const ExperimentalFlamegraphNodesTable& in,
     const std::string& focus_str) {
-  if (in->row_count() == 0 || focus_str.empty()) {
-    return in;
-  }
   std::vector<FocusedState> focused_state =
-      ComputeFocusedState(*in, Matcher(focus_str));
+      ComputeFocusedState(in, Matcher(focus_str));
   std::unique_ptr<ExperimentalFlamegraphNodesTable> tbl(
       new tables::ExperimentalFlamegraphNodesTable(
           storage->mutable_string_pool(), nullptr));
 
+  // The pseudocolumns must be populated because as far as SQLite is
+  // concerned these are equality constraints.
+  auto focus_id = storage->InternString(base::StringView(focus_str));
+
   // Recompute cumulative counts
-  std::vector<CumulativeCounts> node_to_cumulatives(in->row_count());
-  for (int64_t idx = in->row_count() - 1; idx >= 0; --idx) {
+  std::vector<CumulativeCounts> node_to_cumulatives(in.row_count());
+  for (int64_t idx = in.row_count() - 1; idx >= 0; --idx) {
     auto i = static_cast<uint32_t>(idx);
     if (focused_state[i] == FocusedState::kNotFocused) {
       continue;
     }
     auto& cumulatives = node_to_cumulatives[i];
-    cumulatives.size += in->size()[i];
-    cumulatives.count += in->count()[i];
-    cumulatives.alloc_size += in->alloc_size()[i];
-    cumulatives.alloc_count += in->alloc_count()[i];
+    cumulatives.size += in.size()[i];
+    cumulatives.count += in.count()[i];
+    cumulatives.alloc_size += in.alloc_size()[i];
+    cumulatives.alloc_count += in.alloc_count()[i];
 
-    auto parent_id = in->parent_id()[i];
+    auto parent_id = in.parent_id()[i];
     if (parent_id.has_value()) {
       auto& parent_cumulatives =
-          node_to_cumulatives[*in->id().IndexOf(*parent_id)];
+          node_to_cumulatives[*in.id().IndexOf(*parent_id)];
       parent_cumulatives.size += cumulatives.size;
       parent_cumulatives.count += cumulatives.count;
       parent_cumulatives.alloc_size += cumulatives.alloc_size;
@@ -175,8 +216,8 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
   }
 
   // Mapping between the old rows ('node') to the new identifiers.
-  std::vector<ExperimentalFlamegraphNodesTable::Id> node_to_id(in->row_count());
-  for (uint32_t i = 0; i < in->row_count(); ++i) {
+  std::vector<ExperimentalFlamegraphNodesTable::Id> node_to_id(in.row_count());
+  for (uint32_t i = 0; i < in.row_count(); ++i) {
     if (focused_state[i] == FocusedState::kNotFocused) {
       continue;
     }
@@ -184,22 +225,23 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
     // We must reparent the rows as every insertion will get its own
     // identifier.
-    auto original_parent_id = in->parent_id()[i];
+    auto original_parent_id = in.parent_id()[i];
     if (original_parent_id.has_value()) {
-      auto original_idx = *in->id().IndexOf(*original_parent_id);
+      auto original_idx = *in.id().IndexOf(*original_parent_id);
       alloc_row.parent_id = node_to_id[original_idx];
     }
 
-    alloc_row.ts = in->ts()[i];
-    alloc_row.upid = in->upid()[i];
-    alloc_row.profile_type = in->profile_type()[i];
-    alloc_row.depth = in->depth()[i];
-    alloc_row.name = in->name()[i];
-    alloc_row.map_name = in->map_name()[i];
-    alloc_row.count = in->count()[i];
-    alloc_row.size = in->size()[i];
-    alloc_row.alloc_count = in->alloc_count()[i];
-    alloc_row.alloc_size = in->alloc_size()[i];
+    alloc_row.ts = in.ts()[i];
+    alloc_row.upid = in.upid()[i];
+    alloc_row.profile_type = in.profile_type()[i];
+    alloc_row.focus_str = focus_id;
+    alloc_row.depth = in.depth()[i];
+    alloc_row.name = in.name()[i];
+    alloc_row.map_name = in.map_name()[i];
+    alloc_row.count = in.count()[i];
+    alloc_row.size = in.size()[i];
+    alloc_row.alloc_count = in.alloc_count()[i];
+    alloc_row.alloc_size = in.alloc_size()[i];
 
     const auto& cumulative = node_to_cumulatives[i];
     alloc_row.cumulative_count = cumulative.count;
@@ -214,7 +256,7 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
 
 ExperimentalFlamegraphGenerator::ExperimentalFlamegraphGenerator(
     TraceProcessorContext* context)
-    : context_(context) {}
+    : context_(context), native_builder_(context->storage.get()) {}
 
 ExperimentalFlamegraphGenerator::~ExperimentalFlamegraphGenerator() = default;
 
@@ -228,7 +270,20 @@ util::Status ExperimentalFlamegraphGenerator::ValidateConstraints(
     return c.column == static_cast<int>(T::ColumnIndex::ts) &&
            c.op == SQLITE_INDEX_CONSTRAINT_EQ;
   };
-  bool has_ts_cs = std::find_if(cs.begin(), cs.end(), ts_fn) != cs.end();
+  auto ts_upper_fn = [](const QueryConstraints::Constraint& c) {
+    return c.column == static_cast<int>(T::ColumnIndex::ts) &&
+           (c.op == SQLITE_INDEX_CONSTRAINT_LE ||
+            c.op == SQLITE_INDEX_CONSTRAINT_LT);
+  };
+  auto ts_lower_fn = [](const QueryConstraints::Constraint& c) {
+    return c.column == static_cast<int>(T::ColumnIndex::ts) &&
+           (c.op == SQLITE_INDEX_CONSTRAINT_GE ||
+            c.op == SQLITE_INDEX_CONSTRAINT_GT);
+  };
+  bool has_ts_cs =
+      std::find_if(cs.begin(), cs.end(), ts_fn) != cs.end() ||
+      (std::find_if(cs.begin(), cs.end(), ts_upper_fn) != cs.end() &&
+       std::find_if(cs.begin(), cs.end(), ts_lower_fn) != cs.end());
 
   auto upid_fn = [](const QueryConstraints::Constraint& c) {
     return c.column == static_cast<int>(T::ColumnIndex::upid) &&
@@ -248,37 +303,106 @@ util::Status ExperimentalFlamegraphGenerator::ValidateConstraints(
              : util::ErrStatus("Failed to find required constraints");
 }
 
+util::Status ExperimentalFlamegraphGenerator::ValidateConstraintValues(
+    const std::vector<Constraint>& cs) {
+  // Only native flamegraphs are computed incrementally from the allocations,
+  // the others are built from a single dump.
+  auto values = GetFlamegraphInputValues(cs);
+  if (values.start_ts && values.profile_type != "native") {
+    return util::ErrStatus(
+        "experimental_flamegraph: ts ranges are only supported for the "
+        "'native' profile_type, use ts = <value> for '%s'",
+        values.profile_type.c_str());
+  }
+  return util::OkStatus();
+}
+
 std::unique_ptr<Table> ExperimentalFlamegraphGenerator::ComputeTable(
     const std::vector<Constraint>& cs,
     const std::vector<Order>&) {
   // Get the input column values and compute the flamegraph using them.
   auto values = GetFlamegraphInputValues(cs);
 
+  if (values.profile_type == "native") {
+    std::shared_ptr<const FlamegraphTable> table = GetNativeFlamegraph(values);
+    if (!table)
+      return nullptr;
+    return std::unique_ptr<Table>(new CachedTableCopy(std::move(table)));
+  }
+
   std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table;
   if (values.profile_type == "graph") {
+    PERFETTO_DCHECK(!values.start_ts);
     auto* tracker = HeapGraphTracker::GetOrCreate(context_);
     table = tracker->BuildFlamegraph(values.ts, values.upid);
   }
-  if (values.profile_type == "native") {
-    table =
-        BuildNativeFlamegraph(context_->storage.get(), values.upid, values.ts);
-  }
-  if (!values.focus_str.empty()) {
-    table =
-        FocusTable(context_->storage.get(), std::move(table), values.focus_str);
-    // The pseudocolumns must be populated because as far as SQLite is
-    // concerned these are equality constraints.
-    auto focus_id =
-        context_->storage->InternString(base::StringView(values.focus_str));
-    for (uint32_t i = 0; i < table->row_count(); ++i) {
-      table->mutable_focus_str()->Set(i, focus_id);
-    }
+  if (table && !values.focus_str.empty()) {
+    table = FocusTable(context_->storage.get(), *table, values.focus_str);
   }
   // We need to explicitly std::move as clang complains about a bug in old
   // compilers otherwise (-Wreturn-std-move-in-c++11).
   return std::move(table);
 }
 
+std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable>
+ExperimentalFlamegraphGenerator::GetNativeFlamegraph(
+    const InputValues& values) {
+  // Drop the cached flamegraphs if new callsites or allocations were added
+  // since they were computed (e.g. when the trace is streamed).
+  uint32_t allocation_row_count =
+      context_->storage->heap_profile_allocation_table().row_count();
+  if (native_builder_.UpdateTree() ||
+      allocation_row_count != cached_allocation_row_count_) {
+    cache_.clear();
+    cached_allocation_row_count_ = allocation_row_count;
+  }
+
+  std::shared_ptr<const FlamegraphTable> table =
+      FindCachedFlamegraph(values, values.focus_str);
+  if (table)
+    return table;
+
+  // The focused flamegraphs are derived from the unfocused one, so that
+  // changing the focus doesn't recompute the flamegraph.
+  table = FindCachedFlamegraph(values, "");
+  if (!table) {
+    table = native_builder_.Build(values.upid, values.start_ts, values.ts);
+    if (!table)
+      return nullptr;
+    AddCachedFlamegraph(values, "", table);
+  }
+  if (values.focus_str.empty())
+    return table;
+
+  table = FocusTable(context_->storage.get(), *table, values.focus_str);
+  AddCachedFlamegraph(values, values.focus_str, table);
+  return table;
+}
+
+std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable>
+ExperimentalFlamegraphGenerator::FindCachedFlamegraph(
+    const InputValues& values,
+    const std::string& focus_str) {
+  for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+    if (it->upid == values.upid && it->start_ts == values.start_ts &&
+        it->ts == values.ts && it->focus_str == focus_str) {
+      cache_.splice(cache_.begin(), cache_, it);
+      return cache_.front().table;
+    }
+  }
+  return nullptr;
+}
+
+void ExperimentalFlamegraphGenerator::AddCachedFlamegraph(
+    const InputValues& values,
+    const std::string& focus_str,
+    std::shared_ptr<const FlamegraphTable> table) {
+  cache_.push_front(CachedFlamegraph{values.upid, values.start_ts, values.ts,
+                                     focus_str, std::move(table)});
+  if (cache_.size() > kMaxCachedFlamegraphs)
+    cache_.pop_back();
+}
+
 Table::Schema ExperimentalFlamegraphGenerator::CreateSchema() {
   return tables::ExperimentalFlamegraphNodesTable::Schema();
 }
@@ -17,6 +17,12 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 
+#include <list>
+#include <memory>
+#include <string>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/importers/proto/heap_profile_tracker.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -34,8 +40,17 @@ class ExperimentalFlamegraphGenerator
     UniquePid upid;
     std::string profile_type;
     std::string focus_str;
+    // Set when the flamegraph is restricted to a time range, with a lower
+    // bound on ts (e.g. ts > start_ts AND ts <= ts). Only supported for native
+    // profiles: this is the difference between the flamegraphs at |start_ts|
+    // and at |ts|.
+    base::Optional<int64_t> start_ts;
   };
 
+  // The number of flamegraphs (and of focused variants of them) kept in
+  // memory so that queries on the same flamegraph don't recompute it.
+  static constexpr size_t kMaxCachedFlamegraphs = 8;
+
   explicit ExperimentalFlamegraphGenerator(TraceProcessorContext* context);
   virtual ~ExperimentalFlamegraphGenerator() override;
 
@@ -43,11 +58,44 @@ class ExperimentalFlamegraphGenerator
   std::string TableName() override;
   uint32_t EstimateRowCount() override;
   util::Status ValidateConstraints(const QueryConstraints&) override;
+  util::Status ValidateConstraintValues(
+      const std::vector<Constraint>& cs) override;
   std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
                                       const std::vector<Order>& ob) override;
 
  private:
+  using FlamegraphTable = tables::ExperimentalFlamegraphNodesTable;
+
+  struct CachedFlamegraph {
+    UniquePid upid;
+    base::Optional<int64_t> start_ts;
+    int64_t ts;
+    // Empty for the flamegraph with no focus.
+    std::string focus_str;
+    // Shared with the tables returned by ComputeTable(), which reference its
+    // columns, so that it outlives them if it is evicted.
+    std::shared_ptr<const FlamegraphTable> table;
+  };
+
+  std::shared_ptr<const FlamegraphTable> GetNativeFlamegraph(
+      const InputValues&);
+  std::shared_ptr<const FlamegraphTable> FindCachedFlamegraph(
+      const InputValues&,
+      const std::string& focus_str);
+  void AddCachedFlamegraph(const InputValues&,
+                           const std::string& focus_str,
+                           std::shared_ptr<const FlamegraphTable>);
+
   TraceProcessorContext* context_ = nullptr;
+
+  // Native flamegraphs only depend on the callsite tree (kept up to date by
+  // |native_builder_|) and on the allocations: the cache is cleared when
+  // either changes.
+  NativeFlamegraphBuilder native_builder_;
+  uint32_t cached_allocation_row_count_ = 0;
+
+  // Most recently used first.
+  std::list<CachedFlamegraph> cache_;
 };
 
 }  // namespace trace_processor
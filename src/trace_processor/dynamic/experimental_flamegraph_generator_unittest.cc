@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
+
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using T = tables::ExperimentalFlamegraphNodesTable;
+
+constexpr UniquePid kUpid = 1;
+
+class ExperimentalFlamegraphGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalFlamegraphGeneratorTest() {
+    context_.storage.reset(new TraceStorage());
+    generator_.reset(new ExperimentalFlamegraphGenerator(&context_));
+
+    TraceStorage* storage = context_.storage.get();
+    tables::StackProfileMappingTable::Row mapping{};
+    mapping.name = storage->InternString("libfoo.so");
+    auto mapping_id =
+        storage->mutable_stack_profile_mapping_table()->Insert(mapping).id;
+    // main -> foo and main -> bar.
+    for (const char* name : {"main", "foo", "bar"}) {
+      tables::StackProfileFrameTable::Row frame{};
+      frame.name = storage->InternString(name);
+      frame.mapping = mapping_id;
+      tables::StackProfileCallsiteTable::Row callsite{};
+      if (!callsites_.empty()) {
+        callsite.depth = 1;
+        callsite.parent_id = callsites_[0];
+      }
+      callsite.frame_id =
+          storage->mutable_stack_profile_frame_table()->Insert(frame).id;
+      callsites_.push_back(
+          storage->mutable_stack_profile_callsite_table()->Insert(callsite).id);
+    }
+  }
+
+ protected:
+  void AddAllocation(int64_t ts, uint32_t callsite, int64_t size) {
+    tables::HeapProfileAllocationTable::Row alloc{};
+    alloc.ts = ts;
+    alloc.upid = kUpid;
+    alloc.callsite_id = callsites_[callsite];
+    alloc.count = 1;
+    alloc.size = size;
+    context_.storage->mutable_heap_profile_allocation_table()->Insert(alloc);
+  }
+
+  std::vector<Constraint> Constraints(FilterOp ts_op, int64_t ts) {
+    return {
+        Constraint{static_cast<uint32_t>(T::ColumnIndex::ts), ts_op,
+                   SqlValue::Long(ts)},
+        Constraint{static_cast<uint32_t>(T::ColumnIndex::upid), FilterOp::kEq,
+                   SqlValue::Long(kUpid)},
+        Constraint{static_cast<uint32_t>(T::ColumnIndex::profile_type),
+                   FilterOp::kEq, SqlValue::String("native")}};
+  }
+
+  // Returns the cumulative sizes of the nodes of the flamegraph.
+  std::vector<int64_t> CumulativeSizes(const std::vector<Constraint>& cs) {
+    std::unique_ptr<Table> table = generator_->ComputeTable(cs, {});
+    std::vector<int64_t> sizes;
+    if (!table)
+      return sizes;
+    const Column* col = table->GetColumnByName("cumulative_size");
+    for (uint32_t i = 0; i < table->row_count(); ++i)
+      sizes.push_back(col->Get(i).AsLong());
+    return sizes;
+  }
+
+  TraceProcessorContext context_;
+  std::unique_ptr<ExperimentalFlamegraphGenerator> generator_;
+  std::vector<CallsiteId> callsites_;
+};
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, Native) {
+  AddAllocation(1, 1, 10);
+  AddAllocation(2, 2, 5);
+
+  auto at_2 = Constraints(FilterOp::kEq, 2);
+  EXPECT_THAT(CumulativeSizes(at_2), ElementsAre(15, 10, 5));
+  // The second query is served from the cache.
+  EXPECT_THAT(CumulativeSizes(at_2), ElementsAre(15, 10, 5));
+
+  // New allocations invalidate the cache.
+  AddAllocation(2, 1, 1);
+  EXPECT_THAT(CumulativeSizes(at_2), ElementsAre(16, 11, 5));
+}
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, TimeRange) {
+  AddAllocation(1, 1, 10);
+  AddAllocation(2, 2, 5);
+  AddAllocation(3, 2, 7);
+
+  // ts > 1 AND ts <= 2.
+  auto cs = Constraints(FilterOp::kGt, 1);
+  cs.push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::ts),
+                          FilterOp::kLe, SqlValue::Long(2)});
+  EXPECT_THAT(CumulativeSizes(cs), ElementsAre(5, 0, 5));
+
+  // ts >= 2 AND ts < 4.
+  cs = Constraints(FilterOp::kGe, 2);
+  cs.push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::ts),
+                          FilterOp::kLt, SqlValue::Long(4)});
+  EXPECT_THAT(CumulativeSizes(cs), ElementsAre(12, 0, 12));
+}
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, TimeRangeOnlyForNative) {
+  auto cs = Constraints(FilterOp::kGt, 1);
+  cs.push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::ts),
+                          FilterOp::kLe, SqlValue::Long(2)});
+  EXPECT_TRUE(generator_->ValidateConstraintValues(cs).ok());
+
+  cs[2].value = SqlValue::String("graph");
+  util::Status status = generator_->ValidateConstraintValues(cs);
+  ASSERT_FALSE(status.ok());
+  EXPECT_THAT(status.message(), HasSubstr("only supported for the 'native'"));
+
+  // A single dump is fine for all the profile types.
+  cs = Constraints(FilterOp::kEq, 1);
+  cs[2].value = SqlValue::String("graph");
+  EXPECT_TRUE(generator_->ValidateConstraintValues(cs).ok());
+}
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, Focus) {
+  AddAllocation(1, 1, 10);
+  AddAllocation(1, 2, 5);
+
+  auto cs = Constraints(FilterOp::kEq, 1);
+  EXPECT_THAT(CumulativeSizes(cs), ElementsAre(15, 10, 5));
+
+  // Only main and bar are kept. The focused flamegraph is derived from the
+  // cached one.
+  cs.push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::focus_str),
+                          FilterOp::kEq, SqlValue::String("BAR")});
+  EXPECT_THAT(CumulativeSizes(cs), ElementsAre(5, 5));
+  std::unique_ptr<Table> table = generator_->ComputeTable(cs, {});
+  EXPECT_STREQ(table->GetColumnByName("focus_str")->Get(0).AsString(), "BAR");
+
+  // Switching back to the unfocused flamegraph.
+  cs.pop_back();
+  EXPECT_THAT(CumulativeSizes(cs), ElementsAre(15, 10, 5));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_ingest_profile_generator.h"
+
+#include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+ExperimentalIngestProfileGenerator::ExperimentalIngestProfileGenerator(
+    TraceStorage* storage)
+    : storage_(storage) {}
+
+ExperimentalIngestProfileGenerator::~ExperimentalIngestProfileGenerator() =
+    default;
+
+Table::Schema ExperimentalIngestProfileGenerator::CreateSchema() {
+  return tables::IngestProfileTable::Schema();
+}
+
+std::string ExperimentalIngestProfileGenerator::TableName() {
+  return "experimental_ingest_profile";
+}
+
+uint32_t ExperimentalIngestProfileGenerator::EstimateRowCount() {
+  const IngestProfile& profile = storage_->ingest_profile();
+  size_t count = 0;
+  for (size_t i = 0; i < IngestProfile::kNumPhases; ++i)
+    count += profile.entries(static_cast<IngestProfile::Phase>(i)).size();
+  return static_cast<uint32_t>(count);
+}
+
+util::Status ExperimentalIngestProfileGenerator::ValidateConstraints(
+    const QueryConstraints&) {
+  return util::OkStatus();
+}
+
+std::unique_ptr<Table> ExperimentalIngestProfileGenerator::ComputeTable(
+    const std::vector<Constraint>&,
+    const std::vector<Order>&) {
+  std::unique_ptr<tables::IngestProfileTable> table(
+      new tables::IngestProfileTable(storage_->mutable_string_pool(),
+                                     nullptr));
+
+  const IngestProfile& profile = storage_->ingest_profile();
+  for (size_t i = 0; i < IngestProfile::kNumPhases; ++i) {
+    auto phase = static_cast<IngestProfile::Phase>(i);
+    StringId phase_id = storage_->InternString(IngestProfile::PhaseName(phase));
+
+    const auto& entries = profile.entries(phase);
+    for (uint32_t field_id = 0; field_id < entries.size(); ++field_id) {
+      const IngestProfile::Entry& entry = entries[field_id];
+      if (entry.count == 0)
+        continue;
+
+      tables::IngestProfileTable::Row row;
+      row.phase = phase_id;
+      row.field_id = field_id;
+      if (phase == IngestProfile::Phase::kParseFtrace &&
+          field_id < GetDescriptorsSize()) {
+        const char* name = GetMessageDescriptorForId(field_id)->name;
+        if (name)
+          row.name = storage_->InternString(name);
+      }
+      row.count = static_cast<int64_t>(entry.count);
+      row.size = static_cast<int64_t>(entry.size);
+      row.sampled_count = static_cast<int64_t>(entry.sampled_count);
+      row.sampled_dur = entry.sampled_dur_ns;
+      row.dur = entry.EstimatedDurNs();
+      table->Insert(row);
+    }
+  }
+  // We need to explicitly std::move as clang complains about a bug in old
+  // compilers otherwise (-Wreturn-std-move-in-c++11).
+  return std::move(table);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_ingest_profile_generator.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Phase = IngestProfile::Phase;
+
+TEST(IngestProfile, DisabledByDefault) {
+  IngestProfile profile;
+  auto sample = profile.Sample(Phase::kParse, 5, 10);
+  profile.Add(Phase::kSort, 0, 2, 0, 100);
+  ASSERT_TRUE(profile.entries(Phase::kParse).empty());
+  ASSERT_TRUE(profile.entries(Phase::kSort).empty());
+}
+
+TEST(IngestProfile, SamplesOneInInterval) {
+  IngestProfile profile;
+  profile.set_enabled(true);
+  for (uint32_t i = 0; i < IngestProfile::kSamplingInterval * 2 + 1; ++i) {
+    auto sample = profile.Sample(Phase::kParse, 5, 10);
+  }
+
+  const auto& entries = profile.entries(Phase::kParse);
+  ASSERT_EQ(entries.size(), 6u);
+  ASSERT_EQ(entries[0].count, 0u);
+  ASSERT_EQ(entries[5].count, IngestProfile::kSamplingInterval * 2 + 1);
+  ASSERT_EQ(entries[5].size, (IngestProfile::kSamplingInterval * 2 + 1) * 10);
+  ASSERT_EQ(entries[5].sampled_count, 3u);
+  ASSERT_TRUE(profile.entries(Phase::kTokenize).empty());
+}
+
+TEST(IngestProfile, EstimatedDur) {
+  IngestProfile profile;
+  profile.set_enabled(true);
+  profile.Add(Phase::kSort, 0, 2, 0, 100);
+
+  IngestProfile::Entry entry = profile.entries(Phase::kSort)[0];
+  ASSERT_EQ(entry.EstimatedDurNs(), 100);
+
+  entry.count = 8;
+  ASSERT_EQ(entry.EstimatedDurNs(), 400);
+
+  entry.sampled_count = 0;
+  ASSERT_EQ(entry.EstimatedDurNs(), 0);
+}
+
+TEST(ExperimentalIngestProfileGenerator, Rows) {
+  TraceStorage storage;
+  IngestProfile* profile = storage.mutable_ingest_profile();
+  profile->set_enabled(true);
+  profile->Add(Phase::kParse, 2, 1, 20, 30);
+  profile->Add(Phase::kParseFtrace, 4, 3, 40, 50);
+
+  ExperimentalIngestProfileGenerator generator(&storage);
+  ASSERT_EQ(generator.EstimateRowCount(), 8u);
+
+  auto table = generator.ComputeTable({}, {});
+  const auto& res = *static_cast<tables::IngestProfileTable*>(table.get());
+  ASSERT_EQ(res.row_count(), 2u);
+
+  ASSERT_EQ(storage.GetString(res.phase()[0]), "parse");
+  ASSERT_EQ(res.field_id()[0], 2u);
+  ASSERT_EQ(res.name()[0], base::nullopt);
+  ASSERT_EQ(res.count()[0], 1);
+  ASSERT_EQ(res.size()[0], 20);
+  ASSERT_EQ(res.dur()[0], 30);
+
+  ASSERT_EQ(storage.GetString(res.phase()[1]), "parse_ftrace");
+  ASSERT_EQ(res.field_id()[1], 4u);
+  ASSERT_EQ(storage.GetString(*res.name()[1]), "sched_switch");
+  ASSERT_EQ(res.sampled_count()[1], 3);
+  ASSERT_EQ(res.sampled_dur()[1], 50);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_query_profile_generator.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+ExperimentalQueryProfileGenerator::ExperimentalQueryProfileGenerator(
+    TraceStorage* storage)
+    : storage_(storage) {}
+
+ExperimentalQueryProfileGenerator::~ExperimentalQueryProfileGenerator() =
+    default;
+
+Table::Schema ExperimentalQueryProfileGenerator::CreateSchema() {
+  return tables::QueryProfileTable::Schema();
+}
+
+std::string ExperimentalQueryProfileGenerator::TableName() {
+  return "experimental_query_profile";
+}
+
+uint32_t ExperimentalQueryProfileGenerator::EstimateRowCount() {
+  size_t count = 0;
+  for (const auto& profile : storage_->query_profiles())
+    count += profile->operators().size();
+  return static_cast<uint32_t>(count);
+}
+
+util::Status ExperimentalQueryProfileGenerator::ValidateConstraints(
+    const QueryConstraints&) {
+  return util::OkStatus();
+}
+
+std::unique_ptr<Table> ExperimentalQueryProfileGenerator::ComputeTable(
+    const std::vector<Constraint>&,
+    const std::vector<Order>&) {
+  std::unique_ptr<tables::QueryProfileTable> table(
+      new tables::QueryProfileTable(storage_->mutable_string_pool(), nullptr));
+
+  for (const auto& profile : storage_->query_profiles()) {
+    StringId query =
+        storage_->InternString(base::StringView(profile->query()));
+    for (uint32_t i = 0; i < profile->operators().size(); ++i) {
+      const QueryProfile::Operator& op = profile->operators()[i];
+
+      tables::QueryProfileTable::Row row;
+      row.query_id = profile->query_id();
+      row.query = query;
+      row.operator_id = i;
+      row.parent_id = op.parent_id;
+      if (i != QueryProfile::kStatementId) {
+        row.table_name =
+            storage_->InternString(base::StringView(op.table_name));
+        row.plan = storage_->InternString(base::StringView(op.plan));
+      }
+      row.filter_count = op.filter_count;
+      row.cache_hits = op.cache_hit_count;
+      row.rows_scanned = op.rows_scanned;
+      row.rows_returned = op.rows_returned;
+      row.filter_dur = op.filter_dur_ns;
+      row.next_dur = op.next_dur_ns;
+      row.column_dur = op.column_dur_ns;
+      table->Insert(row);
+    }
+  }
+  // We need to explicitly std::move as clang complains about a bug in old
+  // compilers otherwise (-Wreturn-std-move-in-c++11).
+  return std::move(table);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
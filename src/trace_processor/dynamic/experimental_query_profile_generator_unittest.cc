@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_query_profile_generator.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "perfetto/trace_processor/trace_processor.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(QueryProfile, Operators) {
+  QueryProfile profile(3 /* query_id */, "select 1");
+  int cursor_a = 0;
+  int cursor_b = 0;
+  int table = 0;
+  auto plan = [] { return std::string("ts = ?"); };
+
+  {
+    QueryProfile::ScopedCall step(&profile, QueryProfile::kStatementId,
+                                  QueryProfile::Method::kNext);
+    uint32_t a = profile.BindCursor(&cursor_a, &table, 1, "slice", plan);
+    {
+      QueryProfile::ScopedCall filter(&profile, a,
+                                      QueryProfile::Method::kFilter);
+      filter.set_returned_row(true);
+
+      // An operator read while another one is filtered is its child.
+      uint32_t b = profile.BindCursor(&cursor_b, &table, 2, "slice", plan);
+      QueryProfile::ScopedCall child(&profile, b,
+                                     QueryProfile::Method::kFilter);
+    }
+    // The cursors reading the same table with the same plan share their
+    // operator.
+    ASSERT_EQ(profile.BindCursor(&cursor_b, &table, 1, "slice", plan), a);
+    QueryProfile::ScopedCall next(&profile, profile.CursorOperatorId(&cursor_b),
+                                  QueryProfile::Method::kNext);
+    next.set_returned_row(true);
+  }
+
+  const auto& ops = profile.operators();
+  ASSERT_EQ(ops.size(), 3u);
+  ASSERT_EQ(ops[0].parent_id, base::nullopt);
+  ASSERT_EQ(ops[0].filter_count, 0u);
+  ASSERT_EQ(ops[0].rows_returned, 0);
+
+  ASSERT_EQ(ops[1].parent_id, QueryProfile::kStatementId);
+  ASSERT_EQ(ops[1].table_name, "slice");
+  ASSERT_EQ(ops[1].plan, "ts = ?");
+  ASSERT_EQ(ops[1].filter_count, 1u);
+  ASSERT_EQ(ops[1].rows_returned, 2);
+  ASSERT_EQ(ops[1].rows_scanned, base::nullopt);
+
+  ASSERT_EQ(ops[2].parent_id, 1u);
+  ASSERT_EQ(ops[2].filter_count, 1u);
+  ASSERT_EQ(ops[2].rows_returned, 0);
+
+  // The time of the children is included in the one of their parent.
+  ASSERT_GE(ops[0].next_dur_ns, ops[1].filter_dur_ns + ops[1].next_dur_ns);
+  ASSERT_GE(ops[1].filter_dur_ns, ops[2].filter_dur_ns);
+}
+
+class ExperimentalQueryProfileGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalQueryProfileGeneratorTest()
+      : tp_(TraceProcessor::CreateInstance(Config())) {
+    static const char kTrace[] =
+        "# tracer: nop\n"
+        "#\n"
+        "  <idle>-0 (-----) [000] ...1 1.000000: tracing_mark_write: C|1|a|1\n"
+        "  <idle>-0 (-----) [000] ...1 1.000001: tracing_mark_write: C|1|b|5\n"
+        "  <idle>-0 (-----) [000] ...1 1.000004: tracing_mark_write: C|1|a|3\n"
+        "  <idle>-0 (-----) [000] ...1 1.000009: tracing_mark_write: C|1|a|2\n";
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[sizeof(kTrace) - 1]);
+    memcpy(buf.get(), kTrace, sizeof(kTrace) - 1);
+    EXPECT_TRUE(tp_->Parse(std::move(buf), sizeof(kTrace) - 1).ok());
+    tp_->NotifyEndOfFile();
+  }
+
+ protected:
+  // Returns the rows of the query as "|" separated cells.
+  std::vector<std::string> Rows(const std::string& sql) {
+    std::vector<std::string> rows;
+    auto it = tp_->ExecuteQuery(sql);
+    while (it.Next()) {
+      std::string row;
+      for (uint32_t i = 0; i < it.ColumnCount(); ++i) {
+        SqlValue value = it.Get(i);
+        row += i == 0 ? "" : "|";
+        if (value.type == SqlValue::kLong)
+          row += std::to_string(value.AsLong());
+        else if (value.type == SqlValue::kString)
+          row += value.AsString();
+        else
+          row += "null";
+      }
+      rows.push_back(row);
+    }
+    EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+    return rows;
+  }
+
+  std::unique_ptr<TraceProcessor> tp_;
+};
+
+TEST_F(ExperimentalQueryProfileGeneratorTest, DisabledByDefault) {
+  ASSERT_FALSE(tp_->IsQueryProfilingEnabled());
+  Rows("select count(*) from counter");
+  ASSERT_THAT(Rows("select count(*) from experimental_query_profile"),
+              ElementsAre("0"));
+}
+
+TEST_F(ExperimentalQueryProfileGeneratorTest, Operators) {
+  tp_->SetQueryProfilingEnabled(true);
+  ASSERT_THAT(Rows("select count(*) from counter c "
+                   "join counter_track t on c.track_id = t.id "
+                   "where c.value > 1"),
+              ElementsAre("3"));
+  tp_->SetQueryProfilingEnabled(false);
+  Rows("select count(*) from counter");
+
+  // The statement returned one row. The counters were filtered once, on their
+  // value, and the two tracks, few enough for SQLite to prefer scanning them
+  // to looking them up by id, scanned for each counter returned.
+  ASSERT_THAT(
+      Rows("select operator_id, parent_id, table_name, plan, filter_count, "
+           "cache_hits, rows_scanned, rows_returned "
+           "from experimental_query_profile order by operator_id"),
+      ElementsAre("0|null|null|null|0|0|null|1",
+                  "1|0|counter|value > ?|1|0|4|3",
+                  "2|0|counter_track||3|0|6|6"));
+  ASSERT_THAT(Rows("select count(distinct query_id), count(distinct query) "
+                   "from experimental_query_profile"),
+              ElementsAre("1|1"));
+  ASSERT_THAT(Rows("select count(*) from experimental_query_profile "
+                   "where filter_dur < 0 or next_dur < 0 or column_dur < 0"),
+              ElementsAre("0"));
+}
+
+TEST_F(ExperimentalQueryProfileGeneratorTest, QueryId) {
+  auto it = tp_->ExecuteQuery("select count(*) from counter");
+  while (it.Next()) {
+  }
+  uint32_t unprofiled_query_id = it.QueryId();
+
+  tp_->SetQueryProfilingEnabled(true);
+  ASSERT_TRUE(tp_->IsQueryProfilingEnabled());
+  it = tp_->ExecuteQuery("select count(*) from counter");
+  while (it.Next()) {
+  }
+  tp_->SetQueryProfilingEnabled(false);
+
+  // The queries not profiled are numbered too. The profile of a query is
+  // found from its id.
+  uint32_t query_id = it.QueryId();
+  ASSERT_EQ(query_id, unprofiled_query_id + 1);
+  ASSERT_THAT(Rows("select distinct query_id from experimental_query_profile"),
+              ElementsAre(std::to_string(query_id)));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
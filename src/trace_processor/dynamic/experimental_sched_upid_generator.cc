@@ -49,7 +49,10 @@ util::Status ExperimentalSchedUpidGenerator::ValidateConstraints(
 std::unique_ptr<Table> ExperimentalSchedUpidGenerator::ComputeTable(
     const std::vector<Constraint>&,
     const std::vector<Order>&) {
-  if (!upid_column_) {
+  // The sched table keeps growing (and has old rows evicted) when a trace is
+  // streamed so recompute the column whenever it has changed size.
+  if (!upid_column_ ||
+      upid_column_->size() != sched_slice_table_->row_count()) {
     upid_column_.reset(new NullableVector<uint32_t>(ComputeUpidColumn()));
   }
   return std::unique_ptr<Table>(new Table(sched_slice_table_->ExtendWithColumn(
@@ -59,7 +62,13 @@ std::unique_ptr<Table> ExperimentalSchedUpidGenerator::ComputeTable(
 
 NullableVector<uint32_t> ExperimentalSchedUpidGenerator::ComputeUpidColumn() {
   NullableVector<uint32_t> upid;
-  for (uint32_t i = 0; i < sched_slice_table_->row_count(); ++i) {
+
+  // Evicted rows have no data so just mark them as null.
+  uint32_t first_row = sched_slice_table_->evicted_row_count();
+  for (uint32_t i = 0; i < first_row; ++i) {
+    upid.AppendNull();
+  }
+  for (uint32_t i = first_row; i < sched_slice_table_->row_count(); ++i) {
     upid.Append(thread_table_->upid()[sched_slice_table_->utid()[i]]);
   }
   return upid;
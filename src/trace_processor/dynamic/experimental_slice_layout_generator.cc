@@ -15,9 +15,16 @@
  */
 
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/dynamic/cached_table_copy.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 
 namespace perfetto {
@@ -30,15 +37,129 @@ struct GroupInfo {
   int64_t start;
   int64_t end;
   uint32_t max_height;
-  uint32_t layout_depth;
+  uint32_t layout_depth = 0;
+};
+
+// Keeps track of the layout depths used by the open groups and finds the
+// lowest run of free depths a new group fits in.
+// This is a segment tree over the depths: each node stores the longest run of
+// free depths in its range and the runs of free depths at the start and at
+// the end of its range, which finds the lowest run in O(log(depths)).
+class DepthAllocator {
+ public:
+  DepthAllocator() { Resize(64); }
+
+  // Returns the lowest depth such that [depth, depth + height) is free and
+  // marks these depths as used.
+  uint32_t Allocate(uint32_t height) {
+    uint32_t depth;
+    if (nodes_[1].longest_free >= height) {
+      depth = FindFirstFit(height);
+    } else {
+      // All the depths past the end are free so the run starts with the free
+      // depths at the end.
+      depth = capacity_ - nodes_[1].suffix_free;
+      uint32_t capacity = capacity_;
+      while (capacity < depth + height)
+        capacity *= 2;
+      Resize(capacity);
+    }
+    SetFree(depth, height, false);
+    return depth;
+  }
+
+  void Free(uint32_t depth, uint32_t height) { SetFree(depth, height, true); }
+
+ private:
+  struct Node {
+    uint32_t size;
+    uint32_t longest_free;
+    uint32_t prefix_free;
+    uint32_t suffix_free;
+  };
+
+  // The leaves are the nodes [capacity_, 2 * capacity_) and the children of
+  // node i are 2 * i and 2 * i + 1.
+  void Resize(uint32_t capacity) {
+    std::vector<Node> nodes(2 * capacity);
+    for (uint32_t i = 0; i < capacity; ++i) {
+      bool used = i < capacity_ && nodes_[capacity_ + i].longest_free == 0;
+      uint32_t free = used ? 0 : 1;
+      nodes[capacity + i] = Node{1, free, free, free};
+    }
+    nodes_ = std::move(nodes);
+    capacity_ = capacity;
+    for (uint32_t i = capacity - 1; i > 0; --i)
+      Update(i);
+  }
+
+  void SetFree(uint32_t depth, uint32_t height, bool free) {
+    uint32_t lo = capacity_ + depth;
+    uint32_t hi = lo + height - 1;
+    for (uint32_t i = lo; i <= hi; ++i) {
+      uint32_t value = free ? 1 : 0;
+      nodes_[i] = Node{1, value, value, value};
+    }
+    while (lo > 1) {
+      lo /= 2;
+      hi /= 2;
+      for (uint32_t i = lo; i <= hi; ++i)
+        Update(i);
+    }
+  }
+
+  void Update(uint32_t i) {
+    const Node& left = nodes_[2 * i];
+    const Node& right = nodes_[2 * i + 1];
+    Node& node = nodes_[i];
+    node.size = left.size + right.size;
+    node.prefix_free = left.prefix_free == left.size
+                           ? left.size + right.prefix_free
+                           : left.prefix_free;
+    node.suffix_free = right.suffix_free == right.size
+                           ? right.size + left.suffix_free
+                           : right.suffix_free;
+    node.longest_free =
+        std::max(std::max(left.longest_free, right.longest_free),
+                 left.suffix_free + right.prefix_free);
+  }
+
+  uint32_t FindFirstFit(uint32_t height) const {
+    uint32_t i = 1;
+    uint32_t start = 0;
+    while (i < capacity_) {
+      const Node& left = nodes_[2 * i];
+      const Node& right = nodes_[2 * i + 1];
+      if (left.longest_free >= height) {
+        i = 2 * i;
+      } else if (left.suffix_free + right.prefix_free >= height) {
+        return start + left.size - left.suffix_free;
+      } else {
+        start += left.size;
+        i = 2 * i + 1;
+      }
+    }
+    return start;
+  }
+
+  uint32_t capacity_ = 0;
+  std::vector<Node> nodes_;
 };
 
+// Estimates the memory used by a cached layout: the row map selecting the
+// slices and the four columns added to the slice table.
+size_t EstimateSizeBytes(const Table& table) {
+  return table.row_count() *
+         (sizeof(uint32_t) + 3 * sizeof(int64_t) + sizeof(StringPool::Id));
+}
+
 }  // namespace
 
 ExperimentalSliceLayoutGenerator::ExperimentalSliceLayoutGenerator(
     StringPool* string_pool,
     const tables::SliceTable* table)
-    : string_pool_(string_pool),
+    : layout_cache_(kMaxCacheSizeBytes),
+      string_pool_(string_pool),
       slice_table_(table),
       empty_string_id_(string_pool_->InternString("")) {}
 ExperimentalSliceLayoutGenerator::~ExperimentalSliceLayoutGenerator() = default;
@@ -51,6 +172,12 @@ Table::Schema ExperimentalSliceLayoutGenerator::CreateSchema() {
   schema.columns.emplace_back(Table::Schema::Column{
       "filter_track_ids", SqlValue::Type::kString, false /* is_id */,
       false /* is_sorted */, true /* is_hidden */});
+  schema.columns.emplace_back(Table::Schema::Column{
+      "window_start", SqlValue::Type::kLong, false /* is_id */,
+      false /* is_sorted */, true /* is_hidden */});
+  schema.columns.emplace_back(Table::Schema::Column{
+      "window_end", SqlValue::Type::kLong, false /* is_id */,
+      false /* is_sorted */, true /* is_hidden */});
   return schema;
 }
 
@@ -76,43 +203,70 @@ util::Status ExperimentalSliceLayoutGenerator::ValidateConstraints(
 std::unique_ptr<Table> ExperimentalSliceLayoutGenerator::ComputeTable(
     const std::vector<Constraint>& cs,
     const std::vector<Order>&) {
-  std::set<TrackId> selected_tracks;
+  std::vector<uint32_t> selected_tracks;
   std::string filter_string = "";
+  base::Optional<int64_t> window_start;
+  base::Optional<int64_t> window_end;
   for (const auto& c : cs) {
-    bool is_filter_track_ids = c.col_idx == kFilterTrackIdsColumnIndex;
     bool is_equal = c.op == FilterOp::kEq;
-    bool is_string = c.value.type == SqlValue::kString;
-    if (is_filter_track_ids && is_equal && is_string) {
+    if (!is_equal)
+      continue;
+    if (c.col_idx == kFilterTrackIdsColumnIndex &&
+        c.value.type == SqlValue::kString) {
       filter_string = c.value.AsString();
       for (base::StringSplitter sp(filter_string, ','); sp.Next();) {
         base::Optional<uint32_t> maybe = base::CStringToUInt32(sp.cur_token());
         if (maybe) {
-          selected_tracks.insert(TrackId{maybe.value()});
+          selected_tracks.push_back(maybe.value());
         }
       }
+    } else if (c.col_idx == kWindowStartColumnIndex &&
+               c.value.type == SqlValue::kLong) {
+      window_start = c.value.AsLong();
+    } else if (c.col_idx == kWindowEndColumnIndex &&
+               c.value.type == SqlValue::kLong) {
+      window_end = c.value.AsLong();
     }
   }
+  std::sort(selected_tracks.begin(), selected_tracks.end());
+
+  // A window constrained on one side only is unbounded on the other.
+  base::Optional<Window> window;
+  if (window_start || window_end) {
+    window = Window{window_start.value_or(std::numeric_limits<int64_t>::min()),
+                    window_end.value_or(std::numeric_limits<int64_t>::max())};
+  }
 
   StringPool::Id filter_id =
       string_pool_->InternString(base::StringView(filter_string));
 
-  // Try and find the table in the cache.
-  auto it = layout_table_cache_.find(filter_id);
-  if (it != layout_table_cache_.end()) {
-    return std::unique_ptr<Table>(new Table(it->second.Copy()));
+  // All the cached layouts are stale once the slice table has changed, which
+  // happens when queries are run while a trace is still being loaded.
+  if (cached_slice_row_count_ != slice_table_->row_count() ||
+      cached_slice_evicted_row_count_ != slice_table_->evicted_row_count()) {
+    layout_cache_.Clear();
+    cached_slice_row_count_ = slice_table_->row_count();
+    cached_slice_evicted_row_count_ = slice_table_->evicted_row_count();
   }
 
+  // Try and find the table in the cache.
+  LayoutKey key{filter_id, window};
+  std::shared_ptr<const Table>* cached = layout_cache_.Find(key);
+  if (cached)
+    return std::unique_ptr<Table>(new CachedTableCopy(*cached));
+
   // Find all the slices for the tracks we want to filter and create a RowMap
   // out of them.
-  // TODO(lalitm): Update this to use iterator (as this code will be slow after
-  // the event table is implemented).
   // TODO(lalitm): consider generalising this by adding OR constraint support to
   // Constraint and Table::Filter. We definitely want to wait until we have more
   // usecases before implementing that though because it will be a significant
   // amount of work.
   RowMap rm;
-  for (uint32_t i = 0; i < slice_table_->row_count(); ++i) {
-    if (selected_tracks.count(slice_table_->track_id()[i]) > 0) {
+  const auto& track_id_col = slice_table_->track_id();
+  for (uint32_t i = slice_table_->evicted_row_count();
+       i < slice_table_->row_count(); ++i) {
+    if (std::binary_search(selected_tracks.begin(), selected_tracks.end(),
+                           track_id_col[i].value)) {
       rm.Insert(i);
     }
   }
@@ -122,25 +276,11 @@ std::unique_ptr<Table> ExperimentalSliceLayoutGenerator::ComputeTable(
   Table filtered_table = slice_table_->Apply(std::move(rm));
 
   // Compute the table and add it to the cache for future use.
-  Table layout_table = ComputeLayoutTable(filtered_table, filter_id);
-  auto res = layout_table_cache_.emplace(filter_id, std::move(layout_table));
-  return std::unique_ptr<Table>(new Table(res.first->second.Copy()));
-}
-
-// Build up a table of slice id -> root slice id by observing each
-// (id, opt_parent_id) pair in order.
-tables::SliceTable::Id ExperimentalSliceLayoutGenerator::InsertSlice(
-    std::map<tables::SliceTable::Id, tables::SliceTable::Id>& id_map,
-    tables::SliceTable::Id id,
-    base::Optional<tables::SliceTable::Id> parent_id) {
-  if (parent_id) {
-    tables::SliceTable::Id root_id = id_map[parent_id.value()];
-    id_map[id] = root_id;
-    return root_id;
-  } else {
-    id_map[id] = id;
-    return id;
-  }
+  std::shared_ptr<const Table> layout_table(
+      new Table(ComputeLayoutTable(filtered_table, filter_id, window)));
+  size_t size_bytes = EstimateSizeBytes(*layout_table);
+  layout_cache_.Insert(key, layout_table, size_bytes);
+  return std::unique_ptr<Table>(new CachedTableCopy(std::move(layout_table)));
 }
 
 // The problem we're trying to solve is this: given a number of tracks each of
@@ -172,13 +312,15 @@ tables::SliceTable::Id ExperimentalSliceLayoutGenerator::InsertSlice(
 // 3. Go though each slice and give it a layout_depth by summing it's
 //    current depth and the root layout_depth of the stalactite it belongs to.
 //
+// Steps 1 and 2 are O(n log(n)) in the number of slices so that the layout of
+// tracks with millions of slices can be computed.
+//
+// When a window is given, only the stalactites which overlap it are laid out
+// in step 2 and returned in step 3.
 Table ExperimentalSliceLayoutGenerator::ComputeLayoutTable(
     const Table& table,
-    StringPool::Id filter_id) {
-  std::map<tables::SliceTable::Id, GroupInfo> groups;
-  // Map of id -> root_id
-  std::map<tables::SliceTable::Id, tables::SliceTable::Id> id_map;
-
+    StringPool::Id filter_id,
+    base::Optional<Window> window) {
   const auto& id_col = table.GetIdColumnByName<tables::SliceTable::Id>("id");
   const auto& parent_id_col =
       table.GetTypedColumnByName<base::Optional<tables::SliceTable::Id>>(
@@ -188,113 +330,124 @@ Table ExperimentalSliceLayoutGenerator::ComputeLayoutTable(
   const auto& dur_col = table.GetTypedColumnByName<int64_t>("dur");
 
   // Step 1:
-  // Find the bounding box (start ts, end ts, and max depth) for each group
-  // TODO(lalitm): Update this to use iterator (as this code will be slow after
-  // the event table is implemented)
+  // Find the bounding box (start ts, end ts, and max depth) for each group.
+  // The rows are sorted by id and a parent always has a smaller id than its
+  // children, so the row of the parent of a slice is found with a binary
+  // search of the previous rows and the slice belongs to the same group.
+  std::vector<uint32_t> ids(table.row_count());
+  for (uint32_t i = 0; i < table.row_count(); ++i)
+    ids[i] = id_col[i].value;
+
+  std::vector<GroupInfo> groups;
+  std::vector<uint32_t> group_for_row(table.row_count());
   for (uint32_t i = 0; i < table.row_count(); ++i) {
-    tables::SliceTable::Id id = id_col[i];
     base::Optional<tables::SliceTable::Id> parent_id = parent_id_col[i];
     uint32_t depth = depth_col[i];
     int64_t start = ts_col[i];
     int64_t dur = dur_col[i];
     int64_t end = dur == -1 ? std::numeric_limits<int64_t>::max() : start + dur;
-    InsertSlice(id_map, id, parent_id);
-    std::map<tables::SliceTable::Id, GroupInfo>::iterator it;
-    bool inserted;
-    std::tie(it, inserted) = groups.emplace(
-        std::piecewise_construct, std::forward_as_tuple(id_map[id]),
-        std::forward_as_tuple(start, end, depth + 1));
-    if (!inserted) {
-      it->second.max_height = std::max(it->second.max_height, depth + 1);
-      it->second.end = std::max(it->second.end, end);
+
+    auto rows_end = ids.begin() + i;
+    auto parent_it = rows_end;
+    if (parent_id) {
+      parent_it = std::lower_bound(ids.begin(), rows_end, parent_id->value);
+      if (parent_it != rows_end && *parent_it != parent_id->value)
+        parent_it = rows_end;
     }
+
+    // Slices whose parent is not in the table (e.g. because it was evicted)
+    // start a group of their own.
+    if (parent_it == rows_end) {
+      group_for_row[i] = static_cast<uint32_t>(groups.size());
+      groups.emplace_back(start, end, depth + 1);
+      continue;
+    }
+    uint32_t group_idx =
+        group_for_row[static_cast<size_t>(parent_it - ids.begin())];
+    group_for_row[i] = group_idx;
+    GroupInfo& group = groups[group_idx];
+    group.max_height = std::max(group.max_height, depth + 1);
+    group.end = std::max(group.end, end);
   }
 
-  // Sort the groups by ts
-  std::vector<GroupInfo*> sorted_groups;
-  sorted_groups.resize(groups.size());
-  size_t idx = 0;
-  for (auto& group : groups) {
-    sorted_groups[idx++] = &group.second;
+  // Sort the groups by ts, keeping only the ones in the window.
+  std::vector<uint32_t> sorted_groups;
+  sorted_groups.reserve(groups.size());
+  for (uint32_t i = 0; i < groups.size(); ++i) {
+    const GroupInfo& group = groups[i];
+    if (window && (group.start > window->end || group.end < window->start))
+      continue;
+    sorted_groups.push_back(i);
   }
-  std::sort(std::begin(sorted_groups), std::end(sorted_groups),
-            [](const GroupInfo* group1, const GroupInfo* group2) {
-              return group1->start < group2->start;
-            });
+  std::stable_sort(sorted_groups.begin(), sorted_groups.end(),
+                   [&groups](uint32_t group1, uint32_t group2) {
+                     return groups[group1].start < groups[group2].start;
+                   });
 
   // Step 2:
   // Go though each group and choose a depth for the root slice.
   // We keep track of those groups where the start time has passed but the
-  // end time has not in this vector:
-  std::vector<GroupInfo*> still_open;
-  for (GroupInfo* group : sorted_groups) {
-    int64_t start = group->start;
-    uint32_t max_height = group->max_height;
+  // end time has not in a min-heap ordered by end time, and of the depths
+  // these groups use in the allocator.
+  using OpenGroup = std::pair<int64_t /* end */, uint32_t /* group */>;
+  std::priority_queue<OpenGroup, std::vector<OpenGroup>,
+                      std::greater<OpenGroup>>
+      still_open;
+  DepthAllocator depths;
+  for (uint32_t group_idx : sorted_groups) {
+    GroupInfo& group = groups[group_idx];
 
     // Discard all 'closed' groups where that groups end_ts is < our start_ts:
-    {
-      auto it = still_open.begin();
-      while (it != still_open.end()) {
-        if ((*it)->end < start) {
-          it = still_open.erase(it);
-        } else {
-          ++it;
-        }
-      }
-    }
-
-    // Find a start layout depth for this group s.t. our start depth +
-    // our max depth will not intersect with the start depth + max depth for
-    // any of the open groups:
-    uint32_t layout_depth = 0;
-    bool done = false;
-    while (!done) {
-      done = true;
-      uint32_t start_depth = layout_depth;
-      uint32_t end_depth = layout_depth + max_height;
-      for (const auto& open : still_open) {
-        bool top = open->layout_depth <= start_depth &&
-                   start_depth < open->layout_depth + open->max_height;
-        bool bottom = open->layout_depth < end_depth &&
-                      end_depth <= open->layout_depth + open->max_height;
-        if (top || bottom) {
-          // This is extremely dumb, we can make a much better guess for what
-          // depth to try next but it is a little complicated to get right.
-          layout_depth++;
-          done = false;
-          break;
-        }
-      }
+    while (!still_open.empty() && still_open.top().first < group.start) {
+      const GroupInfo& closed = groups[still_open.top().second];
+      depths.Free(closed.layout_depth, closed.max_height);
+      still_open.pop();
     }
 
-    // Add this group to the open groups & re
-    still_open.push_back(group);
-
-    // Set our root layout depth:
-    group->layout_depth = layout_depth;
+    // Find the lowest layout depth for this group s.t. our start depth +
+    // our max depth will not intersect with the depths of any of the open
+    // groups:
+    group.layout_depth = depths.Allocate(group.max_height);
+    still_open.emplace(group.end, group_idx);
   }
 
-  // Step 3: Add the two new columns layout_depth and filter_track_ids:
+  // Step 3: Add the new columns layout_depth, filter_track_ids and the window.
+  RowMap rm;
   std::unique_ptr<NullableVector<int64_t>> layout_depth_column(
       new NullableVector<int64_t>());
   std::unique_ptr<NullableVector<StringPool::Id>> filter_column(
       new NullableVector<StringPool::Id>());
+  std::unique_ptr<NullableVector<int64_t>> window_start_column(
+      new NullableVector<int64_t>());
+  std::unique_ptr<NullableVector<int64_t>> window_end_column(
+      new NullableVector<int64_t>());
 
   for (uint32_t i = 0; i < table.row_count(); ++i) {
-    tables::SliceTable::Id id = id_col[i];
-    uint32_t depth = depth_col[i];
+    const GroupInfo& group = groups[group_for_row[i]];
+    if (window && (group.start > window->end || group.end < window->start))
+      continue;
+    rm.Insert(i);
+
     // Each slice depth is it's current slice depth + root slice depth of the
     // group:
-    layout_depth_column->Append(depth + groups.at(id_map[id]).layout_depth);
-    // We must set this to the value we got in the constraint to ensure our
+    layout_depth_column->Append(depth_col[i] + group.layout_depth);
+    // We must set these to the values we got in the constraints to ensure our
     // rows are not filtered out:
     filter_column->Append(filter_id);
+    window_start_column->Append(window ? base::make_optional(window->start)
+                                       : base::nullopt);
+    window_end_column->Append(window ? base::make_optional(window->end)
+                                     : base::nullopt);
   }
-  return table
+  return table.Apply(std::move(rm))
       .ExtendWithColumn("layout_depth", std::move(layout_depth_column),
                         TypedColumn<int64_t>::default_flags())
       .ExtendWithColumn("filter_track_ids", std::move(filter_column),
-                        TypedColumn<StringPool::Id>::default_flags());
+                        TypedColumn<StringPool::Id>::default_flags())
+      .ExtendWithColumn("window_start", std::move(window_start_column),
+                        TypedColumn<base::Optional<int64_t>>::default_flags())
+      .ExtendWithColumn("window_end", std::move(window_end_column),
+                        TypedColumn<base::Optional<int64_t>>::default_flags());
 }
 
 }  // namespace trace_processor
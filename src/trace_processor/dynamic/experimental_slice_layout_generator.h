@@ -17,8 +17,10 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICE_LAYOUT_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICE_LAYOUT_GENERATOR_H_
 
-#include <set>
+#include <memory>
 
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/dynamic/size_bounded_lru_cache.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
@@ -31,6 +33,17 @@ class ExperimentalSliceLayoutGenerator
   static constexpr uint32_t kFilterTrackIdsColumnIndex =
       static_cast<uint32_t>(tables::SliceTable::ColumnIndex::arg_set_id) + 2;
 
+  // When either is constrained (with an equality), only the stalactites which
+  // overlap [window_start, window_end] are laid out and returned.
+  static constexpr uint32_t kWindowStartColumnIndex =
+      kFilterTrackIdsColumnIndex + 1;
+  static constexpr uint32_t kWindowEndColumnIndex =
+      kFilterTrackIdsColumnIndex + 2;
+
+  // The computed layouts are cached until their estimated size exceeds this,
+  // at which point the least recently used ones are evicted.
+  static constexpr size_t kMaxCacheSizeBytes = 64 * 1024 * 1024;
+
   ExperimentalSliceLayoutGenerator(StringPool* string_pool,
                                    const tables::SliceTable* table);
   virtual ~ExperimentalSliceLayoutGenerator() override;
@@ -42,16 +55,39 @@ class ExperimentalSliceLayoutGenerator
   std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>&,
                                       const std::vector<Order>&) override;
 
+  size_t cache_size_bytes() const { return layout_cache_.size_bytes(); }
+
  private:
-  Table ComputeLayoutTable(const Table& table, StringPool::Id filter_id);
-  tables::SliceTable::Id InsertSlice(
-      std::map<tables::SliceTable::Id, tables::SliceTable::Id>& id_map,
-      tables::SliceTable::Id id,
-      base::Optional<tables::SliceTable::Id> parent_id);
+  struct Window {
+    int64_t start;
+    int64_t end;
+
+    bool operator==(const Window& other) const {
+      return start == other.start && end == other.end;
+    }
+  };
+
+  struct LayoutKey {
+    StringPool::Id filter_id;
+    base::Optional<Window> window;
+
+    bool operator==(const LayoutKey& other) const {
+      return filter_id == other.filter_id && window == other.window;
+    }
+  };
+
+  Table ComputeLayoutTable(const Table& table,
+                           StringPool::Id filter_id,
+                           base::Optional<Window> window);
 
   // TODO(lalitm): remove this cache and move to having explicitly scoped
   // lifetimes of dynamic tables.
-  std::unordered_map<StringId, Table> layout_table_cache_;
+  SizeBoundedLruCache<LayoutKey, std::shared_ptr<const Table>> layout_cache_;
+
+  // The size of the slice table when the cached layouts were computed: they
+  // are all stale once slices have been added or evicted.
+  uint32_t cached_slice_row_count_ = 0;
+  uint32_t cached_slice_evicted_row_count_ = 0;
 
   StringPool* string_pool_;
   const tables::SliceTable* slice_table_;
@@ -0,0 +1,140 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the layout of the slices of a set of async tracks.
+// This mimics what the UI queries to display a group of async tracks merged
+// into a single one: a set of tracks, each with many short stalactites of a
+// few slices, which overlap each other.
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+
+namespace {
+
+using perfetto::trace_processor::Constraint;
+using perfetto::trace_processor::ExperimentalSliceLayoutGenerator;
+using perfetto::trace_processor::FilterOp;
+using perfetto::trace_processor::SqlValue;
+using perfetto::trace_processor::StringPool;
+using perfetto::trace_processor::tables::SliceTable;
+using perfetto::trace_processor::tables::TrackTable;
+
+// The number of async tracks laid out together.
+constexpr uint32_t kTracks = 64;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 1024 * 1024);
+  }
+}
+
+// Inserts |slice_count| slices in stalactites of 1 to 4 slices spread over
+// the tracks, sets |end_ts| to the start of the last one and returns the
+// filter_track_ids constraint selecting them.
+std::string InsertSlices(StringPool* pool,
+                         SliceTable* table,
+                         uint32_t slice_count,
+                         int64_t* end_ts) {
+  std::minstd_rand rnd(0);
+  StringPool::Id name = pool->InternString("slice");
+  int64_t ts = 0;
+  for (uint32_t i = 0; i < slice_count;) {
+    ts += static_cast<int64_t>(rnd() % 1000);
+    int64_t dur = 1 + static_cast<int64_t>(rnd() % 100000);
+    auto height = static_cast<uint32_t>(1 + rnd() % 4);
+
+    SliceTable::Row row;
+    row.track_id = TrackTable::Id{static_cast<uint32_t>(rnd() % kTracks)};
+    row.name = name;
+    for (uint32_t depth = 0; depth < height && i < slice_count; ++depth, ++i) {
+      row.ts = ts + depth;
+      row.dur = dur - 2 * depth;
+      row.depth = depth;
+      // The next slice is a child of this one.
+      row.parent_id = table->Insert(row).id;
+    }
+  }
+  *end_ts = ts;
+
+  std::string filter;
+  for (uint32_t i = 0; i < kTracks; ++i)
+    filter += (i == 0 ? "" : ",") + std::to_string(i);
+  return filter;
+}
+
+static void BM_SliceLayout(benchmark::State& state) {
+  StringPool pool;
+  SliceTable table(&pool, nullptr);
+  auto slice_count = static_cast<uint32_t>(state.range(0));
+  int64_t end_ts;
+  std::string filter = InsertSlices(&pool, &table, slice_count, &end_ts);
+  std::vector<Constraint> cs{
+      Constraint{ExperimentalSliceLayoutGenerator::kFilterTrackIdsColumnIndex,
+                 FilterOp::kEq, SqlValue::String(filter.c_str())}};
+
+  for (auto _ : state) {
+    // Use a new generator for each iteration so the layout is not cached.
+    ExperimentalSliceLayoutGenerator generator(&pool, &table);
+    std::unique_ptr<perfetto::trace_processor::Table> layout =
+        generator.ComputeTable(cs, {});
+    benchmark::DoNotOptimize(layout->row_count());
+  }
+  state.counters["slices"] = benchmark::Counter(
+      static_cast<double>(slice_count * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_SliceLayout)->Apply(BenchmarkArgs);
+
+static void BM_SliceLayoutWindow(benchmark::State& state) {
+  StringPool pool;
+  SliceTable table(&pool, nullptr);
+  auto slice_count = static_cast<uint32_t>(state.range(0));
+  int64_t end_ts;
+  std::string filter = InsertSlices(&pool, &table, slice_count, &end_ts);
+
+  // Only lay out the slices in the middle 1% of the trace, as the UI does when
+  // zoomed in.
+  std::vector<Constraint> cs{
+      Constraint{ExperimentalSliceLayoutGenerator::kFilterTrackIdsColumnIndex,
+                 FilterOp::kEq, SqlValue::String(filter.c_str())},
+      Constraint{ExperimentalSliceLayoutGenerator::kWindowStartColumnIndex,
+                 FilterOp::kEq, SqlValue::Long(end_ts / 2)},
+      Constraint{ExperimentalSliceLayoutGenerator::kWindowEndColumnIndex,
+                 FilterOp::kEq, SqlValue::Long(end_ts / 2 + end_ts / 100)}};
+
+  for (auto _ : state) {
+    ExperimentalSliceLayoutGenerator generator(&pool, &table);
+    std::unique_ptr<perfetto::trace_processor::Table> layout =
+        generator.ComputeTable(cs, {});
+    benchmark::DoNotOptimize(layout->row_count());
+  }
+  state.counters["slices"] = benchmark::Counter(
+      static_cast<double>(slice_count * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_SliceLayoutWindow)->Apply(BenchmarkArgs);
+
+}  // namespace
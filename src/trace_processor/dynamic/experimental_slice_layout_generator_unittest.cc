@@ -26,6 +26,10 @@ namespace {
 
 constexpr uint32_t kColumn =
     ExperimentalSliceLayoutGenerator::kFilterTrackIdsColumnIndex;
+constexpr uint32_t kWindowStartColumn =
+    ExperimentalSliceLayoutGenerator::kWindowStartColumnIndex;
+constexpr uint32_t kWindowEndColumn =
+    ExperimentalSliceLayoutGenerator::kWindowEndColumnIndex;
 
 std::string ToVis(const Table& table) {
   const Column* layout_depth_column = table.GetColumnByName("layout_depth");
@@ -251,6 +255,110 @@ TEST(ExperimentalSliceLayoutGeneratorTest, FilterOutTracks) {
 )");
 }
 
+TEST(ExperimentalSliceLayoutGeneratorTest, ContainedOpenGroup) {
+  StringPool pool;
+  tables::SliceTable slice_table(&pool, nullptr);
+  StringId name = pool.InternString("Slice");
+
+  Insert(&slice_table, 0 /*ts*/, 1 /*dur*/, 1 /*track_id*/, name,
+         base::nullopt);
+  Insert(&slice_table, 0 /*ts*/, 10 /*dur*/, 2 /*track_id*/, name,
+         base::nullopt);
+  // This stalactite is higher than the free depth above the open one of
+  // track 2 so has to go below it.
+  auto a = Insert(&slice_table, 5 /*ts*/, 2 /*dur*/, 3 /*track_id*/, name,
+                  base::nullopt);
+  auto b = Insert(&slice_table, 5 /*ts*/, 2 /*dur*/, 3 /*track_id*/, name, a);
+  Insert(&slice_table, 5 /*ts*/, 1 /*dur*/, 3 /*track_id*/, name, b);
+
+  ExperimentalSliceLayoutGenerator gen(&pool, &slice_table);
+  std::unique_ptr<Table> table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("1,2,3")}}, {});
+  ExpectOutput(*table, R"(
+#
+##########
+     ##
+     ##
+     #
+)");
+}
+
+TEST(ExperimentalSliceLayoutGeneratorTest, Window) {
+  StringPool pool;
+  tables::SliceTable slice_table(&pool, nullptr);
+  StringId name = pool.InternString("Slice");
+
+  for (int64_t ts : {0, 5, 10}) {
+    auto a = Insert(&slice_table, ts, 3 /*dur*/, 1 /*track_id*/, name,
+                    base::nullopt);
+    Insert(&slice_table, ts, 2 /*dur*/, 1 /*track_id*/, name, a);
+  }
+  Insert(&slice_table, 0 /*ts*/, 14 /*dur*/, 2 /*track_id*/, name,
+         base::nullopt);
+
+  ExperimentalSliceLayoutGenerator gen(&pool, &slice_table);
+  std::unique_ptr<Table> table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("1,2")},
+       Constraint{kWindowStartColumn, FilterOp::kEq, SqlValue::Long(4)},
+       Constraint{kWindowEndColumn, FilterOp::kEq, SqlValue::Long(8)}},
+      {});
+  // Only the stalactites overlapping [4, 8] are laid out.
+  ExpectOutput(*table, R"(
+##############
+     ###
+     ##
+)");
+  EXPECT_EQ(table->GetColumnByName("window_start")->Get(0).AsLong(), 4);
+  EXPECT_EQ(table->GetColumnByName("window_end")->Get(0).AsLong(), 8);
+
+  // Only the stalactite of track 1 which ends after the start of the window.
+  table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("1")},
+       Constraint{kWindowStartColumn, FilterOp::kEq, SqlValue::Long(9)}},
+      {});
+  ExpectOutput(*table, R"(
+          ###
+          ##
+)");
+}
+
+TEST(ExperimentalSliceLayoutGeneratorTest, Cache) {
+  StringPool pool;
+  tables::SliceTable slice_table(&pool, nullptr);
+  StringId name = pool.InternString("Slice");
+
+  Insert(&slice_table, 1 /*ts*/, 5 /*dur*/, 1 /*track_id*/, name,
+         base::nullopt);
+
+  ExperimentalSliceLayoutGenerator gen(&pool, &slice_table);
+  std::vector<Constraint> cs{
+      Constraint{kColumn, FilterOp::kEq, SqlValue::String("1")}};
+  std::unique_ptr<Table> table = gen.ComputeTable(cs, {});
+  size_t cache_size_bytes = gen.cache_size_bytes();
+  EXPECT_GT(cache_size_bytes, 0u);
+
+  // The second query is served from the cache.
+  table = gen.ComputeTable(cs, {});
+  EXPECT_EQ(gen.cache_size_bytes(), cache_size_bytes);
+  ExpectOutput(*table, R"(
+ #####
+)");
+
+  // New slices invalidate the cache.
+  Insert(&slice_table, 3 /*ts*/, 5 /*dur*/, 1 /*track_id*/, name,
+         base::nullopt);
+  std::unique_ptr<Table> new_table = gen.ComputeTable(cs, {});
+  ExpectOutput(*new_table, R"(
+ #####
+   #####
+)");
+
+  // Tables returned before are still valid.
+  ExpectOutput(*table, R"(
+ #####
+)");
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
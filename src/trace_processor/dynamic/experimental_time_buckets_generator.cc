@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_time_buckets_generator.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/util/parallel.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using T = tables::ExperimentalTimeBucketsTable;
+
+// Below this number of events, starting threads costs more than it saves.
+constexpr size_t kMinEventsToProcessInParallel = 1 << 16;
+
+constexpr int64_t kMaxSmallPartition = 1 << 16;
+constexpr size_t kNoPartition = std::numeric_limits<size_t>::max();
+
+struct Bucket {
+  uint32_t count = 0;
+  int64_t overlap_dur = 0;
+  double value_sum = 0;
+  double value_max = std::numeric_limits<double>::lowest();
+};
+
+struct Partition {
+  int64_t value;
+  std::vector<uint32_t> rows;
+
+  // The non empty buckets, in ts order.
+  std::vector<std::pair<int64_t /* bucket index */, Bucket>> buckets;
+};
+
+struct Event {
+  int64_t ts;
+  int64_t end;
+  double value;
+};
+
+struct Window {
+  int64_t start;
+  int64_t end;
+  int64_t bucket_dur;
+};
+
+double ToDouble(const SqlValue& value) {
+  return value.type == SqlValue::kDouble ? value.double_value
+                                         : static_cast<double>(value.AsLong());
+}
+
+// Groups the rows of the source by partition, in partition order.
+std::vector<Partition> CollectPartitions(
+    const ExperimentalTimeBucketsGenerator::Source& source) {
+  const Table& table = *source.table;
+  const Column* partition_col =
+      table.GetColumnByName(source.partition_column);
+  const Column* skip_zero_col =
+      source.skip_zero_column ? table.GetColumnByName(source.skip_zero_column)
+                              : nullptr;
+
+  // Partitions are usually small integers (cpus, track ids) so their index is
+  // looked up in a vector, falling back to a map for the others.
+  std::vector<Partition> partitions;
+  std::vector<size_t> small_partition_idx;
+  std::unordered_map<int64_t, size_t> partition_idx;
+  auto find_or_add_partition = [&](int64_t value) -> Partition& {
+    size_t* idx;
+    if (value >= 0 && value < kMaxSmallPartition) {
+      auto small_value = static_cast<size_t>(value);
+      if (small_value >= small_partition_idx.size())
+        small_partition_idx.resize(small_value + 1, kNoPartition);
+      idx = &small_partition_idx[small_value];
+    } else {
+      idx = &partition_idx.emplace(value, kNoPartition).first->second;
+    }
+    if (*idx == kNoPartition) {
+      *idx = partitions.size();
+      partitions.emplace_back();
+      partitions.back().value = value;
+    }
+    return partitions[*idx];
+  };
+
+  for (uint32_t i = table.evicted_row_count(); i < table.row_count(); ++i) {
+    if (skip_zero_col) {
+      SqlValue skip = skip_zero_col->Get(i);
+      if (skip.is_null() || skip.AsLong() == 0)
+        continue;
+    }
+    SqlValue partition = partition_col->Get(i);
+    if (partition.is_null())
+      continue;
+    find_or_add_partition(partition.AsLong()).rows.push_back(i);
+  }
+  std::sort(partitions.begin(), partitions.end(),
+            [](const Partition& a, const Partition& b) {
+              return a.value < b.value;
+            });
+  return partitions;
+}
+
+// Aggregates the events of |partition| in its buckets.
+void ComputeBuckets(const ExperimentalTimeBucketsGenerator::Source& source,
+                    const Window& window,
+                    Partition* partition) {
+  const Table& table = *source.table;
+  const auto& ts_col = table.GetTypedColumnByName<int64_t>("ts");
+  const auto* dur_col =
+      source.dur_column
+          ? &table.GetTypedColumnByName<int64_t>(source.dur_column)
+          : nullptr;
+  const Column* value_col = source.value_column
+                                ? table.GetColumnByName(source.value_column)
+                                : nullptr;
+
+  std::vector<Event> events;
+  events.reserve(partition->rows.size());
+  for (uint32_t row : partition->rows) {
+    Event event;
+    event.ts = ts_col[row];
+    event.end = std::numeric_limits<int64_t>::max();
+    if (dur_col) {
+      int64_t dur = (*dur_col)[row];
+      if (dur >= 0)
+        event.end = event.ts + dur;
+    }
+    SqlValue value = value_col ? value_col->Get(row) : SqlValue();
+    event.value = value.is_null() ? 0 : ToDouble(value);
+    events.push_back(event);
+  }
+  // The rows are not needed anymore so free them while the other partitions
+  // are processed.
+  std::vector<uint32_t>().swap(partition->rows);
+
+  // The events of most tables are already sorted by ts.
+  auto by_ts = [](const Event& a, const Event& b) { return a.ts < b.ts; };
+  if (!std::is_sorted(events.begin(), events.end(), by_ts))
+    std::stable_sort(events.begin(), events.end(), by_ts);
+  if (!dur_col) {
+    for (size_t i = 0; i + 1 < events.size(); ++i)
+      events[i].end = events[i + 1].ts;
+  }
+
+  // As the events are sorted by ts, the buckets before the first one of an
+  // event won't be overlapped by any later event: only the buckets from there
+  // to the last one overlapped so far are kept, all the previous ones are
+  // final.
+  std::deque<Bucket> open;
+  int64_t first_open = 0;
+  auto close_until = [&](int64_t bucket_idx) {
+    for (; first_open < bucket_idx && !open.empty(); ++first_open) {
+      if (open.front().count > 0)
+        partition->buckets.emplace_back(first_open, open.front());
+      open.pop_front();
+    }
+    if (open.empty())
+      first_open = std::max(first_open, bucket_idx);
+  };
+
+  for (const Event& event : events) {
+    int64_t start = std::max(event.ts, window.start);
+    int64_t end = std::min(event.end, window.end);
+    if (start >= window.end || end < start ||
+        (end == start && event.ts < window.start)) {
+      continue;
+    }
+
+    int64_t first = (start - window.start) / window.bucket_dur;
+    int64_t last =
+        end > start ? (end - 1 - window.start) / window.bucket_dur : first;
+    close_until(first);
+    while (first_open + static_cast<int64_t>(open.size()) <= last)
+      open.emplace_back();
+
+    for (int64_t i = first; i <= last; ++i) {
+      int64_t bucket_start = window.start + i * window.bucket_dur;
+      int64_t bucket_end = std::min(bucket_start + window.bucket_dur,
+                                    window.end);
+      Bucket& bucket = open[static_cast<size_t>(i - first_open)];
+      bucket.count++;
+      bucket.overlap_dur +=
+          std::min(end, bucket_end) - std::max(start, bucket_start);
+      bucket.value_sum += event.value;
+      bucket.value_max = std::max(bucket.value_max, event.value);
+    }
+  }
+  close_until(std::numeric_limits<int64_t>::max());
+}
+
+}  // namespace
+
+ExperimentalTimeBucketsGenerator::ExperimentalTimeBucketsGenerator(
+    TraceStorage* storage)
+    : storage_(storage) {
+  sources_["sched"] = Source{&storage->sched_slice_table(), "cpu", "dur",
+                             nullptr, "utid"};
+  sources_["slice"] =
+      Source{&storage->slice_table(), "track_id", "dur", nullptr, nullptr};
+  sources_["counter"] = Source{&storage->counter_table(), "track_id", nullptr,
+                               "value", nullptr};
+}
+
+ExperimentalTimeBucketsGenerator::~ExperimentalTimeBucketsGenerator() =
+    default;
+
+Table::Schema ExperimentalTimeBucketsGenerator::CreateSchema() {
+  return T::Schema();
+}
+
+std::string ExperimentalTimeBucketsGenerator::TableName() {
+  return "experimental_time_buckets";
+}
+
+uint32_t ExperimentalTimeBucketsGenerator::EstimateRowCount() {
+  // The number of rows depends on the bucket duration so just guess a few
+  // hundred buckets for a few tens of partitions.
+  return 10000;
+}
+
+util::Status ExperimentalTimeBucketsGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  const auto& cs = qc.constraints();
+  auto has_eq_cs = [&cs](T::ColumnIndex col) {
+    return std::any_of(cs.begin(), cs.end(),
+                       [col](const QueryConstraints::Constraint& c) {
+                         return c.column == static_cast<int>(col) &&
+                                sqlite_utils::IsOpEq(c.op);
+                       });
+  };
+  return has_eq_cs(T::ColumnIndex::source) &&
+                 has_eq_cs(T::ColumnIndex::bucket_dur)
+             ? util::OkStatus()
+             : util::ErrStatus(
+                   "experimental_time_buckets must have source and bucket_dur "
+                   "constraints");
+}
+
+std::unique_ptr<Table> ExperimentalTimeBucketsGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&) {
+  std::string source_name;
+  int64_t bucket_dur = 0;
+  base::Optional<int64_t> start_ts;
+  base::Optional<int64_t> end_ts;
+  for (const Constraint& c : cs) {
+    if (c.op != FilterOp::kEq)
+      continue;
+    if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::source) &&
+        c.value.type == SqlValue::kString) {
+      source_name = c.value.AsString();
+    } else if (c.value.type != SqlValue::kLong) {
+      continue;
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::bucket_dur)) {
+      bucket_dur = c.value.AsLong();
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::start_ts)) {
+      start_ts = c.value.AsLong();
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::end_ts)) {
+      end_ts = c.value.AsLong();
+    }
+  }
+
+  auto source_it = sources_.find(source_name);
+  if (source_it == sources_.end()) {
+    PERFETTO_ELOG("experimental_time_buckets: unknown source '%s'",
+                  source_name.c_str());
+    return nullptr;
+  }
+  if (bucket_dur <= 0) {
+    PERFETTO_ELOG("experimental_time_buckets: bucket_dur must be positive");
+    return nullptr;
+  }
+
+  // Computing the bounds of the trace scans all the tables so only do it when
+  // needed.
+  Window window{0, 0, bucket_dur};
+  if (!start_ts || !end_ts) {
+    std::pair<int64_t, int64_t> bounds = storage_->GetTraceTimestampBoundsNs();
+    window.start = start_ts.value_or(bounds.first);
+    window.end = end_ts.value_or(bounds.second);
+  } else {
+    window.start = *start_ts;
+    window.end = *end_ts;
+  }
+  if (window.end > window.start &&
+      (window.end - window.start) / bucket_dur >= kMaxBuckets) {
+    PERFETTO_ELOG("experimental_time_buckets: too many buckets, increase "
+                  "bucket_dur");
+    return nullptr;
+  }
+
+  const Source& source = source_it->second;
+  std::vector<Partition> partitions;
+  if (window.end > window.start)
+    partitions = CollectPartitions(source);
+
+  size_t event_count = 0;
+  for (const Partition& partition : partitions)
+    event_count += partition.rows.size();
+  util::ForEachInParallel(&partitions,
+                          event_count >= kMinEventsToProcessInParallel,
+                          [&source, &window](Partition* partition) {
+                            ComputeBuckets(source, window, partition);
+                          });
+
+  std::unique_ptr<T> table(new T(storage_->mutable_string_pool(), nullptr));
+  StringId source_id = storage_->InternString(base::StringView(source_name));
+  bool has_value = source.value_column != nullptr;
+  for (const Partition& partition : partitions) {
+    for (const auto& idx_and_bucket : partition.buckets) {
+      const Bucket& bucket = idx_and_bucket.second;
+      T::Row row;
+      row.source = source_id;
+      row.bucket_dur = bucket_dur;
+      row.start_ts = window.start;
+      row.end_ts = window.end;
+      row.ts = window.start + idx_and_bucket.first * bucket_dur;
+      row.dur = std::min(bucket_dur, window.end - row.ts);
+      row.partition_id = partition.value;
+      row.count = bucket.count;
+      row.overlap_dur = bucket.overlap_dur;
+      if (has_value) {
+        row.value_sum = bucket.value_sum;
+        row.value_max = bucket.value_max;
+      }
+      table->Insert(row);
+    }
+  }
+  // We need to explicitly std::move as clang complains about a bug in old
+  // compilers otherwise (-Wreturn-std-move-in-c++11).
+  return std::move(table);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TIME_BUCKETS_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TIME_BUCKETS_GENERATOR_H_
+
+#include <map>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Dynamic table aggregating the events of a table in buckets of a fixed
+// duration, which summarizes e.g. the CPU usage or a counter for overview
+// tracks without joining the events with the window table.
+// The events of each partition are aggregated in a single pass over them in
+// ts order, with the partitions processed in parallel.
+class ExperimentalTimeBucketsGenerator
+    : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  // A table of events which can be aggregated. The events start at the ts
+  // column of the table.
+  struct Source {
+    const Table* table;
+
+    // Integer column the events are partitioned by.
+    const char* partition_column;
+
+    // int64_t duration of the events or null if each event lasts until the
+    // next one of its partition, like the values of a counter. Events with a
+    // negative duration last until the end of the trace.
+    const char* dur_column;
+
+    // Numeric column aggregated in value_sum and value_max or null.
+    const char* value_column;
+
+    // Events with a zero value in this column are ignored (e.g. the idle
+    // thread of the sched table) or null.
+    const char* skip_zero_column;
+  };
+
+  // The maximum number of buckets which can be requested.
+  static constexpr int64_t kMaxBuckets = 1 << 24;
+
+  explicit ExperimentalTimeBucketsGenerator(TraceStorage* storage);
+  ~ExperimentalTimeBucketsGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>&,
+                                      const std::vector<Order>&) override;
+
+ private:
+  TraceStorage* storage_ = nullptr;
+  std::map<std::string, Source> sources_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TIME_BUCKETS_GENERATOR_H_
@@ -0,0 +1,95 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the aggregation of events in time buckets.
+// This mimics what the UI queries to display the CPU usage overview of a one
+// hour trace: the sched slices of all the CPUs are aggregated in one bucket
+// per pixel.
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/dynamic/experimental_time_buckets_generator.h"
+
+namespace {
+
+using perfetto::trace_processor::Constraint;
+using perfetto::trace_processor::ExperimentalTimeBucketsGenerator;
+using perfetto::trace_processor::FilterOp;
+using perfetto::trace_processor::SqlValue;
+using perfetto::trace_processor::Table;
+using perfetto::trace_processor::TraceStorage;
+using perfetto::trace_processor::tables::ExperimentalTimeBucketsTable;
+using perfetto::trace_processor::tables::SchedSliceTable;
+
+constexpr uint32_t kCpus = 8;
+constexpr int64_t kTraceDur = 3600ll * 1000 * 1000 * 1000;
+constexpr int64_t kBuckets = 2000;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 8 * 1024 * 1024);
+  }
+}
+
+static void BM_TimeBucketsSched(benchmark::State& state) {
+  TraceStorage storage;
+  auto slice_count = static_cast<uint32_t>(state.range(0));
+
+  // The slices are spread evenly over the trace, each CPU being busy half of
+  // the time.
+  std::minstd_rand rnd(0);
+  int64_t step = kTraceDur / slice_count;
+  for (uint32_t i = 0; i < slice_count; ++i) {
+    SchedSliceTable::Row row;
+    row.ts = i * step;
+    row.dur = static_cast<int64_t>(rnd() % static_cast<uint64_t>(step)) *
+              kCpus / 2;
+    row.cpu = static_cast<uint32_t>(rnd() % kCpus);
+    row.utid = static_cast<uint32_t>(1 + rnd() % 100);
+    storage.mutable_sched_slice_table()->Insert(row);
+  }
+
+  using T = ExperimentalTimeBucketsTable;
+  std::vector<Constraint> cs{
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::source), FilterOp::kEq,
+                 SqlValue::String("sched")},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::bucket_dur),
+                 FilterOp::kEq, SqlValue::Long(kTraceDur / kBuckets)},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::start_ts),
+                 FilterOp::kEq, SqlValue::Long(0)},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::end_ts), FilterOp::kEq,
+                 SqlValue::Long(kTraceDur)}};
+
+  ExperimentalTimeBucketsGenerator generator(&storage);
+  for (auto _ : state) {
+    std::unique_ptr<Table> buckets = generator.ComputeTable(cs, {});
+    benchmark::DoNotOptimize(buckets->row_count());
+  }
+  state.counters["slices"] = benchmark::Counter(
+      static_cast<double>(slice_count * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_TimeBucketsSched)->Apply(BenchmarkArgs);
+
+}  // namespace
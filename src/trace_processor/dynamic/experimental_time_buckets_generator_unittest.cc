@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_time_buckets_generator.h"
+
+#include <string>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using T = tables::ExperimentalTimeBucketsTable;
+
+class ExperimentalTimeBucketsGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalTimeBucketsGeneratorTest() : generator_(&storage_) {}
+
+ protected:
+  void AddSched(int64_t ts, int64_t dur, uint32_t cpu, uint32_t utid) {
+    tables::SchedSliceTable::Row row;
+    row.ts = ts;
+    row.dur = dur;
+    row.cpu = cpu;
+    row.utid = utid;
+    storage_.mutable_sched_slice_table()->Insert(row);
+  }
+
+  void AddCounter(int64_t ts, uint32_t track_id, double value) {
+    tables::CounterTable::Row row;
+    row.ts = ts;
+    row.track_id = TrackId{track_id};
+    row.value = value;
+    storage_.mutable_counter_table()->Insert(row);
+  }
+
+  std::vector<Constraint> Constraints(const char* source, int64_t bucket_dur) {
+    return {Constraint{static_cast<uint32_t>(T::ColumnIndex::source),
+                       FilterOp::kEq, SqlValue::String(source)},
+            Constraint{static_cast<uint32_t>(T::ColumnIndex::bucket_dur),
+                       FilterOp::kEq, SqlValue::Long(bucket_dur)}};
+  }
+
+  void AddWindow(std::vector<Constraint>* cs, int64_t start, int64_t end) {
+    cs->push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::start_ts),
+                             FilterOp::kEq, SqlValue::Long(start)});
+    cs->push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::end_ts),
+                             FilterOp::kEq, SqlValue::Long(end)});
+  }
+
+  // Returns the buckets as "partition_id:ts:dur:count:overlap_dur" strings,
+  // followed by ":value_sum:value_max" if they have values.
+  std::vector<std::string> Buckets(const std::vector<Constraint>& cs) {
+    std::unique_ptr<Table> table = generator_.ComputeTable(cs, {});
+    std::vector<std::string> buckets;
+    if (!table)
+      return buckets;
+    for (uint32_t i = 0; i < table->row_count(); ++i) {
+      std::string bucket;
+      for (const char* col :
+           {"partition_id", "ts", "dur", "count", "overlap_dur"}) {
+        bucket += (bucket.empty() ? "" : ":") +
+                  std::to_string(table->GetColumnByName(col)->Get(i).AsLong());
+      }
+      for (const char* col : {"value_sum", "value_max"}) {
+        SqlValue value = table->GetColumnByName(col)->Get(i);
+        if (!value.is_null())
+          bucket += ":" + std::to_string(static_cast<int>(value.AsDouble()));
+      }
+      buckets.push_back(bucket);
+    }
+    return buckets;
+  }
+
+  TraceStorage storage_;
+  ExperimentalTimeBucketsGenerator generator_;
+};
+
+TEST_F(ExperimentalTimeBucketsGeneratorTest, Sched) {
+  AddSched(0, 15, 0 /* cpu */, 1 /* utid */);
+  AddSched(5, 5, 1 /* cpu */, 3 /* utid */);
+  // The idle thread is ignored.
+  AddSched(15, 5, 0 /* cpu */, 0 /* utid */);
+  AddSched(20, 15, 0 /* cpu */, 2 /* utid */);
+
+  // The buckets cover the whole trace by default.
+  EXPECT_THAT(Buckets(Constraints("sched", 10)),
+              ElementsAre("0:0:10:1:10", "0:10:10:1:5", "0:20:10:1:10",
+                          "0:30:5:1:5", "1:0:10:1:5"));
+
+  auto cs = Constraints("sched", 10);
+  AddWindow(&cs, 12, 32);
+  EXPECT_THAT(Buckets(cs), ElementsAre("0:12:10:2:5", "0:22:10:1:10"));
+}
+
+TEST_F(ExperimentalTimeBucketsGeneratorTest, Counter) {
+  // Each value lasts until the next one of its track and the last one until
+  // the end of the window.
+  AddCounter(0, 1 /* track_id */, 1);
+  AddCounter(2, 2 /* track_id */, 7);
+  AddCounter(5, 1 /* track_id */, 3);
+  AddCounter(25, 1 /* track_id */, 2);
+
+  auto cs = Constraints("counter", 10);
+  AddWindow(&cs, 0, 30);
+  EXPECT_THAT(Buckets(cs),
+              ElementsAre("1:0:10:2:10:4:3", "1:10:10:1:10:3:3",
+                          "1:20:10:2:10:5:3", "2:0:10:1:8:7:7",
+                          "2:10:10:1:10:7:7", "2:20:10:1:10:7:7"));
+}
+
+TEST_F(ExperimentalTimeBucketsGeneratorTest, Slice) {
+  tables::SliceTable::Row row;
+  row.track_id = TrackId{4};
+  // The events are sorted by ts if the table is not.
+  row.ts = 10;
+  row.dur = 5;
+  storage_.mutable_slice_table()->Insert(row);
+  // A slice which did not end lasts until the end of the window.
+  row.ts = 2;
+  row.dur = -1;
+  storage_.mutable_slice_table()->Insert(row);
+  // Instants are counted in the bucket they are in.
+  row.ts = 25;
+  row.dur = 0;
+  storage_.mutable_slice_table()->Insert(row);
+
+  auto cs = Constraints("slice", 10);
+  AddWindow(&cs, 0, 30);
+  EXPECT_THAT(Buckets(cs),
+              ElementsAre("4:0:10:1:8", "4:10:10:2:15", "4:20:10:2:10"));
+}
+
+TEST_F(ExperimentalTimeBucketsGeneratorTest, InvalidConstraints) {
+  AddSched(0, 15, 0 /* cpu */, 1 /* utid */);
+  EXPECT_EQ(generator_.ComputeTable(Constraints("unknown", 10), {}), nullptr);
+  EXPECT_EQ(generator_.ComputeTable(Constraints("sched", 0), {}), nullptr);
+
+  auto cs = Constraints("sched", 1);
+  AddWindow(&cs, 0, ExperimentalTimeBucketsGenerator::kMaxBuckets * 2);
+  EXPECT_EQ(generator_.ComputeTable(cs, {}), nullptr);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using T = tables::ExperimentalTrackSummaryTable;
+
+// The summary of a range of events.
+struct Summary {
+  uint32_t count = 0;
+  double min = std::numeric_limits<double>::max();
+  double max = std::numeric_limits<double>::lowest();
+  double sum = 0;
+  double last = 0;
+};
+
+}  // namespace
+
+// The events of a track sorted by ts, with the min, max and sum of their
+// values in aligned blocks of 2, 4, 8... events so the values of any range of
+// events are summarized from O(log(events)) blocks.
+class ExperimentalTrackSummaryGenerator::TrackSummary {
+ public:
+  TrackSummary(std::vector<int64_t> ts, std::vector<double> values)
+      : ts_(std::move(ts)), values_(std::move(values)) {
+    PERFETTO_DCHECK(ts_.size() == values_.size());
+    for (size_t size = values_.size() / 2; size > 0; size /= 2) {
+      std::vector<Block> level;
+      level.reserve(size);
+      for (size_t i = 0; i < size; ++i) {
+        Block a =
+            blocks_.empty() ? Block(values_[2 * i]) : blocks_.back()[2 * i];
+        Block b = blocks_.empty() ? Block(values_[2 * i + 1])
+                                  : blocks_.back()[2 * i + 1];
+        level.push_back(Block(std::min(a.min, b.min), std::max(a.max, b.max),
+                              a.sum + b.sum));
+      }
+      blocks_.push_back(std::move(level));
+    }
+  }
+
+  bool empty() const { return ts_.empty(); }
+  int64_t first_ts() const { return ts_.front(); }
+  int64_t last_ts() const { return ts_.back(); }
+
+  size_t EstimateSizeBytes() const {
+    size_t size = ts_.capacity() * sizeof(int64_t) +
+                  values_.capacity() * sizeof(double);
+    for (const std::vector<Block>& level : blocks_)
+      size += level.capacity() * sizeof(Block);
+    return size;
+  }
+
+  // Calls |fn| with the index and the summary of each non empty bucket of
+  // |bucket_dur| in [start, end), in ts order.
+  template <typename Fn>
+  void ForEachBucket(int64_t start,
+                     int64_t end,
+                     int64_t bucket_dur,
+                     const Fn& fn) const {
+    int64_t bucket_count = (end - start) / bucket_dur;
+    auto it = std::lower_bound(ts_.begin(), ts_.end(), start);
+    while (it != ts_.end() && *it < end) {
+      int64_t idx = (*it - start) / bucket_dur;
+      int64_t bucket_end =
+          idx < bucket_count ? start + (idx + 1) * bucket_dur : end;
+      // Empty buckets are skipped by looking for the end of the bucket of the
+      // next event.
+      auto bucket_end_it = std::lower_bound(it, ts_.end(), bucket_end);
+      fn(idx, Summarize(static_cast<size_t>(it - ts_.begin()),
+                        static_cast<size_t>(bucket_end_it - ts_.begin())));
+      it = bucket_end_it;
+    }
+  }
+
+ private:
+  struct Block {
+    explicit Block(double value) : min(value), max(value), sum(value) {}
+    Block(double _min, double _max, double _sum)
+        : min(_min), max(_max), sum(_sum) {}
+
+    double min;
+    double max;
+    double sum;
+  };
+
+  // Returns the summary of the events [begin, end).
+  Summary Summarize(size_t begin, size_t end) const {
+    Summary summary;
+    if (begin == end)
+      return summary;
+    summary.count = static_cast<uint32_t>(end - begin);
+    summary.last = values_[end - 1];
+    for (size_t i = begin; i < end;) {
+      // Use the largest block starting at i which is in the range.
+      size_t level = 0;
+      while (level < blocks_.size() &&
+             (i & ((size_t(2) << level) - 1)) == 0 &&
+             i + (size_t(2) << level) <= end) {
+        ++level;
+      }
+      Block block =
+          level == 0 ? Block(values_[i]) : blocks_[level - 1][i >> level];
+      summary.min = std::min(summary.min, block.min);
+      summary.max = std::max(summary.max, block.max);
+      summary.sum += block.sum;
+      i += size_t(1) << level;
+    }
+    return summary;
+  }
+
+  std::vector<int64_t> ts_;
+  std::vector<double> values_;
+
+  // blocks_[k][i] summarizes the events [i * 2^(k+1), (i + 1) * 2^(k+1)).
+  std::vector<std::vector<Block>> blocks_;
+};
+
+ExperimentalTrackSummaryGenerator::ExperimentalTrackSummaryGenerator(
+    TraceStorage* storage)
+    : storage_(storage), summary_cache_(kMaxCacheSizeBytes) {
+  counter_source_.table = &storage->counter_table();
+  slice_source_.table = &storage->slice_table();
+}
+
+ExperimentalTrackSummaryGenerator::~ExperimentalTrackSummaryGenerator() =
+    default;
+
+Table::Schema ExperimentalTrackSummaryGenerator::CreateSchema() {
+  return T::Schema();
+}
+
+std::string ExperimentalTrackSummaryGenerator::TableName() {
+  return "experimental_track_summary";
+}
+
+uint32_t ExperimentalTrackSummaryGenerator::EstimateRowCount() {
+  // There is usually about one bucket per pixel.
+  return 1000;
+}
+
+util::Status ExperimentalTrackSummaryGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  const auto& cs = qc.constraints();
+  auto has_eq_cs = [&cs](T::ColumnIndex col) {
+    return std::any_of(cs.begin(), cs.end(),
+                       [col](const QueryConstraints::Constraint& c) {
+                         return c.column == static_cast<int>(col) &&
+                                sqlite_utils::IsOpEq(c.op);
+                       });
+  };
+  return has_eq_cs(T::ColumnIndex::source) &&
+                 has_eq_cs(T::ColumnIndex::track_id) &&
+                 has_eq_cs(T::ColumnIndex::bucket_dur)
+             ? util::OkStatus()
+             : util::ErrStatus(
+                   "experimental_track_summary must have source, track_id and "
+                   "bucket_dur constraints");
+}
+
+const ExperimentalTrackSummaryGenerator::TrackSummary&
+ExperimentalTrackSummaryGenerator::GetOrCreateSummary(SourceType type,
+                                                      uint32_t track_id) {
+  Source& source =
+      type == SourceType::kCounter ? counter_source_ : slice_source_;
+  if (source.table->row_count() != source.row_count ||
+      source.table->evicted_row_count() != source.evicted_row_count) {
+    source.row_count = source.table->row_count();
+    source.evicted_row_count = source.table->evicted_row_count();
+    summary_cache_.EraseIf(
+        [type](const SummaryKey& key) { return key.first == type; });
+  }
+
+  SummaryKey key(type, track_id);
+  std::unique_ptr<TrackSummary>* cached = summary_cache_.Find(key);
+  if (cached)
+    return **cached;
+
+  std::unique_ptr<TrackSummary> summary = CreateSummary(type, track_id);
+  size_t size_bytes = summary->EstimateSizeBytes();
+  return *summary_cache_.Insert(key, std::move(summary), size_bytes);
+}
+
+std::unique_ptr<ExperimentalTrackSummaryGenerator::TrackSummary>
+ExperimentalTrackSummaryGenerator::CreateSummary(SourceType type,
+                                                 uint32_t track_id) {
+  // The rows of the track are found by scanning the track_id column: an index
+  // of the whole table would not be bounded by the size of the cache.
+  std::vector<int64_t> ts;
+  std::vector<double> values;
+  if (type == SourceType::kCounter) {
+    const auto& table = storage_->counter_table();
+    RowMap rm = table.FilterToRowMap({table.track_id().eq(track_id)});
+    ts.reserve(rm.size());
+    values.reserve(rm.size());
+    for (auto it = rm.IterateRows(); it; it.Next()) {
+      ts.push_back(table.ts()[it.row()]);
+      values.push_back(table.value()[it.row()]);
+    }
+  } else {
+    const auto& table = storage_->slice_table();
+    RowMap rm = table.FilterToRowMap({table.track_id().eq(track_id)});
+    ts.reserve(rm.size());
+    values.reserve(rm.size());
+    for (auto it = rm.IterateRows(); it; it.Next()) {
+      // The slices which did not end have no meaningful duration.
+      int64_t dur = table.dur()[it.row()];
+      if (dur < 0)
+        continue;
+      ts.push_back(table.ts()[it.row()]);
+      values.push_back(static_cast<double>(dur));
+    }
+  }
+
+  // The tables are sorted by ts so this is only a safety net.
+  if (!std::is_sorted(ts.begin(), ts.end())) {
+    std::vector<size_t> order(ts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&ts](size_t a, size_t b) { return ts[a] < ts[b]; });
+    std::vector<int64_t> sorted_ts;
+    std::vector<double> sorted_values;
+    sorted_ts.reserve(order.size());
+    sorted_values.reserve(order.size());
+    for (size_t i : order) {
+      sorted_ts.push_back(ts[i]);
+      sorted_values.push_back(values[i]);
+    }
+    ts = std::move(sorted_ts);
+    values = std::move(sorted_values);
+  }
+
+  return std::unique_ptr<TrackSummary>(
+      new TrackSummary(std::move(ts), std::move(values)));
+}
+
+std::unique_ptr<Table> ExperimentalTrackSummaryGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&) {
+  std::string source_name;
+  base::Optional<int64_t> track_id;
+  int64_t bucket_dur = 0;
+  base::Optional<int64_t> start_ts;
+  base::Optional<int64_t> end_ts;
+  for (const Constraint& c : cs) {
+    if (c.op != FilterOp::kEq)
+      continue;
+    if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::source) &&
+        c.value.type == SqlValue::kString) {
+      source_name = c.value.AsString();
+    } else if (c.value.type != SqlValue::kLong) {
+      continue;
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::track_id)) {
+      track_id = c.value.AsLong();
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::bucket_dur)) {
+      bucket_dur = c.value.AsLong();
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::start_ts)) {
+      start_ts = c.value.AsLong();
+    } else if (c.col_idx == static_cast<uint32_t>(T::ColumnIndex::end_ts)) {
+      end_ts = c.value.AsLong();
+    }
+  }
+
+  SourceType type;
+  if (source_name == "counter") {
+    type = SourceType::kCounter;
+  } else if (source_name == "slice") {
+    type = SourceType::kSlice;
+  } else {
+    PERFETTO_ELOG("experimental_track_summary: unknown source '%s'",
+                  source_name.c_str());
+    return nullptr;
+  }
+  if (!track_id || *track_id < 0 ||
+      *track_id > std::numeric_limits<uint32_t>::max()) {
+    PERFETTO_ELOG("experimental_track_summary: invalid track_id");
+    return nullptr;
+  }
+  if (bucket_dur <= 0) {
+    PERFETTO_ELOG("experimental_track_summary: bucket_dur must be positive");
+    return nullptr;
+  }
+
+  auto track = static_cast<uint32_t>(*track_id);
+  const TrackSummary& summary = GetOrCreateSummary(type, track);
+  std::unique_ptr<T> table(new T(storage_->mutable_string_pool(), nullptr));
+  if (summary.empty())
+    return std::move(table);
+
+  int64_t start = start_ts.value_or(summary.first_ts());
+  int64_t end = end_ts.value_or(summary.last_ts() + 1);
+  if (end > start && (end - start) / bucket_dur >= kMaxBuckets) {
+    PERFETTO_ELOG("experimental_track_summary: too many buckets, increase "
+                  "bucket_dur");
+    return nullptr;
+  }
+
+  StringId source_id = storage_->InternString(base::StringView(source_name));
+  summary.ForEachBucket(
+      start, end, bucket_dur, [&](int64_t idx, const Summary& bucket) {
+        T::Row row;
+        row.source = source_id;
+        row.track_id = track;
+        row.bucket_dur = bucket_dur;
+        row.start_ts = start;
+        row.end_ts = end;
+        row.ts = start + idx * bucket_dur;
+        row.dur = std::min(bucket_dur, end - row.ts);
+        row.count = bucket.count;
+        row.min_value = bucket.min;
+        row.max_value = bucket.max;
+        row.avg_value = bucket.sum / bucket.count;
+        row.last_value = bucket.last;
+        table->Insert(row);
+      });
+  // We need to explicitly std::move as clang complains about a bug in old
+  // compilers otherwise (-Wreturn-std-move-in-c++11).
+  return std::move(table);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
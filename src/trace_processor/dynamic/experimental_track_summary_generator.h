@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/trace_processor/dynamic/size_bounded_lru_cache.h"
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Dynamic table summarizing the values of the events of a counter or slice
+// track in buckets of a fixed duration, for the UI to display a track zoomed
+// out over a long trace without reading all its events.
+// The first query of a track builds a summary of its events in blocks of a
+// power of two events, akin to a segment tree, which is cached until the
+// events of the source table change. Each bucket is then summarized from the
+// O(log(events)) blocks it covers. The slices which did not end are left
+// out of the summaries.
+class ExperimentalTrackSummaryGenerator
+    : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  // The maximum number of buckets which can be requested.
+  static constexpr int64_t kMaxBuckets = 1 << 24;
+
+  // The summaries are cached until their estimated size exceeds this, at
+  // which point the least recently used ones are evicted.
+  static constexpr size_t kMaxCacheSizeBytes = 64 * 1024 * 1024;
+
+  explicit ExperimentalTrackSummaryGenerator(TraceStorage* storage);
+  ~ExperimentalTrackSummaryGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>&,
+                                      const std::vector<Order>&) override;
+
+  size_t cache_size_bytes() const { return summary_cache_.size_bytes(); }
+
+ private:
+  class TrackSummary;
+
+  enum class SourceType { kCounter, kSlice };
+
+  // A table whose tracks are summarized. Its summaries are stale once rows
+  // have been added or evicted.
+  struct Source {
+    const Table* table = nullptr;
+    uint32_t row_count = 0;
+    uint32_t evicted_row_count = 0;
+  };
+
+  using SummaryKey = std::pair<SourceType, uint32_t /* track_id */>;
+
+  // Returns the summary of |track_id|, building it if needed. The summary
+  // stays valid until the next call.
+  const TrackSummary& GetOrCreateSummary(SourceType, uint32_t track_id);
+
+  std::unique_ptr<TrackSummary> CreateSummary(SourceType, uint32_t track_id);
+
+  TraceStorage* storage_ = nullptr;
+  Source counter_source_;
+  Source slice_source_;
+
+  SizeBoundedLruCache<SummaryKey, std::unique_ptr<TrackSummary>>
+      summary_cache_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
@@ -0,0 +1,96 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the summary of a counter track.
+// This mimics what the UI queries to display a counter track of a one hour
+// trace zoomed out: one bucket per pixel of the whole trace, once the summary
+// of the track has been built by a first query.
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+
+namespace {
+
+using perfetto::trace_processor::Constraint;
+using perfetto::trace_processor::ExperimentalTrackSummaryGenerator;
+using perfetto::trace_processor::FilterOp;
+using perfetto::trace_processor::SqlValue;
+using perfetto::trace_processor::Table;
+using perfetto::trace_processor::TraceStorage;
+using perfetto::trace_processor::TrackId;
+using perfetto::trace_processor::tables::CounterTable;
+using perfetto::trace_processor::tables::ExperimentalTrackSummaryTable;
+
+constexpr int64_t kTraceDur = 3600ll * 1000 * 1000 * 1000;
+constexpr int64_t kBuckets = 2000;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 8 * 1024 * 1024);
+  }
+}
+
+static void BM_TrackSummaryCounter(benchmark::State& state) {
+  TraceStorage storage;
+  auto counter_count = static_cast<uint32_t>(state.range(0));
+
+  std::minstd_rand rnd(0);
+  int64_t step = kTraceDur / counter_count;
+  for (uint32_t i = 0; i < counter_count; ++i) {
+    CounterTable::Row row;
+    row.ts = i * step;
+    row.track_id = TrackId{0};
+    row.value = static_cast<double>(rnd() % 1000);
+    storage.mutable_counter_table()->Insert(row);
+  }
+
+  using T = ExperimentalTrackSummaryTable;
+  std::vector<Constraint> cs{
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::source), FilterOp::kEq,
+                 SqlValue::String("counter")},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::track_id),
+                 FilterOp::kEq, SqlValue::Long(0)},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::bucket_dur),
+                 FilterOp::kEq, SqlValue::Long(kTraceDur / kBuckets)},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::start_ts),
+                 FilterOp::kEq, SqlValue::Long(0)},
+      Constraint{static_cast<uint32_t>(T::ColumnIndex::end_ts), FilterOp::kEq,
+                 SqlValue::Long(kTraceDur)}};
+
+  // The first query builds the summary of the track.
+  ExperimentalTrackSummaryGenerator generator(&storage);
+  benchmark::DoNotOptimize(generator.ComputeTable(cs, {}));
+
+  for (auto _ : state) {
+    std::unique_ptr<Table> buckets = generator.ComputeTable(cs, {});
+    benchmark::DoNotOptimize(buckets->row_count());
+  }
+  state.counters["buckets"] =
+      benchmark::Counter(static_cast<double>(kBuckets * state.iterations()),
+                         benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_TrackSummaryCounter)->Apply(BenchmarkArgs);
+
+}  // namespace
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+
+#include <algorithm>
+#include <ostream>
+#include <random>
+#include <tuple>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using T = tables::ExperimentalTrackSummaryTable;
+
+struct Bucket {
+  int64_t ts;
+  int64_t dur;
+  int64_t count;
+  double min;
+  double max;
+  double avg;
+  double last;
+
+  bool operator==(const Bucket& other) const {
+    return std::tie(ts, dur, count, min, max, avg, last) ==
+           std::tie(other.ts, other.dur, other.count, other.min, other.max,
+                    other.avg, other.last);
+  }
+};
+
+void PrintTo(const Bucket& b, std::ostream* os) {
+  *os << "{ts: " << b.ts << ", dur: " << b.dur << ", count: " << b.count
+      << ", min: " << b.min << ", max: " << b.max << ", avg: " << b.avg
+      << ", last: " << b.last << "}";
+}
+
+class ExperimentalTrackSummaryGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalTrackSummaryGeneratorTest() : generator_(&storage_) {}
+
+ protected:
+  void AddCounter(int64_t ts, uint32_t track_id, double value) {
+    tables::CounterTable::Row row;
+    row.ts = ts;
+    row.track_id = TrackId{track_id};
+    row.value = value;
+    storage_.mutable_counter_table()->Insert(row);
+  }
+
+  std::vector<Constraint> Constraints(const char* source,
+                                      uint32_t track_id,
+                                      int64_t bucket_dur) {
+    return {Constraint{static_cast<uint32_t>(T::ColumnIndex::source),
+                       FilterOp::kEq, SqlValue::String(source)},
+            Constraint{static_cast<uint32_t>(T::ColumnIndex::track_id),
+                       FilterOp::kEq, SqlValue::Long(track_id)},
+            Constraint{static_cast<uint32_t>(T::ColumnIndex::bucket_dur),
+                       FilterOp::kEq, SqlValue::Long(bucket_dur)}};
+  }
+
+  void AddWindow(std::vector<Constraint>* cs, int64_t start, int64_t end) {
+    cs->push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::start_ts),
+                             FilterOp::kEq, SqlValue::Long(start)});
+    cs->push_back(Constraint{static_cast<uint32_t>(T::ColumnIndex::end_ts),
+                             FilterOp::kEq, SqlValue::Long(end)});
+  }
+
+  std::vector<Bucket> Buckets(const std::vector<Constraint>& cs) {
+    std::unique_ptr<Table> table = generator_.ComputeTable(cs, {});
+    std::vector<Bucket> buckets;
+    if (!table)
+      return buckets;
+    auto get = [&table](const char* col, uint32_t row) {
+      return table->GetColumnByName(col)->Get(row);
+    };
+    for (uint32_t i = 0; i < table->row_count(); ++i) {
+      buckets.push_back(Bucket{
+          get("ts", i).AsLong(), get("dur", i).AsLong(),
+          get("count", i).AsLong(), get("min_value", i).AsDouble(),
+          get("max_value", i).AsDouble(), get("avg_value", i).AsDouble(),
+          get("last_value", i).AsDouble()});
+    }
+    return buckets;
+  }
+
+  TraceStorage storage_;
+  ExperimentalTrackSummaryGenerator generator_;
+};
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, Counter) {
+  AddCounter(0, 1 /* track_id */, 1);
+  AddCounter(2, 2 /* track_id */, 7);
+  AddCounter(5, 1 /* track_id */, 5);
+  AddCounter(9, 1 /* track_id */, 3);
+  AddCounter(25, 1 /* track_id */, 2);
+
+  // The buckets cover the events of the track by default and the empty ones
+  // are not returned.
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 10, 3, 1, 5, 3, 3},
+                          Bucket{20, 6, 1, 2, 2, 2, 2}));
+
+  auto cs = Constraints("counter", 1, 4);
+  AddWindow(&cs, 3, 23);
+  EXPECT_THAT(Buckets(cs), ElementsAre(Bucket{3, 4, 1, 5, 5, 5, 5},
+                                       Bucket{7, 4, 1, 3, 3, 3, 3}));
+
+  EXPECT_THAT(Buckets(Constraints("counter", 2, 10)),
+              ElementsAre(Bucket{2, 1, 1, 7, 7, 7, 7}));
+  EXPECT_THAT(Buckets(Constraints("counter", 3, 10)), ElementsAre());
+}
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, CounterMatchesEvents) {
+  // Compare the summaries of many events with the values of the events, for
+  // buckets aligned or not with the blocks of the summary.
+  std::minstd_rand rnd(0);
+  std::vector<std::pair<int64_t, int64_t>> events;
+  int64_t ts = 0;
+  for (uint32_t i = 0; i < 5000; ++i) {
+    ts += static_cast<int64_t>(rnd() % 100);
+    auto value = static_cast<int64_t>(rnd() % 1000);
+    AddCounter(ts, 0 /* track_id */, static_cast<double>(value));
+    events.emplace_back(ts, value);
+  }
+
+  for (int64_t bucket_dur : {1, 7, 64, 1000, 4096, 100000, 1000000}) {
+    for (int64_t start : {int64_t(0), int64_t(3), ts / 3}) {
+      auto cs = Constraints("counter", 0, bucket_dur);
+      AddWindow(&cs, start, ts);
+      std::vector<Bucket> expected;
+      int64_t bucket_start = 0;
+      int64_t count = 0;
+      int64_t min = 0;
+      int64_t max = 0;
+      int64_t sum = 0;
+      int64_t last = 0;
+      auto add_bucket = [&] {
+        if (count == 0)
+          return;
+        // The values are small integers so their sums are exact.
+        expected.push_back(Bucket{
+            bucket_start, std::min(bucket_dur, ts - bucket_start), count,
+            static_cast<double>(min), static_cast<double>(max),
+            static_cast<double>(sum) / static_cast<double>(count),
+            static_cast<double>(last)});
+      };
+      for (const auto& event : events) {
+        if (event.first < start || event.first >= ts)
+          continue;
+        int64_t event_bucket =
+            start + (event.first - start) / bucket_dur * bucket_dur;
+        if (count == 0 || event_bucket != bucket_start) {
+          add_bucket();
+          bucket_start = event_bucket;
+          count = 0;
+          min = max = event.second;
+          sum = 0;
+        }
+        count++;
+        min = std::min(min, event.second);
+        max = std::max(max, event.second);
+        sum += event.second;
+        last = event.second;
+      }
+      add_bucket();
+      EXPECT_EQ(Buckets(cs), expected)
+          << "bucket_dur " << bucket_dur << " start " << start;
+    }
+  }
+}
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, Slice) {
+  tables::SliceTable::Row row;
+  row.track_id = TrackId{4};
+  row.ts = 2;
+  row.dur = -1;
+  storage_.mutable_slice_table()->Insert(row);
+  row.ts = 3;
+  row.dur = 4;
+  storage_.mutable_slice_table()->Insert(row);
+  row.ts = 10;
+  row.dur = 5;
+  storage_.mutable_slice_table()->Insert(row);
+  row.ts = 15;
+  row.dur = 3;
+  storage_.mutable_slice_table()->Insert(row);
+  row.track_id = TrackId{5};
+  row.ts = 11;
+  row.dur = 100;
+  storage_.mutable_slice_table()->Insert(row);
+
+  // The value of the slices is their duration. The slice which did not end is
+  // left out.
+  EXPECT_THAT(Buckets(Constraints("slice", 4, 10)),
+              ElementsAre(Bucket{3, 10, 2, 4, 5, 4.5, 5},
+                          Bucket{13, 3, 1, 3, 3, 3, 3}));
+}
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, Invalidation) {
+  AddCounter(0, 1 /* track_id */, 1);
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 1, 1, 1, 1, 1, 1}));
+
+  // The summary is rebuilt when the counters change.
+  AddCounter(5, 1 /* track_id */, 3);
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 6, 2, 1, 3, 2, 3}));
+}
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, Cache) {
+  AddCounter(0, 1 /* track_id */, 1);
+  AddCounter(1, 2 /* track_id */, 2);
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 1, 1, 1, 1, 1, 1}));
+  size_t cache_size_bytes = generator_.cache_size_bytes();
+  EXPECT_GT(cache_size_bytes, 0u);
+
+  // The second query is served from the cache.
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 1, 1, 1, 1, 1, 1}));
+  EXPECT_EQ(generator_.cache_size_bytes(), cache_size_bytes);
+
+  EXPECT_THAT(Buckets(Constraints("counter", 2, 10)),
+              ElementsAre(Bucket{1, 1, 1, 2, 2, 2, 2}));
+  EXPECT_GT(generator_.cache_size_bytes(), cache_size_bytes);
+
+  // Only the summaries of the source which changed are dropped.
+  tables::SliceTable::Row row;
+  row.track_id = TrackId{1};
+  row.dur = 5;
+  storage_.mutable_slice_table()->Insert(row);
+  EXPECT_THAT(Buckets(Constraints("slice", 1, 10)),
+              ElementsAre(Bucket{0, 1, 1, 5, 5, 5, 5}));
+  AddCounter(2, 1 /* track_id */, 3);
+  EXPECT_THAT(Buckets(Constraints("counter", 1, 10)),
+              ElementsAre(Bucket{0, 3, 2, 1, 3, 2, 3}));
+  cache_size_bytes = generator_.cache_size_bytes();
+  EXPECT_THAT(Buckets(Constraints("slice", 1, 10)),
+              ElementsAre(Bucket{0, 1, 1, 5, 5, 5, 5}));
+  EXPECT_EQ(generator_.cache_size_bytes(), cache_size_bytes);
+}
+
+TEST_F(ExperimentalTrackSummaryGeneratorTest, InvalidConstraints) {
+  AddCounter(0, 1 /* track_id */, 1);
+  EXPECT_EQ(generator_.ComputeTable(Constraints("unknown", 1, 10), {}),
+            nullptr);
+  EXPECT_EQ(generator_.ComputeTable(Constraints("counter", 1, 0), {}),
+            nullptr);
+
+  auto cs = Constraints("counter", 1, 1);
+  AddWindow(&cs, 0, ExperimentalTrackSummaryGenerator::kMaxBuckets * 2);
+  EXPECT_EQ(generator_.ComputeTable(cs, {}), nullptr);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
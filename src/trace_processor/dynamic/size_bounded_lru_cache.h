@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_SIZE_BOUNDED_LRU_CACHE_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_SIZE_BOUNDED_LRU_CACHE_H_
+
+#include <stddef.h>
+
+#include <list>
+#include <utility>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Cache of the values computed by the dynamic table generators, bounded by
+// the sum of their estimated sizes. Once the limit is exceeded, the least
+// recently used values are evicted.
+// Lookups are linear in the number of values: the generators only cache the
+// few values queried by the UI at a time.
+template <typename Key, typename Value>
+class SizeBoundedLruCache {
+ public:
+  explicit SizeBoundedLruCache(size_t max_size_bytes)
+      : max_size_bytes_(max_size_bytes) {}
+
+  // Returns the value of |key|, which becomes the most recently used one, or
+  // nullptr if it is not cached.
+  Value* Find(const Key& key) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (!(it->key == key))
+        continue;
+      entries_.splice(entries_.begin(), entries_, it);
+      return &entries_.front().value;
+    }
+    return nullptr;
+  }
+
+  // Caches |value| for |key|, which must not be cached already, and evicts
+  // the least recently used values until the cache fits in its limit again.
+  // |value| itself is always kept, even when it is larger than the limit.
+  Value& Insert(Key key, Value value, size_t size_bytes) {
+    entries_.push_front(Entry{std::move(key), std::move(value), size_bytes});
+    size_bytes_ += size_bytes;
+    while (size_bytes_ > max_size_bytes_ && entries_.size() > 1) {
+      size_bytes_ -= entries_.back().size_bytes;
+      entries_.pop_back();
+    }
+    return entries_.front().value;
+  }
+
+  // Evicts the values whose key matches |fn|.
+  template <typename Fn>
+  void EraseIf(const Fn& fn) {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (fn(it->key)) {
+        size_bytes_ -= it->size_bytes;
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void Clear() {
+    entries_.clear();
+    size_bytes_ = 0;
+  }
+
+  size_t size_bytes() const { return size_bytes_; }
+
+ private:
+  struct Entry {
+    Key key;
+    Value value;
+    size_t size_bytes;
+  };
+
+  const size_t max_size_bytes_;
+
+  // Most recently used first.
+  std::list<Entry> entries_;
+  size_t size_bytes_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_SIZE_BOUNDED_LRU_CACHE_H_
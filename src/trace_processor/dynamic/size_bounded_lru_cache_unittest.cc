@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/size_bounded_lru_cache.h"
+
+#include <string>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Cache = SizeBoundedLruCache<int, std::string>;
+
+TEST(SizeBoundedLruCacheTest, FindAndInsert) {
+  Cache cache(100);
+  EXPECT_EQ(cache.Find(1), nullptr);
+
+  EXPECT_EQ(cache.Insert(1, "a", 10), "a");
+  cache.Insert(2, "b", 20);
+  EXPECT_EQ(cache.size_bytes(), 30u);
+  ASSERT_NE(cache.Find(1), nullptr);
+  EXPECT_EQ(*cache.Find(1), "a");
+  ASSERT_NE(cache.Find(2), nullptr);
+  EXPECT_EQ(*cache.Find(2), "b");
+}
+
+TEST(SizeBoundedLruCacheTest, EvictLeastRecentlyUsed) {
+  Cache cache(100);
+  cache.Insert(1, "a", 40);
+  cache.Insert(2, "b", 40);
+
+  // Finding 1 makes 2 the least recently used value.
+  ASSERT_NE(cache.Find(1), nullptr);
+  cache.Insert(3, "c", 40);
+  EXPECT_EQ(cache.size_bytes(), 80u);
+  EXPECT_NE(cache.Find(1), nullptr);
+  EXPECT_EQ(cache.Find(2), nullptr);
+  EXPECT_NE(cache.Find(3), nullptr);
+
+  // A value larger than the limit evicts all the others but is kept.
+  cache.Insert(4, "d", 200);
+  EXPECT_EQ(cache.size_bytes(), 200u);
+  EXPECT_EQ(cache.Find(1), nullptr);
+  EXPECT_EQ(cache.Find(3), nullptr);
+  EXPECT_NE(cache.Find(4), nullptr);
+}
+
+TEST(SizeBoundedLruCacheTest, EraseIfAndClear) {
+  Cache cache(100);
+  cache.Insert(1, "a", 10);
+  cache.Insert(2, "b", 20);
+  cache.Insert(3, "c", 30);
+
+  cache.EraseIf([](int key) { return key % 2 == 1; });
+  EXPECT_EQ(cache.size_bytes(), 20u);
+  EXPECT_EQ(cache.Find(1), nullptr);
+  EXPECT_NE(cache.Find(2), nullptr);
+  EXPECT_EQ(cache.Find(3), nullptr);
+
+  cache.Clear();
+  EXPECT_EQ(cache.size_bytes(), 0u);
+  EXPECT_EQ(cache.Find(2), nullptr);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
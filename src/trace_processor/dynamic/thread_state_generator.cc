@@ -39,7 +39,13 @@ util::Status ThreadStateGenerator::ValidateConstraints(
 std::unique_ptr<Table> ThreadStateGenerator::ComputeTable(
     const std::vector<Constraint>&,
     const std::vector<Order>&) {
-  if (!unsorted_thread_state_table_) {
+  const auto& sched = context_->storage->sched_slice_table();
+  const auto& instants = context_->storage->instant_table();
+  std::array<uint32_t, 4> row_counts{
+      {sched.row_count(), sched.evicted_row_count(), instants.row_count(),
+       instants.evicted_row_count()}};
+  if (!unsorted_thread_state_table_ || row_counts != computed_row_counts_) {
+    computed_row_counts_ = row_counts;
     int64_t trace_end_ts =
         context_->storage->GetTraceTimestampBoundsNs().second;
 
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_THREAD_STATE_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_THREAD_STATE_GENERATOR_H_
 
+#include <array>
+
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -79,6 +81,11 @@ class ThreadStateGenerator : public DbSqliteTable::DynamicTableGenerator {
   std::unique_ptr<tables::ThreadStateTable> unsorted_thread_state_table_;
   base::Optional<Table> sorted_thread_state_table_;
 
+  // The row counts (both total and evicted) of the sched and instant tables
+  // when the thread state table was last computed. Used to recompute the
+  // table when new data is parsed in streaming mode.
+  std::array<uint32_t, 4> computed_row_counts_{};
+
   const StringId running_string_id_;
   const StringId runnable_string_id_;
 
@@ -1217,8 +1217,9 @@ class JsonExporter {
     base::Optional<StringId> raw_chrome_metadata_event_id =
         storage_->string_pool().GetId("chrome_event.metadata");
 
+    // Raw events evicted in streaming mode are skipped.
     const auto& events = storage_->raw_table();
-    for (uint32_t i = 0; i < events.row_count(); ++i) {
+    for (uint32_t i = events.evicted_row_count(); i < events.row_count(); ++i) {
       if (raw_legacy_event_key_id &&
           events.name()[i] == *raw_legacy_event_key_id) {
         Json::Value event = ConvertLegacyRawEventToJson(i);
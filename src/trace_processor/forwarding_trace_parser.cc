@@ -134,6 +134,11 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
         // The UI's error_dialog.ts uses it to make the dialog more graceful.
         return util::ErrStatus("Unknown trace type provided (ERR:fmt)");
     }
+
+    if (context_->sorter && context_->storage->ingest_profile().enabled()) {
+      context_->sorter->set_ingest_profile(
+          context_->storage->mutable_ingest_profile());
+    }
   }
 
   return reader_->Parse(std::move(data), size);
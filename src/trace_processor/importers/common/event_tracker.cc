@@ -88,8 +88,7 @@ InstantId EventTracker::PushInstant(int64_t timestamp,
   auto* instants = context_->storage->mutable_instant_table();
   InstantId id;
   if (resolve_utid_to_upid) {
-    auto ref_type_id = context_->storage->InternString(
-        GetRefTypeStringMap()[static_cast<size_t>(RefType::kRefUpid)]);
+    auto ref_type_id = GetRefTypeId(RefType::kRefUpid);
     auto id_and_row = instants->Insert({timestamp, name_id, 0, ref_type_id});
     id = id_and_row.id;
     PendingUpidResolutionInstant pending;
@@ -97,13 +96,21 @@ InstantId EventTracker::PushInstant(int64_t timestamp,
     pending.utid = static_cast<UniqueTid>(ref);
     pending_upid_resolution_instant_.emplace_back(pending);
   } else {
-    auto ref_type_id = context_->storage->InternString(
-        GetRefTypeStringMap()[static_cast<size_t>(ref_type)]);
+    auto ref_type_id = GetRefTypeId(ref_type);
     id = instants->Insert({timestamp, name_id, ref, ref_type_id}).id;
   }
   return id;
 }
 
+StringId EventTracker::GetRefTypeId(RefType ref_type) {
+  StringId* id = &ref_type_ids_[static_cast<size_t>(ref_type)];
+  if (PERFETTO_UNLIKELY(id->is_null())) {
+    *id = context_->storage->InternString(
+        GetRefTypeStringMap()[static_cast<size_t>(ref_type)]);
+  }
+  return *id;
+}
+
 void EventTracker::FlushPendingEvents() {
   const auto& thread_table = context_->storage->thread_table();
   for (const auto& pending_counter : pending_upid_resolution_counter_) {
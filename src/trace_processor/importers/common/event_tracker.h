@@ -20,6 +20,7 @@
 #include <array>
 #include <limits>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
@@ -76,6 +77,20 @@ class EventTracker {
   // storage.
   void FlushPendingEvents();
 
+  // Returns the first row of the counter (resp. instant) table which is still
+  // pending upid resolution, if any. Rows from there on will be updated by
+  // |FlushPendingEvents()| so must not be evicted.
+  base::Optional<uint32_t> FirstPendingCounterRow() const {
+    if (pending_upid_resolution_counter_.empty())
+      return base::nullopt;
+    return pending_upid_resolution_counter_.front().row;
+  }
+  base::Optional<uint32_t> FirstPendingInstantRow() const {
+    if (pending_upid_resolution_instant_.empty())
+      return base::nullopt;
+    return pending_upid_resolution_instant_.front().row;
+  }
+
   // For SchedEventTracker.
   int64_t max_timestamp() const { return max_timestamp_; }
   void UpdateMaxTimestamp(int64_t ts) {
@@ -102,10 +117,17 @@ class EventTracker {
   // Store the rows in the instants table which need upids resolved.
   std::vector<PendingUpidResolutionInstant> pending_upid_resolution_instant_;
 
+  // Returns the interned string for |ref_type|, interning it on first use.
+  StringId GetRefTypeId(RefType ref_type);
+
   // Timestamp of the previous event. Used to discard events arriving out
   // of order.
   int64_t max_timestamp_ = 0;
 
+  // Interned strings for each RefType; avoids hashing the ref type on every
+  // instant.
+  std::array<StringId, static_cast<size_t>(RefType::kRefMax)> ref_type_ids_{};
+
   TraceProcessorContext* const context_;
 };
 }  // namespace trace_processor
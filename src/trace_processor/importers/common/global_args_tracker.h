@@ -121,6 +121,7 @@ class GlobalArgsTracker {
     // The +1 ensures that nothing has an id == kInvalidArgSetId == 0.
     ArgSetId id = static_cast<uint32_t>(arg_row_for_hash_.size()) + 1;
     arg_row_for_hash_.emplace(digest, arg_table->row_count());
+    context_->storage->StartArgSet(id);
     for (uint32_t i : valid_indexes) {
       const auto& arg = args[i];
 
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class GlobalArgsTrackerTest : public ::testing::Test {
+ public:
+  GlobalArgsTrackerTest() {
+    context_.storage.reset(new TraceStorage());
+    tracker_.reset(new GlobalArgsTracker(&context_));
+  }
+
+  ArgSetId AddArgSet(const std::vector<std::pair<const char*, int64_t>>& kv) {
+    std::vector<GlobalArgsTracker::Arg> args;
+    for (const auto& pair : kv) {
+      GlobalArgsTracker::Arg arg;
+      arg.key = context_.storage->InternString(pair.first);
+      arg.flat_key = arg.key;
+      arg.value = Variadic::Integer(pair.second);
+      args.push_back(arg);
+    }
+    return tracker_->AddArgSet(args, 0, static_cast<uint32_t>(args.size()));
+  }
+
+ protected:
+  TraceProcessorContext context_;
+  std::unique_ptr<GlobalArgsTracker> tracker_;
+};
+
+TEST_F(GlobalArgsTrackerTest, ArgSetRowRange) {
+  ArgSetId first = AddArgSet({{"a", 1}, {"b", 2}});
+  ArgSetId second = AddArgSet({{"c", 3}});
+  ArgSetId dupe = AddArgSet({{"a", 1}, {"b", 2}});
+  ArgSetId third = AddArgSet({{"a", 4}, {"b", 5}, {"c", 6}});
+
+  ASSERT_EQ(dupe, first);
+
+  const TraceStorage& storage = *context_.storage;
+  ASSERT_EQ(storage.GetArgSetRowRange(first), std::make_pair(0u, 2u));
+  ASSERT_EQ(storage.GetArgSetRowRange(second), std::make_pair(2u, 3u));
+  ASSERT_EQ(storage.GetArgSetRowRange(third), std::make_pair(3u, 6u));
+  ASSERT_EQ(storage.GetArgSetRowRange(kInvalidArgSetId),
+            std::make_pair(0u, 0u));
+  ASSERT_EQ(storage.GetArgSetRowRange(third + 1), std::make_pair(0u, 0u));
+
+  RowMap rm = storage.GetArgSetRowMap(third);
+  ASSERT_EQ(rm.size(), 3u);
+  for (auto it = rm.IterateRows(); it; it.Next())
+    ASSERT_EQ(storage.arg_table().arg_set_id()[it.row()], third);
+}
+
+TEST_F(GlobalArgsTrackerTest, ArgSetsRowMap) {
+  ArgSetId first = AddArgSet({{"a", 1}, {"b", 2}});
+  ArgSetId second = AddArgSet({{"c", 3}});
+
+  RowMap rm = context_.storage->GetArgSetsRowMap(
+      {second, kInvalidArgSetId, first, second});
+  ASSERT_EQ(rm.size(), 4u);
+  ASSERT_EQ(rm.Get(0), 2u);
+  ASSERT_EQ(rm.Get(1), 0u);
+  ASSERT_EQ(rm.Get(2), 1u);
+  ASSERT_EQ(rm.Get(3), 2u);
+}
+
+TEST_F(GlobalArgsTrackerTest, ExtractArg) {
+  ArgSetId first = AddArgSet({{"a", 1}, {"b", 2}});
+  ArgSetId second = AddArgSet({{"b", 3}});
+
+  base::Optional<Variadic> value;
+  ASSERT_TRUE(context_.storage->ExtractArg(first, "b", &value).ok());
+  ASSERT_EQ(value->int_value, 2);
+
+  ASSERT_TRUE(context_.storage->ExtractArg(second, "b", &value).ok());
+  ASSERT_EQ(value->int_value, 3);
+
+  ASSERT_TRUE(context_.storage->ExtractArg(second, "a", &value).ok());
+  ASSERT_FALSE(value.has_value());
+
+  ASSERT_TRUE(context_.storage->ExtractArg(first, "unknown", &value).ok());
+  ASSERT_FALSE(value.has_value());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -36,6 +36,11 @@ void RegisterDefaultModules(TraceProcessorContext* context) {
   context->modules.emplace_back(new MemoryTrackerSnapshotModule(context));
   context->modules.emplace_back(new ChromeSystemProbesModule(context));
   context->modules.emplace_back(new TrackEventModule(context));
+  // Similarly, the TrackEvent module parses inline track events which aren't
+  // backed by a TracePacket.
+  context->track_event_module =
+      static_cast<TrackEventModule*>(context->modules.back().get());
+
   context->modules.emplace_back(new ProfileModule(context));
   context->modules.emplace_back(new MetadataModule(context));
 }
@@ -309,7 +309,10 @@ util::Status FtraceParser::ParseFtraceEvent(uint32_t cpu,
   SchedEventTracker* sched_tracker = SchedEventTracker::GetOrCreate(context_);
 
   // Handle the (optional) alternative encoding format for sched_switch.
+  IngestProfile* profile = context_->storage->mutable_ingest_profile();
   if (ttp.type == TimestampedTracePiece::Type::kInlineSchedSwitch) {
+    auto sample = profile->Sample(IngestProfile::Phase::kParseFtrace,
+                                  FtraceEvent::kSchedSwitchFieldNumber, 0);
     const auto& event = ttp.sched_switch;
     sched_tracker->PushSchedSwitchCompact(cpu, ts, event.prev_state,
                                           static_cast<uint32_t>(event.next_pid),
@@ -319,6 +322,8 @@ util::Status FtraceParser::ParseFtraceEvent(uint32_t cpu,
 
   // Handle the (optional) alternative encoding format for sched_waking.
   if (ttp.type == TimestampedTracePiece::Type::kInlineSchedWaking) {
+    auto sample = profile->Sample(IngestProfile::Phase::kParseFtrace,
+                                  FtraceEvent::kSchedWakingFieldNumber, 0);
     const auto& event = ttp.sched_waking;
     sched_tracker->PushSchedWakingCompact(
         cpu, ts, static_cast<uint32_t>(event.pid), event.target_cpu, event.prio,
@@ -345,6 +350,8 @@ util::Status FtraceParser::ParseFtraceEvent(uint32_t cpu,
     if (is_metadata_field)
       continue;
 
+    auto sample = profile->Sample(IngestProfile::Phase::kParseFtrace, fld.id(),
+                                  fld.size());
     ConstBytes data = fld.as_bytes();
     if (fld.id() == FtraceEvent::kGenericFieldNumber) {
       ParseGenericFtrace(ts, cpu, pid, data);
@@ -567,6 +574,16 @@ util::Status FtraceParser::ParseFtraceEvent(uint32_t cpu,
   return util::OkStatus();
 }
 
+// static
+bool FtraceParser::IsKernelFunctionField(uint32_t ftrace_id,
+                                         uint32_t field_id) {
+  return std::any_of(kKernelFunctionFields.begin(), kKernelFunctionFields.end(),
+                     [ftrace_id, field_id](const FtraceEventAndFieldId& ev) {
+                       return ev.event_id == ftrace_id &&
+                              ev.field_id == field_id;
+                     });
+}
+
 void FtraceParser::ParseGenericFtrace(int64_t ts,
                                       uint32_t cpu,
                                       uint32_t tid,
@@ -634,12 +651,7 @@ void FtraceParser::ParseTypedFtraceToRaw(
     StringId name_id = message_strings.field_name_ids[field_id];
 
     // Check if this field represents a kernel function.
-    auto it = std::find_if(
-        kKernelFunctionFields.begin(), kKernelFunctionFields.end(),
-        [ftrace_id, field_id](const FtraceEventAndFieldId& ev) {
-          return ev.event_id == ftrace_id && ev.field_id == field_id;
-        });
-    if (it != kKernelFunctionFields.end()) {
+    if (IsKernelFunctionField(ftrace_id, field_id)) {
       PERFETTO_CHECK(type == ProtoSchemaType::kUint64);
 
       auto* interned_string = seq_state->LookupInternedMessage<
@@ -37,6 +37,11 @@ class FtraceParser {
 
   util::Status ParseFtraceEvent(uint32_t cpu, const TimestampedTracePiece& ttp);
 
+  // Returns true if |field_id| of the ftrace event |ftrace_id| holds the
+  // address of a kernel function, which is replaced by the name of the
+  // function when the trace contains the kernel symbols.
+  static bool IsKernelFunctionField(uint32_t ftrace_id, uint32_t field_id);
+
  private:
   void ParseGenericFtrace(int64_t timestamp,
                           uint32_t cpu,
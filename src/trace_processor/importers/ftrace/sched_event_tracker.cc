@@ -18,6 +18,8 @@
 
 #include <math.h>
 
+#include <algorithm>
+
 #include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
@@ -58,6 +60,8 @@ SchedEventTracker::SchedEventTracker(TraceProcessorContext* context)
         context->storage->InternString(waking_descriptor->fields[i].name);
   }
   sched_waking_id_ = context->storage->InternString(waking_descriptor->name);
+  utid_ref_type_id_ = context->storage->InternString(
+      GetRefTypeStringMap()[static_cast<size_t>(RefType::kRefUtid)]);
 }
 
 SchedEventTracker::~SchedEventTracker() = default;
@@ -315,9 +319,17 @@ void SchedEventTracker::PushSchedWakingCompact(uint32_t cpu,
   // Add a waking entry to the instants.
   auto wakee_utid = context_->process_tracker->GetOrCreateThread(wakee_pid);
   auto* instants = context_->storage->mutable_instant_table();
-  auto ref_type_id = context_->storage->InternString(
-      GetRefTypeStringMap()[static_cast<size_t>(RefType::kRefUtid)]);
-  instants->Insert({ts, sched_waking_id_, wakee_utid, ref_type_id});
+  instants->Insert({ts, sched_waking_id_, wakee_utid, utid_ref_type_id_});
+}
+
+base::Optional<uint32_t> SchedEventTracker::FirstPendingSliceRow() const {
+  uint32_t first_row = std::numeric_limits<uint32_t>::max();
+  for (const auto& pending_sched : pending_sched_per_cpu_) {
+    first_row = std::min(first_row, pending_sched.pending_slice_storage_idx);
+  }
+  if (first_row == std::numeric_limits<uint32_t>::max())
+    return base::nullopt;
+  return first_row;
 }
 
 void SchedEventTracker::FlushPendingEvents() {
@@ -20,6 +20,7 @@
 #include <array>
 #include <limits>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -81,6 +82,10 @@ class SchedEventTracker : public Destructible {
   // storage.
   void FlushPendingEvents();
 
+  // Returns the first row of the sched_slice table which is still open (i.e.
+  // will be updated when the next sched_switch on its cpu is seen), if any.
+  base::Optional<uint32_t> FirstPendingSliceRow() const;
+
  private:
   // Information retained from the preceding sched_switch seen on a given cpu.
   struct PendingSchedInfo {
@@ -120,6 +125,7 @@ class SchedEventTracker : public Destructible {
   static constexpr uint8_t kSchedWakingMaxFieldId = 5;
   std::array<StringId, kSchedWakingMaxFieldId + 1> sched_waking_field_ids_;
   StringId sched_waking_id_;
+  StringId utid_ref_type_id_;
 
   TraceProcessorContext* const context_;
 };
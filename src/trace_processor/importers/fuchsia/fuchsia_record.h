@@ -45,6 +45,10 @@ class FuchsiaRecord {
     fuchsia_trace_utils::ThreadInfo info;
   };
 
+  // Pre-sizes the string entries for a record referencing up to |count|
+  // strings, so that building the record does not reallocate.
+  void ReserveStrings(size_t count) { string_entries_.reserve(count); }
+
   void InsertString(uint32_t, StringId);
   StringId GetString(uint32_t);
 
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_processor.h"
+
+namespace {
+
+using perfetto::trace_processor::Config;
+using perfetto::trace_processor::TraceProcessor;
+
+constexpr uint64_t kMagicNumber = 0x0016547846040010;
+
+// Record types.
+constexpr uint64_t kInitialization = 1;
+constexpr uint64_t kString = 2;
+constexpr uint64_t kThread = 3;
+constexpr uint64_t kEvent = 4;
+
+// Event types.
+constexpr uint64_t kDurationBegin = 2;
+constexpr uint64_t kDurationEnd = 3;
+
+// Argument types.
+constexpr uint64_t kArgInt32 = 1;
+
+constexpr uint64_t kCategoryRef = 1;
+constexpr uint64_t kNameRef = 2;
+constexpr uint64_t kArgNameRef = 3;
+constexpr uint64_t kThreadRef = 1;
+
+// Chunk size with which the trace is fed to the tokenizer, roughly matching
+// what the trace_processor shell reads from disk at a time.
+constexpr size_t kChunkSize = 1024 * 1024;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 1024 * 512);
+  }
+}
+
+void AppendHeader(std::vector<uint64_t>* words,
+                  uint64_t type,
+                  uint64_t len_words,
+                  uint64_t payload) {
+  words->push_back(type | (len_words << 4) | payload);
+}
+
+void AppendString(std::vector<uint64_t>* words,
+                  uint64_t index,
+                  const std::string& str) {
+  uint64_t str_words = (str.size() + 7) / 8;
+  AppendHeader(words, kString, 1 + str_words,
+               (index << 16) | (uint64_t(str.size()) << 32));
+  size_t offset = words->size();
+  words->resize(offset + str_words, 0);
+  memcpy(&(*words)[offset], str.data(), str.size());
+}
+
+// Creates a trace with |num_slices| consecutive begin/end duration event pairs
+// on one thread. All strings and the thread are referenced through the provider's
+// tables, which is what Fuchsia's trace-engine emits in practice. If
+// |with_args| is set, every event carries one int32 argument.
+std::vector<uint8_t> CreateTrace(int64_t num_slices, bool with_args) {
+  std::vector<uint64_t> words;
+  words.push_back(kMagicNumber);
+  AppendHeader(&words, kInitialization, 2, 0);
+  words.push_back(1000000000);
+  AppendString(&words, kCategoryRef, "cat");
+  AppendString(&words, kNameRef, "slice");
+  AppendString(&words, kArgNameRef, "arg");
+  AppendHeader(&words, kThread, 3, kThreadRef << 16);
+  words.push_back(1);  // pid
+  words.push_back(2);  // tid
+
+  uint64_t ticks = 1000;
+  for (int64_t i = 0; i < num_slices * 2; ++i) {
+    uint64_t event_type = i % 2 == 0 ? kDurationBegin : kDurationEnd;
+    uint64_t n_args = with_args ? 1 : 0;
+    AppendHeader(&words, kEvent, 2 + n_args,
+                 (event_type << 16) | (n_args << 20) | (kThreadRef << 24) |
+                     (kCategoryRef << 32) | (kNameRef << 48));
+    words.push_back(ticks++);
+    if (with_args) {
+      words.push_back(kArgInt32 | (1 << 4) | (kArgNameRef << 16) |
+                      (static_cast<uint64_t>(i & 0x7fffffff) << 32));
+    }
+  }
+
+  std::vector<uint8_t> trace(words.size() * sizeof(uint64_t));
+  memcpy(trace.data(), words.data(), trace.size());
+  return trace;
+}
+
+void IngestTrace(benchmark::State& state, bool with_args) {
+  std::vector<uint8_t> trace = CreateTrace(state.range(0), with_args);
+  for (auto _ : state) {
+    auto tp = TraceProcessor::CreateInstance(Config());
+    for (size_t offset = 0; offset < trace.size(); offset += kChunkSize) {
+      size_t size = std::min(kChunkSize, trace.size() - offset);
+      std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+      memcpy(buf.get(), trace.data() + offset, size);
+      auto status = tp->Parse(std::move(buf), size);
+      PERFETTO_CHECK(status.ok());
+    }
+    tp->NotifyEndOfFile();
+    benchmark::DoNotOptimize(tp);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+
+}  // namespace
+
+static void BM_FuchsiaIngest_DurationBeginEnd(benchmark::State& state) {
+  IngestTrace(state, /*with_args=*/false);
+}
+BENCHMARK(BM_FuchsiaIngest_DurationBeginEnd)->Apply(BenchmarkArgs);
+
+static void BM_FuchsiaIngest_DurationBeginEndWithArgs(
+    benchmark::State& state) {
+  IngestTrace(state, /*with_args=*/true);
+}
+BENCHMARK(BM_FuchsiaIngest_DurationBeginEndWithArgs)->Apply(BenchmarkArgs);
@@ -17,6 +17,7 @@
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
 
 #include <inttypes.h>
+#include <algorithm>
 #include <unordered_map>
 
 #include "perfetto/base/logging.h"
@@ -27,6 +28,7 @@
 #include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/types/task_state.h"
 #include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/parallel.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -61,6 +63,13 @@ constexpr uint32_t kZxObjTypeThread = 2;
 // Argument types
 constexpr uint32_t kArgString = 6;
 constexpr uint32_t kArgKernelObject = 8;
+
+// Below this many pending events, decoding them is quicker than starting the
+// threads to decode them on.
+constexpr size_t kMinEventsToDecodeInParallel = 16 * 1024;
+
+// Number of consecutive pending events a thread decodes at a time.
+constexpr size_t kEventsPerBatch = 1024;
 }  // namespace
 
 FuchsiaTraceTokenizer::FuchsiaTraceTokenizer(TraceProcessorContext* context)
@@ -158,8 +167,10 @@ util::Status FuchsiaTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> data,
     uint32_t record_len_bytes =
         fuchsia_trace_utils::ReadField<uint32_t>(header, 4, 15) *
         sizeof(uint64_t);
-    if (record_len_bytes == 0)
+    if (record_len_bytes == 0) {
+      FlushPendingEvents();
       return util::ErrStatus("Unexpected record of size 0");
+    }
 
     if (record_offset + record_len_bytes > size)
       break;
@@ -170,6 +181,7 @@ util::Status FuchsiaTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> data,
 
     record_offset += record_len_bytes;
   }
+  FlushPendingEvents();
 
   leftover_bytes_.insert(leftover_bytes_.end(),
                          full_view.data() + record_offset,
@@ -182,6 +194,8 @@ util::Status FuchsiaTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> data,
 // recording them in |TraceStorage| they are given to |TraceSorter|. In order to
 // facilitate the parsing after sorting, a small view of the provider's string
 // and thread tables is passed alongside the record. See |FuchsiaProviderView|.
+// Building that view is deferred to |FlushPendingEvents|, which does it for
+// runs of event records at once.
 void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
   TraceStorage* storage = context_->storage.get();
   ProcessTracker* procs = context_->process_tracker.get();
@@ -196,6 +210,11 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
 
   uint32_t record_type = fuchsia_trace_utils::ReadField<uint32_t>(header, 0, 3);
 
+  // Any other record may change the provider tables that the pending events
+  // refer to, so those have to be decoded first.
+  if (record_type != kEvent)
+    FlushPendingEvents();
+
   // All non-metadata events require current_provider_ to be set.
   if (record_type != kMetadata && current_provider_ == nullptr) {
     context_->storage->IncrementStats(stats::fuchsia_invalid_event);
@@ -253,7 +272,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         }
         StringId id = storage->InternString(s);
 
-        current_provider_->string_table[index] = id;
+        current_provider_->SetString(index, id);
       }
       break;
     }
@@ -266,100 +285,12 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
 
-        current_provider_->thread_table[index] = tinfo;
+        current_provider_->SetThread(index, tinfo);
       }
       break;
     }
     case kEvent: {
-      uint32_t thread_ref =
-          fuchsia_trace_utils::ReadField<uint32_t>(header, 24, 31);
-      uint32_t cat_ref =
-          fuchsia_trace_utils::ReadField<uint32_t>(header, 32, 47);
-      uint32_t name_ref =
-          fuchsia_trace_utils::ReadField<uint32_t>(header, 48, 63);
-
-      // Build the FuchsiaRecord for the event, i.e. extract the thread
-      // information if not inline, and any non-inline strings (name, category
-      // for now, arg names and string values in the future).
-      auto record =
-          std::unique_ptr<FuchsiaRecord>(new FuchsiaRecord(std::move(tbv)));
-      record->set_ticks_per_second(current_provider_->ticks_per_second);
-
-      uint64_t ticks;
-      if (!cursor.ReadUint64(&ticks)) {
-        context_->storage->IncrementStats(stats::fuchsia_invalid_event);
-        return;
-      }
-      int64_t ts = fuchsia_trace_utils::TicksToNs(
-          ticks, current_provider_->ticks_per_second);
-      if (ts < 0) {
-        storage->IncrementStats(stats::fuchsia_timestamp_overflow);
-        return;
-      }
-
-      if (fuchsia_trace_utils::IsInlineThread(thread_ref)) {
-        // Skip over inline thread
-        cursor.ReadInlineThread(nullptr);
-      } else {
-        record->InsertThread(thread_ref,
-                             current_provider_->thread_table[thread_ref]);
-      }
-
-      if (fuchsia_trace_utils::IsInlineString(cat_ref)) {
-        // Skip over inline string
-        cursor.ReadInlineString(cat_ref, nullptr);
-      } else {
-        record->InsertString(cat_ref, current_provider_->string_table[cat_ref]);
-      }
-
-      if (fuchsia_trace_utils::IsInlineString(name_ref)) {
-        // Skip over inline string
-        cursor.ReadInlineString(name_ref, nullptr);
-      } else {
-        record->InsertString(name_ref,
-                             current_provider_->string_table[name_ref]);
-      }
-
-      uint32_t n_args =
-          fuchsia_trace_utils::ReadField<uint32_t>(header, 20, 23);
-      for (uint32_t i = 0; i < n_args; i++) {
-        const size_t arg_base = cursor.WordIndex();
-        uint64_t arg_header;
-        if (!cursor.ReadUint64(&arg_header)) {
-          storage->IncrementStats(stats::fuchsia_invalid_event);
-          return;
-        }
-        uint32_t arg_type =
-            fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 0, 3);
-        uint32_t arg_size_words =
-            fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 4, 15);
-        uint32_t arg_name_ref =
-            fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 16, 31);
-
-        if (fuchsia_trace_utils::IsInlineString(arg_name_ref)) {
-          // Skip over inline string
-          cursor.ReadInlineString(arg_name_ref, nullptr);
-        } else {
-          record->InsertString(arg_name_ref,
-                               current_provider_->string_table[arg_name_ref]);
-        }
-
-        if (arg_type == kArgString) {
-          uint32_t arg_value_ref =
-              fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 32, 47);
-          if (fuchsia_trace_utils::IsInlineString(arg_value_ref)) {
-            // Skip over inline string
-            cursor.ReadInlineString(arg_value_ref, nullptr);
-          } else {
-            record->InsertString(
-                arg_value_ref, current_provider_->string_table[arg_value_ref]);
-          }
-        }
-
-        cursor.SetWordIndex(arg_base + arg_size_words);
-      }
-
-      sorter->PushFuchsiaRecord(ts, std::move(record));
+      pending_events_.emplace_back(std::move(tbv));
       break;
     }
     case kKernelObject: {
@@ -383,7 +314,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         }
         name = storage->InternString(name_view);
       } else {
-        name = current_provider_->string_table[name_ref];
+        name = current_provider_->GetString(name_ref);
       }
 
       switch (obj_type) {
@@ -425,7 +356,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
                 }
               } else {
                 arg_name = storage->GetString(
-                    current_provider_->string_table[arg_name_ref]);
+                    current_provider_->GetString(arg_name_ref));
               }
 
               if (arg_name == "process") {
@@ -483,7 +414,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
       } else {
-        outgoing_thread = current_provider_->thread_table[outgoing_thread_ref];
+        outgoing_thread = current_provider_->GetThread(outgoing_thread_ref);
       }
 
       fuchsia_trace_utils::ThreadInfo incoming_thread;
@@ -493,7 +424,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
       } else {
-        incoming_thread = current_provider_->thread_table[incoming_thread_ref];
+        incoming_thread = current_provider_->GetThread(incoming_thread_ref);
       }
 
       // A thread with priority 0 represents an idle CPU
@@ -564,6 +495,137 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
   }
 }
 
+void FuchsiaTraceTokenizer::FlushPendingEvents() {
+  if (pending_events_.empty())
+    return;
+
+  // Decoding an event only reads the provider tables, which do not change
+  // until the next non-event record, so it can be done on worker threads.
+  // TraceBlobView refcounting is not thread safe: the workers only move the
+  // views, and they are sliced and destroyed on this thread.
+  const ProviderInfo& provider = *current_provider_;
+  std::vector<size_t> batches;
+  for (size_t i = 0; i < pending_events_.size(); i += kEventsPerBatch)
+    batches.push_back(i);
+  util::ForEachInParallel(
+      &batches, pending_events_.size() >= kMinEventsToDecodeInParallel,
+      [this, &provider](size_t* start) {
+        size_t end = std::min(*start + kEventsPerBatch, pending_events_.size());
+        for (size_t i = *start; i < end; ++i)
+          DecodeEvent(provider, &pending_events_[i]);
+      });
+
+  // The events are pushed in input order so that the sorter sees the same
+  // sequence as if they had been decoded one by one.
+  TraceStorage* storage = context_->storage.get();
+  TraceSorter* sorter = context_->sorter.get();
+  for (PendingEvent& event : pending_events_) {
+    switch (event.result) {
+      case PendingEvent::Result::kOk:
+        sorter->PushFuchsiaRecord(event.ts, std::move(event.record));
+        break;
+      case PendingEvent::Result::kInvalid:
+        storage->IncrementStats(stats::fuchsia_invalid_event);
+        break;
+      case PendingEvent::Result::kTimestampOverflow:
+        storage->IncrementStats(stats::fuchsia_timestamp_overflow);
+        break;
+    }
+  }
+  pending_events_.clear();
+}
+
+// Builds the FuchsiaRecord for an event, i.e. extracts the thread information
+// if not inline, and any non-inline strings (name, category, arg names and
+// string values).
+void FuchsiaTraceTokenizer::DecodeEvent(const ProviderInfo& provider,
+                                        PendingEvent* event) {
+  fuchsia_trace_utils::RecordCursor cursor(event->record_view.data(),
+                                           event->record_view.length());
+  uint64_t header;
+  uint64_t ticks;
+  if (!cursor.ReadUint64(&header) || !cursor.ReadUint64(&ticks)) {
+    event->result = PendingEvent::Result::kInvalid;
+    return;
+  }
+  event->ts = fuchsia_trace_utils::TicksToNs(ticks, provider.ticks_per_second);
+  if (event->ts < 0) {
+    event->result = PendingEvent::Result::kTimestampOverflow;
+    return;
+  }
+
+  uint32_t thread_ref =
+      fuchsia_trace_utils::ReadField<uint32_t>(header, 24, 31);
+  uint32_t cat_ref = fuchsia_trace_utils::ReadField<uint32_t>(header, 32, 47);
+  uint32_t name_ref = fuchsia_trace_utils::ReadField<uint32_t>(header, 48, 63);
+  uint32_t n_args = fuchsia_trace_utils::ReadField<uint32_t>(header, 20, 23);
+
+  // The record is kept in |event| even if decoding fails below, so that it is
+  // destroyed on the ingest thread.
+  event->record.reset(new FuchsiaRecord(std::move(event->record_view)));
+  FuchsiaRecord* record = event->record.get();
+  record->set_ticks_per_second(provider.ticks_per_second);
+  record->ReserveStrings(2 + 2 * n_args);
+
+  if (fuchsia_trace_utils::IsInlineThread(thread_ref)) {
+    // Skip over inline thread
+    cursor.ReadInlineThread(nullptr);
+  } else {
+    record->InsertThread(thread_ref, provider.GetThread(thread_ref));
+  }
+
+  if (fuchsia_trace_utils::IsInlineString(cat_ref)) {
+    // Skip over inline string
+    cursor.ReadInlineString(cat_ref, nullptr);
+  } else {
+    record->InsertString(cat_ref, provider.GetString(cat_ref));
+  }
+
+  if (fuchsia_trace_utils::IsInlineString(name_ref)) {
+    // Skip over inline string
+    cursor.ReadInlineString(name_ref, nullptr);
+  } else {
+    record->InsertString(name_ref, provider.GetString(name_ref));
+  }
+
+  for (uint32_t i = 0; i < n_args; i++) {
+    const size_t arg_base = cursor.WordIndex();
+    uint64_t arg_header;
+    if (!cursor.ReadUint64(&arg_header)) {
+      event->result = PendingEvent::Result::kInvalid;
+      return;
+    }
+    uint32_t arg_type =
+        fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 0, 3);
+    uint32_t arg_size_words =
+        fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 4, 15);
+    uint32_t arg_name_ref =
+        fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 16, 31);
+
+    if (fuchsia_trace_utils::IsInlineString(arg_name_ref)) {
+      // Skip over inline string
+      cursor.ReadInlineString(arg_name_ref, nullptr);
+    } else {
+      record->InsertString(arg_name_ref, provider.GetString(arg_name_ref));
+    }
+
+    if (arg_type == kArgString) {
+      uint32_t arg_value_ref =
+          fuchsia_trace_utils::ReadField<uint32_t>(arg_header, 32, 47);
+      if (fuchsia_trace_utils::IsInlineString(arg_value_ref)) {
+        // Skip over inline string
+        cursor.ReadInlineString(arg_value_ref, nullptr);
+      } else {
+        record->InsertString(arg_value_ref,
+                             provider.GetString(arg_value_ref));
+      }
+    }
+
+    cursor.SetWordIndex(arg_base + arg_size_words);
+  }
+  event->result = PendingEvent::Result::kOk;
+}
+
 void FuchsiaTraceTokenizer::RegisterProvider(uint32_t provider_id,
                                              std::string name) {
   std::unique_ptr<ProviderInfo> provider(new ProviderInfo());
@@ -17,8 +17,14 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FUCHSIA_FUCHSIA_TRACE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FUCHSIA_FUCHSIA_TRACE_TOKENIZER_H_
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/common/trace_blob_view.h"
+#include "src/trace_processor/importers/fuchsia/fuchsia_record.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_utils.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
@@ -40,10 +46,31 @@ class FuchsiaTraceTokenizer : public ChunkedTraceReader {
 
  private:
   struct ProviderInfo {
+    // String refs are 15 bits and thread refs 8 bits wide, so both tables are
+    // indexed directly by the ref rather than hashed for every event.
+    StringId GetString(uint32_t index) const {
+      return index < string_table.size() ? string_table[index] : StringId();
+    }
+    void SetString(uint32_t index, StringId id) {
+      if (index >= string_table.size())
+        string_table.resize(index + 1);
+      string_table[index] = id;
+    }
+
+    fuchsia_trace_utils::ThreadInfo GetThread(uint32_t index) const {
+      return index < thread_table.size() ? thread_table[index]
+                                         : fuchsia_trace_utils::ThreadInfo();
+    }
+    void SetThread(uint32_t index, fuchsia_trace_utils::ThreadInfo info) {
+      if (index >= thread_table.size())
+        thread_table.resize(index + 1);
+      thread_table[index] = info;
+    }
+
     std::string name;
 
-    std::unordered_map<uint64_t, StringId> string_table;
-    std::unordered_map<uint64_t, fuchsia_trace_utils::ThreadInfo> thread_table;
+    std::vector<StringId> string_table;
+    std::vector<fuchsia_trace_utils::ThreadInfo> thread_table;
 
     uint64_t ticks_per_second = 1000000000;
   };
@@ -53,9 +80,26 @@ class FuchsiaTraceTokenizer : public ChunkedTraceReader {
     int64_t start_ts;
   };
 
+  // An event record waiting to be decoded. Decoding fills in |record|, and
+  // |ts| if the decode succeeded.
+  struct PendingEvent {
+    enum class Result { kOk, kInvalid, kTimestampOverflow };
+
+    explicit PendingEvent(TraceBlobView tbv) : record_view(std::move(tbv)) {}
+
+    TraceBlobView record_view;
+    std::unique_ptr<FuchsiaRecord> record;
+    int64_t ts = 0;
+    Result result = Result::kInvalid;
+  };
+
   void ParseRecord(TraceBlobView);
   void RegisterProvider(uint32_t, std::string);
 
+  // Decodes |pending_events_| and pushes them to the sorter in input order.
+  void FlushPendingEvents();
+  static void DecodeEvent(const ProviderInfo&, PendingEvent*);
+
   TraceProcessorContext* const context_;
   std::vector<uint8_t> leftover_bytes_;
 
@@ -66,6 +110,11 @@ class FuchsiaTraceTokenizer : public ChunkedTraceReader {
   ProviderInfo* current_provider_;
 
   std::unordered_map<uint32_t, RunningThread> cpu_threads_;
+
+  // Consecutive event records of |current_provider_|. They are decoded
+  // together, on worker threads when there are enough of them, before any
+  // other record is parsed.
+  std::vector<PendingEvent> pending_events_;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/trace_processor/trace_processor.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint64_t kMagicNumber = 0x0016547846040010;
+
+// Record types.
+constexpr uint64_t kInitialization = 1;
+constexpr uint64_t kString = 2;
+constexpr uint64_t kThread = 3;
+constexpr uint64_t kEvent = 4;
+
+// Event types.
+constexpr uint64_t kInstant = 0;
+constexpr uint64_t kDurationBegin = 2;
+constexpr uint64_t kDurationEnd = 3;
+
+// Argument types.
+constexpr uint64_t kArgInt32 = 1;
+constexpr uint64_t kArgString = 6;
+
+constexpr uint64_t kCategoryRef = 1;
+constexpr uint64_t kNameRef = 2;
+constexpr uint64_t kArgNameRef = 3;
+constexpr uint64_t kArgValueRef = 4;
+constexpr uint64_t kLateNameRef = 5;
+
+// More than twice the number of consecutive events above which the
+// tokenizer decodes them on worker threads.
+constexpr int kEventCount = 60000;
+
+void AppendHeader(std::vector<uint64_t>* words,
+                  uint64_t type,
+                  uint64_t len_words,
+                  uint64_t payload) {
+  words->push_back(type | (len_words << 4) | payload);
+}
+
+void AppendString(std::vector<uint64_t>* words,
+                  uint64_t index,
+                  const std::string& str) {
+  uint64_t str_words = (str.size() + 7) / 8;
+  AppendHeader(words, kString, 1 + str_words,
+               (index << 16) | (uint64_t(str.size()) << 32));
+  size_t offset = words->size();
+  words->resize(offset + str_words, 0);
+  memcpy(&(*words)[offset], str.data(), str.size());
+}
+
+// Creates a trace of begin/end event pairs with args on two threads. The
+// string table changes twice in the middle of the events and some of the
+// event records are invalid or have a timestamp which overflows. Returns the
+// number of invalid records in |invalid_count|.
+std::vector<uint8_t> CreateTrace(uint32_t* invalid_count) {
+  std::vector<uint64_t> words;
+  words.push_back(kMagicNumber);
+  AppendHeader(&words, kInitialization, 2, 0);
+  words.push_back(1000000000);
+  AppendString(&words, kCategoryRef, "cat");
+  AppendString(&words, kNameRef, "slice");
+  AppendString(&words, kArgNameRef, "arg");
+  AppendString(&words, kArgValueRef, "value");
+  for (uint64_t thread_ref : {1, 2}) {
+    AppendHeader(&words, kThread, 3, thread_ref << 16);
+    words.push_back(1);               // pid
+    words.push_back(thread_ref + 1);  // tid
+  }
+
+  *invalid_count = 0;
+  uint64_t ticks = 1000;
+  for (int i = 0; i < kEventCount; ++i) {
+    // The pending events have to be decoded with the string table as it was
+    // before these updates.
+    if (i == kEventCount / 3)
+      AppendString(&words, kNameRef, "renamed");
+    if (i == 2 * kEventCount / 3)
+      AppendString(&words, kLateNameRef, "late");
+
+    uint64_t thread_ref = (i / 2) % 3 == 0 ? 2 : 1;
+    uint64_t name_ref =
+        i >= 2 * kEventCount / 3 && (i / 2) % 2 ? kLateNameRef : kNameRef;
+    uint64_t refs =
+        (thread_ref << 24) | (kCategoryRef << 32) | (name_ref << 48);
+    if (i % 2 == 0) {
+      AppendHeader(&words, kEvent, 4,
+                   (kDurationBegin << 16) | (uint64_t(2) << 20) | refs);
+      words.push_back(ticks);
+      words.push_back(kArgInt32 | (1 << 4) | (kArgNameRef << 16) |
+                      (uint64_t(i) << 32));
+      words.push_back(kArgString | (1 << 4) | (kArgNameRef << 16) |
+                      (kArgValueRef << 32));
+    } else {
+      AppendHeader(&words, kEvent, 2, (kDurationEnd << 16) | refs);
+      words.push_back(ticks);
+    }
+    if (i % 7 == 0) {
+      // The timestamp overflows.
+      AppendHeader(&words, kEvent, 2, (kInstant << 16) | refs);
+      words.push_back(~uint64_t(0));
+    }
+    if (i % 11 == 0) {
+      // The record is too short to hold the timestamp.
+      AppendHeader(&words, kEvent, 1, (kInstant << 16) | refs);
+      ++*invalid_count;
+    }
+    ticks += 3;
+  }
+
+  std::vector<uint8_t> trace(words.size() * sizeof(uint64_t));
+  memcpy(trace.data(), words.data(), trace.size());
+  return trace;
+}
+
+std::vector<std::string> Query(TraceProcessor* tp, const std::string& sql) {
+  std::vector<std::string> rows;
+  auto it = tp->ExecuteQuery(sql);
+  while (it.Next()) {
+    std::string row;
+    for (uint32_t i = 0; i < it.ColumnCount(); ++i) {
+      SqlValue value = it.Get(i);
+      if (value.type == SqlValue::kLong) {
+        row += std::to_string(value.long_value);
+      } else if (value.type == SqlValue::kString) {
+        row += value.string_value;
+      } else if (value.type == SqlValue::kNull) {
+        row += "[NULL]";
+      }
+      row += ",";
+    }
+    rows.push_back(row);
+  }
+  EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+  return rows;
+}
+
+// Ingests |trace| fed in chunks of |chunk_size| bytes and returns the
+// resulting slices, args, stats and threads.
+std::vector<std::string> Ingest(const std::vector<uint8_t>& trace,
+                                size_t chunk_size) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  for (size_t offset = 0; offset < trace.size(); offset += chunk_size) {
+    size_t size = std::min(chunk_size, trace.size() - offset);
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+    memcpy(buf.get(), trace.data() + offset, size);
+    EXPECT_TRUE(tp->Parse(std::move(buf), size).ok());
+  }
+  tp->NotifyEndOfFile();
+
+  std::vector<std::string> rows;
+  for (const char* sql :
+       {"select ts, dur, name, category, depth, track_id, arg_set_id "
+        "from slice order by id",
+        "select arg_set_id, key, int_value, string_value from args "
+        "order by arg_set_id, key",
+        // The durations measured while parsing differ between runs.
+        "select name, idx, value from stats where value > 0 and "
+        "name not like '%_duration_ns' order by name",
+        "select utid, tid, upid from thread order by utid"}) {
+    std::vector<std::string> query_rows = Query(tp.get(), sql);
+    rows.insert(rows.end(), query_rows.begin(), query_rows.end());
+  }
+  return rows;
+}
+
+TEST(FuchsiaTraceTokenizerTest, ParallelDecodeMatchesSerialDecode) {
+  uint32_t invalid_count = 0;
+  std::vector<uint8_t> trace = CreateTrace(&invalid_count);
+
+  // Fed at once, the runs of events between the string records are long
+  // enough to be decoded on worker threads. Fed in small chunks, each call to
+  // Parse() decodes its few events on the ingest thread.
+  std::vector<std::string> parallel = Ingest(trace, trace.size());
+  std::vector<std::string> serial = Ingest(trace, 4096);
+  EXPECT_EQ(parallel, serial);
+
+  // Each pair of events is one slice and the renamed strings are used from
+  // where they were updated.
+  auto tp = TraceProcessor::CreateInstance(Config());
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+  memcpy(buf.get(), trace.data(), trace.size());
+  ASSERT_TRUE(tp->Parse(std::move(buf), trace.size()).ok());
+  tp->NotifyEndOfFile();
+  EXPECT_THAT(Query(tp.get(),
+                    "select name, count(*) from slice group by name "
+                    "order by name"),
+              ::testing::ElementsAre("late,5000,", "renamed,15000,",
+                                     "slice,10000,"));
+  EXPECT_THAT(
+      Query(tp.get(),
+            "select name, value from stats where name glob 'fuchsia_*' "
+            "and value > 0 order by name"),
+      ::testing::ElementsAre(
+          "fuchsia_invalid_event," + std::to_string(invalid_count) + ",",
+          "fuchsia_timestamp_overflow," +
+              std::to_string((kEventCount + 6) / 7) + ","));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -51,37 +51,109 @@ void GlobalNodeGraph::AddNodeOwnershipEdge(Node* owner,
   owned->AddOwnedByEdge(edge);
 }
 
-Node* GlobalNodeGraph::CreateNode(Process* process_graph, Node* parent) {
-  all_nodes_.emplace_front(process_graph, parent);
-  return &*all_nodes_.begin();
+void GlobalNodeGraph::AddToNodesById(Node* node) {
+  if (!node->id().empty())
+    nodes_by_id_.emplace(node->id(), node);
 }
 
 PreOrderIterator GlobalNodeGraph::VisitInDepthFirstPreOrder() {
-  std::vector<Node*> roots;
-  for (auto it = process_node_graphs_.rbegin();
-       it != process_node_graphs_.rend(); it++) {
-    roots.push_back(it->second->root());
-  }
-  roots.push_back(shared_memory_graph_->root());
-  return PreOrderIterator{std::move(roots)};
+  return PreOrderIterator{TraversalRoots()};
 }
 
 PostOrderIterator GlobalNodeGraph::VisitInDepthFirstPostOrder() {
+  return PostOrderIterator(TraversalRoots());
+}
+
+// Same traversal as PreOrderIterator::next().
+std::vector<Node*> GlobalNodeGraph::NodesInDepthFirstPreOrder() {
+  const uint32_t traversal_id = ++last_traversal_id_;
+  auto visited = [traversal_id](const Node* node) {
+    return node->traversal_id_ == traversal_id;
+  };
+
+  std::vector<Node*> nodes;
+  std::vector<Node*> to_visit = TraversalRoots();
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    if (visited(node))
+      continue;
+    if (node->owns_edge() && !visited(node->owns_edge()->target()))
+      continue;
+    if (node->parent() && !visited(node->parent()))
+      continue;
+
+    for (auto it = node->children_.rbegin(); it != node->children_.rend();
+         it++) {
+      to_visit.push_back(it->second);
+    }
+    for (auto it = node->owned_by_edges_.rbegin();
+         it != node->owned_by_edges_.rend(); it++) {
+      to_visit.push_back((*it)->source());
+    }
+    node->traversal_id_ = traversal_id;
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+// Same traversal as PostOrderIterator::next().
+std::vector<Node*> GlobalNodeGraph::NodesInDepthFirstPostOrder() {
+  const uint32_t traversal_id = ++last_traversal_id_;
+
+  std::vector<Node*> nodes;
+  std::vector<Node*> to_visit = TraversalRoots();
+  std::vector<Node*> path;
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    if (node->traversal_id_ == traversal_id)
+      continue;
+
+    if (!path.empty() && path.back() == node) {
+      node->traversal_id_ = traversal_id;
+      path.pop_back();
+      nodes.push_back(node);
+      continue;
+    }
+
+    path.push_back(node);
+    to_visit.push_back(node);
+    for (auto it = node->children_.rbegin(); it != node->children_.rend();
+         it++) {
+      to_visit.push_back(it->second);
+    }
+    for (auto it = node->owned_by_edges_.rbegin();
+         it != node->owned_by_edges_.rend(); it++) {
+      to_visit.push_back((*it)->source());
+    }
+  }
+  return nodes;
+}
+
+std::vector<Node*> GlobalNodeGraph::TraversalRoots() const {
   std::vector<Node*> roots;
   for (auto it = process_node_graphs_.rbegin();
        it != process_node_graphs_.rend(); it++) {
     roots.push_back(it->second->root());
   }
   roots.push_back(shared_memory_graph_->root());
-  return PostOrderIterator(std::move(roots));
+  return roots;
 }
 
 Process::Process(base::PlatformProcessId pid, GlobalNodeGraph* global_graph)
     : pid_(pid),
       global_graph_(global_graph),
-      root_(global_graph->CreateNode(this, nullptr)) {}
+      root_(CreateNodeInArena(nullptr)) {}
 Process::~Process() {}
 
+Node* Process::CreateNodeInArena(Node* parent) {
+  nodes_.emplace_back(this, parent);
+  return &nodes_.back();
+}
+
 Node* Process::CreateNode(MemoryAllocatorNodeId id,
                           const std::string& path,
                           bool weak) {
@@ -94,7 +166,7 @@ Node* Process::CreateNode(MemoryAllocatorNodeId id,
     Node* parent = current;
     current = current->GetChild(key);
     if (!current) {
-      current = global_graph_->CreateNode(this, parent);
+      current = CreateNodeInArena(parent);
       parent->InsertChild(key, current);
     }
   }
@@ -108,8 +180,7 @@ Node* Process::CreateNode(MemoryAllocatorNodeId id,
   current->set_id(id);
 
   // Add to the global id map as well if it exists.
-  if (!id.empty())
-    global_graph_->nodes_by_id_.emplace(id, current);
+  global_graph_->AddToNodesById(current);
 
   return current;
 }
@@ -141,7 +212,7 @@ void Node::InsertChild(const std::string& name, Node* node) {
 }
 
 Node* Node::CreateChild(const std::string& name) {
-  Node* new_child = node_graph_->global_graph()->CreateNode(node_graph_, this);
+  Node* new_child = node_graph_->CreateNodeInArena(this);
   InsertChild(name, new_child);
   return new_child;
 }
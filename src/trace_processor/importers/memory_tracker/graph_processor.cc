@@ -18,6 +18,8 @@
 
 #include <list>
 
+#include "src/trace_processor/util/parallel.h"
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -31,6 +33,11 @@ const char kSharedMemoryRootNode[] = "shared_memory";
 const char kSizeEntryName[] = "size";
 const char kEffectiveSizeEntryName[] = "effective_size";
 
+// Below this number of nodes, the process graphs are all processed on the
+// calling thread: starting the worker threads would take longer than the
+// processing itself.
+constexpr size_t kMinNodesToProcessInParallel = 4096;
+
 Node::Entry::ScalarUnits EntryUnitsFromString(const std::string& units) {
   if (units == RawMemoryGraphNode::kUnitsBytes) {
     return Node::Entry::ScalarUnits::kBytes;
@@ -52,6 +59,35 @@ base::Optional<uint64_t> GetSizeEntryOfNode(Node* node) {
   return base::Optional<uint64_t>(size_it->second.value_uint64);
 }
 
+void AddEntriesToNode(const RawMemoryGraphNode& raw_node, Node* node) {
+  // Copy any entries not already present into the node.
+  for (auto& entry : raw_node.entries()) {
+    switch (entry.entry_type) {
+      case RawMemoryGraphNode::MemoryNodeEntry::EntryType::kUint64:
+        node->AddEntry(entry.name, EntryUnitsFromString(entry.units),
+                       entry.value_uint64);
+        break;
+      case RawMemoryGraphNode::MemoryNodeEntry::EntryType::kString:
+        node->AddEntry(entry.name, entry.value_string);
+        break;
+    }
+  }
+}
+
+// Calls |fn| for the graph of each process, see util::ForEachInParallel().
+template <typename Fn>
+void ForEachProcessInParallel(GlobalNodeGraph* global_graph, const Fn& fn) {
+  std::vector<Process*> processes;
+  size_t node_count = 0;
+  for (const auto& pid_to_process : global_graph->process_node_graphs()) {
+    processes.push_back(pid_to_process.second.get());
+    node_count += pid_to_process.second->node_count();
+  }
+  util::ForEachInParallel(&processes,
+                          node_count >= kMinNodesToProcessInParallel,
+                          [&fn](Process** process) { fn(*process); });
+}
+
 }  // namespace
 
 // static
@@ -59,25 +95,40 @@ std::unique_ptr<GlobalNodeGraph> GraphProcessor::CreateMemoryGraph(
     const GraphProcessor::RawMemoryNodeMap& process_nodes) {
   auto global_graph = std::unique_ptr<GlobalNodeGraph>(new GlobalNodeGraph());
 
-  // First pass: collects allocator nodes into a graph and populate
-  // with entries.
+  struct ProcessNodes {
+    const RawProcessMemoryNode* source;
+    Process* graph;
+    std::vector<Node*> nodes;
+  };
+  std::vector<ProcessNodes> processes;
+  size_t node_count = 0;
   for (const auto& pid_to_node : process_nodes) {
     // There can be null entries in the map; simply filter these out.
     if (!pid_to_node.second)
       continue;
 
     auto* graph = global_graph->CreateGraphForProcess(pid_to_node.first);
-    CollectAllocatorNodes(*pid_to_node.second, global_graph.get(), graph);
+    processes.push_back({pid_to_node.second.get(), graph, {}});
+    node_count += pid_to_node.second->allocator_nodes().size();
   }
 
-  // Second pass: generate the graph of edges between the nodes.
-  for (const auto& pid_to_node : process_nodes) {
-    // There can be null entries in the map; simply filter these out.
-    if (!pid_to_node.second)
-      continue;
+  // First pass: collects allocator nodes into a graph and populate
+  // with entries. The nodes of each process are collected in parallel. The
+  // global nodes and the id map are shared by all the processes so are then
+  // populated on this thread, one process after the other.
+  util::ForEachInParallel(&processes,
+                          node_count >= kMinNodesToProcessInParallel,
+                          [](ProcessNodes* process) {
+                            CollectProcessAllocatorNodes(*process->source,
+                                                         process->graph,
+                                                         &process->nodes);
+                          });
+  for (const ProcessNodes& process : processes)
+    CollectAllocatorNodes(*process.source, global_graph.get(), process.nodes);
 
-    AddEdges(*pid_to_node.second, global_graph.get());
-  }
+  // Second pass: generate the graph of edges between the nodes.
+  for (const ProcessNodes& process : processes)
+    AddEdges(*process.source, global_graph.get());
 
   return global_graph;
 }
@@ -87,11 +138,12 @@ void GraphProcessor::RemoveWeakNodesFromGraph(GlobalNodeGraph* global_graph) {
   auto* global_root = global_graph->shared_memory_graph()->root();
 
   // Third pass: mark recursively nodes as weak if they don't have an associated
-  // node and all their children are weak.
+  // node and all their children are weak. This only looks at the tree of each
+  // process so they can be processed in parallel.
   MarkImplicitWeakParentsRecursively(global_root);
-  for (const auto& pid_to_process : global_graph->process_node_graphs()) {
-    MarkImplicitWeakParentsRecursively(pid_to_process.second->root());
-  }
+  ForEachProcessInParallel(global_graph, [](Process* process) {
+    MarkImplicitWeakParentsRecursively(process->root());
+  });
 
   // Fourth pass: recursively mark nodes as weak if they own a node which is
   // weak or if they have a parent who is weak.
@@ -105,11 +157,13 @@ void GraphProcessor::RemoveWeakNodesFromGraph(GlobalNodeGraph* global_graph) {
   }
 
   // Fifth pass: remove all nodes which are weak (including their descendants)
-  // and clean owned by edges to match.
+  // and clean owned by edges to match. This only changes the nodes of each
+  // process tree (the weakness of owners in other trees is only read) so the
+  // processes can be handled in parallel.
   RemoveWeakNodesRecursively(global_root);
-  for (const auto& pid_to_process : global_graph->process_node_graphs()) {
-    RemoveWeakNodesRecursively(pid_to_process.second->root());
-  }
+  ForEachProcessInParallel(global_graph, [](Process* process) {
+    RemoveWeakNodesRecursively(process->root());
+  });
 }
 
 // static
@@ -128,59 +182,49 @@ void GraphProcessor::AddOverheadsAndPropagateEntries(
   }
 
   // Seventh pass: aggregate non-size integer entries into parents and propagate
-  // string and int entries for shared graph.
+  // string and int entries for shared graph. Once the entries have been
+  // propagated to the owners, the aggregation only looks at the tree of each
+  // process so they can be processed in parallel.
   auto* global_root = global_graph->shared_memory_graph()->root();
   AggregateNumericsRecursively(global_root);
   PropagateNumericsAndDiagnosticsRecursively(global_root);
-  for (auto& pid_to_process : global_graph->process_node_graphs()) {
-    AggregateNumericsRecursively(pid_to_process.second->root());
-  }
+  ForEachProcessInParallel(global_graph, [](Process* process) {
+    AggregateNumericsRecursively(process->root());
+  });
 }
 
 // static
 void GraphProcessor::CalculateSizesForGraph(GlobalNodeGraph* global_graph) {
+  // These passes follow the ownership edges, which cross the process graphs, so
+  // they are not run in parallel. The order of the nodes is only computed once
+  // for all the passes which don't change the structure of the graph.
+
   // Eighth pass: calculate the size field for nodes by considering the sizes
-  // of their children and owners.
-  {
-    auto it = global_graph->VisitInDepthFirstPostOrder();
-    while (Node* node = it.next()) {
-      CalculateSizeForNode(node);
-    }
-  }
+  // of their children and owners. The "<unspecified>" nodes created by this
+  // pass are added to nodes which were already visited so they would not be
+  // visited by an iterator either.
+  for (Node* node : global_graph->NodesInDepthFirstPostOrder())
+    CalculateSizeForNode(node);
+
+  std::vector<Node*> post_order = global_graph->NodesInDepthFirstPostOrder();
 
   // Ninth pass: Calculate not-owned and not-owning sub-sizes of all nodes.
-  {
-    auto it = global_graph->VisitInDepthFirstPostOrder();
-    while (Node* node = it.next()) {
-      CalculateNodeSubSizes(node);
-    }
-  }
+  for (Node* node : post_order)
+    CalculateNodeSubSizes(node);
 
   // Tenth pass: Calculate owned and owning coefficients of owned and owner
   // nodes.
-  {
-    auto it = global_graph->VisitInDepthFirstPostOrder();
-    while (Node* node = it.next()) {
-      CalculateNodeOwnershipCoefficient(node);
-    }
-  }
+  for (Node* node : post_order)
+    CalculateNodeOwnershipCoefficient(node);
 
   // Eleventh pass: Calculate cumulative owned and owning coefficients of all
   // nodes.
-  {
-    auto it = global_graph->VisitInDepthFirstPreOrder();
-    while (Node* node = it.next()) {
-      CalculateNodeCumulativeOwnershipCoefficient(node);
-    }
-  }
+  for (Node* node : global_graph->NodesInDepthFirstPreOrder())
+    CalculateNodeCumulativeOwnershipCoefficient(node);
 
   // Twelfth pass: Calculate the effective sizes of all nodes.
-  {
-    auto it = global_graph->VisitInDepthFirstPostOrder();
-    while (Node* node = it.next()) {
-      CalculateNodeEffectiveSize(node);
-    }
-  }
+  for (Node* node : post_order)
+    CalculateNodeEffectiveSize(node);
 }
 
 // static
@@ -261,49 +305,70 @@ GraphProcessor::ComputeSharedFootprintFromGraph(
   return pid_to_shared_footprint;
 }
 
+// static
+void GraphProcessor::CollectProcessAllocatorNodes(
+    const RawProcessMemoryNode& source,
+    Process* process_graph,
+    std::vector<Node*>* nodes) {
+  // Turn each node into a node in the graph of nodes of the process, leaving
+  // global nodes (i.e. those starting with global/) to
+  // CollectAllocatorNodes().
+  for (const auto& path_to_node : source.allocator_nodes()) {
+    const std::string& path = path_to_node.first;
+    const RawMemoryGraphNode& raw_node = *path_to_node.second;
+    if (base::StartsWith(path, "global/")) {
+      nodes->push_back(nullptr);
+      continue;
+    }
+
+    // Storing whether the process is weak here will allow for later
+    // computations on whether or not the node should be removed.
+    bool is_weak = raw_node.flags() & RawMemoryGraphNode::Flags::kWeak;
+
+    // The id map is shared by all the processes so the node is only added to
+    // it later, by CollectAllocatorNodes().
+    Node* node =
+        process_graph->CreateNode(MemoryAllocatorNodeId(), path, is_weak);
+    node->set_id(raw_node.id());
+    AddEntriesToNode(raw_node, node);
+    nodes->push_back(node);
+  }
+}
+
 // static
 void GraphProcessor::CollectAllocatorNodes(const RawProcessMemoryNode& source,
                                            GlobalNodeGraph* global_graph,
-                                           Process* process_graph) {
-  // Turn each node into a node in the graph of nodes in the appropriate
-  // process node or global node.
+                                           const std::vector<Node*>& nodes) {
+  PERFETTO_DCHECK(nodes.size() == source.allocator_nodes().size());
+  auto node_it = nodes.begin();
   for (const auto& path_to_node : source.allocator_nodes()) {
+    Node* process_node = *node_it++;
+    if (process_node) {
+      // Ids of the nodes of a process are unique: they cannot clash with
+      // the ids of the nodes of other processes.
+      PERFETTO_DCHECK(global_graph->nodes_by_id().count(process_node->id()) ==
+                      0);
+      global_graph->AddToNodesById(process_node);
+      continue;
+    }
+
     const std::string& path = path_to_node.first;
     const RawMemoryGraphNode& raw_node = *path_to_node.second;
 
-    // All global nodes (i.e. those starting with global/) should be redirected
-    // to the shared graph.
-    bool is_global = base::StartsWith(path, "global/");
-    Process* process =
-        is_global ? global_graph->shared_memory_graph() : process_graph;
+    // All global nodes should be redirected to the shared graph.
+    Process* process = global_graph->shared_memory_graph();
 
     Node* node;
     auto node_iterator = global_graph->nodes_by_id().find(raw_node.id());
     if (node_iterator == global_graph->nodes_by_id().end()) {
-      // Storing whether the process is weak here will allow for later
-      // computations on whether or not the node should be removed.
       bool is_weak = raw_node.flags() & RawMemoryGraphNode::Flags::kWeak;
       node = process->CreateNode(raw_node.id(), path, is_weak);
     } else {
       node = node_iterator->second;
 
       PERFETTO_DCHECK(node == process->FindNode(path));
-
-      PERFETTO_DCHECK(is_global);
-    }
-
-    // Copy any entries not already present into the node.
-    for (auto& entry : raw_node.entries()) {
-      switch (entry.entry_type) {
-        case RawMemoryGraphNode::MemoryNodeEntry::EntryType::kUint64:
-          node->AddEntry(entry.name, EntryUnitsFromString(entry.units),
-                         entry.value_uint64);
-          break;
-        case RawMemoryGraphNode::MemoryNodeEntry::EntryType::kString:
-          node->AddEntry(entry.name, entry.value_string);
-          break;
-      }
     }
+    AddEntriesToNode(raw_node, node);
   }
 }
 
@@ -338,103 +403,132 @@ void GraphProcessor::AddEdges(const RawProcessMemoryNode& source,
 }
 
 // static
-void GraphProcessor::MarkImplicitWeakParentsRecursively(Node* node) {
-  // Ensure that we aren't in a bad state where we have an implicit node
-  // which doesn't have any children (which is not the root node).
-  PERFETTO_DCHECK(node->is_explicit() || !node->children()->empty() ||
-                  !node->parent());
-
-  // Check that at this stage, any node which is weak is only so because
-  // it was explicitly created as such.
-  PERFETTO_DCHECK(!node->is_weak() || node->is_explicit());
-
-  // If a node is already weak then all children will be marked weak at a
-  // later stage.
-  if (node->is_weak())
-    return;
+void GraphProcessor::MarkImplicitWeakParentsRecursively(Node* root) {
+  // Collect the nodes in pre-order so that, going through them backwards,
+  // children are always visited before their parent.
+  std::vector<Node*> nodes;
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    // Ensure that we aren't in a bad state where we have an implicit node
+    // which doesn't have any children (which is not the root node).
+    PERFETTO_DCHECK(node->is_explicit() || !node->children()->empty() ||
+                    !node->parent());
+
+    // Check that at this stage, any node which is weak is only so because
+    // it was explicitly created as such.
+    PERFETTO_DCHECK(!node->is_weak() || node->is_explicit());
+
+    // If a node is already weak then all children will be marked weak at a
+    // later stage.
+    if (node->is_weak())
+      continue;
 
-  // Recurse into each child and find out if all the children of this node are
-  // weak.
-  bool all_children_weak = true;
-  for (const auto& path_to_child : *node->children()) {
-    MarkImplicitWeakParentsRecursively(path_to_child.second);
-    all_children_weak = all_children_weak && path_to_child.second->is_weak();
+    nodes.push_back(node);
+    for (const auto& path_to_child : *node->children())
+      to_visit.push_back(path_to_child.second);
   }
 
-  // If all the children are weak and the parent is only an implicit one then we
-  // consider the parent as weak as well and we will later remove it.
-  node->set_weak(!node->is_explicit() && all_children_weak);
+  for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+    Node* node = *it;
+
+    // Find out if all the children of this node are weak.
+    bool all_children_weak = true;
+    for (const auto& path_to_child : *node->children())
+      all_children_weak = all_children_weak && path_to_child.second->is_weak();
+
+    // If all the children are weak and the parent is only an implicit one then
+    // we consider the parent as weak as well and we will later remove it.
+    node->set_weak(!node->is_explicit() && all_children_weak);
+  }
 }
 
 // static
 void GraphProcessor::MarkWeakOwnersAndChildrenRecursively(
-    Node* node,
+    Node* root,
     std::set<const Node*>* visited) {
-  // If we've already visited this node then nothing to do.
-  if (visited->count(node) != 0)
-    return;
-
-  // If we haven't visited the node which this node owns then wait for that.
-  if (node->owns_edge() && visited->count(node->owns_edge()->target()) == 0)
-    return;
+  // The nodes to visit are pushed in reverse order so that they are visited in
+  // the same order as a recursive traversal would.
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    // If we've already visited this node then nothing to do.
+    if (visited->count(node) != 0)
+      continue;
 
-  // If we haven't visited the node's parent then wait for that.
-  if (node->parent() && visited->count(node->parent()) == 0)
-    return;
+    // If we haven't visited the node which this node owns then wait for that.
+    if (node->owns_edge() && visited->count(node->owns_edge()->target()) == 0)
+      continue;
 
-  // If either the node we own or our parent is weak, then mark this node
-  // as weak.
-  if ((node->owns_edge() && node->owns_edge()->target()->is_weak()) ||
-      (node->parent() && node->parent()->is_weak())) {
-    node->set_weak(true);
-  }
-  visited->insert(node);
+    // If we haven't visited the node's parent then wait for that.
+    if (node->parent() && visited->count(node->parent()) == 0)
+      continue;
 
-  // Recurse into each owner node to mark any other nodes.
-  for (auto* owned_by_edge : *node->owned_by_edges()) {
-    MarkWeakOwnersAndChildrenRecursively(owned_by_edge->source(), visited);
-  }
+    // If either the node we own or our parent is weak, then mark this node
+    // as weak.
+    if ((node->owns_edge() && node->owns_edge()->target()->is_weak()) ||
+        (node->parent() && node->parent()->is_weak())) {
+      node->set_weak(true);
+    }
+    visited->insert(node);
 
-  // Recurse into each child and find out if all the children of this node are
-  // weak.
-  for (const auto& path_to_child : *node->children()) {
-    MarkWeakOwnersAndChildrenRecursively(path_to_child.second, visited);
+    // Visit each child, after each owner node to mark any other nodes.
+    for (auto it = node->children()->rbegin(); it != node->children()->rend();
+         ++it) {
+      to_visit.push_back(it->second);
+    }
+    for (auto it = node->owned_by_edges()->rbegin();
+         it != node->owned_by_edges()->rend(); ++it) {
+      to_visit.push_back((*it)->source());
+    }
   }
 }
 
 // static
-void GraphProcessor::RemoveWeakNodesRecursively(Node* node) {
-  auto* children = node->children();
-  for (auto child_it = children->begin(); child_it != children->end();) {
-    Node* child = child_it->second;
-
-    // If the node is weak, remove it. This automatically makes all
-    // descendents unreachable from the parents. If this node owned
-    // by another, it will have been marked earlier in
-    // |MarkWeakOwnersAndChildrenRecursively| and so will be removed
-    // by this method at some point.
-    if (child->is_weak()) {
-      child_it = children->erase(child_it);
-      continue;
-    }
+void GraphProcessor::RemoveWeakNodesRecursively(Node* root) {
+  // The weakness of the nodes doesn't change here so the order in which the
+  // nodes are visited doesn't matter.
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    auto* children = node->children();
+    for (auto child_it = children->begin(); child_it != children->end();) {
+      Node* child = child_it->second;
+
+      // If the node is weak, remove it. This automatically makes all
+      // descendents unreachable from the parents. If this node owned
+      // by another, it will have been marked earlier in
+      // |MarkWeakOwnersAndChildrenRecursively| and so will be removed
+      // by this method at some point.
+      if (child->is_weak()) {
+        child_it = children->erase(child_it);
+        continue;
+      }
 
-    // We should never be in a situation where we're about to
-    // keep a node which owns a weak node (which will be/has been
-    // removed).
-    PERFETTO_DCHECK(!child->owns_edge() ||
-                    !child->owns_edge()->target()->is_weak());
+      // We should never be in a situation where we're about to
+      // keep a node which owns a weak node (which will be/has been
+      // removed).
+      PERFETTO_DCHECK(!child->owns_edge() ||
+                      !child->owns_edge()->target()->is_weak());
 
-    // Descend and remove all weak child nodes.
-    RemoveWeakNodesRecursively(child);
+      // Descend and remove all weak child nodes.
+      to_visit.push_back(child);
 
-    // Remove all edges with owner nodes which are weak.
-    std::vector<Edge*>* owned_by_edges = child->owned_by_edges();
-    auto new_end =
-        std::remove_if(owned_by_edges->begin(), owned_by_edges->end(),
-                       [](Edge* edge) { return edge->source()->is_weak(); });
-    owned_by_edges->erase(new_end, owned_by_edges->end());
+      // Remove all edges with owner nodes which are weak.
+      std::vector<Edge*>* owned_by_edges = child->owned_by_edges();
+      auto new_end =
+          std::remove_if(owned_by_edges->begin(), owned_by_edges->end(),
+                         [](Edge* edge) { return edge->source()->is_weak(); });
+      owned_by_edges->erase(new_end, owned_by_edges->end());
 
-    ++child_it;
+      ++child_it;
+    }
   }
 }
 
@@ -498,34 +592,56 @@ Node::Entry GraphProcessor::AggregateNumericWithNameForNode(
 }
 
 // static
-void GraphProcessor::AggregateNumericsRecursively(Node* node) {
-  std::set<std::string> numeric_names;
-
-  for (const auto& path_to_child : *node->children()) {
-    AggregateNumericsRecursively(path_to_child.second);
-    for (const auto& name_to_entry : *path_to_child.second->entries()) {
-      const std::string& name = name_to_entry.first;
-      if (name_to_entry.second.type == Node::Entry::Type::kUInt64 &&
-          name != kSizeEntryName && name != kEffectiveSizeEntryName) {
-        numeric_names.insert(name);
+void GraphProcessor::AggregateNumericsRecursively(Node* root) {
+  // Collect the nodes in pre-order so that, going through them backwards,
+  // children are always aggregated before their parent.
+  std::vector<Node*> nodes;
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+    nodes.push_back(node);
+    for (const auto& path_to_child : *node->children())
+      to_visit.push_back(path_to_child.second);
+  }
+
+  for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+    Node* node = *it;
+    std::set<std::string> numeric_names;
+    for (const auto& path_to_child : *node->children()) {
+      for (const auto& name_to_entry : *path_to_child.second->entries()) {
+        const std::string& name = name_to_entry.first;
+        if (name_to_entry.second.type == Node::Entry::Type::kUInt64 &&
+            name != kSizeEntryName && name != kEffectiveSizeEntryName) {
+          numeric_names.insert(name);
+        }
       }
     }
-  }
 
-  for (auto& name : numeric_names) {
-    node->entries()->emplace(name, AggregateNumericWithNameForNode(node, name));
+    for (auto& name : numeric_names) {
+      node->entries()->emplace(name,
+                               AggregateNumericWithNameForNode(node, name));
+    }
   }
 }
 
 // static
-void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* node) {
-  for (const auto& name_to_entry : *node->entries()) {
-    for (auto* edge : *node->owned_by_edges()) {
-      edge->source()->entries()->insert(name_to_entry);
+void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* root) {
+  // The children are pushed in reverse order so that the nodes are visited in
+  // the same order as a recursive pre-order traversal would.
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+    for (const auto& name_to_entry : *node->entries()) {
+      for (auto* edge : *node->owned_by_edges()) {
+        edge->source()->entries()->insert(name_to_entry);
+      }
+    }
+    for (auto it = node->children()->rbegin(); it != node->children()->rend();
+         ++it) {
+      to_visit.push_back(it->second);
     }
-  }
-  for (const auto& path_to_child : *node->children()) {
-    PropagateNumericsAndDiagnosticsRecursively(path_to_child.second);
   }
 }
 
@@ -533,21 +649,25 @@ void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* node) {
 base::Optional<uint64_t> GraphProcessor::AggregateSizeForDescendantNode(
     Node* root,
     Node* descendant) {
-  Edge* owns_edge = descendant->owns_edge();
-  if (owns_edge && owns_edge->target()->IsDescendentOf(*root))
-    return base::make_optional(0UL);
-
-  if (descendant->children()->empty())
-    return GetSizeEntryOfNode(descendant).value_or(0ul);
-
-  base::Optional<uint64_t> size;
-  for (const auto& path_to_child : *descendant->children()) {
-    auto c_size = AggregateSizeForDescendantNode(root, path_to_child.second);
-    if (size) {
-      *size += c_size.value_or(0);
-    } else {
-      size = std::move(c_size);
+  // The size of a leaf is always defined (it is 0 if it has no size entry) so
+  // the aggregated size is always defined too: it is the sum of the sizes of
+  // the leaves under |descendant| which don't own a node under |root|.
+  uint64_t size = 0;
+  std::vector<Node*> to_visit{descendant};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    Edge* owns_edge = node->owns_edge();
+    if (owns_edge && owns_edge->target()->IsDescendentOf(*root))
+      continue;
+
+    if (node->children()->empty()) {
+      size += GetSizeEntryOfNode(node).value_or(0ul);
+      continue;
     }
+    for (const auto& path_to_child : *node->children())
+      to_visit.push_back(path_to_child.second);
   }
   return size;
 }
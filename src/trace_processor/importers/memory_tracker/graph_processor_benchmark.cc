@@ -0,0 +1,128 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the processing of a memory-infra dump.
+// This mimics what MemoryTrackerSnapshotParser does for each snapshot of a
+// Chrome trace: the raw nodes of all the processes are turned into a graph
+// whose sizes are then computed. Each process has a few allocators with some
+// nodes each and shares memory with the other processes through global nodes.
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/trace_processor/importers/memory_tracker/graph_processor.h"
+
+namespace {
+
+using perfetto::trace_processor::GlobalNodeGraph;
+using perfetto::trace_processor::GraphProcessor;
+using perfetto::trace_processor::LevelOfDetail;
+using perfetto::trace_processor::MemoryAllocatorNodeId;
+using perfetto::trace_processor::MemoryGraphEdge;
+using perfetto::trace_processor::RawMemoryGraphNode;
+using perfetto::trace_processor::RawProcessMemoryNode;
+
+// The number of nodes under each allocator of each process.
+constexpr uint32_t kNodesPerAllocator = 64;
+
+// The number of nodes shared between all the processes.
+constexpr uint32_t kSharedNodes = 32;
+
+const char* const kAllocators[] = {"malloc", "partition_alloc/partitions",
+                                   "v8/isolate/heap_spaces", "blink_gc",
+                                   "discardable", "gpu/gl"};
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(2);
+  } else {
+    b->RangeMultiplier(4)->Range(2, 128);
+  }
+}
+
+std::unique_ptr<RawMemoryGraphNode> CreateNode(const std::string& path,
+                                               uint64_t id,
+                                               uint64_t size) {
+  return std::unique_ptr<RawMemoryGraphNode>(new RawMemoryGraphNode(
+      path, LevelOfDetail::kDetailed, MemoryAllocatorNodeId(id),
+      std::vector<RawMemoryGraphNode::MemoryNodeEntry>{
+          {RawMemoryGraphNode::kNameSize, RawMemoryGraphNode::kUnitsBytes,
+           size},
+          {"object_count", RawMemoryGraphNode::kUnitsObjects, size / 64}}));
+}
+
+GraphProcessor::RawMemoryNodeMap CreateDump(uint32_t process_count) {
+  GraphProcessor::RawMemoryNodeMap dump;
+  uint64_t next_id = kSharedNodes + 1;
+  for (uint32_t pid = 1; pid <= process_count; pid++) {
+    RawProcessMemoryNode::MemoryNodesMap nodes;
+    RawProcessMemoryNode::AllocatorNodeEdgesMap edges;
+    for (const char* allocator : kAllocators) {
+      for (uint32_t i = 0; i < kNodesPerAllocator; i++) {
+        std::string path = std::string(allocator) + "/bucket_" +
+                           std::to_string(i % 8) + "/node_" + std::to_string(i);
+        nodes.emplace(path, CreateNode(path, next_id++, 4096 * (i + 1)));
+      }
+    }
+
+    // Each process maps all the shared memory segments.
+    for (uint32_t i = 1; i <= kSharedNodes; i++) {
+      std::string global_path = "global/" + std::to_string(i);
+      nodes.emplace(global_path, CreateNode(global_path, i, 1024 * 1024));
+
+      std::string path = "shared_memory/" + std::to_string(i);
+      uint64_t id = next_id++;
+      nodes.emplace(path, CreateNode(path, id, 1024 * 1024));
+      edges.emplace(MemoryAllocatorNodeId(id),
+                    std::unique_ptr<MemoryGraphEdge>(new MemoryGraphEdge(
+                        MemoryAllocatorNodeId(id), MemoryAllocatorNodeId(i),
+                        static_cast<int>(pid % 2), false)));
+    }
+    dump.emplace(pid, std::unique_ptr<RawProcessMemoryNode>(
+                          new RawProcessMemoryNode(LevelOfDetail::kDetailed,
+                                                   std::move(edges),
+                                                   std::move(nodes))));
+  }
+  return dump;
+}
+
+static void BM_GraphProcessorProcessDump(benchmark::State& state) {
+  auto process_count = static_cast<uint32_t>(state.range(0));
+  GraphProcessor::RawMemoryNodeMap dump = CreateDump(process_count);
+
+  for (auto _ : state) {
+    std::unique_ptr<GlobalNodeGraph> graph =
+        GraphProcessor::CreateMemoryGraph(dump);
+    GraphProcessor::CalculateSizesForGraph(graph.get());
+    benchmark::DoNotOptimize(graph.get());
+  }
+
+  uint64_t node_count = 0;
+  for (const auto& pid_to_node : dump)
+    node_count += pid_to_node.second->allocator_nodes().size();
+  state.counters["nodes"] = benchmark::Counter(
+      static_cast<double>(node_count * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_GraphProcessorProcessDump)->Apply(BenchmarkArgs);
+
+}  // namespace
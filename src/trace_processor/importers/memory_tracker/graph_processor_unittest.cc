@@ -161,6 +161,79 @@ TEST_F(GraphProcessorTest, SmokeComputeMemoryGraph) {
   ASSERT_EQ(edge_it->priority(), 10);
 }
 
+TEST_F(GraphProcessorTest, ComputeMemoryGraphManyProcesses) {
+  // Enough nodes for the processes to be collected in parallel.
+  constexpr uint32_t kProcessCount = 32;
+  constexpr uint32_t kNodesPerProcess = 256;
+  const MemoryAllocatorNodeId kGlobalId(1);
+
+  std::map<base::PlatformProcessId, std::unique_ptr<RawProcessMemoryNode>>
+      process_nodes;
+  for (uint32_t pid = 1; pid <= kProcessCount; pid++) {
+    RawProcessMemoryNode::MemoryNodesMap nodes_map;
+    for (uint32_t i = 0; i < kNodesPerProcess; i++) {
+      std::unique_ptr<RawMemoryGraphNode> node(new RawMemoryGraphNode(
+          "malloc/partition_" + std::to_string(i), LevelOfDetail::kDetailed,
+          MemoryAllocatorNodeId(pid * kNodesPerProcess + i),
+          std::vector<RawMemoryGraphNode::MemoryNodeEntry>{
+              {RawMemoryGraphNode::kNameSize, RawMemoryGraphNode::kUnitsBytes,
+               pid * 1000 + i}}));
+      nodes_map.emplace(node->absolute_name(), std::move(node));
+    }
+
+    // All the processes have the same global node: the entries of the first
+    // process are kept.
+    std::unique_ptr<RawMemoryGraphNode> global(new RawMemoryGraphNode(
+        "global/shared", LevelOfDetail::kDetailed, kGlobalId,
+        std::vector<RawMemoryGraphNode::MemoryNodeEntry>{
+            {RawMemoryGraphNode::kNameSize, RawMemoryGraphNode::kUnitsBytes,
+             pid}}));
+    nodes_map.emplace(global->absolute_name(), std::move(global));
+
+    RawProcessMemoryNode::AllocatorNodeEdgesMap edges_map;
+    MemoryAllocatorNodeId source_id(pid * kNodesPerProcess);
+    edges_map.emplace(source_id, std::unique_ptr<MemoryGraphEdge>(
+                                     new MemoryGraphEdge(source_id, kGlobalId,
+                                                         0, false)));
+
+    process_nodes.emplace(
+        pid, std::unique_ptr<RawProcessMemoryNode>(new RawProcessMemoryNode(
+                 LevelOfDetail::kDetailed, std::move(edges_map),
+                 std::move(nodes_map))));
+  }
+
+  auto global_graph = GraphProcessor::CreateMemoryGraph(process_nodes);
+  ASSERT_EQ(global_graph->process_node_graphs().size(), kProcessCount);
+
+  const auto& nodes_by_id = global_graph->nodes_by_id();
+  ASSERT_EQ(nodes_by_id.size(), kProcessCount * kNodesPerProcess + 1);
+  for (const auto& pid_to_process : global_graph->process_node_graphs()) {
+    base::PlatformProcessId pid = pid_to_process.first;
+    Process* process = pid_to_process.second.get();
+    ASSERT_EQ(process->FindNode("global"), nullptr);
+    for (uint32_t i = 0; i < kNodesPerProcess; i++) {
+      Node* node = process->FindNode("malloc/partition_" + std::to_string(i));
+      ASSERT_NE(node, nullptr);
+      ASSERT_EQ(node->node_graph(), process);
+      ASSERT_EQ(nodes_by_id.at(node->id()), node);
+      ASSERT_EQ(
+          node->entries()->at(RawMemoryGraphNode::kNameSize).value_uint64,
+          pid * 1000 + i);
+    }
+  }
+
+  Node* global = global_graph->shared_memory_graph()->FindNode("global/shared");
+  ASSERT_EQ(nodes_by_id.at(kGlobalId), global);
+  ASSERT_EQ(global->entries()->at(RawMemoryGraphNode::kNameSize).value_uint64,
+            1u);
+  ASSERT_EQ(global->owned_by_edges()->size(), kProcessCount);
+  for (uint32_t i = 0; i < kProcessCount; i++) {
+    Edge* edge = (*global->owned_by_edges())[i];
+    ASSERT_EQ(edge->source()->node_graph()->pid(),
+              static_cast<base::PlatformProcessId>(i + 1));
+  }
+}
+
 TEST_F(GraphProcessorTest, ComputeSharedFootprintFromGraphSameImportance) {
   Process* global_process = graph.shared_memory_graph();
   Node* global_node = global_process->CreateNode(kEmptyId, "global/1", false);
@@ -24,6 +24,7 @@ namespace trace_processor {
 
 namespace {
 
+using ::testing::ElementsAre;
 using Node = GlobalNodeGraph::Node;
 using Process = GlobalNodeGraph::Process;
 
@@ -88,6 +89,14 @@ TEST(GlobalNodeGraphTest, VisitInDepthFirstPostOrder) {
   ASSERT_EQ(iterator.next(), c3);
   ASSERT_EQ(iterator.next(), process_2->root());
   ASSERT_EQ(iterator.next(), nullptr);
+
+  // The nodes are returned in the same order by each traversal.
+  for (int i = 0; i < 2; i++) {
+    ASSERT_THAT(graph.NodesInDepthFirstPostOrder(),
+                ElementsAre(graph.shared_memory_graph()->root(), c1, c2_c1,
+                            c3_c2, c2_c2, c2, process_1->root(), c3_c1, c3,
+                            process_2->root()));
+  }
 }
 
 TEST(GlobalNodeGraphTest, VisitInDepthFirstPreOrder) {
@@ -121,6 +130,14 @@ TEST(GlobalNodeGraphTest, VisitInDepthFirstPreOrder) {
   ASSERT_EQ(iterator.next(), c3_c2);
   ASSERT_EQ(iterator.next(), c2_c2);
   ASSERT_EQ(iterator.next(), nullptr);
+
+  // The nodes are returned in the same order by each traversal.
+  for (int i = 0; i < 2; i++) {
+    ASSERT_THAT(graph.NodesInDepthFirstPreOrder(),
+                ElementsAre(graph.shared_memory_graph()->root(),
+                            process_1->root(), c1, c2, c2_c1,
+                            process_2->root(), c3, c3_c1, c3_c2, c2_c2));
+  }
 }
 
 TEST(ProcessTest, CreateAndFindNode) {
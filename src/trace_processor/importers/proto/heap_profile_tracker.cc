@@ -26,26 +26,20 @@
 namespace perfetto {
 namespace trace_processor {
 
-namespace {
-struct MergedCallsite {
-  StringId frame_name;
-  StringId mapping_name;
-  base::Optional<uint32_t> parent_idx;
-  bool operator<(const MergedCallsite& o) const {
-    return std::tie(frame_name, mapping_name, parent_idx) <
-           std::tie(o.frame_name, o.mapping_name, o.parent_idx);
-  }
-};
+NativeFlamegraphBuilder::NativeFlamegraphBuilder(TraceStorage* storage)
+    : storage_(storage) {}
+
+NativeFlamegraphBuilder::~NativeFlamegraphBuilder() = default;
 
-std::vector<MergedCallsite> GetMergedCallsites(TraceStorage* storage,
-                                               uint32_t callstack_row) {
+std::vector<NativeFlamegraphBuilder::MergedCallsite>
+NativeFlamegraphBuilder::GetMergedCallsites(uint32_t callstack_row) {
   const tables::StackProfileCallsiteTable& callsites_tbl =
-      storage->stack_profile_callsite_table();
+      storage_->stack_profile_callsite_table();
   const tables::StackProfileFrameTable& frames_tbl =
-      storage->stack_profile_frame_table();
-  const tables::SymbolTable& symbols_tbl = storage->symbol_table();
+      storage_->stack_profile_frame_table();
+  const tables::SymbolTable& symbols_tbl = storage_->symbol_table();
   const tables::StackProfileMappingTable& mapping_tbl =
-      storage->stack_profile_mapping_table();
+      storage_->stack_profile_mapping_table();
 
   uint32_t frame_idx =
       *frames_tbl.id().IndexOf(callsites_tbl.frame_id()[callstack_row]);
@@ -80,31 +74,47 @@ std::vector<MergedCallsite> GetMergedCallsites(TraceStorage* storage,
   std::reverse(result.begin(), result.end());
   return result;
 }
-}  // namespace
-
-std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> BuildNativeFlamegraph(
-    TraceStorage* storage,
-    UniquePid upid,
-    int64_t timestamp) {
-  const tables::HeapProfileAllocationTable& allocation_tbl =
-      storage->heap_profile_allocation_table();
-  const tables::StackProfileCallsiteTable& callsites_tbl =
-      storage->stack_profile_callsite_table();
-
-  StringId profile_type = storage->InternString("native");
 
-  std::vector<uint32_t> callsite_to_merged_callsite(callsites_tbl.row_count(),
-                                                    0);
-  std::map<MergedCallsite, uint32_t> merged_callsites_to_table_idx;
+bool NativeFlamegraphBuilder::FramesChanged() const {
+  const tables::StackProfileFrameTable& frames_tbl =
+      storage_->stack_profile_frame_table();
+  for (uint32_t i = 0; i < frame_symbol_set_ids_.size(); ++i) {
+    if (frames_tbl.symbol_set_id()[i] != frame_symbol_set_ids_[i] ||
+        frames_tbl.deobfuscated_name()[i] != frame_deobfuscated_names_[i]) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl(
-      new tables::ExperimentalFlamegraphNodesTable(
-          storage->mutable_string_pool(), nullptr));
+bool NativeFlamegraphBuilder::UpdateTree() {
+  const tables::StackProfileCallsiteTable& callsites_tbl =
+      storage_->stack_profile_callsite_table();
+  const tables::StackProfileFrameTable& frames_tbl =
+      storage_->stack_profile_frame_table();
+
+  bool rebuild = FramesChanged();
+  if (!rebuild && callsite_to_node_.size() == callsites_tbl.row_count())
+    return false;
+
+  if (rebuild) {
+    nodes_.clear();
+    merged_callsites_to_node_.clear();
+    callsite_to_node_.clear();
+    frame_symbol_set_ids_.clear();
+    frame_deobfuscated_names_.clear();
+  }
+  for (uint32_t i = static_cast<uint32_t>(frame_symbol_set_ids_.size());
+       i < frames_tbl.row_count(); ++i) {
+    frame_symbol_set_ids_.push_back(frames_tbl.symbol_set_id()[i]);
+    frame_deobfuscated_names_.push_back(frames_tbl.deobfuscated_name()[i]);
+  }
 
   // FORWARD PASS:
   // Aggregate callstacks by frame name / mapping name. Use symbolization
-  // data.
-  for (uint32_t i = 0; i < callsites_tbl.row_count(); ++i) {
+  // data. Only the callsites added since the last update are visited.
+  for (uint32_t i = static_cast<uint32_t>(callsite_to_node_.size());
+       i < callsites_tbl.row_count(); ++i) {
     base::Optional<uint32_t> parent_idx;
 
     auto opt_parent_id = callsites_tbl.parent_id()[i];
@@ -112,52 +122,65 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> BuildNativeFlamegraph(
       parent_idx = callsites_tbl.id().IndexOf(*opt_parent_id);
       // Make sure what we index into has been populated already.
       PERFETTO_CHECK(*parent_idx < i);
-      parent_idx = callsite_to_merged_callsite[*parent_idx];
+      parent_idx = callsite_to_node_[*parent_idx];
     }
 
-    auto callsites = GetMergedCallsites(storage, i);
+    auto callsites = GetMergedCallsites(i);
     // Loop below needs to run at least once for parent_idx to get updated.
     PERFETTO_CHECK(!callsites.empty());
     for (MergedCallsite& merged_callsite : callsites) {
       merged_callsite.parent_idx = parent_idx;
-      auto it = merged_callsites_to_table_idx.find(merged_callsite);
-      if (it == merged_callsites_to_table_idx.end()) {
-        std::tie(it, std::ignore) = merged_callsites_to_table_idx.emplace(
-            merged_callsite, merged_callsites_to_table_idx.size());
-        tables::ExperimentalFlamegraphNodesTable::Row row{};
-        if (parent_idx) {
-          row.depth = tbl->depth()[*parent_idx] + 1;
-        } else {
-          row.depth = 0;
-        }
-        row.ts = timestamp;
-        row.upid = upid;
-        row.profile_type = profile_type;
-        row.name = merged_callsite.frame_name;
-        row.map_name = merged_callsite.mapping_name;
-        if (parent_idx)
-          row.parent_id = tbl->id()[*parent_idx];
-
-        parent_idx = tbl->Insert(std::move(row)).row;
-        PERFETTO_CHECK(merged_callsites_to_table_idx.size() ==
-                       tbl->row_count());
+      auto it = merged_callsites_to_node_.find(merged_callsite);
+      if (it == merged_callsites_to_node_.end()) {
+        std::tie(it, std::ignore) = merged_callsites_to_node_.emplace(
+            merged_callsite, static_cast<uint32_t>(nodes_.size()));
+        Node node;
+        node.name = merged_callsite.frame_name;
+        node.map_name = merged_callsite.mapping_name;
+        node.parent_idx = parent_idx;
+        node.depth = parent_idx ? nodes_[*parent_idx].depth + 1 : 0;
+        nodes_.push_back(node);
+        PERFETTO_CHECK(merged_callsites_to_node_.size() == nodes_.size());
       }
       parent_idx = it->second;
     }
 
     PERFETTO_CHECK(parent_idx);
-    callsite_to_merged_callsite[i] = *parent_idx;
+    callsite_to_node_.push_back(*parent_idx);
   }
+  return true;
+}
+
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+NativeFlamegraphBuilder::Build(UniquePid upid,
+                               base::Optional<int64_t> start_ts,
+                               int64_t end_ts) {
+  const tables::HeapProfileAllocationTable& allocation_tbl =
+      storage_->heap_profile_allocation_table();
+  const tables::StackProfileCallsiteTable& callsites_tbl =
+      storage_->stack_profile_callsite_table();
+
+  UpdateTree();
 
   // PASS OVER ALLOCATIONS:
-  // Aggregate allocations into the newly built tree.
-  auto filtered = allocation_tbl.Filter(
-      {allocation_tbl.ts().le(timestamp), allocation_tbl.upid().eq(upid)});
+  // Aggregate allocations into the tree.
+  std::vector<Constraint> cs{allocation_tbl.ts().le(end_ts),
+                             allocation_tbl.upid().eq(upid)};
+  if (start_ts)
+    cs.push_back(allocation_tbl.ts().gt(*start_ts));
+  auto filtered = allocation_tbl.Filter(cs);
 
   if (filtered.row_count() == 0) {
     return nullptr;
   }
 
+  struct Counts {
+    int64_t size = 0;
+    int64_t count = 0;
+    int64_t alloc_size = 0;
+    int64_t alloc_count = 0;
+  };
+  std::vector<Counts> self(nodes_.size());
   for (auto it = filtered.IterateRows(); it; it.Next()) {
     int64_t size =
         it.Get(static_cast<uint32_t>(
@@ -174,64 +197,72 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> BuildNativeFlamegraph(
             .long_value;
 
     PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
-    uint32_t merged_idx =
-        callsite_to_merged_callsite[*callsites_tbl.id().IndexOf(
-            CallsiteId(static_cast<uint32_t>(callsite_id)))];
+    Counts& node = self[callsite_to_node_[*callsites_tbl.id().IndexOf(
+        CallsiteId(static_cast<uint32_t>(callsite_id)))]];
     // On old heapprofd producers, the count field is incorrectly set and we
     // zero it in proto_trace_parser.cc.
     // As such, we cannot depend on count == 0 to imply size == 0, so we check
     // for both of them separately.
-    if (size > 0) {
-      tbl->mutable_alloc_size()->Set(merged_idx,
-                                     tbl->alloc_size()[merged_idx] + size);
-    }
-    if (count > 0) {
-      tbl->mutable_alloc_count()->Set(merged_idx,
-                                      tbl->alloc_count()[merged_idx] + count);
-    }
-
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + size);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + count);
+    if (size > 0)
+      node.alloc_size += size;
+    if (count > 0)
+      node.alloc_count += count;
+    node.size += size;
+    node.count += count;
   }
 
   // BACKWARD PASS:
   // Propagate sizes to parents.
-  for (int64_t i = tbl->row_count() - 1; i >= 0; --i) {
-    uint32_t idx = static_cast<uint32_t>(i);
-
-    tbl->mutable_cumulative_size()->Set(
-        idx, tbl->cumulative_size()[idx] + tbl->size()[idx]);
-    tbl->mutable_cumulative_count()->Set(
-        idx, tbl->cumulative_count()[idx] + tbl->count()[idx]);
-
-    tbl->mutable_cumulative_alloc_size()->Set(
-        idx, tbl->cumulative_alloc_size()[idx] + tbl->alloc_size()[idx]);
-    tbl->mutable_cumulative_alloc_count()->Set(
-        idx, tbl->cumulative_alloc_count()[idx] + tbl->alloc_count()[idx]);
-
-    auto parent = tbl->parent_id()[idx];
-    if (parent) {
-      uint32_t parent_idx = *tbl->id().IndexOf(
-          tables::ExperimentalFlamegraphNodesTable::Id(*parent));
-      tbl->mutable_cumulative_size()->Set(
-          parent_idx,
-          tbl->cumulative_size()[parent_idx] + tbl->cumulative_size()[idx]);
-      tbl->mutable_cumulative_count()->Set(
-          parent_idx,
-          tbl->cumulative_count()[parent_idx] + tbl->cumulative_count()[idx]);
-
-      tbl->mutable_cumulative_alloc_size()->Set(
-          parent_idx, tbl->cumulative_alloc_size()[parent_idx] +
-                          tbl->cumulative_alloc_size()[idx]);
-      tbl->mutable_cumulative_alloc_count()->Set(
-          parent_idx, tbl->cumulative_alloc_count()[parent_idx] +
-                          tbl->cumulative_alloc_count()[idx]);
-    }
+  std::vector<Counts> cumulative(self);
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    auto parent_idx = nodes_[i].parent_idx;
+    if (!parent_idx)
+      continue;
+    Counts& parent = cumulative[*parent_idx];
+    parent.size += cumulative[i].size;
+    parent.count += cumulative[i].count;
+    parent.alloc_size += cumulative[i].alloc_size;
+    parent.alloc_count += cumulative[i].alloc_count;
   }
 
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl(
+      new tables::ExperimentalFlamegraphNodesTable(
+          storage_->mutable_string_pool(), nullptr));
+  StringId profile_type = storage_->InternString("native");
+  for (uint32_t i = 0; i < nodes_.size(); ++i) {
+    const Node& node = nodes_[i];
+    tables::ExperimentalFlamegraphNodesTable::Row row{};
+    row.ts = end_ts;
+    row.upid = upid;
+    row.profile_type = profile_type;
+    row.depth = node.depth;
+    row.name = node.name;
+    row.map_name = node.map_name;
+    // The nodes are inserted in order so the index of a node is its id.
+    if (node.parent_idx)
+      row.parent_id = tables::ExperimentalFlamegraphNodesTable::Id(
+          *node.parent_idx);
+    row.size = self[i].size;
+    row.count = self[i].count;
+    row.alloc_size = self[i].alloc_size;
+    row.alloc_count = self[i].alloc_count;
+    row.cumulative_size = cumulative[i].size;
+    row.cumulative_count = cumulative[i].count;
+    row.cumulative_alloc_size = cumulative[i].alloc_size;
+    row.cumulative_alloc_count = cumulative[i].alloc_count;
+    tbl->Insert(std::move(row));
+  }
   return tbl;
 }
 
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> BuildNativeFlamegraph(
+    TraceStorage* storage,
+    UniquePid upid,
+    int64_t timestamp) {
+  return NativeFlamegraphBuilder(storage).Build(upid, base::nullopt,
+                                                timestamp);
+}
+
 HeapProfileTracker::HeapProfileTracker(TraceProcessorContext* context)
     : context_(context), empty_(context_->storage->InternString({"", 0})) {}
 
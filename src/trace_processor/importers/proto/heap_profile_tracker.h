@@ -17,8 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_HEAP_PROFILE_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_HEAP_PROFILE_TRACKER_H_
 
+#include <map>
 #include <set>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/importers/proto/stack_profile_tracker.h"
@@ -27,6 +30,67 @@
 namespace perfetto {
 namespace trace_processor {
 
+// Builds the flamegraphs of the native heap profiles.
+//
+// All the flamegraphs of a trace are built on the same tree, made of the
+// callsites merged by frame and mapping name, which only depends on the
+// callsite, frame and symbol tables. The builder keeps this tree across calls:
+// it is extended with the callsites added since the previous call and is only
+// rebuilt when existing frames got symbolized or deobfuscated.
+class NativeFlamegraphBuilder {
+ public:
+  explicit NativeFlamegraphBuilder(TraceStorage* storage);
+  ~NativeFlamegraphBuilder();
+
+  // Returns the flamegraph of the allocations of |upid| with
+  // |start_ts| < ts <= |end_ts|, or nullptr if there are none.
+  // Without |start_ts|, this is the state of the heap at |end_ts|. With it,
+  // this is the difference between the states of the heap at |start_ts| and
+  // at |end_ts|.
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> Build(
+      UniquePid upid,
+      base::Optional<int64_t> start_ts,
+      int64_t end_ts);
+
+  // Brings the tree up to date with the storage. Returns true if the tree has
+  // changed since the previous call (and so the flamegraphs built before).
+  bool UpdateTree();
+
+ private:
+  struct MergedCallsite {
+    StringId frame_name;
+    StringId mapping_name;
+    base::Optional<uint32_t> parent_idx;
+    bool operator<(const MergedCallsite& o) const {
+      return std::tie(frame_name, mapping_name, parent_idx) <
+             std::tie(o.frame_name, o.mapping_name, o.parent_idx);
+    }
+  };
+  struct Node {
+    StringId name;
+    StringId map_name;
+    base::Optional<uint32_t> parent_idx;
+    uint32_t depth;
+  };
+
+  std::vector<MergedCallsite> GetMergedCallsites(uint32_t callstack_row);
+  bool FramesChanged() const;
+
+  TraceStorage* const storage_;
+
+  // The nodes of the tree, parents before their children.
+  std::vector<Node> nodes_;
+  std::map<MergedCallsite, uint32_t> merged_callsites_to_node_;
+
+  // The node of each row of the callsite table already added to the tree.
+  std::vector<uint32_t> callsite_to_node_;
+
+  // The symbols and deobfuscated name of each row of the frame table when the
+  // tree was built, to detect when they changed.
+  std::vector<base::Optional<uint32_t>> frame_symbol_set_ids_;
+  std::vector<base::Optional<StringId>> frame_deobfuscated_names_;
+};
+
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
 BuildNativeFlamegraph(TraceStorage* storage, UniquePid upid, int64_t timestamp);
 
@@ -346,6 +346,113 @@ TEST(HeapProfileTrackerTest, Functional) {
   hpt->FinalizeProfile(kDefaultSequence, spt.get(), nullptr);
 }
 
+class NativeFlamegraphBuilderTest : public ::testing::Test {
+ public:
+  NativeFlamegraphBuilderTest() : builder_(&storage_) {
+    tables::StackProfileMappingTable::Row mapping{};
+    mapping.name = storage_.InternString("libfoo.so");
+    mapping_ =
+        storage_.mutable_stack_profile_mapping_table()->Insert(mapping).id;
+  }
+
+ protected:
+  FrameId AddFrame(const char* name) {
+    tables::StackProfileFrameTable::Row frame{};
+    frame.name = storage_.InternString(name);
+    frame.mapping = mapping_;
+    return storage_.mutable_stack_profile_frame_table()->Insert(frame).id;
+  }
+
+  CallsiteId AddCallsite(base::Optional<CallsiteId> parent, FrameId frame) {
+    const auto& callsites = storage_.stack_profile_callsite_table();
+    tables::StackProfileCallsiteTable::Row callsite{};
+    callsite.depth =
+        parent ? callsites.depth()[*callsites.id().IndexOf(*parent)] + 1 : 0;
+    callsite.parent_id = parent;
+    callsite.frame_id = frame;
+    return storage_.mutable_stack_profile_callsite_table()->Insert(callsite).id;
+  }
+
+  void AddAllocation(int64_t ts, CallsiteId callsite, int64_t size) {
+    tables::HeapProfileAllocationTable::Row alloc{};
+    alloc.ts = ts;
+    alloc.upid = kUpid;
+    alloc.callsite_id = callsite;
+    alloc.count = size > 0 ? 1 : -1;
+    alloc.size = size;
+    storage_.mutable_heap_profile_allocation_table()->Insert(alloc);
+  }
+
+  // Returns "name size cumulative_size" for each node of the flamegraph.
+  std::vector<std::string> Describe(
+      const std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>& tbl) {
+    std::vector<std::string> nodes;
+    for (uint32_t i = 0; i < tbl->row_count(); ++i) {
+      nodes.push_back(tbl->name().GetString(i).ToStdString() + " " +
+                      std::to_string(tbl->size()[i]) + " " +
+                      std::to_string(tbl->cumulative_size()[i]));
+    }
+    return nodes;
+  }
+
+  static constexpr UniquePid kUpid = 1;
+
+  TraceStorage storage_;
+  NativeFlamegraphBuilder builder_;
+  tables::StackProfileMappingTable::Id mapping_{0};
+};
+
+TEST_F(NativeFlamegraphBuilderTest, TimeRange) {
+  CallsiteId main = AddCallsite(base::nullopt, AddFrame("main"));
+  CallsiteId foo = AddCallsite(main, AddFrame("foo"));
+  CallsiteId bar = AddCallsite(main, AddFrame("bar"));
+  AddAllocation(1, foo, 10);
+  AddAllocation(2, bar, 5);
+  AddAllocation(3, foo, -10);
+
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 2)),
+              ElementsAre("main 0 15", "foo 10 10", "bar 5 5"));
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 3)),
+              ElementsAre("main 0 5", "foo 0 0", "bar 5 5"));
+
+  // The difference between the flamegraphs at 1 and 3.
+  EXPECT_THAT(Describe(builder_.Build(kUpid, 1, 3)),
+              ElementsAre("main 0 -5", "foo -10 -10", "bar 5 5"));
+
+  EXPECT_EQ(builder_.Build(kUpid, 3, 4), nullptr);
+  EXPECT_EQ(builder_.Build(kUpid + 1, base::nullopt, 3), nullptr);
+}
+
+TEST_F(NativeFlamegraphBuilderTest, NewCallsites) {
+  CallsiteId main = AddCallsite(base::nullopt, AddFrame("main"));
+  AddAllocation(1, AddCallsite(main, AddFrame("foo")), 10);
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 1)),
+              ElementsAre("main 0 10", "foo 10 10"));
+  EXPECT_FALSE(builder_.UpdateTree());
+
+  // A callsite with the same frame names as an existing one is merged into
+  // the existing node.
+  CallsiteId other_main = AddCallsite(base::nullopt, AddFrame("main"));
+  AddAllocation(2, AddCallsite(other_main, AddFrame("bar")), 5);
+  EXPECT_TRUE(builder_.UpdateTree());
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 2)),
+              ElementsAre("main 0 15", "foo 10 10", "bar 5 5"));
+}
+
+TEST_F(NativeFlamegraphBuilderTest, DeobfuscatedFrames) {
+  FrameId frame = AddFrame("a");
+  AddAllocation(1, AddCallsite(base::nullopt, frame), 10);
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 1)),
+              ElementsAre("a 10 10"));
+
+  auto* frames = storage_.mutable_stack_profile_frame_table();
+  frames->mutable_deobfuscated_name()->Set(*frames->id().IndexOf(frame),
+                                           storage_.InternString("Foo.bar"));
+  EXPECT_TRUE(builder_.UpdateTree());
+  EXPECT_THAT(Describe(builder_.Build(kUpid, base::nullopt, 1)),
+              ElementsAre("Foo.bar 10 10"));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
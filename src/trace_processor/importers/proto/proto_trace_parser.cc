@@ -44,6 +44,7 @@
 #include "src/trace_processor/importers/proto/profile_packet_utils.h"
 #include "src/trace_processor/importers/proto/profiler_util.h"
 #include "src/trace_processor/importers/proto/stack_profile_tracker.h"
+#include "src/trace_processor/importers/proto/track_event_module.h"
 #include "src/trace_processor/storage/metadata.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/tables/profiler_tables.h"
@@ -88,6 +89,16 @@ ProtoTraceParser::ProtoTraceParser(TraceProcessorContext* context)
 ProtoTraceParser::~ProtoTraceParser() = default;
 
 void ProtoTraceParser::ParseTracePacket(int64_t ts, TimestampedTracePiece ttp) {
+  if (ttp.type == TimestampedTracePiece::Type::kInlineTrackEvent) {
+    PERFETTO_DCHECK(context_->track_event_module);
+    auto sample = context_->storage->mutable_ingest_profile()->Sample(
+        IngestProfile::Phase::kParse,
+        protos::pbzero::TracePacket::kTrackEventFieldNumber, 0);
+    context_->track_event_module->ParseInlineTrackEvent(ttp);
+    context_->args_tracker->Flush();
+    return;
+  }
+
   const TracePacketData* data = nullptr;
   if (ttp.type == TimestampedTracePiece::Type::kTracePacket) {
     data = &ttp.packet_data;
@@ -134,6 +145,8 @@ void ProtoTraceParser::ParseTracePacketImpl(
   auto& modules = context_->modules_by_field;
   for (uint32_t field_id = 1; field_id < modules.size(); ++field_id) {
     if (!modules[field_id].empty() && packet.Get(field_id).valid()) {
+      auto sample = context_->storage->mutable_ingest_profile()->Sample(
+          IngestProfile::Phase::kParse, field_id, packet.Get(field_id).size());
       for (ProtoImporterModule* module : modules[field_id])
         module->ParsePacket(packet, ttp, field_id);
       return;
@@ -197,6 +210,12 @@ void ProtoTraceParser::ParseTraceStats(ConstBytes blob) {
                     static_cast<int64_t>(evt.chunks_discarded()));
   storage->SetStats(stats::traced_patches_discarded,
                     static_cast<int64_t>(evt.patches_discarded()));
+  storage->SetStats(stats::traced_deduplicated_packets,
+                    static_cast<int64_t>(evt.deduplicated_packets()));
+  storage->SetStats(stats::traced_deduplicated_bytes,
+                    static_cast<int64_t>(evt.deduplicated_bytes()));
+  storage->SetStats(stats::traced_flush_ipcs_skipped,
+                    static_cast<int64_t>(evt.flush_ipcs_skipped()));
 
   int buf_num = 0;
   for (auto it = evt.buffer_stats(); it; ++it, ++buf_num) {
@@ -221,6 +240,10 @@ void ProtoTraceParser::ParseTraceStats(ConstBytes blob) {
                              static_cast<int64_t>(buf.chunks_overwritten()));
     storage->SetIndexedStats(stats::traced_buf_chunks_discarded, buf_num,
                              static_cast<int64_t>(buf.chunks_discarded()));
+    storage->SetIndexedStats(stats::traced_buf_chunks_evicted, buf_num,
+                             static_cast<int64_t>(buf.chunks_evicted()));
+    storage->SetIndexedStats(stats::traced_buf_bytes_evicted, buf_num,
+                             static_cast<int64_t>(buf.bytes_evicted()));
     storage->SetIndexedStats(stats::traced_buf_chunks_read, buf_num,
                              static_cast<int64_t>(buf.chunks_read()));
     storage->SetIndexedStats(
@@ -661,6 +661,31 @@ TEST_F(ProtoTraceParserTest, LoadThreadPacket) {
   Tokenize();
 }
 
+TEST_F(ProtoTraceParserTest, DeduplicatedPackets) {
+  auto* packet = trace_->add_packet();
+  packet->set_trusted_packet_sequence_id(1);
+  packet->set_dedup_id(1);
+  auto* thread = packet->set_process_tree()->add_threads();
+  thread->set_tid(1);
+  thread->set_tgid(2);
+
+  packet = trace_->add_packet();
+  packet->set_trusted_packet_sequence_id(1);
+  packet->set_duplicate_of(1);
+
+  // References to packets not in the trace are dropped.
+  packet = trace_->add_packet();
+  packet->set_trusted_packet_sequence_id(1);
+  packet->set_duplicate_of(2);
+  packet = trace_->add_packet();
+  packet->set_trusted_packet_sequence_id(2);
+  packet->set_duplicate_of(1);
+
+  EXPECT_CALL(*process_, UpdateThread(1, 2)).Times(2);
+  Tokenize();
+  EXPECT_EQ(storage_->stats()[stats::packet_duplicate_of_missing].value, 2);
+}
+
 TEST_F(ProtoTraceParserTest, ProcessNameFromProcessDescriptor) {
   context_.sorter.reset(new TraceSorter(
       CreateParser(), std::numeric_limits<int64_t>::max() /*window size*/));
@@ -1539,6 +1564,107 @@ TEST_F(ProtoTraceParserTest, TrackEventWithTrackDescriptors) {
       storage_->thread_slice_table().thread_instruction_delta()[*id_1]);
 }
 
+TEST_F(ProtoTraceParserTest, TrackEventInlineSliceBeginEnd) {
+  context_.sorter.reset(new TraceSorter(
+      CreateParser(), std::numeric_limits<int64_t>::max() /*window size*/));
+
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+    packet->set_timestamp(1000000);
+    auto* track_desc = packet->set_track_descriptor();
+    track_desc->set_uuid(1234);
+    auto* thread_desc = track_desc->set_thread();
+    thread_desc->set_pid(15);
+    thread_desc->set_tid(16);
+  }
+  {
+    // Begin event which only references interned data: this takes the inline
+    // fast path.
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1010000);
+    auto* event = packet->set_track_event();
+    event->set_track_uuid(1234);
+    event->add_category_iids(1);
+    event->set_name_iid(1);
+    event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_BEGIN);
+
+    auto* interned_data = packet->set_interned_data();
+    auto cat1 = interned_data->add_event_categories();
+    cat1->set_iid(1);
+    cat1->set_name("cat1");
+    auto ev1 = interned_data->add_event_names();
+    ev1->set_iid(1);
+    ev1->set_name("ev1");
+  }
+  {
+    // Nested begin event with an unknown category iid.
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1011000);
+    auto* event = packet->set_track_event();
+    event->set_track_uuid(1234);
+    event->add_category_iids(2);
+    event->set_name_iid(1);
+    event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_BEGIN);
+  }
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1012000);
+    auto* event = packet->set_track_event();
+    event->set_track_uuid(1234);
+    event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_END);
+  }
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1020000);
+    auto* event = packet->set_track_event();
+    event->set_track_uuid(1234);
+    event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_END);
+  }
+
+  EXPECT_CALL(*process_,
+              UpdateThreadNameByUtid(1u, kNullStringId,
+                                     ThreadNamePriority::kTrackDescriptor));
+  EXPECT_CALL(*process_, UpdateThread(16, 15)).WillRepeatedly(Return(1));
+
+  tables::ThreadTable::Row t1(16);
+  t1.upid = 1u;
+  storage_->mutable_thread_table()->Insert(t1);
+
+  Tokenize();
+
+  InSequence in_sequence;  // Below slices should be sorted by timestamp.
+
+  EXPECT_CALL(*slice_, StartSlice(1010000, TrackId{0}, _, _))
+      .WillOnce(DoAll(IgnoreResult(InvokeArgument<3>()), Return(SliceId(0u))));
+  EXPECT_CALL(*slice_, StartSlice(1011000, TrackId{0}, _, _))
+      .WillOnce(DoAll(IgnoreResult(InvokeArgument<3>()), Return(SliceId(1u))));
+  EXPECT_CALL(*slice_,
+              End(1012000, TrackId{0}, kNullStringId, kNullStringId, _))
+      .WillOnce(Return(SliceId(1u)));
+  EXPECT_CALL(*slice_,
+              End(1020000, TrackId{0}, kNullStringId, kNullStringId, _))
+      .WillOnce(Return(SliceId(0u)));
+
+  context_.sorter->ExtractEventsForced();
+
+  EXPECT_EQ(storage_->thread_track_table().row_count(), 1u);
+  EXPECT_EQ(storage_->thread_track_table().utid()[0], 1u);
+
+  const auto& slices = storage_->thread_slice_table();
+  EXPECT_EQ(slices.row_count(), 2u);
+  EXPECT_EQ(slices.name().GetString(0), "ev1");
+  EXPECT_EQ(slices.category().GetString(0), "cat1");
+  EXPECT_EQ(slices.name().GetString(1), "ev1");
+  EXPECT_EQ(slices.category().GetString(1), "unknown(2)");
+  EXPECT_FALSE(slices.thread_ts()[0]);
+}
+
 TEST_F(ProtoTraceParserTest, TrackEventWithResortedCounterDescriptor) {
   context_.sorter.reset(new TraceSorter(
       CreateParser(), std::numeric_limits<int64_t>::max() /*window size*/));
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/proto/proto_trace_reader.h"
 
+#include <string.h>
+
 #include <string>
 
 #include "perfetto/base/build_config.h"
@@ -62,6 +64,31 @@ util::Status ProtoTraceReader::Parse(std::unique_ptr<uint8_t[]> owned_buf,
       [this](TraceBlobView packet) { return ParsePacket(std::move(packet)); });
 }
 
+util::Status ProtoTraceReader::ParseDuplicatePacket(
+    const protos::pbzero::TracePacket_Decoder& decoder,
+    const TraceBlobView& packet) {
+  auto it = dedup_packets_.find(std::make_pair(
+      decoder.trusted_packet_sequence_id(), decoder.duplicate_of()));
+  if (it == dedup_packets_.end()) {
+    context_->storage->IncrementStats(stats::packet_duplicate_of_missing);
+    return util::OkStatus();
+  }
+
+  // Rebuild the packet as the original one followed by the fields of the
+  // reference, minus duplicate_of. As the last occurrence of a field wins, the
+  // trusted fields of the reference override the ones of the original packet.
+  std::string expanded = it->second;
+  protozero::ProtoDecoder fields(packet.data(), packet.length());
+  for (auto f = fields.ReadField(); f.valid(); f = fields.ReadField()) {
+    if (f.id() != protos::pbzero::TracePacket::kDuplicateOfFieldNumber)
+      f.SerializeAndAppendTo(&expanded);
+  }
+
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[expanded.size()]);
+  memcpy(buf.get(), expanded.data(), expanded.size());
+  return ParsePacket(TraceBlobView(std::move(buf), 0, expanded.size()));
+}
+
 util::Status ProtoTraceReader::ParseExtensionDescriptor(ConstBytes descriptor) {
   protos::pbzero::ExtensionDescriptor::Decoder decoder(descriptor.data,
                                                        descriptor.size);
@@ -83,6 +110,19 @@ util::Status ProtoTraceReader::ParsePacket(TraceBlobView packet) {
   PERFETTO_CHECK(!decoder.has_compressed_packets());
 
   const uint32_t seq_id = decoder.trusted_packet_sequence_id();
+
+  if (PERFETTO_UNLIKELY(decoder.has_duplicate_of()))
+    return ParseDuplicatePacket(decoder, packet);
+  if (PERFETTO_UNLIKELY(decoder.has_dedup_id())) {
+    // Expanded duplicates carry the dedup_id of the original too: keep the
+    // original copy.
+    auto key = std::make_pair(seq_id, decoder.dedup_id());
+    if (dedup_packets_.find(key) == dedup_packets_.end()) {
+      dedup_packets_[key].assign(reinterpret_cast<const char*>(packet.data()),
+                                 packet.length());
+    }
+  }
+
   auto* state = GetIncrementalStateForPacketSequence(seq_id);
 
   uint32_t sequence_flags = decoder.sequence_flags();
@@ -210,6 +250,8 @@ util::Status ProtoTraceReader::ParsePacket(TraceBlobView packet) {
   auto& modules = context_->modules_by_field;
   for (uint32_t field_id = 1; field_id < modules.size(); ++field_id) {
     if (!modules[field_id].empty() && decoder.Get(field_id).valid()) {
+      auto sample = context_->storage->mutable_ingest_profile()->Sample(
+          IngestProfile::Phase::kTokenize, field_id, packet.length());
       for (ProtoImporterModule* module : modules[field_id]) {
         ModuleResult res = module->TokenizePacket(decoder, &packet, timestamp,
                                                   state, field_id);
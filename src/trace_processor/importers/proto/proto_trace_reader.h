@@ -19,7 +19,10 @@
 
 #include <stdint.h>
 
+#include <map>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/common/trace_blob_view.h"
@@ -64,6 +67,8 @@ class ProtoTraceReader : public ChunkedTraceReader {
  private:
   using ConstBytes = protozero::ConstBytes;
   util::Status ParsePacket(TraceBlobView);
+  util::Status ParseDuplicatePacket(const protos::pbzero::TracePacket_Decoder&,
+                                    const TraceBlobView& packet);
   util::Status ParseServiceEvent(int64_t ts, ConstBytes);
   util::Status ParseClockSnapshot(ConstBytes blob, uint32_t seq_id);
   void HandleIncrementalStateCleared(
@@ -96,6 +101,12 @@ class ProtoTraceReader : public ChunkedTraceReader {
   // Stores incremental state and references to interned data, e.g. for track
   // event protos.
   std::unique_ptr<ProtoIncrementalState> incremental_state;
+
+  // Copies of the packets with a dedup_id, keyed by sequence id and
+  // dedup_id, to expand the packets which refer to them with duplicate_of.
+  // They are copied rather than kept as TraceBlobViews, which would pin the
+  // whole chunk of the trace they belong to.
+  std::map<std::pair<uint32_t, uint64_t>, std::string> dedup_packets_;
 };
 
 }  // namespace trace_processor
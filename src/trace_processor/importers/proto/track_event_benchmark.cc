@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_processor_storage.h"
+
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
+#include "protos/perfetto/trace/track_event/thread_descriptor.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_descriptor.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace {
+
+using perfetto::protos::pbzero::TracePacket;
+using perfetto::protos::pbzero::TrackEvent;
+using perfetto::trace_processor::Config;
+using perfetto::trace_processor::TraceProcessorStorage;
+
+constexpr uint32_t kSequenceId = 1;
+constexpr uint64_t kTrackUuid = 1;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1024, 1024 * 512);
+  }
+}
+
+// Creates a trace with |num_slices| consecutive begin/end pairs on a single
+// thread track. If |with_debug_annotation| is set, every event carries one debug
+// annotation, which forces it through the full TrackEvent parser.
+std::vector<uint8_t> CreateTrace(int64_t num_slices,
+                                 bool with_debug_annotation) {
+  protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
+
+  auto* packet = trace->add_packet();
+  packet->set_trusted_packet_sequence_id(kSequenceId);
+  packet->set_sequence_flags(TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+  auto* track = packet->set_track_descriptor();
+  track->set_uuid(kTrackUuid);
+  auto* thread = track->set_thread();
+  thread->set_pid(1);
+  thread->set_tid(2);
+  auto* interned_data = packet->set_interned_data();
+  auto* event_name = interned_data->add_event_names();
+  event_name->set_iid(1);
+  event_name->set_name("slice");
+  auto* category = interned_data->add_event_categories();
+  category->set_iid(1);
+  category->set_name("cat");
+
+  int64_t ts = 1000;
+  for (int64_t i = 0; i < num_slices * 2; ++i) {
+    packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(kSequenceId);
+    packet->set_sequence_flags(TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+    packet->set_timestamp(static_cast<uint64_t>(ts++));
+    auto* event = packet->set_track_event();
+    event->set_type(i % 2 == 0 ? TrackEvent::TYPE_SLICE_BEGIN
+                               : TrackEvent::TYPE_SLICE_END);
+    event->set_track_uuid(kTrackUuid);
+    event->set_name_iid(1);
+    event->add_category_iids(1);
+    if (with_debug_annotation) {
+      auto* annotation = event->add_debug_annotations();
+      annotation->set_name("arg");
+      annotation->set_int_value(i);
+    }
+  }
+  return trace.SerializeAsArray();
+}
+
+void IngestTrace(benchmark::State& state, bool with_debug_annotation) {
+  std::vector<uint8_t> trace =
+      CreateTrace(state.range(0), with_debug_annotation);
+  for (auto _ : state) {
+    auto tp = TraceProcessorStorage::CreateInstance(Config());
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+    memcpy(buf.get(), trace.data(), trace.size());
+    auto status = tp->Parse(std::move(buf), trace.size());
+    PERFETTO_CHECK(status.ok());
+    tp->NotifyEndOfFile();
+    benchmark::DoNotOptimize(tp);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+
+}  // namespace
+
+// Begin/end events without arguments: these take the inline fast path.
+static void BM_TrackEventIngest_SliceBeginEnd(benchmark::State& state) {
+  IngestTrace(state, /*with_debug_annotation=*/false);
+}
+BENCHMARK(BM_TrackEventIngest_SliceBeginEnd)->Apply(BenchmarkArgs);
+
+// Same events with a debug annotation: these go through the full parser.
+static void BM_TrackEventIngest_SliceBeginEndWithArgs(
+    benchmark::State& state) {
+  IngestTrace(state, /*with_debug_annotation=*/true);
+}
+BENCHMARK(BM_TrackEventIngest_SliceBeginEndWithArgs)->Apply(BenchmarkArgs);
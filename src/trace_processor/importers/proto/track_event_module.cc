@@ -90,6 +90,12 @@ void TrackEventModule::ParsePacket(const TracePacket::Decoder& decoder,
   }
 }
 
+void TrackEventModule::ParseInlineTrackEvent(
+    const TimestampedTracePiece& ttp) {
+  PERFETTO_DCHECK(ttp.type == TimestampedTracePiece::Type::kInlineTrackEvent);
+  parser_.ParseInlineTrackEvent(ttp.timestamp, ttp.inline_track_event);
+}
+
 void TrackEventModule::OnIncrementalStateCleared(uint32_t packet_sequence_id) {
   track_event_tracker_->OnIncrementalStateCleared(packet_sequence_id);
 }
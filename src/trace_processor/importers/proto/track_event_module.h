@@ -45,6 +45,10 @@ class TrackEventModule : public ProtoImporterModule {
                    const TimestampedTracePiece& ttp,
                    uint32_t field_id) override;
 
+  // Parses a TrackEvent which was tokenized into an InlineTrackEvent rather
+  // than pushed to the sorter as a TracePacket.
+  void ParseInlineTrackEvent(const TimestampedTracePiece& ttp);
+
  private:
   std::unique_ptr<TrackEventTracker> track_event_tracker_;
   TrackEventTokenizer tokenizer_;
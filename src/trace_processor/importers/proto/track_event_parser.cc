@@ -148,6 +148,75 @@ base::Optional<base::Status> MaybeParseSourceLocation(
   return base::OkStatus();
 }
 
+// The track, thread and process that an event on a descriptor track belongs
+// to.
+struct DescriptorTrackAssociation {
+  TrackId track_id;
+  base::Optional<UniqueTid> utid;
+  base::Optional<UniquePid> upid;
+  // See EventImporter::legacy_passthrough_utid_.
+  base::Optional<UniqueTid> legacy_passthrough_utid;
+};
+
+DescriptorTrackAssociation AssociateWithDescriptorTrack(
+    TraceProcessorContext* context,
+    TrackEventTracker* track_event_tracker,
+    PacketSequenceState* sequence_state,
+    uint64_t track_uuid,
+    StringId name_id) {
+  TraceStorage* storage = context->storage.get();
+  ProcessTracker* procs = context->process_tracker.get();
+  DescriptorTrackAssociation association;
+
+  base::Optional<TrackId> opt_track_id =
+      track_event_tracker->GetDescriptorTrack(track_uuid, name_id);
+  if (!opt_track_id) {
+    track_event_tracker->ReserveDescriptorChildTrack(track_uuid,
+                                                     /*parent_uuid=*/0,
+                                                     name_id);
+    opt_track_id = track_event_tracker->GetDescriptorTrack(track_uuid, name_id);
+  }
+  association.track_id = *opt_track_id;
+
+  auto thread_track_row =
+      storage->thread_track_table().id().IndexOf(association.track_id);
+  if (thread_track_row) {
+    association.utid = storage->thread_track_table().utid()[*thread_track_row];
+    association.upid = storage->thread_table().upid()[*association.utid];
+    return association;
+  }
+
+  auto process_track_row =
+      storage->process_track_table().id().IndexOf(association.track_id);
+  if (process_track_row) {
+    association.upid =
+        storage->process_track_table().upid()[*process_track_row];
+    if (sequence_state->pid_and_tid_valid()) {
+      uint32_t pid = static_cast<uint32_t>(sequence_state->pid());
+      uint32_t tid = static_cast<uint32_t>(sequence_state->tid());
+      UniqueTid utid_candidate = procs->UpdateThread(tid, pid);
+      if (storage->thread_table().upid()[utid_candidate] == association.upid)
+        association.legacy_passthrough_utid = utid_candidate;
+    }
+    return association;
+  }
+
+  auto* tracks = storage->mutable_track_table();
+  auto track_index = tracks->id().IndexOf(association.track_id);
+  if (track_index) {
+    const StringPool::Id& id = tracks->name()[*track_index];
+    if (id.is_null())
+      tracks->mutable_name()->Set(*track_index, name_id);
+  }
+
+  if (sequence_state->pid_and_tid_valid()) {
+    uint32_t pid = static_cast<uint32_t>(sequence_state->pid());
+    uint32_t tid = static_cast<uint32_t>(sequence_state->tid());
+    association.legacy_passthrough_utid = procs->UpdateThread(tid, pid);
+  }
+  return association;
+}
+
 std::string SanitizeDebugAnnotationName(const std::string& raw_name) {
   std::string result = raw_name;
   std::replace(result.begin(), result.end(), '.', '_');
@@ -338,54 +407,13 @@ class TrackEventParser::EventImporter {
     //      TrackEvent types), or
     //   b) a default track.
     if (track_uuid_) {
-      base::Optional<TrackId> opt_track_id =
-          track_event_tracker_->GetDescriptorTrack(track_uuid_, name_id_);
-      if (!opt_track_id) {
-        track_event_tracker_->ReserveDescriptorChildTrack(track_uuid_,
-                                                          /*parent_uuid=*/0,
-                                                          name_id_);
-        opt_track_id =
-            track_event_tracker_->GetDescriptorTrack(track_uuid_, name_id_);
-      }
-      track_id_ = *opt_track_id;
-
-      auto thread_track_row =
-          storage_->thread_track_table().id().IndexOf(track_id_);
-      if (thread_track_row) {
-        utid_ = storage_->thread_track_table().utid()[*thread_track_row];
-        upid_ = storage_->thread_table().upid()[*utid_];
-      } else {
-        auto process_track_row =
-            storage_->process_track_table().id().IndexOf(track_id_);
-        if (process_track_row) {
-          upid_ = storage_->process_track_table().upid()[*process_track_row];
-          if (sequence_state_->state()->pid_and_tid_valid()) {
-            uint32_t pid =
-                static_cast<uint32_t>(sequence_state_->state()->pid());
-            uint32_t tid =
-                static_cast<uint32_t>(sequence_state_->state()->tid());
-            UniqueTid utid_candidate = procs->UpdateThread(tid, pid);
-            if (storage_->thread_table().upid()[utid_candidate] == upid_)
-              legacy_passthrough_utid_ = utid_candidate;
-          }
-        } else {
-          auto* tracks = context_->storage->mutable_track_table();
-          auto track_index = tracks->id().IndexOf(track_id_);
-          if (track_index) {
-            const StringPool::Id& id = tracks->name()[*track_index];
-            if (id.is_null())
-              tracks->mutable_name()->Set(*track_index, name_id_);
-          }
-
-          if (sequence_state_->state()->pid_and_tid_valid()) {
-            uint32_t pid =
-                static_cast<uint32_t>(sequence_state_->state()->pid());
-            uint32_t tid =
-                static_cast<uint32_t>(sequence_state_->state()->tid());
-            legacy_passthrough_utid_ = procs->UpdateThread(tid, pid);
-          }
-        }
-      }
+      DescriptorTrackAssociation association = AssociateWithDescriptorTrack(
+          context_, track_event_tracker_, sequence_state_->state(),
+          track_uuid_, name_id_);
+      track_id_ = association.track_id;
+      utid_ = association.utid;
+      upid_ = association.upid;
+      legacy_passthrough_utid_ = association.legacy_passthrough_utid;
     } else {
       bool pid_tid_state_valid = sequence_state_->state()->pid_and_tid_valid();
 
@@ -1695,6 +1723,45 @@ void TrackEventParser::ParseCounterDescriptor(
   counter_tracks->mutable_unit()->Set(track_idx, counter_unit_ids_[unit_index]);
 }
 
+void TrackEventParser::ParseInlineTrackEvent(int64_t ts,
+                                             const InlineTrackEvent& event) {
+  DescriptorTrackAssociation association = AssociateWithDescriptorTrack(
+      context_, track_event_tracker_, event.sequence_state, event.track_uuid,
+      event.name);
+
+  // Inline events don't carry any arguments of their own, so the only arg we
+  // may have to add is the one which the full parser adds for JSON export.
+  auto args_inserter = [this, &association](BoundInserter* inserter) {
+    if (association.legacy_passthrough_utid) {
+      inserter->AddArg(
+          legacy_event_passthrough_utid_id_,
+          Variadic::UnsignedInteger(*association.legacy_passthrough_utid),
+          ArgsTracker::UpdatePolicy::kSkipIfExists);
+    }
+  };
+
+  SliceTracker* slice_tracker = context_->slice_tracker.get();
+  if (event.type == TrackEvent::TYPE_SLICE_END) {
+    slice_tracker->End(ts, association.track_id, event.category, event.name,
+                       args_inserter);
+    return;
+  }
+
+  PERFETTO_DCHECK(event.type == TrackEvent::TYPE_SLICE_BEGIN);
+  if (association.utid) {
+    tables::ThreadSliceTable::Row row;
+    row.ts = ts;
+    row.track_id = association.track_id;
+    row.category = event.category;
+    row.name = event.name;
+    slice_tracker->BeginTyped(context_->storage->mutable_thread_slice_table(),
+                              row, args_inserter);
+  } else {
+    slice_tracker->Begin(ts, association.track_id, event.category, event.name,
+                         args_inserter);
+  }
+}
+
 void TrackEventParser::ParseTrackEvent(int64_t ts,
                                        TrackEventData* event_data,
                                        ConstBytes blob) {
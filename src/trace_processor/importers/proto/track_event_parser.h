@@ -60,6 +60,7 @@ class TrackEventParser {
   void ParseTrackEvent(int64_t ts,
                        TrackEventData* event_data,
                        protozero::ConstBytes);
+  void ParseInlineTrackEvent(int64_t ts, const InlineTrackEvent&);
 
  private:
   class EventImporter;
@@ -17,6 +17,7 @@
 #include "src/trace_processor/importers/proto/track_event_tokenizer.h"
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_writer.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/trace_blob_view.h"
@@ -29,6 +30,7 @@
 #include "src/trace_processor/trace_sorter.h"
 
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 #include "protos/perfetto/trace/track_event/chrome_process_descriptor.pbzero.h"
 #include "protos/perfetto/trace/track_event/chrome_thread_descriptor.pbzero.h"
@@ -43,7 +45,8 @@ namespace trace_processor {
 
 namespace {
 using protos::pbzero::CounterDescriptor;
-}
+using protos::pbzero::TrackEvent;
+}  // namespace
 
 TrackEventTokenizer::TrackEventTokenizer(TraceProcessorContext* context,
                                          TrackEventTracker* track_event_tracker)
@@ -209,8 +212,6 @@ void TrackEventTokenizer::TokenizeTrackEventPacket(
       state->current_generation()->GetTrackEventDefaults();
 
   int64_t timestamp;
-  std::unique_ptr<TrackEventData> data(
-      new TrackEventData(std::move(*packet_blob), state->current_generation()));
 
   // TODO(eseckler): Remove handling of timestamps relative to ThreadDescriptors
   // once all producers have switched to clock-domain timestamps (e.g.
@@ -250,6 +251,12 @@ void TrackEventTokenizer::TokenizeTrackEventPacket(
     return;
   }
 
+  if (MaybePushInlineTrackEvent(state, packet, field, defaults, timestamp))
+    return;
+
+  std::unique_ptr<TrackEventData> data(
+      new TrackEventData(std::move(*packet_blob), state->current_generation()));
+
   if (event.has_thread_time_delta_us()) {
     // Delta timestamps require a valid ThreadDescriptor packet since the last
     // packet loss.
@@ -349,6 +356,110 @@ void TrackEventTokenizer::TokenizeTrackEventPacket(
   context_->sorter->PushTrackEventPacket(timestamp, std::move(data));
 }
 
+bool TrackEventTokenizer::MaybePushInlineTrackEvent(
+    PacketSequenceState* state,
+    const protos::pbzero::TracePacket::Decoder& packet,
+    protozero::ConstBytes event,
+    protos::pbzero::TrackEventDefaults::Decoder* defaults,
+    int64_t timestamp) {
+  // ProtoTraceParser handles these fields itself before dispatching the packet
+  // to the modules, so the packet has to be kept around.
+  if (packet.has_chrome_events() || packet.has_deobfuscation_mapping())
+    return false;
+
+  int32_t type = TrackEvent::TYPE_UNSPECIFIED;
+  bool has_track_uuid = false;
+  uint64_t track_uuid = 0;
+  uint64_t name_iid = 0;
+  uint64_t category_iid = 0;
+  uint32_t category_count = 0;
+
+  // Rather than checking for the absence of every field which would add
+  // arguments, flows or counters, only allow the fields we know how to handle.
+  protozero::ProtoDecoder decoder(event.data, event.size);
+  for (auto f = decoder.ReadField(); f.valid(); f = decoder.ReadField()) {
+    if (f.type() != protozero::proto_utils::ProtoWireType::kVarInt)
+      return false;
+    switch (f.id()) {
+      case TrackEvent::kTypeFieldNumber:
+        type = f.as_int32();
+        break;
+      case TrackEvent::kTrackUuidFieldNumber:
+        has_track_uuid = true;
+        track_uuid = f.as_uint64();
+        break;
+      case TrackEvent::kNameIidFieldNumber:
+        name_iid = f.as_uint64();
+        break;
+      case TrackEvent::kCategoryIidsFieldNumber:
+        category_iid = f.as_uint64();
+        category_count++;
+        break;
+      case TrackEvent::kTimestampDeltaUsFieldNumber:
+      case TrackEvent::kTimestampAbsoluteUsFieldNumber:
+        // Already taken into account by the caller.
+        break;
+      default:
+        return false;
+    }
+  }
+
+  if (type != TrackEvent::TYPE_SLICE_BEGIN &&
+      type != TrackEvent::TYPE_SLICE_END) {
+    return false;
+  }
+
+  // Multiple categories are concatenated by the parser.
+  if (category_count > 1)
+    return false;
+
+  if (!has_track_uuid && defaults && defaults->has_track_uuid())
+    track_uuid = defaults->track_uuid();
+
+  // Events without a track uuid are associated with the default track or the
+  // legacy pid/tid track of the sequence, which is left to the parser.
+  if (!track_uuid)
+    return false;
+
+  PacketSequenceStateGeneration* generation =
+      state->current_generation().get();
+
+  StringId name_id = kNullStringId;
+  if (name_iid) {
+    auto* decoder = generation->LookupInternedMessage<
+        protos::pbzero::InternedData::kEventNamesFieldNumber,
+        protos::pbzero::EventName>(name_iid);
+    if (decoder)
+      name_id = context_->storage->InternString(decoder->name());
+  }
+
+  StringId category_id = kNullStringId;
+  if (category_count) {
+    auto* decoder = generation->LookupInternedMessage<
+        protos::pbzero::InternedData::kEventCategoriesFieldNumber,
+        protos::pbzero::EventCategory>(category_iid);
+    if (decoder) {
+      category_id = context_->storage->InternString(decoder->name());
+    } else {
+      char buffer[32];
+      base::StringWriter writer(buffer, sizeof(buffer));
+      writer.AppendLiteral("unknown(");
+      writer.AppendUnsignedInt(category_iid);
+      writer.AppendChar(')');
+      category_id = context_->storage->InternString(writer.GetStringView());
+    }
+  }
+
+  InlineTrackEvent inline_event;
+  inline_event.track_uuid = track_uuid;
+  inline_event.name = name_id;
+  inline_event.category = category_id;
+  inline_event.sequence_state = state;
+  inline_event.type = type;
+  context_->sorter->PushInlineTrackEvent(timestamp, inline_event);
+  return true;
+}
+
 template <typename T>
 base::Status TrackEventTokenizer::AddExtraCounterValues(
     TrackEventData& data,
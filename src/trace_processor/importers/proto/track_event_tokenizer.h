@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include "perfetto/protozero/field.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "src/trace_processor/importers/proto/proto_importer_module.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -31,6 +32,7 @@ class ChromeThreadDescriptor_Decoder;
 class ProcessDescriptor_Decoder;
 class ThreadDescriptor_Decoder;
 class TracePacket_Decoder;
+class TrackEventDefaults_Decoder;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -62,6 +64,15 @@ class TrackEventTokenizer {
   void TokenizeThreadDescriptor(
       PacketSequenceState* state,
       const protos::pbzero::ThreadDescriptor_Decoder&);
+  // Pushes |event| to the sorter as an InlineTrackEvent if it only begins or
+  // ends a slice on a descriptor track and carries no other data. Returns false
+  // if the event needs to go through the full TrackEventParser instead.
+  bool MaybePushInlineTrackEvent(
+      PacketSequenceState* state,
+      const protos::pbzero::TracePacket_Decoder& packet,
+      protozero::ConstBytes event,
+      protos::pbzero::TrackEventDefaults_Decoder* defaults,
+      int64_t timestamp);
   template <typename T>
   base::Status AddExtraCounterValues(
       TrackEventData& data,
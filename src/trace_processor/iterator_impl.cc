@@ -29,13 +29,15 @@ IteratorImpl::IteratorImpl(TraceProcessorImpl* trace_processor,
                            ScopedStmt stmt,
                            uint32_t column_count,
                            util::Status status,
-                           uint32_t sql_stats_row)
+                           uint32_t sql_stats_row,
+                           std::shared_ptr<QueryProfile> profile)
     : trace_processor_(trace_processor),
       db_(db),
       stmt_(std::move(stmt)),
       column_count_(column_count),
       status_(status),
-      sql_stats_row_(sql_stats_row) {}
+      sql_stats_row_(sql_stats_row),
+      profile_(std::move(profile)) {}
 
 IteratorImpl::~IteratorImpl() {
   if (trace_processor_) {
@@ -53,6 +55,21 @@ void IteratorImpl::RecordFirstNextInSqlStats() {
   sql_stats->RecordQueryFirstNext(sql_stats_row_, t_first_next.count());
 }
 
+int IteratorImpl::ProfiledStep() {
+  // The profile of an outer query being stepped (e.g. if this query is run by
+  // a function called by the outer query) is restored once this step is done.
+  QueryProfile* outer_profile = QueryProfile::SetActive(profile_.get());
+  int ret;
+  {
+    QueryProfile::ScopedCall call(profile_.get(), QueryProfile::kStatementId,
+                                  QueryProfile::Method::kNext);
+    ret = sqlite3_step(*stmt_);
+    call.set_returned_row(ret == SQLITE_ROW);
+  }
+  QueryProfile::SetActive(outer_profile);
+  return ret;
+}
+
 Iterator::Iterator(std::unique_ptr<IteratorImpl> iterator)
     : iterator_(std::move(iterator)) {}
 Iterator::~Iterator() = default;
@@ -80,5 +97,9 @@ util::Status Iterator::Status() {
   return iterator_->Status();
 }
 
+uint32_t Iterator::QueryId() {
+  return iterator_->sql_stats_row();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
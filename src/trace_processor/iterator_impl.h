@@ -28,6 +28,7 @@
 #include "perfetto/trace_processor/iterator.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/storage/query_profile.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -41,7 +42,8 @@ class IteratorImpl {
                ScopedStmt,
                uint32_t column_count,
                util::Status,
-               uint32_t sql_stats_row);
+               uint32_t sql_stats_row,
+               std::shared_ptr<QueryProfile> profile);
   ~IteratorImpl();
 
   IteratorImpl(IteratorImpl&) noexcept = delete;
@@ -61,7 +63,8 @@ class IteratorImpl {
     if (!status_.ok())
       return false;
 
-    int ret = sqlite3_step(*stmt_);
+    int ret = PERFETTO_LIKELY(!profile_) ? sqlite3_step(*stmt_)
+                                         : ProfiledStep();
     if (PERFETTO_UNLIKELY(ret != SQLITE_ROW && ret != SQLITE_DONE)) {
       status_ = util::ErrStatus("%s", sqlite3_errmsg(db_));
       return false;
@@ -108,6 +111,8 @@ class IteratorImpl {
 
   util::Status Status() { return status_; }
 
+  uint32_t sql_stats_row() const { return sql_stats_row_; }
+
  private:
   // Dummy function to pass to ScopedResource.
   static int DummyClose(TraceProcessorImpl*) { return 0; }
@@ -123,6 +128,9 @@ class IteratorImpl {
 
   void RecordFirstNextInSqlStats();
 
+  // Steps the statement with |profile_| active.
+  int ProfiledStep();
+
   ScopedTraceProcessor trace_processor_;
   sqlite3* db_ = nullptr;
   ScopedStmt stmt_;
@@ -131,6 +139,9 @@ class IteratorImpl {
 
   uint32_t sql_stats_row_ = 0;
   bool called_next_ = false;
+
+  // Set if the query is profiled.
+  std::shared_ptr<QueryProfile> profile_;
 };
 
 }  // namespace trace_processor
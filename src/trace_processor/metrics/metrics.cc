@@ -22,6 +22,7 @@
 
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/trace_processor/metrics/sql_metrics.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -69,12 +70,38 @@ SqlValue SqlValueFromSqliteValue(sqlite3_value* value) {
   return sql_value;
 }
 
+using Slices = std::vector<protozero::ScatteredHeapBuffer::Slice>;
+
+size_t SlicesSize(const Slices& slices) {
+  size_t size = 0;
+  for (const auto& slice : slices)
+    size += slice.size() - slice.unused_bytes();
+  return size;
+}
+
+// Copies the used part of |slices| to |dst| and returns the pointer past the
+// last byte written.
+uint8_t* CopySlices(const Slices& slices, uint8_t* dst) {
+  for (const auto& slice : slices) {
+    size_t used = slice.size() - slice.unused_bytes();
+    memcpy(dst, slice.start(), used);
+    dst += used;
+  }
+  return dst;
+}
+
+// Passes the ownership of |proto| to SQLite as the result of the function.
+void ResultSerializedProto(sqlite3_context* ctx, SerializedProto proto) {
+  sqlite3_result_blob(ctx, proto.data.release(), static_cast<int>(proto.size),
+                      free);
+}
+
 }  // namespace
 
 ProtoBuilder::ProtoBuilder(const ProtoDescriptor* descriptor)
     : descriptor_(descriptor) {}
 
-util::Status ProtoBuilder::AppendSqlValue(const std::string& field_name,
+util::Status ProtoBuilder::AppendSqlValue(base::StringView field_name,
                                           const SqlValue& value) {
   switch (value.type) {
     case SqlValue::kLong:
@@ -95,76 +122,102 @@ util::Status ProtoBuilder::AppendSqlValue(const std::string& field_name,
   PERFETTO_FATAL("For GCC");
 }
 
-util::Status ProtoBuilder::AppendLong(const std::string& field_name,
-                                      int64_t value,
-                                      bool is_inside_repeated) {
-  auto field = descriptor_->FindFieldByName(field_name);
-  if (!field) {
+util::Status ProtoBuilder::AppendLong(base::StringView field_name,
+                                      int64_t value) {
+  const FieldDescriptor* field = nullptr;
+  RETURN_IF_ERROR(FindField(field_name, &field));
+  return AppendLong(*field, value, false);
+}
+
+util::Status ProtoBuilder::AppendDouble(base::StringView field_name,
+                                        double value) {
+  const FieldDescriptor* field = nullptr;
+  RETURN_IF_ERROR(FindField(field_name, &field));
+  return AppendDouble(*field, value, false);
+}
+
+util::Status ProtoBuilder::AppendString(base::StringView field_name,
+                                        base::StringView value) {
+  const FieldDescriptor* field = nullptr;
+  RETURN_IF_ERROR(FindField(field_name, &field));
+  return AppendString(*field, value, false);
+}
+
+util::Status ProtoBuilder::AppendBytes(base::StringView field_name,
+                                       const uint8_t* ptr,
+                                       size_t size) {
+  const FieldDescriptor* field = nullptr;
+  RETURN_IF_ERROR(FindField(field_name, &field));
+  return AppendBytes(*field, ptr, size, false);
+}
+
+util::Status ProtoBuilder::FindField(base::StringView field_name,
+                                     const FieldDescriptor** field) const {
+  *field = descriptor_->FindFieldByName(field_name);
+  if (!*field) {
     return util::ErrStatus("Field with name %s not found in proto type %s",
-                           field_name.c_str(),
+                           field_name.ToStdString().c_str(),
                            descriptor_->full_name().c_str());
   }
+  return util::OkStatus();
+}
 
+util::Status ProtoBuilder::AppendLong(const FieldDescriptor& field,
+                                      int64_t value,
+                                      bool is_inside_repeated) {
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
-  if (field->is_repeated() && !is_inside_repeated) {
+  if (field.is_repeated() && !is_inside_repeated) {
     return util::ErrStatus(
         "Unexpected long value for repeated field %s in proto type %s",
-        field_name.c_str(), descriptor_->full_name().c_str());
+        field.name().c_str(), descriptor_->full_name().c_str());
   }
 
-  switch (field->type()) {
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_INT32:
     case FieldDescriptorProto::TYPE_INT64:
     case FieldDescriptorProto::TYPE_UINT32:
     case FieldDescriptorProto::TYPE_BOOL:
     case FieldDescriptorProto::TYPE_ENUM:
-      message_->AppendVarInt(field->number(), value);
+      message_->AppendVarInt(field.number(), value);
       break;
     case FieldDescriptorProto::TYPE_SINT32:
     case FieldDescriptorProto::TYPE_SINT64:
-      message_->AppendSignedVarInt(field->number(), value);
+      message_->AppendSignedVarInt(field.number(), value);
       break;
     case FieldDescriptorProto::TYPE_FIXED32:
     case FieldDescriptorProto::TYPE_SFIXED32:
     case FieldDescriptorProto::TYPE_FIXED64:
     case FieldDescriptorProto::TYPE_SFIXED64:
-      message_->AppendFixed(field->number(), value);
+      message_->AppendFixed(field.number(), value);
       break;
     default: {
       return util::ErrStatus(
           "Tried to write value of type long into field %s (in proto type %s) "
           "which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return util::OkStatus();
 }
 
-util::Status ProtoBuilder::AppendDouble(const std::string& field_name,
+util::Status ProtoBuilder::AppendDouble(const FieldDescriptor& field,
                                         double value,
                                         bool is_inside_repeated) {
-  auto field = descriptor_->FindFieldByName(field_name);
-  if (!field) {
-    return util::ErrStatus("Field with name %s not found in proto type %s",
-                           field_name.c_str(),
-                           descriptor_->full_name().c_str());
-  }
-
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
-  if (field->is_repeated() && !is_inside_repeated) {
+  if (field.is_repeated() && !is_inside_repeated) {
     return util::ErrStatus(
         "Unexpected double value for repeated field %s in proto type %s",
-        field_name.c_str(), descriptor_->full_name().c_str());
+        field.name().c_str(), descriptor_->full_name().c_str());
   }
 
-  switch (field->type()) {
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_FLOAT:
     case FieldDescriptorProto::TYPE_DOUBLE: {
-      if (field->type() == FieldDescriptorProto::TYPE_FLOAT) {
-        message_->AppendFixed(field->number(), static_cast<float>(value));
+      if (field.type() == FieldDescriptorProto::TYPE_FLOAT) {
+        message_->AppendFixed(field.number(), static_cast<float>(value));
       } else {
-        message_->AppendFixed(field->number(), value);
+        message_->AppendFixed(field.number(), value);
       }
       break;
     }
@@ -172,63 +225,49 @@ util::Status ProtoBuilder::AppendDouble(const std::string& field_name,
       return util::ErrStatus(
           "Tried to write value of type double into field %s (in proto type "
           "%s) which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return util::OkStatus();
 }
 
-util::Status ProtoBuilder::AppendString(const std::string& field_name,
+util::Status ProtoBuilder::AppendString(const FieldDescriptor& field,
                                         base::StringView data,
                                         bool is_inside_repeated) {
-  const FieldDescriptor* field = descriptor_->FindFieldByName(field_name);
-  if (!field) {
-    return util::ErrStatus("Field with name %s not found in proto type %s",
-                           field_name.c_str(),
-                           descriptor_->full_name().c_str());
-  }
-
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
-  if (field->is_repeated() && !is_inside_repeated) {
+  if (field.is_repeated() && !is_inside_repeated) {
     return util::ErrStatus(
         "Unexpected string value for repeated field %s in proto type %s",
-        field_name.c_str(), descriptor_->full_name().c_str());
+        field.name().c_str(), descriptor_->full_name().c_str());
   }
 
-  switch (field->type()) {
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_STRING: {
-      message_->AppendBytes(field->number(), data.data(), data.size());
+      message_->AppendBytes(field.number(), data.data(), data.size());
       break;
     }
     default: {
       return util::ErrStatus(
           "Tried to write value of type string into field %s (in proto type "
           "%s) which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return util::OkStatus();
 }
 
-util::Status ProtoBuilder::AppendBytes(const std::string& field_name,
+util::Status ProtoBuilder::AppendBytes(const FieldDescriptor& field,
                                        const uint8_t* ptr,
                                        size_t size,
                                        bool is_inside_repeated) {
-  const FieldDescriptor* field = descriptor_->FindFieldByName(field_name);
-  if (!field) {
-    return util::ErrStatus("Field with name %s not found in proto type %s",
-                           field_name.c_str(),
-                           descriptor_->full_name().c_str());
-  }
-
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
-  if (field->is_repeated() && !is_inside_repeated)
-    return AppendRepeated(*field, ptr, size);
+  if (field.is_repeated() && !is_inside_repeated)
+    return AppendRepeated(field, ptr, size);
 
-  if (field->type() == FieldDescriptorProto::TYPE_MESSAGE)
-    return AppendSingleMessage(*field, ptr, size);
+  if (field.type() == FieldDescriptorProto::TYPE_MESSAGE)
+    return AppendSingleMessage(field, ptr, size);
 
   if (size == 0) {
     return util::ErrStatus(
@@ -236,13 +275,13 @@ util::Status ProtoBuilder::AppendBytes(const std::string& field_name,
         "%s). Nulls are only supported for message protos; all other types "
         "should ensure that nulls are not passed to proto builder functions by "
         "using the SQLite IFNULL/COALESCE functions.",
-        field->name().c_str(), descriptor_->full_name().c_str());
+        field.name().c_str(), descriptor_->full_name().c_str());
   }
 
   return util::ErrStatus(
       "Tried to write value of type bytes into field %s (in proto type %s) "
       "which has type %d",
-      field->name().c_str(), descriptor_->full_name().c_str(), field->type());
+      field.name().c_str(), descriptor_->full_name().c_str(), field.type());
 }
 
 util::Status ProtoBuilder::AppendSingleMessage(const FieldDescriptor& field,
@@ -273,10 +312,11 @@ util::Status ProtoBuilder::AppendSingleMessage(const FieldDescriptor& field,
                            field.name().c_str(), field.type(), single.type());
   }
 
-  auto actual_type_name = single.type_name().ToStdString();
-  if (actual_type_name != field.resolved_type_name()) {
+  base::StringView actual_type_name(single.type_name());
+  if (actual_type_name != base::StringView(field.resolved_type_name())) {
     return util::ErrStatus("Field %s has wrong type (expected %s, was %s)",
-                           field.name().c_str(), actual_type_name.c_str(),
+                           field.name().c_str(),
+                           actual_type_name.ToStdString().c_str(),
                            field.resolved_type_name().c_str());
   }
 
@@ -313,15 +353,15 @@ util::Status ProtoBuilder::AppendRepeated(const FieldDescriptor& field,
     protos::pbzero::RepeatedBuilderResult::Value::Decoder value(*it);
     util::Status status;
     if (value.has_int_value()) {
-      status = AppendLong(field.name(), value.int_value(), true);
+      status = AppendLong(field, value.int_value(), true);
     } else if (value.has_double_value()) {
-      status = AppendDouble(field.name(), value.double_value(), true);
+      status = AppendDouble(field, value.double_value(), true);
     } else if (value.has_string_value()) {
-      status = AppendString(field.name(),
-                            base::StringView(value.string_value()), true);
+      status =
+          AppendString(field, base::StringView(value.string_value()), true);
     } else if (value.has_bytes_value()) {
       const auto& bytes = value.bytes_value();
-      status = AppendBytes(field.name(), bytes.data, bytes.size, true);
+      status = AppendBytes(field, bytes.data, bytes.size, true);
     } else {
       status = util::ErrStatus("Unknown type in repeated field");
     }
@@ -332,27 +372,82 @@ util::Status ProtoBuilder::AppendRepeated(const FieldDescriptor& field,
   return util::OkStatus();
 }
 
-std::vector<uint8_t> ProtoBuilder::SerializeToProtoBuilderResult() {
-  std::vector<uint8_t> serialized = SerializeRaw();
-  if (serialized.empty())
-    return serialized;
-
-  const auto& type_name = descriptor_->full_name();
-
-  protozero::HeapBuffered<protos::pbzero::ProtoBuilderResult> result;
-  result->set_is_repeated(false);
-
-  auto* single = result->set_single();
-  single->set_type(protos::pbzero::FieldDescriptorProto_Type_TYPE_MESSAGE);
-  single->set_type_name(type_name.c_str(), type_name.size());
-  single->set_protobuf(serialized.data(), serialized.size());
-  return result.SerializeAsArray();
+SerializedProto ProtoBuilder::SerializeToProtoBuilderResult() {
+  using protos::pbzero::ProtoBuilderResult;
+  using protos::pbzero::SingleBuilderResult;
+  using protozero::proto_utils::MakeTagLengthDelimited;
+  using protozero::proto_utils::MakeTagVarInt;
+  using protozero::proto_utils::WriteVarInt;
+
+  const auto& slices = message_.GetSlices();
+  size_t proto_size = SlicesSize(slices);
+  if (proto_size == 0)
+    return SerializedProto();
+
+  // Rather than serializing the proto and then copying it into a
+  // |ProtoBuilderResult| message, write the fields of the wrapping messages
+  // by hand: the size of all of them is known upfront so the proto only needs
+  // to be copied once.
+  const std::string& type_name = descriptor_->full_name();
+
+  // The fields of |SingleBuilderResult| preceding and following the type name.
+  uint8_t single_pre[3 * protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* ptr = single_pre;
+  ptr = WriteVarInt(MakeTagVarInt(SingleBuilderResult::kTypeFieldNumber), ptr);
+  ptr = WriteVarInt(static_cast<uint32_t>(
+                        protos::pbzero::FieldDescriptorProto_Type_TYPE_MESSAGE),
+                    ptr);
+  ptr = WriteVarInt(
+      MakeTagLengthDelimited(SingleBuilderResult::kTypeNameFieldNumber), ptr);
+  ptr = WriteVarInt(type_name.size(), ptr);
+  size_t single_pre_size = static_cast<size_t>(ptr - single_pre);
+
+  uint8_t single_post[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  ptr = single_post;
+  ptr = WriteVarInt(
+      MakeTagLengthDelimited(SingleBuilderResult::kProtobufFieldNumber), ptr);
+  ptr = WriteVarInt(proto_size, ptr);
+  size_t single_post_size = static_cast<size_t>(ptr - single_post);
+
+  size_t single_size =
+      single_pre_size + type_name.size() + single_post_size + proto_size;
+
+  // The fields of |ProtoBuilderResult| preceding the |SingleBuilderResult|.
+  uint8_t result_pre[2 * protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  ptr = result_pre;
+  ptr = WriteVarInt(MakeTagVarInt(ProtoBuilderResult::kIsRepeatedFieldNumber),
+                    ptr);
+  ptr = WriteVarInt(0, ptr);
+  ptr = WriteVarInt(
+      MakeTagLengthDelimited(ProtoBuilderResult::kSingleFieldNumber), ptr);
+  ptr = WriteVarInt(single_size, ptr);
+  size_t result_pre_size = static_cast<size_t>(ptr - result_pre);
+
+  SerializedProto result;
+  result.size = result_pre_size + single_size;
+  result.data.reset(static_cast<uint8_t*>(malloc(result.size)));
+  ptr = result.data.get();
+  memcpy(ptr, result_pre, result_pre_size);
+  ptr += result_pre_size;
+  memcpy(ptr, single_pre, single_pre_size);
+  ptr += single_pre_size;
+  memcpy(ptr, type_name.data(), type_name.size());
+  ptr += type_name.size();
+  memcpy(ptr, single_post, single_post_size);
+  ptr += single_post_size;
+  ptr = CopySlices(slices, ptr);
+  PERFETTO_DCHECK(ptr == result.data.get() + result.size);
+  return result;
 }
 
 std::vector<uint8_t> ProtoBuilder::SerializeRaw() {
   return message_.SerializeAsArray();
 }
 
+void ProtoBuilder::Reset() {
+  message_.Reset();
+}
+
 RepeatedFieldBuilder::RepeatedFieldBuilder() {
   repeated_ = message_->set_repeated();
 }
@@ -399,13 +494,19 @@ void RepeatedFieldBuilder::AddBytes(const uint8_t* data, size_t size) {
   repeated_->add_value()->set_bytes_value(data, size);
 }
 
-std::vector<uint8_t> RepeatedFieldBuilder::SerializeToProtoBuilderResult() {
+SerializedProto RepeatedFieldBuilder::SerializeToProtoBuilderResult() {
   repeated_ = nullptr;
   if (!has_data_)
-    return std::vector<uint8_t>();
+    return SerializedProto();
 
   message_->set_is_repeated(true);
-  return message_.SerializeAsArray();
+  const auto& slices = message_.GetSlices();
+
+  SerializedProto result;
+  result.size = SlicesSize(slices);
+  result.data.reset(static_cast<uint8_t*>(malloc(result.size)));
+  CopySlices(slices, result.data.get());
+  return result;
 }
 
 int TemplateReplace(
@@ -493,16 +594,12 @@ void RepeatedFieldFinal(sqlite3_context* ctx) {
   // Capture the context pointer so that it will be freed at the end of this
   // function.
   std::unique_ptr<RepeatedFieldBuilder> builder(*builder_ptr_ptr);
-  std::vector<uint8_t> raw = builder->SerializeToProtoBuilderResult();
-  if (raw.empty()) {
+  SerializedProto proto = builder->SerializeToProtoBuilderResult();
+  if (proto.size == 0) {
     sqlite3_result_null(ctx);
     return;
   }
-
-  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
-      static_cast<uint8_t*>(malloc(raw.size())));
-  memcpy(data.get(), raw.data(), raw.size());
-  sqlite3_result_blob(ctx, data.release(), static_cast<int>(raw.size()), free);
+  ResultSerializedProto(ctx, std::move(proto));
 }
 
 // SQLite function implementation used to build a proto directly in SQL. The
@@ -514,8 +611,7 @@ void RepeatedFieldFinal(sqlite3_context* ctx) {
 // The return value is the built proto or an error about why the proto could
 // not be built.
 void BuildProto(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
-  const auto* fn_ctx =
-      static_cast<const BuildProtoContext*>(sqlite3_user_data(ctx));
+  auto* fn_ctx = static_cast<BuildProtoContext*>(sqlite3_user_data(ctx));
   if (argc % 2 != 0) {
     util::Status error =
         util::ErrStatus("Invalid number of args to %s BuildProto (got %d)",
@@ -524,7 +620,15 @@ void BuildProto(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
     return;
   }
 
-  ProtoBuilder builder(fn_ctx->desc);
+  // The arguments (including any nested proto) have been fully evaluated
+  // before this function is called so the builder cannot be in use by another
+  // call to this function.
+  if (fn_ctx->builder) {
+    fn_ctx->builder->Reset();
+  } else {
+    fn_ctx->builder.reset(new ProtoBuilder(fn_ctx->desc));
+  }
+  ProtoBuilder& builder = *fn_ctx->builder;
   for (int i = 0; i < argc; i += 2) {
     if (sqlite3_value_type(argv[i]) != SQLITE_TEXT) {
       sqlite3_result_error(ctx, "BuildProto: Invalid args", -1);
@@ -542,18 +646,14 @@ void BuildProto(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
 
   // Even if the message is empty, we don't return null here as we want the
   // existence of the message to be respected.
-  std::vector<uint8_t> raw = builder.SerializeToProtoBuilderResult();
-  if (raw.empty()) {
+  SerializedProto proto = builder.SerializeToProtoBuilderResult();
+  if (proto.size == 0) {
     // Passing nullptr to SQLite feels dangerous so just pass an empty string
     // and zero as the size so we don't deref nullptr accidentially somewhere.
     sqlite3_result_blob(ctx, "", 0, nullptr);
     return;
   }
-
-  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
-      static_cast<uint8_t*>(malloc(raw.size())));
-  memcpy(data.get(), raw.data(), raw.size());
-  sqlite3_result_blob(ctx, data.release(), static_cast<int>(raw.size()), free);
+  ResultSerializedProto(ctx, std::move(proto));
 }
 
 void RunMetric(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
@@ -652,7 +752,7 @@ util::Status ComputeMetrics(TraceProcessor* tp,
     // empty proto being returned.
     const auto& field_name = sql_metric.proto_field_name.value();
     if (!has_next) {
-      metric_builder.AppendBytes(field_name, nullptr, 0);
+      metric_builder.AppendBytes(base::StringView(field_name), nullptr, 0);
       continue;
     }
 
@@ -666,7 +766,8 @@ util::Status ComputeMetrics(TraceProcessor* tp,
       return util::ErrStatus("Output table %s column has invalid type",
                              sql_metric.output_table_name.value().c_str());
     }
-    RETURN_IF_ERROR(metric_builder.AppendSqlValue(field_name, col));
+    RETURN_IF_ERROR(
+        metric_builder.AppendSqlValue(base::StringView(field_name), col));
 
     has_next = it.Next();
     if (has_next) {
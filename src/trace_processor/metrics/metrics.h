@@ -19,10 +19,12 @@
 
 #include <sqlite3.h>
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/field.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -56,6 +58,13 @@ struct SqlMetricFile {
   std::string sql;
 };
 
+// A serialized proto stored in a buffer allocated with malloc: this allows it
+// to be handed over to SQLite (with free as the destructor) without copying it.
+struct SerializedProto {
+  std::unique_ptr<uint8_t[], base::FreeDeleter> data;
+  size_t size = 0;
+};
+
 // Helper class to build a nested (metric) proto checking the schema against
 // a descriptor.
 // Visible for testing.
@@ -63,41 +72,53 @@ class ProtoBuilder {
  public:
   ProtoBuilder(const ProtoDescriptor*);
 
-  util::Status AppendSqlValue(const std::string& field_name,
+  util::Status AppendSqlValue(base::StringView field_name,
                               const SqlValue& value);
 
-  // Note: all external callers to these functions should not
-  // |is_inside_repeated| to this function and instead rely on the default
-  // value.
-  util::Status AppendLong(const std::string& field_name,
-                          int64_t value,
-                          bool is_inside_repeated = false);
-  util::Status AppendDouble(const std::string& field_name,
-                            double value,
-                            bool is_inside_repeated = false);
-  util::Status AppendString(const std::string& field_name,
-                            base::StringView value,
-                            bool is_inside_repeated = false);
-  util::Status AppendBytes(const std::string& field_name,
+  util::Status AppendLong(base::StringView field_name, int64_t value);
+  util::Status AppendDouble(base::StringView field_name, double value);
+  util::Status AppendString(base::StringView field_name,
+                            base::StringView value);
+  util::Status AppendBytes(base::StringView field_name,
                            const uint8_t* data,
-                           size_t size,
-                           bool is_inside_repeated = false);
+                           size_t size);
 
   // Returns the serialized |protos::ProtoBuilderResult| with the built proto
-  // as the nested |protobuf| message.
-  // Note: no other functions should be called on this class after this method
-  // is called.
-  std::vector<uint8_t> SerializeToProtoBuilderResult();
+  // as the nested |protobuf| message. The built proto is copied only once, as
+  // the header of the |ProtoBuilderResult| is written directly in the returned
+  // buffer.
+  // Note: only |Reset()| should be called on this class after this method is
+  // called.
+  SerializedProto SerializeToProtoBuilderResult();
 
   // Returns the serialized version of the raw message being built.
   // This function should only be used at the top level where type checking is
   // no longer important because the proto will be returned as is. In all other
   // instances, prefer |SerializeToProtoBuilderResult()| instead.
-  // Note: no other functions should be called on this class after this method
-  // is called.
+  // Note: only |Reset()| should be called on this class after this method is
+  // called.
   std::vector<uint8_t> SerializeRaw();
 
+  // Discards the message being built so that this builder can be reused to
+  // build another one. The buffer which backs the message is kept so building
+  // the next message will not need to allocate it again.
+  void Reset();
+
  private:
+  util::Status AppendLong(const FieldDescriptor& field,
+                          int64_t value,
+                          bool is_inside_repeated);
+  util::Status AppendDouble(const FieldDescriptor& field,
+                            double value,
+                            bool is_inside_repeated);
+  util::Status AppendString(const FieldDescriptor& field,
+                            base::StringView value,
+                            bool is_inside_repeated);
+  util::Status AppendBytes(const FieldDescriptor& field,
+                           const uint8_t* data,
+                           size_t size,
+                           bool is_inside_repeated);
+
   util::Status AppendSingleMessage(const FieldDescriptor& field,
                                    const uint8_t* ptr,
                                    size_t size);
@@ -106,6 +127,11 @@ class ProtoBuilder {
                               const uint8_t* ptr,
                               size_t size);
 
+  // Returns the descriptor of the field with the given name or an error if
+  // there is no such field.
+  util::Status FindField(base::StringView field_name,
+                         const FieldDescriptor** field) const;
+
   const ProtoDescriptor* descriptor_ = nullptr;
   protozero::HeapBuffered<protozero::Message> message_;
 };
@@ -128,7 +154,7 @@ class RepeatedFieldBuilder {
   // repeated fields as |repeated_values| in the proto.
   // Note: no other functions should be called on this class after this method
   // is called.
-  std::vector<uint8_t> SerializeToProtoBuilderResult();
+  SerializedProto SerializeToProtoBuilderResult();
 
  private:
   bool has_data_ = false;
@@ -159,6 +185,10 @@ struct BuildProtoContext {
   TraceProcessor* tp;
   const DescriptorPool* pool;
   const ProtoDescriptor* desc;
+
+  // Reused by all the calls to the function to avoid allocating the buffer
+  // of the proto for every row. Lazily created on the first call.
+  std::unique_ptr<ProtoBuilder> builder;
 };
 
 // This function implements all the proto creation functions.
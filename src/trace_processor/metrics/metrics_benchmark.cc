@@ -0,0 +1,111 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the building of metric protos.
+// This mimics what the proto building SQL functions do for a metric which
+// outputs one nested message per row of a table: a message is built for each
+// row (as the <Message>(...) functions do), all of them are collected in a
+// repeated field (as RepeatedField does) which is then set in the output
+// message.
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/metrics/metrics.h"
+
+#include "protos/perfetto/common/descriptor.pbzero.h"
+
+namespace {
+
+using perfetto::trace_processor::FieldDescriptor;
+using perfetto::trace_processor::ProtoDescriptor;
+using perfetto::trace_processor::metrics::ProtoBuilder;
+using perfetto::trace_processor::metrics::RepeatedFieldBuilder;
+using perfetto::trace_processor::metrics::SerializedProto;
+using FieldDescriptorProto = perfetto::protos::pbzero::FieldDescriptorProto;
+
+// The number of fields of the row message, most metric protos have a few tens
+// of fields.
+constexpr uint32_t kRowFields = 32;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(16);
+  } else {
+    b->RangeMultiplier(8)->Range(16, 16 * 1024);
+  }
+}
+
+std::string RowFieldName(uint32_t i) {
+  return "field_" + std::to_string(i);
+}
+
+static void BM_MetricsBuildRepeatedMessages(benchmark::State& state) {
+  ProtoDescriptor row("file.proto", ".perfetto.protos",
+                      ".perfetto.protos.BenchmarkMetric.Row",
+                      ProtoDescriptor::Type::kMessage, perfetto::base::nullopt);
+  for (uint32_t i = 0; i < kRowFields; ++i) {
+    row.AddField(FieldDescriptor(RowFieldName(i), i + 1,
+                                 FieldDescriptorProto::TYPE_INT64, "", false));
+  }
+
+  ProtoDescriptor metric("file.proto", ".perfetto.protos",
+                         ".perfetto.protos.BenchmarkMetric",
+                         ProtoDescriptor::Type::kMessage,
+                         perfetto::base::nullopt);
+  FieldDescriptor rows("rows", 1, FieldDescriptorProto::TYPE_MESSAGE,
+                       row.full_name(), true);
+  rows.set_resolved_type_name(row.full_name());
+  metric.AddField(rows);
+
+  // Only set a few fields of each row, using the last fields declared, to
+  // measure the field lookup for larger messages.
+  std::vector<std::string> names;
+  for (uint32_t i = kRowFields - 4; i < kRowFields; ++i)
+    names.push_back(RowFieldName(i));
+
+  auto row_count = static_cast<int64_t>(state.range(0));
+  ProtoBuilder row_builder(&row);
+  for (auto _ : state) {
+    RepeatedFieldBuilder rows_builder;
+    for (int64_t i = 0; i < row_count; ++i) {
+      row_builder.Reset();
+      for (const std::string& name : names)
+        PERFETTO_CHECK(row_builder.AppendLong(name.c_str(), i).ok());
+      SerializedProto row_ser = row_builder.SerializeToProtoBuilderResult();
+      rows_builder.AddBytes(row_ser.data.get(), row_ser.size);
+    }
+    SerializedProto rows_ser = rows_builder.SerializeToProtoBuilderResult();
+
+    ProtoBuilder metric_builder(&metric);
+    PERFETTO_CHECK(
+        metric_builder.AppendBytes("rows", rows_ser.data.get(), rows_ser.size)
+            .ok());
+    SerializedProto metric_ser = metric_builder.SerializeToProtoBuilderResult();
+    benchmark::DoNotOptimize(metric_ser.data.get());
+  }
+  state.counters["rows"] = benchmark::Counter(
+      static_cast<double>(row_count * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_MetricsBuildRepeatedMessages)->Apply(BenchmarkArgs);
+
+}  // namespace
@@ -54,9 +54,9 @@ class ProtoBuilderTest : public ::testing::Test {
  protected:
   template <bool repeated>
   protozero::TypedProtoDecoder<1, repeated> DecodeSingleFieldProto(
-      const std::vector<uint8_t>& result_ser) {
-    protos::pbzero::ProtoBuilderResult::Decoder result(result_ser.data(),
-                                                       result_ser.size());
+      const SerializedProto& result_ser) {
+    protos::pbzero::ProtoBuilderResult::Decoder result(result_ser.data.get(),
+                                                       result_ser.size);
     protozero::ConstBytes single_ser = result.single();
     protos::pbzero::SingleBuilderResult::Decoder single(single_ser.data,
                                                         single_ser.size);
@@ -165,7 +165,7 @@ TEST_F(ProtoBuilderTest, AppendNested) {
 
   ProtoBuilder builder(&descriptor);
   ASSERT_TRUE(
-      builder.AppendBytes("nested_value", nest_ser.data(), nest_ser.size())
+      builder.AppendBytes("nested_value", nest_ser.data.get(), nest_ser.size)
           .ok());
 
   auto result_ser = builder.SerializeToProtoBuilderResult();
@@ -200,11 +200,11 @@ TEST_F(ProtoBuilderTest, AppendRepeatedPrimitive) {
   rep_builder.AddLong(1234);
   rep_builder.AddLong(5678);
 
-  std::vector<uint8_t> rep_ser = rep_builder.SerializeToProtoBuilderResult();
+  SerializedProto rep_ser = rep_builder.SerializeToProtoBuilderResult();
 
   ProtoBuilder builder(&descriptor);
   ASSERT_TRUE(
-      builder.AppendBytes("rep_int_value", rep_ser.data(), rep_ser.size())
+      builder.AppendBytes("rep_int_value", rep_ser.data.get(), rep_ser.size)
           .ok());
 
   auto result_ser = builder.SerializeToProtoBuilderResult();
@@ -215,6 +215,60 @@ TEST_F(ProtoBuilderTest, AppendRepeatedPrimitive) {
   ASSERT_FALSE(++it);
 }
 
+TEST_F(ProtoBuilderTest, AppendNestedWrongType) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+
+  ProtoDescriptor other("file.proto", ".perfetto.protos",
+                        ".perfetto.protos.OtherProto",
+                        ProtoDescriptor::Type::kMessage, base::nullopt);
+  other.AddField(FieldDescriptor("int_value", 1,
+                                 FieldDescriptorProto::TYPE_INT64, "", false));
+
+  ProtoDescriptor descriptor("file.proto", ".perfetto.protos",
+                             ".perfetto.protos.TestProto",
+                             ProtoDescriptor::Type::kMessage, base::nullopt);
+  auto field =
+      FieldDescriptor("nested_value", 1, FieldDescriptorProto::TYPE_MESSAGE,
+                      ".perfetto.protos.TestProto.NestedProto", false);
+  field.set_resolved_type_name(".perfetto.protos.TestProto.NestedProto");
+  descriptor.AddField(field);
+
+  ProtoBuilder other_builder(&other);
+  ASSERT_TRUE(other_builder.AppendLong("int_value", 1).ok());
+  auto other_ser = other_builder.SerializeToProtoBuilderResult();
+
+  ProtoBuilder builder(&descriptor);
+  ASSERT_FALSE(builder
+                   .AppendBytes("nested_value", other_ser.data.get(),
+                                other_ser.size)
+                   .ok());
+  ASSERT_FALSE(builder.AppendLong("unknown_value", 1).ok());
+}
+
+TEST_F(ProtoBuilderTest, Reset) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+
+  ProtoDescriptor descriptor("file.proto", ".perfetto.protos",
+                             ".perfetto.protos.TestProto",
+                             ProtoDescriptor::Type::kMessage, base::nullopt);
+  descriptor.AddField(FieldDescriptor(
+      "int_value", 1, FieldDescriptorProto::TYPE_INT64, "", false));
+
+  ProtoBuilder builder(&descriptor);
+  for (int64_t i = 0; i < 3; ++i) {
+    builder.Reset();
+    ASSERT_TRUE(builder.AppendLong("int_value", i).ok());
+
+    auto result_ser = builder.SerializeToProtoBuilderResult();
+    auto proto = DecodeSingleFieldProto<false>(result_ser);
+    ASSERT_EQ(proto.Get(1).as_int64(), i);
+  }
+
+  // An empty message is serialized as an empty result.
+  builder.Reset();
+  ASSERT_EQ(builder.SerializeToProtoBuilderResult().size, 0u);
+}
+
 }  // namespace
 
 }  // namespace metrics
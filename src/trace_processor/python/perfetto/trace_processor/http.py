@@ -24,9 +24,10 @@ class TraceProcessorHttp:
     self.protos = ProtoFactory()
     self.conn = http.client.HTTPConnection(url)
 
-  def execute_query(self, query):
+  def execute_query(self, query, columnar=False):
     args = self.protos.RawQueryArgs()
     args.sql_query = query
+    args.columnar = columnar
     byte_data = args.SerializeToString()
     self.conn.request('POST', '/query', body=byte_data)
     with self.conn.getresponse() as f:
@@ -59,3 +59,7 @@ class ProtoFactory:
         'perfetto.protos.DisableAndReadMetatraceResult')
     self.CellsBatch = create_message_factory(
         'perfetto.protos.QueryResult.CellsBatch')
+    self.ColumnsBatch = create_message_factory(
+        'perfetto.protos.QueryResult.ColumnsBatch')
+    self.ColumnsBatchColumn = create_message_factory(
+        'perfetto.protos.QueryResult.ColumnsBatch.Column')
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/rpc/query_result_serializer.h"
 
+#include <algorithm>
+#include <string>
 #include <vector>
 
 #include "perfetto/protozero/packed_repeated_fields.h"
@@ -32,6 +34,8 @@ namespace {
 
 namespace pu = ::protozero::proto_utils;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnsBatchProto = protos::pbzero::QueryResult::ColumnsBatch;
+using ColumnProto = protos::pbzero::QueryResult::ColumnsBatch::Column;
 using ResultProto = protos::pbzero::QueryResult;
 
 // The reserved field in trace_processor.proto.
@@ -43,10 +47,49 @@ uint8_t MakeLenDelimTag(uint32_t field_num) {
   return static_cast<uint8_t>(tag);
 }
 
+// Accumulates the cells of one column of a ColumnsBatch.
+struct ColumnBuffer {
+  // The BatchProto::CellType of each row.
+  std::vector<uint8_t> cell_types;
+
+  // A bitmask of the cell types seen (1 << CellType).
+  uint32_t seen_types = 0;
+
+  // These have one entry per row up to the last row with a value of the
+  // type, they are padded with zeros up to the row count at the end.
+  std::vector<int64_t> longs;
+  std::vector<double> doubles;
+
+  // The NUL-terminated strings.
+  std::string strings;
+
+  // The blobs, back to back, and their sizes.
+  std::vector<uint8_t> blobs;
+  std::vector<uint32_t> blob_sizes;
+};
+
+ColumnProto::Type ColumnType(uint32_t seen_types) {
+  switch (seen_types & ~(1u << BatchProto::CELL_NULL)) {
+    case 0:
+      return ColumnProto::TYPE_NULL;
+    case 1u << BatchProto::CELL_VARINT:
+      return ColumnProto::TYPE_LONG;
+    case 1u << BatchProto::CELL_FLOAT64:
+      return ColumnProto::TYPE_DOUBLE;
+    case 1u << BatchProto::CELL_STRING:
+      return ColumnProto::TYPE_STRING;
+    case 1u << BatchProto::CELL_BLOB:
+      return ColumnProto::TYPE_BLOB;
+  }
+  return ColumnProto::TYPE_MIXED;
+}
+
 }  // namespace
 
-QueryResultSerializer::QueryResultSerializer(Iterator iter)
-    : iter_(iter.take_impl()), num_cols_(iter_->ColumnCount()) {}
+QueryResultSerializer::QueryResultSerializer(Iterator iter, BatchFormat format)
+    : iter_(iter.take_impl()),
+      num_cols_(iter_->ColumnCount()),
+      format_(format) {}
 
 QueryResultSerializer::~QueryResultSerializer() = default;
 
@@ -71,11 +114,19 @@ bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
   // write an empty batch with the EOF marker. Errors can happen also in the
   // middle of a query, not just before starting it.
 
-  SerializeBatch(res);
+  if (format_ == BatchFormat::kColumns) {
+    SerializeColumnsBatch(res);
+  } else {
+    SerializeBatch(res);
+  }
   MaybeSerializeError(res);
   return !eof_reached_;
 }
 
+util::Status QueryResultSerializer::status() const {
+  return iter_->Status();
+}
+
 void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // The buffer is filled in this way:
   // - Append all the strings as we iterate through the results. The rationale
@@ -246,6 +297,125 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   batch->Finalize();
 }
 
+void QueryResultSerializer::SerializeColumnsBatch(
+    protos::pbzero::QueryResult* res) {
+  // Unlike SerializeBatch(), the cells are buffered column by column while
+  // iterating and all the columns are written at the end of the batch. The
+  // batches are split with the same rules, so that a batch has at most
+  // |cells_per_batch_| cells and whole rows.
+  std::vector<ColumnBuffer> columns(num_cols_);
+  const uint32_t max_rows = std::max(cells_per_batch_ / std::max(num_cols_, 1u),
+                                     1u);
+  uint32_t approx_batch_size = 16;
+  uint32_t row_count = 0;
+  bool batch_full = false;
+
+  for (;;) {
+    // |col_| is 0 if the previous batch stopped before a row which was already
+    // fetched (and UINT32_MAX before the first row).
+    if (col_ >= num_cols_) {
+      if (!iter_->Next())
+        break;  // EOF or error.
+      PERFETTO_DCHECK(num_cols_ > 0);
+      col_ = 0;
+    }
+    if (row_count == max_rows || approx_batch_size > batch_split_threshold_) {
+      batch_full = true;
+      break;
+    }
+
+    for (; col_ < num_cols_; ++col_) {
+      ColumnBuffer& column = columns[col_];
+      auto value = iter_->Get(col_);
+      uint8_t cell_type = BatchProto::CELL_INVALID;
+      switch (value.type) {
+        case SqlValue::Type::kNull:
+          cell_type = BatchProto::CELL_NULL;
+          break;
+        case SqlValue::Type::kLong:
+          cell_type = BatchProto::CELL_VARINT;
+          column.longs.resize(row_count);
+          column.longs.push_back(value.long_value);
+          approx_batch_size += sizeof(int64_t);
+          break;
+        case SqlValue::Type::kDouble:
+          cell_type = BatchProto::CELL_FLOAT64;
+          column.doubles.resize(row_count);
+          column.doubles.push_back(value.double_value);
+          approx_batch_size += sizeof(double);
+          break;
+        case SqlValue::Type::kString: {
+          cell_type = BatchProto::CELL_STRING;
+          size_t len_with_nul = strlen(value.string_value) + 1;
+          column.strings.append(value.string_value, len_with_nul);
+          approx_batch_size += static_cast<uint32_t>(len_with_nul);
+          break;
+        }
+        case SqlValue::Type::kBytes: {
+          cell_type = BatchProto::CELL_BLOB;
+          auto* src = static_cast<const uint8_t*>(value.bytes_value);
+          uint32_t len = static_cast<uint32_t>(value.bytes_count);
+          column.blobs.insert(column.blobs.end(), src, src + len);
+          column.blob_sizes.push_back(len);
+          approx_batch_size += len + 4;  // 4 is a guess on the preamble size.
+          break;
+        }
+      }
+      PERFETTO_DCHECK(cell_type != BatchProto::CELL_INVALID);
+      column.cell_types.push_back(cell_type);
+      column.seen_types |= 1u << cell_type;
+    }
+    row_count++;
+  }
+
+  auto* batch = res->add_columns_batch();
+  batch->set_row_count(row_count);
+  for (ColumnBuffer& column : columns) {
+    auto* col = batch->add_columns();
+    ColumnProto::Type type = ColumnType(column.seen_types);
+    col->set_type(type);
+
+    if (column.seen_types & (1u << BatchProto::CELL_NULL)) {
+      std::vector<uint8_t> nulls(row_count);
+      for (uint32_t i = 0; i < row_count; ++i)
+        nulls[i] = column.cell_types[i] == BatchProto::CELL_NULL;
+      col->set_nulls(nulls.data(), nulls.size());
+    }
+    // The values are written in the host byte order, which is little-endian
+    // on all the platforms we support.
+    if (column.seen_types & (1u << BatchProto::CELL_VARINT)) {
+      column.longs.resize(row_count);
+      col->set_long_values(
+          reinterpret_cast<const uint8_t*>(column.longs.data()),
+          column.longs.size() * sizeof(int64_t));
+    }
+    if (column.seen_types & (1u << BatchProto::CELL_FLOAT64)) {
+      column.doubles.resize(row_count);
+      col->set_double_values(
+          reinterpret_cast<const uint8_t*>(column.doubles.data()),
+          column.doubles.size() * sizeof(double));
+    }
+    if (column.seen_types & (1u << BatchProto::CELL_STRING)) {
+      col->set_string_values(
+          reinterpret_cast<const uint8_t*>(column.strings.data()),
+          column.strings.size());
+    }
+    const uint8_t* blob = column.blobs.data();
+    for (uint32_t size : column.blob_sizes) {
+      col->add_blob_values(blob, size);
+      blob += size;
+    }
+    if (type == ColumnProto::TYPE_MIXED)
+      col->set_cell_types(column.cell_types.data(), row_count);
+  }
+
+  // If this is the last batch, write the EOF field.
+  if (!batch_full) {
+    eof_reached_ = true;
+    batch->set_is_last_batch(true);
+  }
+}
+
 void QueryResultSerializer::MaybeSerializeError(
     protos::pbzero::QueryResult* res) {
   if (iter_->Status().ok())
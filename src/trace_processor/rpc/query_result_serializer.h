@@ -24,6 +24,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "perfetto/trace_processor/status.h"
+
 namespace perfetto {
 
 namespace protos {
@@ -53,7 +55,18 @@ class IteratorImpl;
 // chunked-encoded HTTP response, or through a repetition of Wasm calls.
 class QueryResultSerializer {
  public:
-  explicit QueryResultSerializer(Iterator);
+  // How the cells of a batch are laid out, see QueryResult.CellsBatch and
+  // QueryResult.ColumnsBatch in trace_processor.proto.
+  enum class BatchFormat {
+    // Cells are serialized row by row, the format used by the UI.
+    kCells,
+    // Cells are grouped by column, which allows to decode a whole column at
+    // once (e.g. into a numpy array in the Python API).
+    kColumns,
+  };
+
+  explicit QueryResultSerializer(Iterator,
+                                 BatchFormat format = BatchFormat::kCells);
   ~QueryResultSerializer();
 
   // No copy or move.
@@ -69,6 +82,10 @@ class QueryResultSerializer {
   // extra copies.
   bool Serialize(std::vector<uint8_t>*);
 
+  // Returns the status of the query. An error is also serialized in
+  // QueryResult.error.
+  util::Status status() const;
+
   void set_batch_size_for_testing(uint32_t cells_per_batch, uint32_t thres) {
     cells_per_batch_ = cells_per_batch;
     batch_split_threshold_ = thres;
@@ -77,10 +94,12 @@ class QueryResultSerializer {
  private:
   void SerializeColumnNames(protos::pbzero::QueryResult*);
   void SerializeBatch(protos::pbzero::QueryResult*);
+  void SerializeColumnsBatch(protos::pbzero::QueryResult*);
   void MaybeSerializeError(protos::pbzero::QueryResult*);
 
   std::unique_ptr<IteratorImpl> iter_;
   const uint32_t num_cols_;
+  const BatchFormat format_;
   bool did_write_column_names_ = false;
   bool eof_reached_ = false;
   uint32_t col_ = UINT32_MAX;
@@ -71,6 +71,7 @@ namespace {
 
 using ::testing::ElementsAre;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnProto = protos::pbzero::QueryResult::ColumnsBatch::Column;
 using ResultProto = protos::pbzero::QueryResult;
 
 void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
@@ -91,6 +92,10 @@ class TestDeserializer {
   bool eof_reached = false;
 
  private:
+  void DeserializeColumnsBatch(protozero::ConstBytes);
+  SqlValue CopyString(const std::string&);
+  SqlValue CopyBytes(const std::string&);
+
   std::vector<std::unique_ptr<char[]>> copied_buf_;
 };
 
@@ -191,6 +196,122 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
       EXPECT_EQ(num_cells % columns.size(), 0u);
     }
   }
+
+  for (auto batch_it = result.columns_batch(); batch_it; ++batch_it)
+    DeserializeColumnsBatch(*batch_it);
+}
+
+// Converts a ColumnsBatch back to row-major cells, so that the tests can check
+// both formats in the same way.
+void TestDeserializer::DeserializeColumnsBatch(protozero::ConstBytes bytes) {
+  ASSERT_FALSE(eof_reached);
+  ResultProto::ColumnsBatch::Decoder batch(bytes);
+  eof_reached = batch.is_last_batch();
+  const uint32_t rows = batch.row_count();
+
+  std::vector<std::vector<SqlValue>> cols;
+  for (auto col_it = batch.columns(); col_it; ++col_it) {
+    ColumnProto::Decoder col(*col_it);
+    auto nulls = col.nulls();
+    auto longs = col.long_values();
+    auto doubles = col.double_values();
+    auto cell_types = col.cell_types();
+    if (nulls.size)
+      ASSERT_EQ(nulls.size, rows);
+    if (longs.size)
+      ASSERT_EQ(longs.size, rows * sizeof(int64_t));
+    if (doubles.size)
+      ASSERT_EQ(doubles.size, rows * sizeof(double));
+
+    std::string merged_strings = col.string_values().ToStdString();
+    size_t string_pos = 0;
+    auto blob_it = col.blob_values();
+
+    cols.emplace_back();
+    for (uint32_t row = 0; row < rows; ++row) {
+      uint8_t cell_type = BatchProto::CELL_INVALID;
+      if (nulls.size && nulls.data[row]) {
+        cell_type = BatchProto::CELL_NULL;
+      } else {
+        switch (col.type()) {
+          case ColumnProto::TYPE_NULL:
+            cell_type = BatchProto::CELL_NULL;
+            break;
+          case ColumnProto::TYPE_LONG:
+            cell_type = BatchProto::CELL_VARINT;
+            break;
+          case ColumnProto::TYPE_DOUBLE:
+            cell_type = BatchProto::CELL_FLOAT64;
+            break;
+          case ColumnProto::TYPE_STRING:
+            cell_type = BatchProto::CELL_STRING;
+            break;
+          case ColumnProto::TYPE_BLOB:
+            cell_type = BatchProto::CELL_BLOB;
+            break;
+          case ColumnProto::TYPE_MIXED:
+            ASSERT_EQ(cell_types.size, rows);
+            cell_type = cell_types.data[row];
+            break;
+          default:
+            FAIL() << "Unknown column type " << col.type();
+        }
+      }
+      switch (cell_type) {
+        case BatchProto::CELL_NULL:
+          cols.back().emplace_back(SqlValue());
+          break;
+        case BatchProto::CELL_VARINT: {
+          int64_t value;
+          memcpy(&value, longs.data + row * sizeof(int64_t), sizeof(value));
+          cols.back().emplace_back(SqlValue::Long(value));
+          break;
+        }
+        case BatchProto::CELL_FLOAT64: {
+          double value;
+          memcpy(&value, doubles.data + row * sizeof(double), sizeof(value));
+          cols.back().emplace_back(SqlValue::Double(value));
+          break;
+        }
+        case BatchProto::CELL_STRING: {
+          size_t next_sep = merged_strings.find('\0', string_pos);
+          ASSERT_NE(next_sep, std::string::npos);
+          cols.back().emplace_back(CopyString(
+              merged_strings.substr(string_pos, next_sep - string_pos)));
+          string_pos = next_sep + 1;
+          break;
+        }
+        case BatchProto::CELL_BLOB:
+          ASSERT_TRUE(blob_it);
+          cols.back().emplace_back(CopyBytes((*blob_it).ToStdString()));
+          ++blob_it;
+          break;
+        default:
+          FAIL() << "Unknown cell type " << cell_type;
+      }
+    }
+    EXPECT_EQ(string_pos, merged_strings.size());
+    EXPECT_FALSE(blob_it);
+  }
+
+  ASSERT_EQ(cols.size(), columns.size());
+  for (uint32_t row = 0; row < rows; ++row) {
+    for (const auto& col : cols)
+      cells.emplace_back(col[row]);
+  }
+}
+
+SqlValue TestDeserializer::CopyString(const std::string& str) {
+  copied_buf_.emplace_back(new char[str.size() + 1]);
+  char* new_buf = copied_buf_.back().get();
+  memcpy(new_buf, str.c_str(), str.size() + 1);
+  return SqlValue::String(new_buf);
+}
+
+SqlValue TestDeserializer::CopyBytes(const std::string& bytes) {
+  copied_buf_.emplace_back(new char[bytes.size()]);
+  memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
+  return SqlValue::Bytes(copied_buf_.back().get(), bytes.size());
 }
 
 TEST(QueryResultSerializerTest, ShortBatch) {
@@ -212,6 +333,58 @@ TEST(QueryResultSerializerTest, ShortBatch) {
                           SqlValue::Bytes("a_blob", 6)));
 }
 
+TEST(QueryResultSerializerTest, ShortColumnsBatch) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  auto iter = tp->ExecuteQuery(
+      "select 1 as i8, 42001001001 as i64, 1e9 as f64, 'a_string' as str, "
+      "cast('a_blob' as blob) as blb, null as nul");
+  QueryResultSerializer ser(std::move(iter),
+                            QueryResultSerializer::BatchFormat::kColumns);
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+
+  EXPECT_THAT(deser.columns,
+              ElementsAre("i8", "i64", "f64", "str", "blb", "nul"));
+  EXPECT_THAT(deser.cells,
+              ElementsAre(SqlValue::Long(1), SqlValue::Long(42001001001),
+                          SqlValue::Double(1e9), SqlValue::String("a_string"),
+                          SqlValue::Bytes("a_blob", 6), SqlValue()));
+}
+
+TEST(QueryResultSerializerTest, ColumnsBatchTypes) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+  RunQueryChecked(tp.get(), "create table tab (l, d, s, n, m)");
+  RunQueryChecked(tp.get(),
+                  "insert into tab values (1, 1.5, 'a', null, 1), "
+                  "(null, 2.5, '', null, 'b'), (3, null, 'c', null, 2.5)");
+
+  auto iter = tp->ExecuteQuery("select * from tab");
+  QueryResultSerializer ser(std::move(iter),
+                            QueryResultSerializer::BatchFormat::kColumns);
+  std::vector<uint8_t> buf;
+  ser.Serialize(&buf);
+
+  ResultProto::Decoder result(buf.data(), buf.size());
+  ASSERT_FALSE(result.has_batch());
+  ResultProto::ColumnsBatch::Decoder batch(*result.columns_batch());
+  EXPECT_EQ(batch.row_count(), 3u);
+  EXPECT_TRUE(batch.is_last_batch());
+  std::vector<int32_t> types;
+  std::vector<bool> has_nulls;
+  for (auto it = batch.columns(); it; ++it) {
+    ColumnProto::Decoder col(*it);
+    types.push_back(col.type());
+    has_nulls.push_back(col.has_nulls());
+  }
+  std::vector<int32_t> expected_types = {
+      ColumnProto::TYPE_LONG, ColumnProto::TYPE_DOUBLE,
+      ColumnProto::TYPE_STRING, ColumnProto::TYPE_NULL,
+      ColumnProto::TYPE_MIXED};
+  EXPECT_EQ(types, expected_types);
+  EXPECT_THAT(has_nulls, ElementsAre(true, true, false, true, false));
+}
+
 TEST(QueryResultSerializerTest, LongBatch) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
 
@@ -316,13 +489,16 @@ TEST(QueryResultSerializerTest, LargeStringAndBlobs) {
   sql_values.resize(sql_values.size() - 1);  // Remove trailing comma.
   RunQueryChecked(tp.get(), "insert into tab (colz) values " + sql_values);
 
-  auto iter = tp->ExecuteQuery("select colz from tab");
-  QueryResultSerializer ser(std::move(iter));
-  TestDeserializer deser;
-  deser.SerializeAndDeserialize(&ser);
-  ASSERT_EQ(deser.cells.size(), expected.size());
-  for (size_t i = 0; i < expected.size(); i++) {
-    EXPECT_EQ(deser.cells[i], expected[i]) << "Cell " << i;
+  for (auto format : {QueryResultSerializer::BatchFormat::kCells,
+                      QueryResultSerializer::BatchFormat::kColumns}) {
+    auto iter = tp->ExecuteQuery("select colz from tab");
+    QueryResultSerializer ser(std::move(iter), format);
+    TestDeserializer deser;
+    deser.SerializeAndDeserialize(&ser);
+    ASSERT_EQ(deser.cells.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      EXPECT_EQ(deser.cells[i], expected[i]) << "Cell " << i;
+    }
   }
 }
 
@@ -388,7 +564,9 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   // Serialize and de-serialize with different batch and payload sizes.
   for (int rep = 0; rep < 10; rep++) {
     auto iter = tp->ExecuteQuery("select * from tab");
-    QueryResultSerializer ser(std::move(iter));
+    QueryResultSerializer ser(
+        std::move(iter), rep % 2 ? QueryResultSerializer::BatchFormat::kColumns
+                                 : QueryResultSerializer::BatchFormat::kCells);
     uint32_t cells_per_batch = 1 << (rnd_engine() % 8 + 2);
     uint32_t binary_payload_size = 1 << (rnd_engine() % 8 + 8);
     ser.set_batch_size_for_testing(cells_per_batch, binary_payload_size);
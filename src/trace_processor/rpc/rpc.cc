@@ -16,6 +16,7 @@
 
 #include "src/trace_processor/rpc/rpc.h"
 
+#include <string>
 #include <vector>
 
 #include "perfetto/base/time.h"
@@ -34,6 +35,60 @@ using ColumnDesc = protos::pbzero::RawQueryResult::ColumnDesc;
 // Writes a "Loading trace ..." update every N bytes.
 constexpr size_t kProgressUpdateBytes = 50 * 1000 * 1000;
 
+namespace {
+
+Iterator ExecuteQuery(TraceProcessor* tp,
+                      const std::string& sql,
+                      bool profile) {
+  if (!profile)
+    return tp->ExecuteQuery(sql);
+  // Profiling is decided when the query is executed so it can be restored
+  // before the rows are read.
+  bool was_enabled = tp->IsQueryProfilingEnabled();
+  tp->SetQueryProfilingEnabled(true);
+  auto it = tp->ExecuteQuery(sql);
+  tp->SetQueryProfilingEnabled(was_enabled);
+  return it;
+}
+
+// Writes the profile of the query |query_id|, as returned by
+// Iterator::QueryId().
+void WriteQueryProfile(TraceProcessor* tp,
+                       uint32_t query_id,
+                       protos::pbzero::QueryProfile* profile) {
+  profile->set_query_id(query_id);
+  auto it = tp->ExecuteQuery(
+      "SELECT operator_id, parent_id, table_name, plan, filter_count, "
+      "cache_hits, rows_scanned, rows_returned, filter_dur, next_dur, "
+      "column_dur "
+      "FROM experimental_query_profile "
+      "WHERE query_id = " +
+      std::to_string(query_id) + " ORDER BY operator_id");
+  while (it.Next()) {
+    auto* op = profile->add_operators();
+    op->set_id(static_cast<uint32_t>(it.Get(0).AsLong()));
+    if (!it.Get(1).is_null())
+      op->set_parent_id(static_cast<uint32_t>(it.Get(1).AsLong()));
+    if (!it.Get(2).is_null())
+      op->set_table_name(it.Get(2).AsString());
+    if (!it.Get(3).is_null())
+      op->set_plan(it.Get(3).AsString());
+    op->set_filter_count(static_cast<uint32_t>(it.Get(4).AsLong()));
+    op->set_cache_hits(static_cast<uint32_t>(it.Get(5).AsLong()));
+    if (!it.Get(6).is_null())
+      op->set_rows_scanned(it.Get(6).AsLong());
+    op->set_rows_returned(it.Get(7).AsLong());
+    op->set_filter_dur_ns(it.Get(8).AsLong());
+    op->set_next_dur_ns(it.Get(9).AsLong());
+    op->set_column_dur_ns(it.Get(10).AsLong());
+  }
+  if (!it.Status().ok())
+    PERFETTO_ELOG("[RPC] Failed to read the query profile: %s",
+                  it.Status().c_message());
+}
+
+}  // namespace
+
 Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance)
     : trace_processor_(std::move(preloaded_instance)) {}
 
@@ -104,12 +159,24 @@ void Rpc::Query(const uint8_t* args,
     return;
   }
 
-  auto it = trace_processor_->ExecuteQuery(sql.c_str());
-  QueryResultSerializer serializer(std::move(it));
+  auto it = ExecuteQuery(trace_processor_.get(), sql, query.profile());
+  uint32_t query_id = it.QueryId();
+  QueryResultSerializer serializer(
+      std::move(it), query.columnar()
+                         ? QueryResultSerializer::BatchFormat::kColumns
+                         : QueryResultSerializer::BatchFormat::kCells);
 
   std::vector<uint8_t> res;
   for (bool has_more = true; has_more;) {
     has_more = serializer.Serialize(&res);
+    if (!has_more && query.profile()) {
+      // Fields can be added to an encoded message by appending them.
+      protozero::HeapBuffered<protos::pbzero::QueryResult> profile;
+      WriteQueryProfile(trace_processor_.get(), query_id,
+                        profile->set_profile());
+      std::vector<uint8_t> profile_data = profile.SerializeAsArray();
+      res.insert(res.end(), profile_data.begin(), profile_data.end());
+    }
     result_callback(res.data(), res.size(), has_more);
     res.clear();
   }
@@ -130,7 +197,7 @@ std::vector<uint8_t> Rpc::RawQuery(const uint8_t* args, size_t len) {
     return result.SerializeAsArray();
   }
 
-  auto it = trace_processor_->ExecuteQuery(sql.c_str());
+  auto it = ExecuteQuery(trace_processor_.get(), sql, query.profile());
 
   // This vector contains a standalone protozero message per column. The problem
   // it's solving is the following: (i) sqlite iterators are row-based; (ii) the
@@ -243,6 +310,9 @@ std::vector<uint8_t> Rpc::RawQuery(const uint8_t* args, size_t len) {
   result->set_num_records(rows);
   if (!status.ok())
     result->set_error(status.c_message());
+  if (query.profile())
+    WriteQueryProfile(trace_processor_.get(), it.QueryId(),
+                      result->set_profile());
   PERFETTO_DLOG("[RPC] RawQuery > %d rows (err: %d)", rows, !status.ok());
 
   return result.SerializeAsArray();
@@ -19,6 +19,7 @@
 #include "perfetto/ext/base/string_writer.h"
 #include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/storage/query_profile.h"
 #include "src/trace_processor/tp_metatrace.h"
 
 namespace perfetto {
@@ -438,8 +439,14 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
       });
       // If we have a dynamically created table, regenerate the table based on
       // the new constraints.
-      dynamic_table_ =
-          db_sqlite_table_->generator_->ComputeTable(constraints_, orders_);
+      DynamicTableGenerator* generator = db_sqlite_table_->generator_.get();
+      util::Status status = generator->ValidateConstraintValues(constraints_);
+      if (!status.ok()) {
+        db_sqlite_table_->SetErrorMessage(
+            sqlite3_mprintf("%s", status.c_message()));
+        return SQLITE_CONSTRAINT;
+      }
+      dynamic_table_ = generator->ComputeTable(constraints_, orders_);
       upstream_table_ = dynamic_table_.get();
       if (!upstream_table_)
         return SQLITE_CONSTRAINT;
@@ -447,6 +454,14 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
     }
   }
 
+  if (QueryProfile* profile = QueryProfile::active()) {
+    QueryProfile::Operator* op = profile->current_operator();
+    op->rows_scanned =
+        op->rows_scanned.value_or(0) + SourceTable()->row_count();
+    if (sorted_cache_table_)
+      op->cache_hit_count++;
+  }
+
   PERFETTO_TP_TRACE("DB_TABLE_FILTER_AND_SORT", [this](metatrace::Record* r) {
     const Table* source = SourceTable();
     char buffer[2048];
@@ -608,5 +623,10 @@ int DbSqliteTable::Cursor::Column(sqlite3_context* ctx, int raw_col) {
 
 DbSqliteTable::DynamicTableGenerator::~DynamicTableGenerator() = default;
 
+util::Status DbSqliteTable::DynamicTableGenerator::ValidateConstraintValues(
+    const std::vector<Constraint>&) {
+  return util::OkStatus();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -61,6 +61,12 @@ class DbSqliteTable : public SqliteTable {
     // constraints on hidden columns for table-valued functions are present).
     virtual util::Status ValidateConstraints(const QueryConstraints& qc) = 0;
 
+    // Checks that the values of the constraints are valid before computing
+    // the table. Unlike ValidateConstraints, this is called at filter time and
+    // the error message is returned to the user.
+    virtual util::Status ValidateConstraintValues(
+        const std::vector<Constraint>& cs);
+
     // Dynamically computes the table given the constraints and order by
     // vectors.
     virtual std::unique_ptr<Table> ComputeTable(
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/materialized_args.h"
+
+#include <algorithm>
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Returns the type of the column a value of type |type| is materialized into.
+SqlValue::Type ColumnTypeForVariadic(Variadic::Type type) {
+  switch (type) {
+    case Variadic::Type::kInt:
+    case Variadic::Type::kUint:
+    case Variadic::Type::kBool:
+    case Variadic::Type::kPointer:
+      return SqlValue::Type::kLong;
+    case Variadic::Type::kReal:
+      return SqlValue::Type::kDouble;
+    case Variadic::Type::kString:
+    case Variadic::Type::kJson:
+      return SqlValue::Type::kString;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace
+
+constexpr uint32_t MaterializedArgs::kMinLookupsBeforeIndexing;
+constexpr uint32_t MaterializedArgs::kArgRowsPerLookup;
+constexpr uint32_t MaterializedArgs::kNoRow;
+constexpr uint32_t MaterializedArgs::kMultipleRows;
+
+MaterializedArgs::MaterializedArgs(const TraceStorage* storage)
+    : storage_(storage) {}
+MaterializedArgs::~MaterializedArgs() = default;
+
+util::Status MaterializedArgs::ExtractArg(uint32_t arg_set_id,
+                                          const char* key,
+                                          base::Optional<Variadic>* result) {
+  *result = base::nullopt;
+
+  // If the key was never interned, no arg can have it.
+  base::Optional<StringId> key_id = storage_->string_pool().GetId(key);
+  if (!key_id)
+    return util::OkStatus();
+
+  KeyState* state = &keys_[*key_id];
+  if (!state->indexed) {
+    uint32_t arg_rows = storage_->arg_table().row_count();
+    if (++state->lookups < kMinLookupsBeforeIndexing ||
+        state->lookups < arg_rows / kArgRowsPerLookup) {
+      return storage_->ExtractArg(arg_set_id, key, result);
+    }
+  }
+  UpdateIndex(*key_id, state);
+
+  if (arg_set_id >= state->row_for_arg_set.size())
+    return util::OkStatus();
+  uint32_t row = state->row_for_arg_set[arg_set_id];
+  if (row == kNoRow)
+    return util::OkStatus();
+  if (row == kMultipleRows) {
+    return util::ErrStatus(
+        "EXTRACT_ARG: received multiple args matching arg set id and key");
+  }
+  *result = storage_->GetArgValue(row);
+  return util::OkStatus();
+}
+
+util::Status MaterializedArgs::MaterializeColumn(const Table& table,
+                                                 const char* key,
+                                                 Column* column) {
+  const auto* arg_set_id_col = table.GetColumnByName("arg_set_id");
+  PERFETTO_CHECK(arg_set_id_col);
+
+  // Find the args table row holding the value of |key| for each row of
+  // |table|, checking the type of all the values along the way.
+  std::vector<uint32_t> arg_rows(table.row_count(), kNoRow);
+  bool has_long = false;
+  bool has_double = false;
+  bool has_string = false;
+  base::Optional<StringId> key_id = storage_->string_pool().GetId(key);
+  if (key_id) {
+    KeyState* state = &keys_[*key_id];
+    UpdateIndex(*key_id, state);
+
+    const auto& arg_table = storage_->arg_table();
+    for (uint32_t i = table.evicted_row_count(); i < table.row_count(); ++i) {
+      SqlValue arg_set_id = arg_set_id_col->Get(i);
+      if (arg_set_id.is_null())
+        continue;
+      auto id = static_cast<uint32_t>(arg_set_id.AsLong());
+      if (id >= state->row_for_arg_set.size())
+        continue;
+      uint32_t row = state->row_for_arg_set[id];
+      if (row == kMultipleRows) {
+        return util::ErrStatus(
+            "Arg column for key %s: multiple args matching arg set id %u", key,
+            id);
+      }
+      if (row == kNoRow)
+        continue;
+      arg_rows[i] = row;
+
+      auto type = *storage_->GetVariadicTypeForId(arg_table.value_type()[row]);
+      switch (ColumnTypeForVariadic(type)) {
+        case SqlValue::Type::kLong:
+          has_long = true;
+          break;
+        case SqlValue::Type::kDouble:
+          has_double = true;
+          break;
+        case SqlValue::Type::kString:
+          has_string = true;
+          break;
+        case SqlValue::Type::kNull:
+        case SqlValue::Type::kBytes:
+          PERFETTO_FATAL("Unexpected column type");
+      }
+    }
+  }
+  if (has_string && (has_long || has_double)) {
+    return util::ErrStatus(
+        "Arg column for key %s: key has both string and numeric values", key);
+  }
+
+  *column = Column();
+  if (has_string) {
+    column->type = SqlValue::Type::kString;
+    column->string_values.reset(new NullableVector<StringPool::Id>());
+  } else if (has_double) {
+    column->type = SqlValue::Type::kDouble;
+    column->double_values.reset(new NullableVector<double>());
+  } else {
+    column->type = SqlValue::Type::kLong;
+    column->long_values.reset(new NullableVector<int64_t>());
+  }
+
+  for (uint32_t row : arg_rows) {
+    if (row == kNoRow) {
+      switch (column->type) {
+        case SqlValue::Type::kLong:
+          column->long_values->AppendNull();
+          break;
+        case SqlValue::Type::kDouble:
+          column->double_values->AppendNull();
+          break;
+        case SqlValue::Type::kString:
+          column->string_values->Append(kNullStringId);
+          break;
+        case SqlValue::Type::kNull:
+        case SqlValue::Type::kBytes:
+          PERFETTO_FATAL("Unexpected column type");
+      }
+      continue;
+    }
+
+    Variadic value = storage_->GetArgValue(row);
+    switch (value.type) {
+      case Variadic::Type::kInt:
+      case Variadic::Type::kUint:
+      case Variadic::Type::kBool:
+      case Variadic::Type::kPointer: {
+        // All of these are stored in the int_value column of the args table.
+        int64_t long_value = *storage_->arg_table().int_value()[row];
+        if (column->type == SqlValue::Type::kDouble) {
+          column->double_values->Append(static_cast<double>(long_value));
+        } else {
+          column->long_values->Append(long_value);
+        }
+        break;
+      }
+      case Variadic::Type::kReal:
+        column->double_values->Append(value.real_value);
+        break;
+      case Variadic::Type::kString:
+        column->string_values->Append(value.string_value);
+        break;
+      case Variadic::Type::kJson:
+        column->string_values->Append(value.json_value);
+        break;
+    }
+  }
+  return util::OkStatus();
+}
+
+bool MaterializedArgs::IsIndexed(const char* key) const {
+  base::Optional<StringId> key_id = storage_->string_pool().GetId(key);
+  if (!key_id)
+    return false;
+  auto it = keys_.find(*key_id);
+  return it != keys_.end() && it->second.indexed;
+}
+
+void MaterializedArgs::UpdateIndex(StringId key, KeyState* state) {
+  state->indexed = true;
+
+  const auto& arg_table = storage_->arg_table();
+  const auto& key_col = arg_table.key();
+  const auto& arg_set_id_col = arg_table.arg_set_id();
+  for (uint32_t row = state->indexed_arg_rows; row < arg_table.row_count();
+       ++row) {
+    if (key_col[row] != key)
+      continue;
+    uint32_t arg_set_id = arg_set_id_col[row];
+    if (arg_set_id >= state->row_for_arg_set.size())
+      state->row_for_arg_set.resize(arg_set_id + 1, kNoRow);
+    uint32_t* entry = &state->row_for_arg_set[arg_set_id];
+    *entry = *entry == kNoRow ? row : kMultipleRows;
+  }
+  state->indexed_arg_rows = arg_table.row_count();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
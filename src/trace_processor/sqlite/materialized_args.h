@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_MATERIALIZED_ARGS_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_MATERIALIZED_ARGS_H_
+
+#include <stdint.h>
+
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/containers/nullable_vector.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/variadic.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Speeds up lookups of the args which are accessed over and over again by
+// queries (e.g. EXTRACT_ARG(arg_set_id, 'args.name') evaluated for every row
+// of the slice table by a metric).
+//
+// Looking up a key in an arg set requires scanning all the args in the set
+// and comparing their keys. Instead, for keys which are "hot" (i.e. either
+// looked up often enough or explicitly materialized into a column), this
+// class keeps an index from arg set id to the row of the args table holding
+// the value of the key so every further lookup is O(1).
+//
+// The args table is append-only so indexes are extended (rather than rebuilt)
+// when new args are added while parsing.
+class MaterializedArgs {
+ public:
+  // A key is indexed after it has been looked up at least
+  // |kMinLookupsBeforeIndexing| times and at least once for every
+  // |kArgRowsPerLookup| rows of the args table. Building the index requires a
+  // scan of the whole args table while an unindexed lookup scans a single arg
+  // set: this ensures the cost of the index is amortized by the lookups.
+  static constexpr uint32_t kMinLookupsBeforeIndexing = 1024;
+  static constexpr uint32_t kArgRowsPerLookup = 8;
+
+  // The values of a key for each row of a table, see MaterializeColumn().
+  struct Column {
+    // The type of the values of the key, one of kLong, kDouble or kString.
+    // Only the vector matching this type is set.
+    SqlValue::Type type = SqlValue::Type::kLong;
+    std::unique_ptr<NullableVector<int64_t>> long_values;
+    std::unique_ptr<NullableVector<double>> double_values;
+    std::unique_ptr<NullableVector<StringPool::Id>> string_values;
+  };
+
+  explicit MaterializedArgs(const TraceStorage* storage);
+  ~MaterializedArgs();
+
+  // Same as TraceStorage::ExtractArg() but looks up the value of |key| in an
+  // index if |key| is hot.
+  util::Status ExtractArg(uint32_t arg_set_id,
+                          const char* key,
+                          base::Optional<Variadic>* result);
+
+  // Computes the value of |key| for each row of |table| (which must have an
+  // arg_set_id column), indexing |key| if it is not already. Rows without
+  // the key (and evicted rows) are null.
+  //
+  // Integer, boolean and pointer values are materialized as longs, real
+  // values as doubles (longs are promoted if a key has both) and string and
+  // json values as strings. Returns an error if a key has both string and
+  // numeric values or appears more than once in an arg set.
+  util::Status MaterializeColumn(const Table& table,
+                                 const char* key,
+                                 Column* column);
+
+  // Returns whether |key| is currently indexed.
+  bool IsIndexed(const char* key) const;
+
+  const TraceStorage* storage() const { return storage_; }
+
+ private:
+  static constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+  static constexpr uint32_t kMultipleRows = kNoRow - 1;
+
+  struct KeyState {
+    uint32_t lookups = 0;
+    bool indexed = false;
+
+    // The row of the args table holding the value of the key, indexed by arg
+    // set id. kNoRow if the arg set doesn't contain the key, kMultipleRows if
+    // it contains it more than once.
+    std::vector<uint32_t> row_for_arg_set;
+
+    // Number of rows of the args table which have been indexed so far.
+    uint32_t indexed_arg_rows = 0;
+  };
+
+  // Brings the index of |key| up to date with the args table.
+  void UpdateIndex(StringId key, KeyState* state);
+
+  const TraceStorage* const storage_;
+  std::unordered_map<StringId, KeyState> keys_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_MATERIALIZED_ARGS_H_
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/materialized_args.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class MaterializedArgsTest : public ::testing::Test {
+ public:
+  MaterializedArgsTest() : args_(&storage_) {}
+
+ protected:
+  // Adds a new arg set containing the given args and returns its id.
+  ArgSetId AddArgSet(
+      const std::vector<std::pair<const char*, Variadic>>& args) {
+    ArgSetId id = next_arg_set_id_++;
+    storage_.StartArgSet(id);
+    for (const auto& arg : args) {
+      tables::ArgTable::Row row;
+      row.arg_set_id = id;
+      row.key = storage_.InternString(arg.first);
+      row.flat_key = row.key;
+      row.value_type = storage_.GetIdForVariadicType(arg.second.type);
+      switch (arg.second.type) {
+        case Variadic::Type::kInt:
+          row.int_value = arg.second.int_value;
+          break;
+        case Variadic::Type::kBool:
+          row.int_value = arg.second.bool_value;
+          break;
+        case Variadic::Type::kReal:
+          row.real_value = arg.second.real_value;
+          break;
+        case Variadic::Type::kString:
+          row.string_value = arg.second.string_value;
+          break;
+        case Variadic::Type::kUint:
+        case Variadic::Type::kPointer:
+        case Variadic::Type::kJson:
+          PERFETTO_FATAL("Not used by the tests");
+      }
+      storage_.mutable_arg_table()->Insert(row);
+    }
+    return id;
+  }
+
+  void AddSlice(ArgSetId arg_set_id) {
+    tables::SliceTable::Row row;
+    row.arg_set_id = arg_set_id;
+    storage_.mutable_slice_table()->Insert(row);
+  }
+
+  Variadic String(const char* str) {
+    return Variadic::String(storage_.InternString(str));
+  }
+
+  // Looks up |key| enough times for it to be indexed.
+  void MakeHot(ArgSetId arg_set_id, const char* key) {
+    base::Optional<Variadic> value;
+    for (uint32_t i = 0; i < MaterializedArgs::kMinLookupsBeforeIndexing; ++i)
+      ASSERT_TRUE(args_.ExtractArg(arg_set_id, key, &value).ok());
+  }
+
+  TraceStorage storage_;
+  MaterializedArgs args_;
+  ArgSetId next_arg_set_id_ = 1;
+};
+
+TEST_F(MaterializedArgsTest, HotKeyIsIndexed) {
+  ArgSetId set_a = AddArgSet({{"a", Variadic::Integer(1)}});
+  ArgSetId set_ab =
+      AddArgSet({{"a", Variadic::Integer(2)}, {"b", String("foo")}});
+  ArgSetId set_b = AddArgSet({{"b", String("bar")}});
+
+  MakeHot(set_a, "a");
+  ASSERT_TRUE(args_.IsIndexed("a"));
+  ASSERT_FALSE(args_.IsIndexed("b"));
+
+  // Lookups of the indexed key must return the same results as the storage.
+  for (ArgSetId id : {ArgSetId(0), set_a, set_ab, set_b, ArgSetId(100)}) {
+    for (const char* key : {"a", "b", "c"}) {
+      base::Optional<Variadic> expected;
+      base::Optional<Variadic> actual;
+      ASSERT_TRUE(storage_.ExtractArg(id, key, &expected).ok());
+      ASSERT_TRUE(args_.ExtractArg(id, key, &actual).ok());
+      ASSERT_EQ(actual, expected) << "set " << id << " key " << key;
+    }
+  }
+}
+
+TEST_F(MaterializedArgsTest, IndexFollowsNewArgs) {
+  ArgSetId set_a = AddArgSet({{"a", Variadic::Integer(1)}});
+  MakeHot(set_a, "a");
+  ASSERT_TRUE(args_.IsIndexed("a"));
+
+  ArgSetId new_set_a = AddArgSet({{"a", Variadic::Integer(42)}});
+  base::Optional<Variadic> value;
+  ASSERT_TRUE(args_.ExtractArg(new_set_a, "a", &value).ok());
+  ASSERT_EQ(value, Variadic::Integer(42));
+}
+
+TEST_F(MaterializedArgsTest, DuplicateKeyIsError) {
+  ArgSetId set = AddArgSet({{"a", Variadic::Integer(1)},
+                            {"a", Variadic::Integer(2)},
+                            {"b", Variadic::Integer(3)}});
+  base::Optional<Variadic> value;
+  ASSERT_FALSE(args_.ExtractArg(set, "a", &value).ok());
+
+  MakeHot(set, "b");
+  ASSERT_TRUE(args_.IsIndexed("b"));
+  ASSERT_FALSE(args_.ExtractArg(set, "a", &value).ok());
+
+  MaterializedArgs::Column column;
+  AddSlice(set);
+  ASSERT_FALSE(args_.MaterializeColumn(storage_.slice_table(), "a", &column)
+                   .ok());
+}
+
+TEST_F(MaterializedArgsTest, MaterializeLongColumn) {
+  ArgSetId set_1 = AddArgSet({{"a", Variadic::Integer(1)}});
+  ArgSetId set_true = AddArgSet({{"a", Variadic::Boolean(true)}});
+  ArgSetId set_b = AddArgSet({{"b", Variadic::Integer(2)}});
+  AddSlice(set_1);
+  AddSlice(kInvalidArgSetId);
+  AddSlice(set_b);
+  AddSlice(set_true);
+
+  MaterializedArgs::Column column;
+  ASSERT_TRUE(
+      args_.MaterializeColumn(storage_.slice_table(), "a", &column).ok());
+  ASSERT_EQ(column.type, SqlValue::Type::kLong);
+  ASSERT_EQ(column.long_values->size(), 4u);
+  ASSERT_EQ(column.long_values->Get(0), 1);
+  ASSERT_EQ(column.long_values->Get(1), base::nullopt);
+  ASSERT_EQ(column.long_values->Get(2), base::nullopt);
+  ASSERT_EQ(column.long_values->Get(3), 1);
+  ASSERT_TRUE(args_.IsIndexed("a"));
+}
+
+TEST_F(MaterializedArgsTest, MaterializeDoubleColumn) {
+  AddSlice(AddArgSet({{"a", Variadic::Integer(1)}}));
+  AddSlice(AddArgSet({{"a", Variadic::Real(2.5)}}));
+
+  MaterializedArgs::Column column;
+  ASSERT_TRUE(
+      args_.MaterializeColumn(storage_.slice_table(), "a", &column).ok());
+  ASSERT_EQ(column.type, SqlValue::Type::kDouble);
+  ASSERT_EQ(column.double_values->Get(0), 1.0);
+  ASSERT_EQ(column.double_values->Get(1), 2.5);
+}
+
+TEST_F(MaterializedArgsTest, MaterializeStringColumn) {
+  AddSlice(AddArgSet({{"a", String("foo")}}));
+  AddSlice(AddArgSet({{"b", String("bar")}}));
+
+  MaterializedArgs::Column column;
+  ASSERT_TRUE(
+      args_.MaterializeColumn(storage_.slice_table(), "a", &column).ok());
+  ASSERT_EQ(column.type, SqlValue::Type::kString);
+  ASSERT_EQ(storage_.GetString(column.string_values->GetNonNull(0)), "foo");
+  ASSERT_TRUE(column.string_values->GetNonNull(1).is_null());
+}
+
+TEST_F(MaterializedArgsTest, MaterializeMixedColumnIsError) {
+  AddSlice(AddArgSet({{"a", String("foo")}}));
+  AddSlice(AddArgSet({{"a", Variadic::Integer(1)}}));
+
+  MaterializedArgs::Column column;
+  ASSERT_FALSE(
+      args_.MaterializeColumn(storage_.slice_table(), "a", &column).ok());
+}
+
+TEST_F(MaterializedArgsTest, MaterializeUnknownKey) {
+  AddSlice(AddArgSet({{"a", Variadic::Integer(1)}}));
+
+  MaterializedArgs::Column column;
+  ASSERT_TRUE(args_.MaterializeColumn(storage_.slice_table(), "never_interned",
+                                      &column)
+                  .ok());
+  ASSERT_EQ(column.type, SqlValue::Type::kLong);
+  ASSERT_EQ(column.long_values->size(), 1u);
+  ASSERT_EQ(column.long_values->Get(0), base::nullopt);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
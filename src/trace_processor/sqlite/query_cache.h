@@ -64,6 +64,10 @@ class QueryCache {
     return cached_.table;
   }
 
+  // Drops the cached table; used when the source tables have changed (e.g.
+  // because rows were evicted in streaming mode).
+  void Clear() { cached_ = CachedTable(); }
+
  private:
   struct CachedTable {
     std::shared_ptr<Table> table;
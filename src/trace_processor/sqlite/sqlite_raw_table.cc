@@ -18,6 +18,9 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+#include <limits>
+
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/system_info_tracker.h"
@@ -59,6 +62,7 @@ class ArgsSerializer {
                  ArgSetId arg_set_id,
                  NullTermStringView event_name,
                  std::vector<uint32_t>* field_id_to_arg_index,
+                 std::vector<StringId>* field_keys,
                  base::StringWriter*);
 
   void SerializeArgs();
@@ -128,6 +132,7 @@ class ArgsSerializer {
   ArgSetId arg_set_id_ = kInvalidArgSetId;
   NullTermStringView event_name_;
   std::vector<uint32_t>* field_id_to_arg_index_;
+  std::vector<StringId>* field_keys_;
 
   RowMap row_map_;
   uint32_t start_row_ = 0;
@@ -139,19 +144,20 @@ ArgsSerializer::ArgsSerializer(TraceProcessorContext* context,
                                ArgSetId arg_set_id,
                                NullTermStringView event_name,
                                std::vector<uint32_t>* field_id_to_arg_index,
+                               std::vector<StringId>* field_keys,
                                base::StringWriter* writer)
     : context_(context),
       arg_set_id_(arg_set_id),
       event_name_(event_name),
       field_id_to_arg_index_(field_id_to_arg_index),
+      field_keys_(field_keys),
       writer_(writer) {
   storage_ = context_->storage.get();
   const auto& args = storage_->arg_table();
-  const auto& set_ids = args.arg_set_id();
 
-  // We assume that the row map is a contiguous range (which is always the case
-  // because arg_set_ids are contiguous by definition).
-  row_map_ = args.FilterToRowMap({set_ids.eq(arg_set_id_)});
+  // The row map is always a contiguous range because arg sets are inserted
+  // contiguously.
+  row_map_ = storage_->GetArgSetRowMap(arg_set_id_);
   start_row_ = row_map_.empty() ? 0 : row_map_.Get(0);
 
   // If the vector already has entries, we've previously cached the mapping
@@ -175,9 +181,16 @@ ArgsSerializer::ArgsSerializer(TraceProcessorContext* context,
 
   // We need to reserve an index for the invalid field id 0.
   field_id_to_arg_index_->resize(max + 1);
+  field_keys_->resize(max + 1, kNullStringId);
 
   // Go through each field id and find the entry in the args table for that
   for (uint32_t i = 1; i <= max; ++i) {
+    // Field ids which are not used by the event have no name.
+    if (!descriptor->fields[i].name)
+      continue;
+    auto key_id = storage_->string_pool().GetId(descriptor->fields[i].name);
+    if (key_id)
+      (*field_keys_)[i] = *key_id;
     for (auto it = row_map_.IterateRows(); it; it.Next()) {
       base::StringView key = args.key().GetString(it.row());
       if (key == descriptor->fields[i].name) {
@@ -454,9 +467,33 @@ void ArgsSerializer::SerializeArgs() {
     WriteValueForField(TMW::kValueFieldNumber);
     return;
   }
+
+  // The args are written in an order which doesn't depend on the ids of the
+  // interned keys, so that trace_to_text can produce the same output without
+  // trace processor: by proto field id for the events which have a descriptor
+  // and by key for generic events.
+  const auto& args = storage_->arg_table();
+  std::vector<std::pair<uint32_t, uint32_t>> rank_and_row;
   for (auto it = row_map_.IterateRows(); it; it.Next()) {
-    WriteArgAtRow(it.row());
+    StringId key = args.key()[it.row()];
+    auto field_it = std::find(field_keys_->begin(), field_keys_->end(), key);
+    uint32_t rank =
+        field_it == field_keys_->end()
+            ? std::numeric_limits<uint32_t>::max()
+            : static_cast<uint32_t>(field_it - field_keys_->begin());
+    rank_and_row.emplace_back(rank, it.row());
   }
+  std::stable_sort(
+      rank_and_row.begin(), rank_and_row.end(),
+      [this, &args](const std::pair<uint32_t, uint32_t>& a,
+                    const std::pair<uint32_t, uint32_t>& b) {
+        if (a.first != b.first)
+          return a.first < b.first;
+        return storage_->GetString(args.key()[a.second]) <
+               storage_->GetString(args.key()[b.second]);
+      });
+  for (const auto& rank_row : rank_and_row)
+    WriteArgAtRow(rank_row.second);
 }
 
 void ArgsSerializer::WriteArgAtRow(uint32_t arg_row, ValueWriter writer) {
@@ -514,6 +551,7 @@ SqliteRawTable::SqliteRawTable(sqlite3* db, Context context)
           db,
           {context.cache, tables::RawTable::Schema(), TableComputation::kStatic,
            &context.context->storage->raw_table(), nullptr}),
+      raw_table_(&context.context->storage->raw_table()),
       serializer_(context.context) {
   auto fn = [](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
     auto* thiz = static_cast<SqliteRawTable*>(sqlite3_user_data(ctx));
@@ -540,9 +578,17 @@ void SqliteRawTable::ToSystrace(sqlite3_context* ctx,
     sqlite3_result_error(ctx, "Usage: to_ftrace(id)", -1);
     return;
   }
-  uint32_t row = static_cast<uint32_t>(sqlite3_value_int64(argv[0]));
+  int64_t id = sqlite3_value_int64(argv[0]);
+  base::Optional<uint32_t> row;
+  if (id >= 0 && id <= std::numeric_limits<uint32_t>::max())
+    row = raw_table_->id().IndexOf(RawId(static_cast<uint32_t>(id)));
+  if (!row) {
+    // Either the id never existed or the event was evicted in streaming mode.
+    sqlite3_result_error(ctx, "to_ftrace: no raw event with this id", -1);
+    return;
+  }
 
-  auto str = serializer_.SerializeToString(row);
+  auto str = serializer_.SerializeToString(*row);
   sqlite3_result_text(ctx, str.release(), -1, free);
 }
 
@@ -573,7 +619,7 @@ SystraceSerializer::ScopedCString SystraceSerializer::SerializeToString(
 
   ArgsSerializer serializer(context_, raw.arg_set_id()[raw_row], event_name,
                             &proto_id_to_arg_index_by_event_[event_name_id],
-                            &writer);
+                            &field_keys_by_event_[event_name_id], &writer);
   serializer.SerializeArgs();
 
   return ScopedCString(writer.CreateStringCopy(), free);
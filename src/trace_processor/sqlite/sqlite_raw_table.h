@@ -41,6 +41,8 @@ class SystraceSerializer {
   void SerializePrefix(uint32_t raw_row, base::StringWriter* writer);
 
   StringIdMap proto_id_to_arg_index_by_event_;
+  // The key of each proto field, by event and field id.
+  std::unordered_map<StringId, std::vector<StringId>> field_keys_by_event_;
   const TraceStorage* storage_ = nullptr;
   TraceProcessorContext* context_ = nullptr;
 };
@@ -60,6 +62,7 @@ class SqliteRawTable : public DbSqliteTable {
  private:
   void ToSystrace(sqlite3_context* ctx, int argc, sqlite3_value** argv);
 
+  const tables::RawTable* raw_table_ = nullptr;
   SystraceSerializer serializer_;
 };
 
@@ -23,6 +23,7 @@
 #include <map>
 
 #include "perfetto/base/logging.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -45,6 +46,41 @@ std::string TypeToString(SqlValue::Type type) {
   PERFETTO_FATAL("Not reached");  // For gcc
 }
 
+const char* OpToString(int op) {
+  switch (op) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      return "=";
+    case SQLITE_INDEX_CONSTRAINT_GT:
+      return ">";
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      return "<=";
+    case SQLITE_INDEX_CONSTRAINT_LT:
+      return "<";
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      return ">=";
+    case SQLITE_INDEX_CONSTRAINT_MATCH:
+      return "MATCH";
+    case SQLITE_INDEX_CONSTRAINT_LIKE:
+      return "LIKE";
+    case SQLITE_INDEX_CONSTRAINT_GLOB:
+      return "GLOB";
+    case SQLITE_INDEX_CONSTRAINT_REGEXP:
+      return "REGEXP";
+    case SQLITE_INDEX_CONSTRAINT_NE:
+      return "!=";
+    case SQLITE_INDEX_CONSTRAINT_ISNOT:
+      return "IS NOT";
+    case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+      return "IS NOT NULL";
+    case SQLITE_INDEX_CONSTRAINT_ISNULL:
+      return "IS NULL";
+    case SQLITE_INDEX_CONSTRAINT_IS:
+      return "IS";
+  }
+  // Ops added by the tables themselves in ModifyConstraints (e.g. span join).
+  return "<custom op>";
+}
+
 }  // namespace
 
 // static
@@ -166,6 +202,29 @@ bool SqliteTable::ReadConstraints(int idxNum, const char* idxStr, int argc) {
   return cache_hit;
 }
 
+std::string SqliteTable::DescribeConstraints() const {
+  const auto& columns = schema_.columns();
+  auto column_name = [&columns](int column) {
+    return column >= 0 && static_cast<size_t>(column) < columns.size()
+               ? columns[static_cast<size_t>(column)].name()
+               : std::string("rowid");
+  };
+
+  std::string desc;
+  for (const auto& cs : qc_cache_.constraints()) {
+    desc += desc.empty() ? "" : " AND ";
+    desc += column_name(cs.column) + " " + OpToString(cs.op);
+    if (!sqlite_utils::IsOpIsNull(cs.op) && !sqlite_utils::IsOpIsNotNull(cs.op))
+      desc += " ?";
+  }
+  for (size_t i = 0; i < qc_cache_.order_by().size(); ++i) {
+    const auto& ob = qc_cache_.order_by()[i];
+    desc += i == 0 ? (desc.empty() ? "ORDER BY " : " ORDER BY ") : ", ";
+    desc += column_name(ob.iColumn) + (ob.desc ? " DESC" : "");
+  }
+  return desc;
+}
+
 SqliteTable::Cursor::Cursor(SqliteTable* table) : table_(table) {
   // This is required to prevent us from leaving this field uninitialised if
   // we ever move construct the Cursor.
@@ -30,6 +30,7 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/sqlite/query_constraints.h"
+#include "src/trace_processor/storage/query_profile.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -270,15 +271,45 @@ class SqliteTable : public sqlite3_vtab {
 
       auto history = is_cached ? Cursor::FilterHistory::kSame
                                : Cursor::FilterHistory::kDifferent;
-      return static_cast<TCursor*>(c)->Filter(c->table_->qc_cache_, v, history);
+
+      QueryProfile* profile = QueryProfile::active();
+      if (PERFETTO_LIKELY(!profile)) {
+        return static_cast<TCursor*>(c)->Filter(c->table_->qc_cache_, v,
+                                                history);
+      }
+      SqliteTable* table = c->table_;
+      uint32_t op_id = profile->BindCursor(vc, table, i, table->name_, [table] {
+        return table->DescribeConstraints();
+      });
+      QueryProfile::ScopedCall call(profile, op_id,
+                                    QueryProfile::Method::kFilter);
+      int ret = static_cast<TCursor*>(c)->Filter(table->qc_cache_, v, history);
+      call.set_returned_row(ret == SQLITE_OK &&
+                            !static_cast<TCursor*>(c)->Eof());
+      return ret;
     };
     module->xNext = [](sqlite3_vtab_cursor* c) {
-      return static_cast<TCursor*>(c)->Next();
+      QueryProfile* profile = QueryProfile::active();
+      if (PERFETTO_LIKELY(!profile))
+        return static_cast<TCursor*>(c)->Next();
+
+      QueryProfile::ScopedCall call(profile, profile->CursorOperatorId(c),
+                                    QueryProfile::Method::kNext);
+      int ret = static_cast<TCursor*>(c)->Next();
+      call.set_returned_row(ret == SQLITE_OK &&
+                            !static_cast<TCursor*>(c)->Eof());
+      return ret;
     };
     module->xEof = [](sqlite3_vtab_cursor* c) {
       return static_cast<TCursor*>(c)->Eof();
     };
     module->xColumn = [](sqlite3_vtab_cursor* c, sqlite3_context* a, int b) {
+      QueryProfile* profile = QueryProfile::active();
+      if (PERFETTO_LIKELY(!profile))
+        return static_cast<TCursor*>(c)->Column(a, b);
+
+      QueryProfile::ScopedCall call(profile, profile->CursorOperatorId(c),
+                                    QueryProfile::Method::kColumn);
       return static_cast<TCursor*>(c)->Column(a, b);
     };
     module->xRowid = [](sqlite3_vtab_cursor* c, sqlite3_int64* r) {
@@ -353,6 +384,10 @@ class SqliteTable : public sqlite3_vtab {
 
   bool ReadConstraints(int idxNum, const char* idxStr, int argc);
 
+  // Describes the constraints and order by clauses last read by
+  // ReadConstraints, e.g. "ts >= ? AND cpu = ? ORDER BY ts DESC".
+  std::string DescribeConstraints() const;
+
   // Overriden functions from sqlite3_vtab.
   int OpenInternal(sqlite3_vtab_cursor**);
   int BestIndexInternal(sqlite3_index_info*);
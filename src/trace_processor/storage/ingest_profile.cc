@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/ingest_profile.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+const char* IngestProfile::PhaseName(Phase phase) {
+  switch (phase) {
+    case Phase::kTokenize:
+      return "tokenize";
+    case Phase::kParse:
+      return "parse";
+    case Phase::kParseFtrace:
+      return "parse_ftrace";
+    case Phase::kSort:
+      return "sort";
+    case Phase::kNumPhases:
+      break;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_INGEST_PROFILE_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_INGEST_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/time.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Collects counters of the work done in each phase of ingestion, broken down
+// by the type of the data being processed (i.e. the field id of the
+// TracePacket or FtraceEvent), to figure out where time goes when a trace is
+// slow to load. Exposed to SQL as the experimental_ingest_profile table.
+//
+// The profile is disabled by default (see Config::profile_ingestion), in which
+// case nothing is counted. When enabled, every event is counted but, to keep
+// the overhead low, only one in |kSamplingInterval| events of each type is
+// timed; the total time is then extrapolated from the sampled events.
+class IngestProfile {
+ public:
+  enum class Phase : uint32_t {
+    // ProtoImporterModule::TokenizePacket, by TracePacket field id.
+    kTokenize = 0,
+    // ProtoImporterModule::ParsePacket, by TracePacket field id.
+    kParse,
+    // FtraceParser, by FtraceEvent field id.
+    kParseFtrace,
+    // Sorting of the TraceSorter queues, by queue index (0 for non-ftrace
+    // data, cpu + 1 for ftrace data). All sorts are timed.
+    kSort,
+
+    kNumPhases,
+  };
+  static constexpr size_t kNumPhases = static_cast<size_t>(Phase::kNumPhases);
+
+  // Odd so that events of a type which alternate (e.g. slice begin/end) are
+  // not always sampled on the same side.
+  static constexpr uint32_t kSamplingInterval = 31;
+
+  struct Entry {
+    uint64_t count = 0;
+    uint64_t size = 0;
+    uint64_t sampled_count = 0;
+    int64_t sampled_dur_ns = 0;
+
+    // Returns the total duration of all events, extrapolated from the
+    // sampled ones.
+    int64_t EstimatedDurNs() const {
+      if (sampled_count == 0)
+        return 0;
+      return static_cast<int64_t>(static_cast<double>(sampled_dur_ns) *
+                                  static_cast<double>(count) /
+                                  static_cast<double>(sampled_count));
+    }
+  };
+
+  // Times the scope it lives in if the event was chosen to be sampled.
+  class ScopedSample {
+   public:
+    ScopedSample() = default;
+    ScopedSample(IngestProfile* profile, Phase phase, uint32_t field_id)
+        : profile_(profile),
+          phase_(phase),
+          field_id_(field_id),
+          start_ns_(base::GetWallTimeNs()) {}
+    ~ScopedSample() {
+      if (PERFETTO_LIKELY(!profile_))
+        return;
+      // Look the entry up again as the vector storing it might have been
+      // resized while this sample was in scope.
+      int64_t dur_ns = (base::GetWallTimeNs() - start_ns_).count();
+      profile_->GetOrCreateEntry(phase_, field_id_)->sampled_dur_ns += dur_ns;
+    }
+
+    ScopedSample(ScopedSample&& other) noexcept { *this = std::move(other); }
+    ScopedSample& operator=(ScopedSample&& other) noexcept {
+      profile_ = other.profile_;
+      phase_ = other.phase_;
+      field_id_ = other.field_id_;
+      start_ns_ = other.start_ns_;
+      other.profile_ = nullptr;
+      return *this;
+    }
+
+   private:
+    ScopedSample(const ScopedSample&) = delete;
+    ScopedSample& operator=(const ScopedSample&) = delete;
+
+    IngestProfile* profile_ = nullptr;
+    Phase phase_ = Phase::kTokenize;
+    uint32_t field_id_ = 0;
+    base::TimeNanos start_ns_{};
+  };
+
+  // Counts an event of type |field_id| with |size| bytes in |phase|. The
+  // returned object should be kept in scope while the event is processed.
+  ScopedSample Sample(Phase phase, uint32_t field_id, size_t size) {
+    if (PERFETTO_LIKELY(!enabled_))
+      return ScopedSample();
+    Entry* entry = GetOrCreateEntry(phase, field_id);
+    entry->size += size;
+    if (PERFETTO_LIKELY(entry->count++ % kSamplingInterval != 0))
+      return ScopedSample();
+    entry->sampled_count++;
+    return ScopedSample(this, phase, field_id);
+  }
+
+  // Records events which were timed (as a whole) by the caller.
+  void Add(Phase phase,
+           uint32_t field_id,
+           uint64_t count,
+           size_t size,
+           int64_t dur_ns) {
+    if (!enabled_)
+      return;
+    Entry* entry = GetOrCreateEntry(phase, field_id);
+    entry->count += count;
+    entry->size += size;
+    entry->sampled_count += count;
+    entry->sampled_dur_ns += dur_ns;
+  }
+
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  // Returns the entries of |phase|, indexed by field id. Entries of field ids
+  // which were never seen have a zero count.
+  const std::vector<Entry>& entries(Phase phase) const {
+    return entries_[static_cast<size_t>(phase)];
+  }
+
+  static const char* PhaseName(Phase phase);
+
+ private:
+  Entry* GetOrCreateEntry(Phase phase, uint32_t field_id) {
+    std::vector<Entry>& entries = entries_[static_cast<size_t>(phase)];
+    if (PERFETTO_UNLIKELY(field_id >= entries.size()))
+      entries.resize(field_id + 1);
+    return &entries[field_id];
+  }
+
+  bool enabled_ = false;
+  std::array<std::vector<Entry>, kNumPhases> entries_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_INGEST_PROFILE_H_
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/query_profile.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+PERFETTO_THREAD_LOCAL QueryProfile* QueryProfile::active_ = nullptr;
+
+QueryProfile::QueryProfile(uint32_t query_id, std::string query)
+    : query_id_(query_id), query_(std::move(query)) {
+  operators_.emplace_back();
+}
+
+QueryProfile::~QueryProfile() = default;
+
+QueryProfile::ScopedCall::~ScopedCall() {
+  int64_t dur_ns = (base::GetWallTimeNs() - start_ns_).count();
+  profile_->current_operator_id_ = outer_operator_id_;
+
+  // Look the operator up again as the vector storing it might have been
+  // resized while this call was in scope.
+  Operator* op = &profile_->operators_[operator_id_];
+  switch (method_) {
+    case Method::kFilter:
+      op->filter_count++;
+      op->filter_dur_ns += dur_ns;
+      break;
+    case Method::kNext:
+      op->next_dur_ns += dur_ns;
+      break;
+    case Method::kColumn:
+      op->column_dur_ns += dur_ns;
+      break;
+  }
+  if (returned_row_)
+    op->rows_returned++;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_QUERY_PROFILE_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_QUERY_PROFILE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/optional.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Records the work done by the virtual tables read by a query, to figure out
+// where time goes when a query is slow. Exposed to SQL as the
+// experimental_query_profile table.
+//
+// The work is broken down by operator: an operator is a virtual table read
+// with one of the plans chosen by SQLite in BestIndex. Operator 0 is the
+// statement itself, so the time spent in SQLite (e.g. evaluating expressions
+// and sorting) is the time of the statement minus the one of its children.
+// Operators read while a method of another operator runs (e.g. the children of
+// a span join) are children of that operator and their time is included in
+// the one of their parent.
+//
+// Profiling times every call made by SQLite to the virtual tables, so it is
+// only done for the queries executed while it is enabled (see
+// TraceProcessor::SetQueryProfilingEnabled).
+class QueryProfile {
+ public:
+  static constexpr uint32_t kStatementId = 0;
+
+  enum class Method { kFilter, kNext, kColumn };
+
+  struct Operator {
+    base::Optional<uint32_t> parent_id;
+
+    // Both empty for the statement.
+    std::string table_name;
+    std::string plan;
+
+    uint32_t filter_count = 0;
+    // Number of Filter calls served from the table cached by the QueryCache.
+    uint32_t cache_hit_count = 0;
+    // Number of rows of the tables filtered, only known for the tables backed
+    // by a db::Table.
+    base::Optional<int64_t> rows_scanned;
+    // Number of rows returned to SQLite by Filter and Next.
+    int64_t rows_returned = 0;
+
+    int64_t filter_dur_ns = 0;
+    int64_t next_dur_ns = 0;
+    int64_t column_dur_ns = 0;
+  };
+
+  // Times a call to a method of an operator. The operator is the current one
+  // while the call is in scope.
+  class ScopedCall {
+   public:
+    ScopedCall(QueryProfile* profile, uint32_t operator_id, Method method)
+        : profile_(profile),
+          operator_id_(operator_id),
+          method_(method),
+          outer_operator_id_(profile->current_operator_id_),
+          start_ns_(base::GetWallTimeNs()) {
+      profile_->current_operator_id_ = operator_id_;
+    }
+    ~ScopedCall();
+
+    // Counts a row returned by the call.
+    void set_returned_row(bool returned_row) { returned_row_ = returned_row; }
+
+   private:
+    ScopedCall(const ScopedCall&) = delete;
+    ScopedCall& operator=(const ScopedCall&) = delete;
+
+    QueryProfile* profile_ = nullptr;
+    uint32_t operator_id_ = 0;
+    Method method_ = Method::kFilter;
+    uint32_t outer_operator_id_ = 0;
+    bool returned_row_ = false;
+    base::TimeNanos start_ns_{};
+  };
+
+  QueryProfile(uint32_t query_id, std::string query);
+  ~QueryProfile();
+
+  // Returns the profile the virtual tables record into on this thread: the
+  // one of the query being stepped, if it is profiled, or nullptr.
+  static QueryProfile* active() { return active_; }
+
+  // Sets the profile the virtual tables record into on this thread and
+  // returns the previous one.
+  static QueryProfile* SetActive(QueryProfile* profile) {
+    QueryProfile* previous = active_;
+    active_ = profile;
+    return previous;
+  }
+
+  // Returns the operator reading |table| with the plan |plan_id| given by
+  // BestIndex, adding it as a child of the current operator if needed, and
+  // binds |cursor| to it for the following Next and Column calls.
+  // |describe_plan| is only called when the operator is added.
+  template <typename DescribePlan>
+  uint32_t BindCursor(const void* cursor,
+                      const void* table,
+                      int plan_id,
+                      const std::string& table_name,
+                      DescribePlan describe_plan) {
+    auto it = operators_by_plan_.find(std::make_pair(table, plan_id));
+    uint32_t id;
+    if (it == operators_by_plan_.end()) {
+      id = static_cast<uint32_t>(operators_.size());
+      Operator op;
+      op.parent_id = current_operator_id_;
+      op.table_name = table_name;
+      op.plan = describe_plan();
+      operators_.emplace_back(std::move(op));
+      operators_by_plan_.emplace(std::make_pair(table, plan_id), id);
+    } else {
+      id = it->second;
+    }
+    operators_by_cursor_[cursor] = id;
+    return id;
+  }
+
+  // Returns the operator |cursor| was bound to by its last Filter call.
+  uint32_t CursorOperatorId(const void* cursor) const {
+    auto it = operators_by_cursor_.find(cursor);
+    return it == operators_by_cursor_.end() ? kStatementId : it->second;
+  }
+
+  // Returns the operator whose method is being called.
+  Operator* current_operator() { return &operators_[current_operator_id_]; }
+
+  uint32_t query_id() const { return query_id_; }
+  const std::string& query() const { return query_; }
+  const std::vector<Operator>& operators() const { return operators_; }
+
+ private:
+  QueryProfile(const QueryProfile&) = delete;
+  QueryProfile& operator=(const QueryProfile&) = delete;
+
+  static PERFETTO_THREAD_LOCAL QueryProfile* active_;
+
+  uint32_t query_id_ = 0;
+  std::string query_;
+
+  std::vector<Operator> operators_;
+  std::map<std::pair<const void*, int>, uint32_t> operators_by_plan_;
+  std::unordered_map<const void*, uint32_t> operators_by_cursor_;
+  uint32_t current_operator_id_ = kStatementId;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_QUERY_PROFILE_H_
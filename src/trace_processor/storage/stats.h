@@ -65,6 +65,9 @@ namespace stats {
   F(meminfo_unknown_keys,               kSingle,  kError,    kAnalysis, ""),   \
   F(mismatched_sched_switch_tids,       kSingle,  kError,    kAnalysis, ""),   \
   F(mm_unknown_type,                    kSingle,  kError,    kAnalysis, ""),   \
+  F(packet_duplicate_of_missing,        kSingle,  kDataLoss, kTrace,           \
+      "A packet refers through duplicate_of to a deduplicated packet which is "\
+      "not in the trace. The packet has been dropped."),                       \
   F(parse_trace_duration_ns,            kSingle,  kInfo,     kAnalysis, ""),   \
   F(power_rail_unknown_index,           kSingle,  kError,    kTrace,    ""),   \
   F(proc_stat_unknown_counters,         kSingle,  kError,    kAnalysis, ""),   \
@@ -87,10 +90,12 @@ namespace stats {
   F(systrace_parse_failure,             kSingle,  kError,    kAnalysis, ""),   \
   F(task_state_invalid,                 kSingle,  kError,    kAnalysis, ""),   \
   F(traced_buf_buffer_size,             kIndexed, kInfo,     kTrace,    ""),   \
+  F(traced_buf_bytes_evicted,           kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_bytes_overwritten,       kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_bytes_read,              kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_bytes_written,           kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_chunks_discarded,        kIndexed, kInfo,     kTrace,    ""),   \
+  F(traced_buf_chunks_evicted,          kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_chunks_overwritten,      kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_chunks_read,             kIndexed, kInfo,     kTrace,    ""),   \
   F(traced_buf_chunks_rewritten,        kIndexed, kInfo,     kTrace,    ""),   \
@@ -108,6 +113,9 @@ namespace stats {
   F(traced_chunks_discarded,            kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_data_sources_registered,     kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_data_sources_seen,           kSingle,  kInfo,     kTrace,    ""),   \
+  F(traced_deduplicated_bytes,          kSingle,  kInfo,     kTrace,    ""),   \
+  F(traced_deduplicated_packets,        kSingle,  kInfo,     kTrace,    ""),   \
+  F(traced_flush_ipcs_skipped,          kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_patches_discarded,           kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_producers_connected,         kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_producers_seen,              kSingle,  kInfo,     kTrace,    ""),   \
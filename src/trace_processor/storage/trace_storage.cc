@@ -71,7 +71,8 @@ const std::vector<NullTermStringView>& GetRefTypeStringMap() {
   return map.ref();
 }
 
-TraceStorage::TraceStorage(const Config&) {
+TraceStorage::TraceStorage(const Config& cfg) {
+  ingest_profile_.set_enabled(cfg.profile_ingestion);
   for (uint32_t i = 0; i < variadic_type_ids_.size(); ++i) {
     variadic_type_ids_[i] = InternString(Variadic::kTypeNames[i]);
   }
@@ -79,6 +80,15 @@ TraceStorage::TraceStorage(const Config&) {
 
 TraceStorage::~TraceStorage() {}
 
+std::shared_ptr<QueryProfile> TraceStorage::AddQueryProfile(
+    uint32_t sql_stats_row,
+    const std::string& query) {
+  if (query_profiles_.size() >= SqlStats::kMaxLogEntries)
+    query_profiles_.pop_front();
+  query_profiles_.emplace_back(new QueryProfile(sql_stats_row, query));
+  return query_profiles_.back();
+}
+
 uint32_t TraceStorage::SqlStats::RecordQueryBegin(const std::string& query,
                                                   int64_t time_queued,
                                                   int64_t time_started) {
@@ -119,6 +129,17 @@ void TraceStorage::SqlStats::RecordQueryEnd(uint32_t row, int64_t time_ended) {
   times_ended_[queue_row] = time_ended;
 }
 
+RowMap TraceStorage::GetArgSetsRowMap(
+    const std::vector<ArgSetId>& arg_set_ids) const {
+  std::vector<uint32_t> rows;
+  for (ArgSetId arg_set_id : arg_set_ids) {
+    auto range = GetArgSetRowRange(arg_set_id);
+    for (uint32_t row = range.first; row < range.second; ++row)
+      rows.push_back(row);
+  }
+  return RowMap(std::move(rows));
+}
+
 std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   int64_t start_ns = std::numeric_limits<int64_t>::max();
   int64_t end_ns = std::numeric_limits<int64_t>::min();
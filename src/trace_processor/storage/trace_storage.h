@@ -20,6 +20,7 @@
 #include <array>
 #include <deque>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -34,7 +35,9 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/storage/ingest_profile.h"
 #include "src/trace_processor/storage/metadata.h"
+#include "src/trace_processor/storage/query_profile.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/tables/android_tables.h"
 #include "src/trace_processor/tables/counter_tables.h"
@@ -425,6 +428,15 @@ class TraceStorage {
   const SqlStats& sql_stats() const { return sql_stats_; }
   SqlStats* mutable_sql_stats() { return &sql_stats_; }
 
+  // Adds the profile of the query at |sql_stats_row|. Only the profiles of
+  // the last SqlStats::kMaxLogEntries queries profiled are kept but the
+  // profile lives as long as the returned pointer, i.e. until the query ends.
+  std::shared_ptr<QueryProfile> AddQueryProfile(uint32_t sql_stats_row,
+                                                const std::string& query);
+  const std::deque<std::shared_ptr<QueryProfile>>& query_profiles() const {
+    return query_profiles_;
+  }
+
   const tables::InstantTable& instant_table() const { return instant_table_; }
   tables::InstantTable* mutable_instant_table() { return &instant_table_; }
 
@@ -437,6 +449,9 @@ class TraceStorage {
 
   const StatsMap& stats() const { return stats_; }
 
+  const IngestProfile& ingest_profile() const { return ingest_profile_; }
+  IngestProfile* mutable_ingest_profile() { return &ingest_profile_; }
+
   const tables::MetadataTable& metadata_table() const {
     return metadata_table_;
   }
@@ -636,22 +651,57 @@ class TraceStorage {
   // Returns (0, 0) if the trace is empty.
   std::pair<int64_t, int64_t> GetTraceTimestampBoundsNs() const;
 
+  // Records that the args of |arg_set_id| start at the current end of the
+  // args table. Must be called, in increasing order of id, before the args of
+  // each new arg set are inserted; GlobalArgsTracker takes care of this.
+  void StartArgSet(ArgSetId arg_set_id) {
+    PERFETTO_DCHECK(arg_set_id == arg_set_start_rows_.size());
+    arg_set_start_rows_.push_back(arg_table_.row_count());
+  }
+
+  // Returns the [begin, end) range of rows of the args table containing the
+  // args of |arg_set_id|. As arg sets are inserted contiguously, this does not
+  // need to search the table.
+  std::pair<uint32_t, uint32_t> GetArgSetRowRange(ArgSetId arg_set_id) const {
+    if (arg_set_id >= arg_set_start_rows_.size())
+      return std::make_pair(0u, 0u);
+    uint32_t end = arg_set_id + 1 < arg_set_start_rows_.size()
+                       ? arg_set_start_rows_[arg_set_id + 1]
+                       : arg_table_.row_count();
+    return std::make_pair(arg_set_start_rows_[arg_set_id], end);
+  }
+
+  // Returns a RowMap over the rows of the args table containing the args of
+  // |arg_set_id|.
+  RowMap GetArgSetRowMap(ArgSetId arg_set_id) const {
+    auto range = GetArgSetRowRange(arg_set_id);
+    return RowMap(range.first, range.second);
+  }
+
+  // Returns a RowMap over the rows of the args table containing the args of
+  // all the |arg_set_ids|, in the order of the ids.
+  RowMap GetArgSetsRowMap(const std::vector<ArgSetId>& arg_set_ids) const;
+
   util::Status ExtractArg(uint32_t arg_set_id,
                           const char* key,
-                          base::Optional<Variadic>* result) {
-    const auto& args = arg_table();
-    RowMap filtered = args.FilterToRowMap(
-        {args.arg_set_id().eq(arg_set_id), args.key().eq(key)});
-    if (filtered.empty()) {
-      *result = base::nullopt;
+                          base::Optional<Variadic>* result) const {
+    *result = base::nullopt;
+
+    // If the key was never interned, no arg can have it.
+    base::Optional<StringId> key_id = string_pool_.GetId(key);
+    if (!key_id)
       return util::OkStatus();
+
+    auto range = GetArgSetRowRange(arg_set_id);
+    for (uint32_t row = range.first; row < range.second; ++row) {
+      if (arg_table_.key()[row] != *key_id)
+        continue;
+      if (result->has_value()) {
+        return util::ErrStatus(
+            "EXTRACT_ARG: received multiple args matching arg set id and key");
+      }
+      *result = GetArgValue(row);
     }
-    if (filtered.size() > 1) {
-      return util::ErrStatus(
-          "EXTRACT_ARG: received multiple args matching arg set id and key");
-    }
-    uint32_t idx = filtered.Get(0);
-    *result = GetArgValue(idx);
     return util::OkStatus();
   }
 
@@ -721,6 +771,9 @@ class TraceStorage {
   // Stats about parsing the trace.
   StatsMap stats_{};
 
+  // Per-phase counters of the work done during ingestion.
+  IngestProfile ingest_profile_;
+
   // Extra data extracted from the trace. Includes:
   // * metadata from chrome and benchmarking infrastructure
   // * descriptions of android packages
@@ -756,6 +809,11 @@ class TraceStorage {
   // Args for all other tables.
   tables::ArgTable arg_table_{&string_pool_, nullptr};
 
+  // The first row of |arg_table_| containing the args of each arg set,
+  // indexed by arg set id. Starts with an entry for kInvalidArgSetId which
+  // never has any args.
+  std::vector<uint32_t> arg_set_start_rows_ = std::vector<uint32_t>(1, 0);
+
   // Information about all the threads and processes in the trace.
   tables::ThreadTable thread_table_{&string_pool_, nullptr};
   tables::ProcessTable process_table_{&string_pool_, nullptr};
@@ -786,6 +844,9 @@ class TraceStorage {
 
   SqlStats sql_stats_;
 
+  // The work done by the virtual tables of the queries profiled.
+  std::deque<std::shared_ptr<QueryProfile>> query_profiles_;
+
   // These are instantaneous events in the trace. They have no duration
   // and do not have a value that make sense to track over time.
   // e.g. signal events
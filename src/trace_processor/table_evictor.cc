@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/table_evictor.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/ftrace/sched_event_tracker.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Returns the row up to which rows of |table| can be evicted given the
+// |cutoff_ts|; |scan_row| is the row at which the previous scan ended.
+template <typename Table>
+uint32_t FindEvictionEnd(const Table& table,
+                         int64_t cutoff_ts,
+                         base::Optional<uint32_t> first_pending_row,
+                         uint32_t* scan_row) {
+  uint32_t end = table.row_count();
+  if (first_pending_row)
+    end = std::min(end, *first_pending_row);
+
+  // Rows are (almost always) inserted in timestamp order so scan forward from
+  // where we stopped last time; this makes the cost of scanning linear in the
+  // number of rows over the lifetime of the trace. If a row is out of order,
+  // we simply stop early which is safe.
+  const auto& ts = table.ts();
+  uint32_t row = std::max(*scan_row, table.evicted_row_count());
+  for (; row < end && ts[row] < cutoff_ts; ++row) {
+  }
+  *scan_row = row;
+  return row;
+}
+
+template <typename Table>
+bool MaybeEvictTable(Table* table,
+                     int64_t cutoff_ts,
+                     base::Optional<uint32_t> first_pending_row,
+                     uint32_t* scan_row) {
+  uint32_t end =
+      FindEvictionEnd(*table, cutoff_ts, first_pending_row, scan_row);
+
+  // Only evict once a sizeable fraction of the table can be evicted: each
+  // eviction moves all the remaining rows so this bounds the amortized cost.
+  uint32_t evictable = end - table->evicted_row_count();
+  uint32_t live_rows = table->row_count() - table->evicted_row_count();
+  uint32_t min_rows = TableEvictor::kMinRowsToEvict;
+  if (evictable < std::max(min_rows, live_rows / 2))
+    return false;
+
+  table->EvictRowsBefore(end);
+  return true;
+}
+
+}  // namespace
+
+TableEvictor::TableEvictor(TraceProcessorContext* context, int64_t horizon_ns)
+    : context_(context), horizon_ns_(horizon_ns) {}
+
+TableEvictor::~TableEvictor() = default;
+
+bool TableEvictor::MaybeEvict() {
+  // The sorter is only created once the type of the trace is known.
+  if (!context_->sorter)
+    return false;
+
+  // The sorter's max timestamp goes back to zero whenever all its queues are
+  // drained so keep track of the newest timestamp ourselves.
+  max_ts_ = std::max(max_ts_, context_->sorter->max_timestamp());
+  if (max_ts_ < std::numeric_limits<int64_t>::min() + horizon_ns_)
+    return false;
+  int64_t cutoff_ts = max_ts_ - horizon_ns_;
+
+  // Don't touch the sched_tracker unless it has been created: the tracker is
+  // only created lazily when sched events are seen.
+  base::Optional<uint32_t> first_pending_sched;
+  if (context_->sched_tracker) {
+    first_pending_sched =
+        SchedEventTracker::GetOrCreate(context_)->FirstPendingSliceRow();
+  }
+
+  TraceStorage* storage = context_->storage.get();
+  const EventTracker* event_tracker = context_->event_tracker.get();
+  bool evicted = false;
+  evicted |= MaybeEvictTable(storage->mutable_sched_slice_table(), cutoff_ts,
+                             first_pending_sched, &sched_scan_row_);
+  evicted |= MaybeEvictTable(storage->mutable_counter_table(), cutoff_ts,
+                             event_tracker->FirstPendingCounterRow(),
+                             &counter_scan_row_);
+  evicted |= MaybeEvictTable(storage->mutable_instant_table(), cutoff_ts,
+                             event_tracker->FirstPendingInstantRow(),
+                             &instant_scan_row_);
+  evicted |= MaybeEvictTable(storage->mutable_raw_table(), cutoff_ts,
+                             base::nullopt, &raw_scan_row_);
+  return evicted;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
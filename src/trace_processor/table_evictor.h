@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_TABLE_EVICTOR_H_
+#define SRC_TRACE_PROCESSOR_TABLE_EVICTOR_H_
+
+#include <stdint.h>
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Implements the eviction of old rows in streaming mode (see
+// Config::streaming_horizon_ns): rows of the high-volume event tables which
+// are older than the horizon (relative to the newest event seen by the sorter)
+// are evicted, in bulk, from the start of the tables.
+//
+// Only tables which are append-only in timestamp order, have no child tables
+// and whose rows are not referenced by id from other tables are evicted: i.e.
+// sched_slice, counter, instant and raw. Rows which trackers may still update
+// (e.g. sched slices which are still open) are never evicted.
+class TableEvictor {
+ public:
+  // The minimum number of rows which are evicted from a table at once. As
+  // eviction needs to move all the remaining rows of a table, doing it in bulk
+  // keeps the amortized cost per row constant.
+  static constexpr uint32_t kMinRowsToEvict = 64 * 1024;
+
+  TableEvictor(TraceProcessorContext* context, int64_t horizon_ns);
+  ~TableEvictor();
+
+  // Evicts rows from the tables if enough of them are older than the horizon.
+  // Returns true if any rows were evicted.
+  bool MaybeEvict();
+
+ private:
+  TraceProcessorContext* const context_;
+  const int64_t horizon_ns_;
+  int64_t max_ts_ = 0;
+
+  uint32_t sched_scan_row_ = 0;
+  uint32_t counter_scan_row_ = 0;
+  uint32_t instant_scan_row_ = 0;
+  uint32_t raw_scan_row_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_TABLE_EVICTOR_H_
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/table_evictor.h"
+
+#include <limits>
+#include <string>
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/track_tracker.h"
+#include "src/trace_processor/importers/proto/proto_trace_parser.h"
+#include "src/trace_processor/sqlite/query_cache.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/sqlite_raw_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kMinRows = TableEvictor::kMinRowsToEvict;
+constexpr int64_t kHorizonNs = 1000;
+
+class NoopTraceParser : public ProtoTraceParser {
+ public:
+  explicit NoopTraceParser(TraceProcessorContext* context)
+      : ProtoTraceParser(context) {}
+
+  void ParseTracePacket(int64_t, TimestampedTracePiece) override {}
+};
+
+class TableEvictorTest : public ::testing::Test {
+ public:
+  TableEvictorTest()
+      : sequence_state_(&context_),
+        buffer_(std::unique_ptr<uint8_t[]>(new uint8_t[8]), 0, 8) {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+    context_.event_tracker.reset(new EventTracker(&context_));
+    context_.track_tracker.reset(new TrackTracker(&context_));
+    context_.sorter.reset(new TraceSorter(
+        std::unique_ptr<TraceParser>(new NoopTraceParser(&context_)),
+        std::numeric_limits<int64_t>::max()));
+    evictor_.reset(new TableEvictor(&context_, kHorizonNs));
+  }
+
+ protected:
+  // Moves the newest timestamp seen by the sorter forward to |ts|.
+  void AdvanceTo(int64_t ts) {
+    context_.sorter->PushTracePacket(ts, &sequence_state_,
+                                     buffer_.slice(0, 1));
+  }
+
+  void InsertRaw(uint32_t count, int64_t ts) {
+    auto* raw = context_.storage->mutable_raw_table();
+    for (uint32_t i = 0; i < count; ++i) {
+      tables::RawTable::Row row;
+      row.ts = ts;
+      raw->Insert(row);
+    }
+  }
+
+  TraceProcessorContext context_;
+  PacketSequenceState sequence_state_;
+  TraceBlobView buffer_;
+  std::unique_ptr<TableEvictor> evictor_;
+};
+
+TEST_F(TableEvictorTest, NoSorter) {
+  context_.sorter.reset();
+  ASSERT_FALSE(evictor_->MaybeEvict());
+}
+
+TEST_F(TableEvictorTest, EvictsInBulk) {
+  const auto& raw = context_.storage->raw_table();
+
+  // Too few rows older than the horizon: nothing should be evicted.
+  InsertRaw(kMinRows - 1, 100);
+  AdvanceTo(5000);
+  ASSERT_FALSE(evictor_->MaybeEvict());
+  ASSERT_EQ(raw.evicted_row_count(), 0u);
+
+  // Once enough rows are old, all of them are evicted at once.
+  InsertRaw(1, 200);
+  InsertRaw(10, 5000);
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(raw.evicted_row_count(), kMinRows);
+  ASSERT_EQ(raw.row_count(), kMinRows + 10);
+  ASSERT_EQ(raw.Filter({}).row_count(), 10u);
+
+  // Nothing else is old enough.
+  ASSERT_FALSE(evictor_->MaybeEvict());
+}
+
+TEST_F(TableEvictorTest, DrainedSorter) {
+  const auto& raw = context_.storage->raw_table();
+
+  InsertRaw(kMinRows - 1, 100);
+  AdvanceTo(5000);
+  ASSERT_FALSE(evictor_->MaybeEvict());
+
+  // Draining the sorter resets its max timestamp but the horizon should still
+  // be relative to the newest timestamp seen.
+  context_.sorter->ExtractEventsForced();
+  ASSERT_EQ(context_.sorter->max_timestamp(), 0);
+  InsertRaw(1, 200);
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(raw.evicted_row_count(), kMinRows);
+}
+
+TEST_F(TableEvictorTest, OutOfOrderRowStopsEviction) {
+  const auto& raw = context_.storage->raw_table();
+
+  InsertRaw(kMinRows, 100);
+  InsertRaw(1, 100000);
+  InsertRaw(kMinRows, 100);
+  AdvanceTo(5000);
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(raw.evicted_row_count(), kMinRows);
+}
+
+TEST_F(TableEvictorTest, ToFtraceOnEvictedRow) {
+  const auto& raw = context_.storage->raw_table();
+
+  InsertRaw(kMinRows, 100);
+  InsertRaw(1, 5000);
+  AdvanceTo(5000);
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(raw.id().IndexOf(RawId(0)), base::nullopt);
+  ASSERT_EQ(raw.id().IndexOf(RawId(kMinRows)), kMinRows);
+
+  sqlite3* db_raw = nullptr;
+  ASSERT_EQ(sqlite3_open(":memory:", &db_raw), SQLITE_OK);
+  ScopedDb db(db_raw);
+  ASSERT_EQ(sqlite3_exec(*db, "CREATE TABLE perfetto_tables(name STRING)",
+                         nullptr, nullptr, nullptr),
+            SQLITE_OK);
+  QueryCache cache;
+  SqliteRawTable::RegisterTable(*db, &cache, &context_);
+
+  auto step = [&db](const std::string& sql) {
+    sqlite3_stmt* stmt_raw = nullptr;
+    PERFETTO_CHECK(sqlite3_prepare_v2(*db, sql.c_str(), -1, &stmt_raw,
+                                      nullptr) == SQLITE_OK);
+    ScopedStmt stmt(stmt_raw);
+    return sqlite3_step(*stmt);
+  };
+
+  // Looking up an evicted row by id doesn't return it. This also
+  // creates the raw table which registers to_ftrace.
+  ASSERT_EQ(step("select * from raw where id = 0"), SQLITE_DONE);
+
+  // Evicted and never inserted ids are errors rather than out of bounds
+  // reads.
+  ASSERT_EQ(step("select to_ftrace(0)"), SQLITE_ERROR);
+  ASSERT_EQ(step("select to_ftrace(" + std::to_string(kMinRows + 1) + ")"),
+            SQLITE_ERROR);
+  ASSERT_EQ(step("select to_ftrace(" + std::to_string(kMinRows) + ")"),
+            SQLITE_ROW);
+}
+
+TEST_F(TableEvictorTest, PendingCountersNotEvicted) {
+  const auto& counters = context_.storage->counter_table();
+  auto* event_tracker = context_.event_tracker.get();
+
+  TrackId track = context_.track_tracker->InternCpuCounterTrack(
+      context_.storage->InternString("counter"), 0);
+  for (uint32_t i = 0; i < kMinRows; ++i) {
+    event_tracker->PushCounter(i, 0, track);
+  }
+
+  // This counter needs its upid to be resolved at the end of the trace so
+  // it (and all the rows after it) need to be kept.
+  UniqueTid utid = context_.process_tracker->GetOrCreateThread(1);
+  event_tracker->PushProcessCounterForThread(
+      kMinRows, 0, context_.storage->InternString("process_counter"), utid);
+  for (uint32_t i = 1; i <= kMinRows; ++i) {
+    event_tracker->PushCounter(kMinRows + i, 0, track);
+  }
+
+  AdvanceTo(10 * kMinRows);
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(counters.evicted_row_count(), kMinRows);
+
+  event_tracker->FlushPendingEvents();
+  ASSERT_TRUE(evictor_->MaybeEvict());
+  ASSERT_EQ(counters.evicted_row_count(), 2 * kMinRows + 1);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -91,6 +91,19 @@ static void BM_TableInsert(benchmark::State& state) {
 }
 BENCHMARK(BM_TableInsert);
 
+static void BM_TableInsertBulk(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  for (auto _ : state) {
+    StringPool pool;
+    RootTestTable root(&pool, nullptr);
+    for (uint32_t i = 0; i < size; ++i) {
+      benchmark::DoNotOptimize(root.Insert({}));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TableInsertBulk)->Apply(TableFilterArgs);
+
 static void BM_TableIteratorChild(benchmark::State& state) {
   StringPool pool;
   RootTestTable root(&pool, nullptr);
@@ -18,6 +18,8 @@
 #define SRC_TRACE_PROCESSOR_TABLES_MACROS_INTERNAL_H_
 
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/db/typed_column.h"
@@ -120,6 +122,21 @@ class MacroTable : public Table {
     row_maps_.back().Insert(row_count_++);
   }
 
+  // Interns the type of a row being inserted into a root table. Types are
+  // static strings and a table hierarchy only has a handful of them so we
+  // cache the interned ids by pointer to avoid hashing the type on every
+  // insert.
+  StringPool::Id InternType(const char* type) {
+    for (const auto& type_and_id : type_ids_) {
+      if (type_and_id.first == type)
+        return type_and_id.second;
+    }
+    StringPool::Id id = string_pool_->InternString(type);
+    if (type_ids_.size() < kMaxCachedTypes)
+      type_ids_.emplace_back(type, id);
+    return id;
+  }
+
   // Stores the most specific "derived" type of this row in the table.
   //
   // For example, suppose a row is inserted into the gpu_slice table. This will
@@ -133,6 +150,10 @@ class MacroTable : public Table {
   NullableVector<StringPool::Id> type_;
 
  private:
+  static constexpr size_t kMaxCachedTypes = 16;
+
+  std::vector<std::pair<const char*, StringPool::Id>> type_ids_;
+
   const char* name_ = nullptr;
   Table* parent_ = nullptr;
 };
@@ -372,12 +393,18 @@ class MacroTable : public Table {
     }                                                                         \
     ~class_name() override;                                                   \
                                                                               \
+    /*                                                                        \
+     * There is no bulk insert or Reserve(): the columns are backed by        \
+     * std::deque so appending never copies existing rows, and building       \
+     * a Row is as cheap as writing the columns directly. The per-insert      \
+     * cost which mattered, interning the type, is cached by InternType().    \
+     */                                                                       \
     IdAndRow Insert(const Row& row) {                                         \
       Id id;                                                                  \
       uint32_t row_number = row_count();                                      \
       if (parent_ == nullptr) {                                               \
         id = Id{row_number};                                                  \
-        type_.Append(string_pool_->InternString(row.type()));                 \
+        type_.Append(InternType(row.type()));                                 \
       } else {                                                                \
         id = Id{parent_->Insert(row).id};                                     \
       }                                                                       \
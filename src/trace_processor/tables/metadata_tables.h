@@ -135,6 +135,154 @@ PERFETTO_TP_TABLE(PERFETTO_TP_CPU_FREQ_TABLE_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_CLOCK_SNAPSHOT_TABLE_DEF);
 
+// Counters of the work done while ingesting the trace, broken down by phase
+// and type of data. See IngestProfile for details.
+//
+// @param phase         one of "tokenize", "parse", "parse_ftrace" or "sort".
+// @param field_id      field id of the TracePacket (tokenize and parse),
+//                      FtraceEvent (parse_ftrace) or the sorter queue index
+//                      (sort).
+// @param name          the name of the ftrace event for parse_ftrace or null
+//                      otherwise.
+// @param count         number of events processed.
+// @param size          total size in bytes of the events processed.
+// @param sampled_count number of events which were timed.
+// @param sampled_dur   total duration of the timed events.
+// @param dur           estimated total duration of all events, extrapolated
+//                      from the timed ones.
+#define PERFETTO_TP_INGEST_PROFILE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(IngestProfileTable, "experimental_ingest_profile")      \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                            \
+  C(StringPool::Id, phase)                                     \
+  C(uint32_t, field_id)                                        \
+  C(base::Optional<StringPool::Id>, name)                      \
+  C(int64_t, count)                                            \
+  C(int64_t, size)                                             \
+  C(int64_t, sampled_count)                                    \
+  C(int64_t, sampled_dur)                                      \
+  C(int64_t, dur)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_INGEST_PROFILE_TABLE_DEF);
+
+// The work done by the virtual tables read by the queries profiled, broken
+// down by operator. See QueryProfile for details.
+//
+// @param query_id      the index of the query in the queries executed since
+//                      the trace processor was created.
+// @param query         the SQL of the query.
+// @param operator_id   the index of the operator in the query; 0 for the
+//                      statement itself.
+// @param parent_id     the operator which read this one; null for the
+//                      statement.
+// @param table_name    the virtual table read; null for the statement.
+// @param plan          the constraints and order by clauses passed to the
+//                      table, e.g. "ts >= ? AND cpu = ? ORDER BY ts"; null for
+//                      the statement.
+// @param filter_count  number of times the table was filtered.
+// @param cache_hits    number of filters served by the query cache.
+// @param rows_scanned  number of rows of the tables filtered; null if the
+//                      table is not backed by a db::Table.
+// @param rows_returned number of rows returned.
+// @param filter_dur    time spent filtering the table.
+// @param next_dur      time spent stepping through the rows.
+// @param column_dur    time spent reading the values of the rows.
+#define PERFETTO_TP_QUERY_PROFILE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(QueryProfileTable, "experimental_query_profile")      \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                          \
+  C(uint32_t, query_id)                                      \
+  C(StringPool::Id, query)                                   \
+  C(uint32_t, operator_id)                                   \
+  C(base::Optional<uint32_t>, parent_id)                     \
+  C(base::Optional<StringPool::Id>, table_name)              \
+  C(base::Optional<StringPool::Id>, plan)                    \
+  C(uint32_t, filter_count)                                  \
+  C(uint32_t, cache_hits)                                    \
+  C(base::Optional<int64_t>, rows_scanned)                   \
+  C(int64_t, rows_returned)                                  \
+  C(int64_t, filter_dur)                                     \
+  C(int64_t, next_dur)                                       \
+  C(int64_t, column_dur)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_QUERY_PROFILE_TABLE_DEF);
+
+// The events of a table aggregated in buckets of a fixed duration, for each
+// partition of the events. Only the buckets overlapped by events are returned.
+//
+// @param source        the events aggregated: "sched" (the non-idle sched
+//                      slices, partitioned by cpu), "slice" (partitioned by
+//                      track_id) or "counter" (partitioned by track_id, each
+//                      value lasting until the next one of its track).
+// @param bucket_dur    the duration of the buckets.
+// @param start_ts      the start of the first bucket, defaults to the start
+//                      of the trace.
+// @param end_ts        the end of the last bucket, defaults to the end of the
+//                      trace.
+// @param ts            the start of the bucket.
+// @param dur           the duration of the bucket, shorter than bucket_dur
+//                      for the last bucket if end_ts is not aligned.
+// @param partition_id  the cpu or track_id of the events.
+// @param count         number of events overlapping the bucket.
+// @param overlap_dur   total duration of the events within the bucket.
+// @param value_sum     sum of the values of the events overlapping the
+//                      bucket, null for events without values.
+// @param value_max     max of the values of the events overlapping the
+//                      bucket, null for events without values.
+#define PERFETTO_TP_EXPERIMENTAL_TIME_BUCKETS_TABLE_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalTimeBucketsTable, "experimental_time_buckets")      \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                     \
+  C(StringPool::Id, source, Column::Flag::kHidden)                      \
+  C(int64_t, bucket_dur, Column::Flag::kHidden)                         \
+  C(int64_t, start_ts, Column::Flag::kHidden)                           \
+  C(int64_t, end_ts, Column::Flag::kHidden)                             \
+  C(int64_t, ts)                                                        \
+  C(int64_t, dur)                                                       \
+  C(int64_t, partition_id)                                              \
+  C(uint32_t, count)                                                    \
+  C(int64_t, overlap_dur)                                               \
+  C(base::Optional<double>, value_sum)                                  \
+  C(base::Optional<double>, value_max)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_TIME_BUCKETS_TABLE_DEF);
+
+// Summary of the events of a track in buckets of a fixed duration, computed
+// from a multi-resolution summary of the track built on its first query so
+// the cost of a query depends on the number of buckets rather than on the
+// number of events. Only the non empty buckets are returned.
+//
+// @param source        "counter" for the values of a counter track or "slice"
+//                      for the durations of the slices of a track (the slices
+//                      which did not end are left out).
+// @param track_id      the track summarized.
+// @param bucket_dur    the duration of the buckets.
+// @param start_ts      the start of the first bucket, defaults to the ts of
+//                      the first event of the track.
+// @param end_ts        the end of the last bucket, defaults to just after the
+//                      ts of the last event of the track.
+// @param ts            the start of the bucket.
+// @param dur           the duration of the bucket.
+// @param count         number of events starting in the bucket.
+// @param min_value     min of the values of the events in the bucket.
+// @param max_value     max of the values of the events in the bucket.
+// @param avg_value     average of the values of the events in the bucket.
+// @param last_value    value of the last event of the bucket.
+#define PERFETTO_TP_EXPERIMENTAL_TRACK_SUMMARY_TABLE_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalTrackSummaryTable, "experimental_track_summary")       \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                       \
+  C(StringPool::Id, source, Column::Flag::kHidden)                        \
+  C(uint32_t, track_id, Column::Flag::kHidden)                            \
+  C(int64_t, bucket_dur, Column::Flag::kHidden)                           \
+  C(int64_t, start_ts, Column::Flag::kHidden)                             \
+  C(int64_t, end_ts, Column::Flag::kHidden)                               \
+  C(int64_t, ts, Column::Flag::kSorted)                                   \
+  C(int64_t, dur)                                                         \
+  C(uint32_t, count)                                                      \
+  C(double, min_value)                                                    \
+  C(double, max_value)                                                    \
+  C(double, avg_value)                                                    \
+  C(double, last_value)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_TRACK_SUMMARY_TABLE_DEF);
+
 }  // namespace tables
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -46,6 +46,10 @@ CpuFreqTable::~CpuFreqTable() = default;
 ThreadTable::~ThreadTable() = default;
 ProcessTable::~ProcessTable() = default;
 ClockSnapshotTable::~ClockSnapshotTable() = default;
+IngestProfileTable::~IngestProfileTable() = default;
+QueryProfileTable::~QueryProfileTable() = default;
+ExperimentalTimeBucketsTable::~ExperimentalTimeBucketsTable() = default;
+ExperimentalTrackSummaryTable::~ExperimentalTrackSummaryTable() = default;
 
 // profiler_tables.h
 StackProfileMappingTable::~StackProfileMappingTable() = default;
@@ -53,6 +53,18 @@ struct InlineSchedWaking {
   StringId comm;
 };
 
+// A TrackEvent which only begins or ends a slice and carries no arguments,
+// flows, counters or thread timestamps. The tokenizer resolves the interned
+// name and category of these events upfront, so that they can be kept in the
+// sorter without a copy of the packet and parsed without decoding it again.
+struct InlineTrackEvent {
+  uint64_t track_uuid;
+  StringId name;
+  StringId category;
+  PacketSequenceState* sequence_state;
+  int32_t type;  // protos::pbzero::TrackEvent::Type.
+};
+
 struct TracePacketData {
   TraceBlobView packet;
   std::shared_ptr<PacketSequenceStateGeneration> sequence_state;
@@ -89,6 +101,7 @@ struct TimestampedTracePiece {
     kFuchsiaRecord,
     kTrackEvent,
     kSystraceLine,
+    kInlineTrackEvent,
   };
 
   TimestampedTracePiece(
@@ -149,6 +162,12 @@ struct TimestampedTracePiece {
         packet_idx(idx),
         type(Type::kInlineSchedWaking) {}
 
+  TimestampedTracePiece(int64_t ts, uint64_t idx, InlineTrackEvent ite)
+      : inline_track_event(std::move(ite)),
+        timestamp(ts),
+        packet_idx(idx),
+        type(Type::kInlineTrackEvent) {}
+
   TimestampedTracePiece(TimestampedTracePiece&& ttp) noexcept {
     // Adopt |ttp|'s data. We have to use placement-new to fill the fields
     // because their original values may be uninitialized and thus
@@ -182,6 +201,11 @@ struct TimestampedTracePiece {
       case Type::kSystraceLine:
         new (&systrace_line)
             std::unique_ptr<SystraceLine>(std::move(ttp.systrace_line));
+        break;
+      case Type::kInlineTrackEvent:
+        new (&inline_track_event)
+            InlineTrackEvent(std::move(ttp.inline_track_event));
+        break;
     }
     timestamp = ttp.timestamp;
     packet_idx = ttp.packet_idx;
@@ -209,6 +233,7 @@ struct TimestampedTracePiece {
       case Type::kInvalid:
       case Type::kInlineSchedSwitch:
       case Type::kInlineSchedWaking:
+      case Type::kInlineTrackEvent:
         break;
       case Type::kFtraceEvent:
         ftrace_event.~FtraceEventData();
@@ -254,6 +279,7 @@ struct TimestampedTracePiece {
     std::unique_ptr<FuchsiaRecord> fuchsia_record;
     std::unique_ptr<TrackEventData> track_event_data;
     std::unique_ptr<SystraceLine> systrace_line;
+    InlineTrackEvent inline_track_event;
   };
 
   int64_t timestamp;
@@ -261,6 +287,11 @@ struct TimestampedTracePiece {
   Type type;
 };
 
+// Inline events exist to keep the sorter queues compact, so they should never
+// grow the size of the union above.
+static_assert(sizeof(InlineTrackEvent) <= sizeof(TracePacketData),
+              "InlineTrackEvent should not be larger than TracePacketData");
+
 }  // namespace trace_processor
 }  // namespace perfetto
 
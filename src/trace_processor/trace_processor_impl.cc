@@ -28,10 +28,15 @@
 #include "src/trace_processor/dynamic/descendant_slice_generator.h"
 #include "src/trace_processor/dynamic/describe_slice_generator.h"
 #include "src/trace_processor/dynamic/experimental_annotated_stack_generator.h"
+#include "src/trace_processor/dynamic/experimental_arg_columns_generator.h"
 #include "src/trace_processor/dynamic/experimental_counter_dur_generator.h"
 #include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
+#include "src/trace_processor/dynamic/experimental_ingest_profile_generator.h"
+#include "src/trace_processor/dynamic/experimental_query_profile_generator.h"
 #include "src/trace_processor/dynamic/experimental_sched_upid_generator.h"
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+#include "src/trace_processor/dynamic/experimental_time_buckets_generator.h"
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
 #include "src/trace_processor/dynamic/thread_state_generator.h"
 #include "src/trace_processor/export_json.h"
 #include "src/trace_processor/importers/additional_modules.h"
@@ -44,6 +49,7 @@
 #include "src/trace_processor/importers/proto/metadata_tracker.h"
 #include "src/trace_processor/importers/systrace/systrace_trace_parser.h"
 #include "src/trace_processor/iterator_impl.h"
+#include "src/trace_processor/sqlite/materialized_args.h"
 #include "src/trace_processor/sqlite/span_join_operator_table.h"
 #include "src/trace_processor/sqlite/sql_stats_table.h"
 #include "src/trace_processor/sqlite/sqlite3_str_split.h"
@@ -558,12 +564,13 @@ void ExtractArg(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
     return;
   }
 
-  TraceStorage* storage = static_cast<TraceStorage*>(sqlite3_user_data(ctx));
+  auto* args = static_cast<MaterializedArgs*>(sqlite3_user_data(ctx));
+  const TraceStorage* storage = args->storage();
   uint32_t arg_set_id = static_cast<uint32_t>(sqlite3_value_int(argv[0]));
   const char* key = reinterpret_cast<const char*>(sqlite3_value_text(argv[1]));
 
   base::Optional<Variadic> opt_value;
-  util::Status status = storage->ExtractArg(arg_set_id, key, &opt_value);
+  util::Status status = args->ExtractArg(arg_set_id, key, &opt_value);
   if (!status.ok()) {
     sqlite3_result_error(ctx, status.c_message(), -1);
     return;
@@ -601,10 +608,11 @@ void ExtractArg(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
   }
 }
 
-void CreateExtractArgFunction(TraceStorage* ts, sqlite3* db) {
+void CreateExtractArgFunction(MaterializedArgs* args, sqlite3* db) {
   auto ret = sqlite3_create_function_v2(db, "EXTRACT_ARG", 2,
-                                        SQLITE_UTF8 | SQLITE_DETERMINISTIC, ts,
-                                        &ExtractArg, nullptr, nullptr, nullptr);
+                                        SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                        args, &ExtractArg, nullptr, nullptr,
+                                        nullptr);
   if (ret != SQLITE_OK) {
     PERFETTO_FATAL("Error initializing EXTRACT_ARG: %s", sqlite3_errmsg(db));
   }
@@ -715,7 +723,8 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   CreateHashFunction(db);
   CreateDemangledNameFunction(db);
   CreateLastNonNullFunction(db);
-  CreateExtractArgFunction(context_.storage.get(), db);
+  materialized_args_.reset(new MaterializedArgs(context_.storage.get()));
+  CreateExtractArgFunction(materialized_args_.get(), db);
   CreateSourceGeqFunction(db);
   CreateValueAtMaxTsFunction(db);
 
@@ -724,6 +733,12 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   // Setup the query cache.
   query_cache_.reset(new QueryCache());
 
+  // Setup the eviction of old rows in streaming mode.
+  if (cfg.streaming_horizon_ns > 0) {
+    table_evictor_.reset(
+        new TableEvictor(&context_, cfg.streaming_horizon_ns));
+  }
+
   const TraceStorage* storage = context_.storage.get();
 
   SqlStatsTable::RegisterTable(*db_, storage);
@@ -769,6 +784,24 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
       new ThreadStateGenerator(&context_)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalAnnotatedStackGenerator>(
       new ExperimentalAnnotatedStackGenerator(&context_)));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalIngestProfileGenerator>(
+      new ExperimentalIngestProfileGenerator(context_.storage.get())));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalQueryProfileGenerator>(
+      new ExperimentalQueryProfileGenerator(context_.storage.get())));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalTimeBucketsGenerator>(
+      new ExperimentalTimeBucketsGenerator(context_.storage.get())));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalTrackSummaryGenerator>(
+      new ExperimentalTrackSummaryGenerator(context_.storage.get())));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalArgColumnsGenerator>(
+      new ExperimentalArgColumnsGenerator(
+          "experimental_slice_with_args", &storage->slice_table(),
+          tables::SliceTable::Schema(), materialized_args_.get(),
+          cfg.materialized_arg_keys)));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalArgColumnsGenerator>(
+      new ExperimentalArgColumnsGenerator(
+          "experimental_raw_with_args", &storage->raw_table(),
+          tables::RawTable::Schema(), materialized_args_.get(),
+          cfg.materialized_arg_keys)));
 
   // New style db-backed tables.
   RegisterDbTable(storage->arg_table());
@@ -838,7 +871,13 @@ TraceProcessorImpl::~TraceProcessorImpl() = default;
 util::Status TraceProcessorImpl::Parse(std::unique_ptr<uint8_t[]> data,
                                        size_t size) {
   bytes_parsed_ += size;
-  return TraceProcessorStorageImpl::Parse(std::move(data), size);
+  util::Status status =
+      TraceProcessorStorageImpl::Parse(std::move(data), size);
+  if (status.ok() && table_evictor_ && table_evictor_->MaybeEvict()) {
+    // Any cached sorted table contains rows which were just evicted.
+    query_cache_->Clear();
+  }
+  return status;
 }
 
 std::string TraceProcessorImpl::GetCurrentTraceName() {
@@ -928,8 +967,13 @@ Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql,
       context_.storage->mutable_sql_stats()->RecordQueryBegin(sql, time_queued,
                                                               t_start.count());
 
-  std::unique_ptr<IteratorImpl> impl(new IteratorImpl(
-      this, *db_, ScopedStmt(raw_stmt), col_count, status, sql_stats_row));
+  std::shared_ptr<QueryProfile> profile;
+  if (query_profiling_enabled_)
+    profile = context_.storage->AddQueryProfile(sql_stats_row, sql);
+
+  std::unique_ptr<IteratorImpl> impl(
+      new IteratorImpl(this, *db_, ScopedStmt(raw_stmt), col_count, status,
+                       sql_stats_row, std::move(profile)));
   return Iterator(std::move(impl));
 }
 
@@ -945,7 +989,8 @@ bool TraceProcessorImpl::IsRootMetricField(const std::string& metric_name) {
       pool_.FindDescriptorIdx(".perfetto.protos.TraceMetrics");
   if (!desc_idx.has_value())
     return false;
-  auto field_idx = pool_.descriptors()[*desc_idx].FindFieldByName(metric_name);
+  auto field_idx = pool_.descriptors()[*desc_idx].FindFieldByName(
+      base::StringView(metric_name));
   return field_idx != nullptr;
 }
 
@@ -1061,6 +1106,14 @@ std::vector<uint8_t> TraceProcessorImpl::GetMetricDescriptors() {
   return pool_.SerializeAsDescriptorSet();
 }
 
+void TraceProcessorImpl::SetQueryProfilingEnabled(bool enabled) {
+  query_profiling_enabled_ = enabled;
+}
+
+bool TraceProcessorImpl::IsQueryProfilingEnabled() {
+  return query_profiling_enabled_;
+}
+
 void TraceProcessorImpl::EnableMetatrace() {
   metatrace::Enable();
 }
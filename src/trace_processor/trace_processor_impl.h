@@ -29,8 +29,10 @@
 #include "perfetto/trace_processor/status.h"
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/materialized_args.h"
 #include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/table_evictor.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
 
 #include "src/trace_processor/metrics/metrics.h"
@@ -82,6 +84,9 @@ class TraceProcessorImpl : public TraceProcessor,
   util::Status DisableAndReadMetatrace(
       std::vector<uint8_t>* trace_proto) override;
 
+  void SetQueryProfilingEnabled(bool enabled) override;
+  bool IsQueryProfilingEnabled() override;
+
  private:
   // Needed for iterators to be able to access the context.
   friend class IteratorImpl;
@@ -102,6 +107,13 @@ class TraceProcessorImpl : public TraceProcessor,
   ScopedDb db_;
   std::unique_ptr<QueryCache> query_cache_;
 
+  // Indexes the args looked up often by EXTRACT_ARG and materializes the
+  // values of Config::materialized_arg_keys into columns.
+  std::unique_ptr<MaterializedArgs> materialized_args_;
+
+  // Only set in streaming mode (i.e. if Config::streaming_horizon_ns > 0).
+  std::unique_ptr<TableEvictor> table_evictor_;
+
   DescriptorPool pool_;
   std::vector<metrics::SqlMetricFile> sql_metrics_;
 
@@ -109,6 +121,8 @@ class TraceProcessorImpl : public TraceProcessor,
   // to prevent single-flow compiler optimizations in ExecuteQuery().
   std::atomic<bool> query_interrupted_{false};
 
+  bool query_profiling_enabled_ = false;
+
   // Keeps track of the tables created by the ingestion process. This is used
   // by RestoreInitialTables() to delete all the tables/view that have been
   // created after that point.
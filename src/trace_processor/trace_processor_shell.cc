@@ -17,8 +17,10 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <vector>
@@ -42,6 +44,7 @@
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/trace_processor/metrics/chrome/all_chrome_metrics.descriptor.h"
 #include "src/trace_processor/metrics/metrics.descriptor.h"
+#include "src/trace_processor/rpc/query_result_serializer.h"
 #include "src/trace_processor/util/proto_to_json.h"
 #include "src/trace_processor/util/status_macros.h"
 
@@ -524,6 +527,21 @@ util::Status PrintQueryResultAsCsv(Iterator* it, FILE* output) {
   return it->Status();
 }
 
+// Writes the result as the QueryResult protos (see trace_processor.proto)
+// that the /query endpoint returns when RawQueryArgs.columnar is set.
+util::Status PrintQueryResultAsColumns(Iterator it, FILE* output) {
+  QueryResultSerializer serializer(
+      std::move(it), QueryResultSerializer::BatchFormat::kColumns);
+  std::vector<uint8_t> buf;
+  for (bool has_more = true; has_more;) {
+    buf.clear();
+    has_more = serializer.Serialize(&buf);
+    if (fwrite(buf.data(), 1, buf.size(), output) != buf.size())
+      return util::ErrStatus("Failed to write the query result");
+  }
+  return serializer.status();
+}
+
 bool IsBlankLine(const std::string& buffer) {
   return buffer == "\n" || buffer == "\r\n";
 }
@@ -584,13 +602,19 @@ util::Status RunQueriesWithoutOutput(const std::vector<std::string>& queries) {
   return util::OkStatus();
 }
 
+enum class QueryOutputFormat {
+  kCsv,
+  kColumnar,
+};
+
 util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
+                                      QueryOutputFormat format,
                                       FILE* output) {
   bool is_first_query = true;
   bool has_output = false;
   for (const auto& sql_query : queries) {
     // Add an extra newline separator between query results.
-    if (!is_first_query)
+    if (!is_first_query && format == QueryOutputFormat::kCsv)
       fprintf(output, "\n");
     is_first_query = false;
 
@@ -628,14 +652,19 @@ util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
           "More than one query generated result rows. This is unsupported.");
     }
     has_output = true;
-    RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, output));
+    if (format == QueryOutputFormat::kColumnar) {
+      RETURN_IF_ERROR(PrintQueryResultAsColumns(std::move(it), output));
+    } else {
+      RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, output));
+    }
   }
   return util::OkStatus();
 }
 
 util::Status PrintPerfFile(const std::string& perf_file_path,
                            base::TimeNanos t_load,
-                           base::TimeNanos t_run) {
+                           base::TimeNanos t_run,
+                           bool profile_ingestion) {
   char buf[128];
   int count = snprintf(buf, sizeof(buf), "%" PRId64 ",%" PRId64,
                        static_cast<int64_t>(t_load.count()),
@@ -644,11 +673,33 @@ util::Status PrintPerfFile(const std::string& perf_file_path,
     return util::ErrStatus("Failed to write perf data");
   }
 
+  std::string perf(buf, static_cast<size_t>(count));
+
+  // With --profile-ingestion, follow the totals with a breakdown of where the
+  // ingestion time went, one line per phase and type of data.
+  if (profile_ingestion) {
+    auto it = g_tp->ExecuteQuery(
+        "SELECT phase, field_id, IFNULL(name, ''), count, size, dur "
+        "FROM experimental_ingest_profile ORDER BY dur DESC");
+    while (it.Next()) {
+      count = snprintf(buf, sizeof(buf),
+                       "\n%s,%" PRId64 ",%s,%" PRId64 ",%" PRId64 ",%" PRId64,
+                       it.Get(0).AsString(), it.Get(1).AsLong(),
+                       it.Get(2).AsString(), it.Get(3).AsLong(),
+                       it.Get(4).AsLong(), it.Get(5).AsLong());
+      if (count < 0 || static_cast<size_t>(count) >= sizeof(buf)) {
+        return util::ErrStatus("Failed to write perf data");
+      }
+      perf.append(buf, static_cast<size_t>(count));
+    }
+    RETURN_IF_ERROR(it.Status());
+  }
+
   auto fd(base::OpenFile(perf_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666));
   if (!fd) {
     return util::ErrStatus("Failed to open perf file");
   }
-  base::WriteAll(fd.get(), buf, static_cast<size_t>(count));
+  base::WriteAll(fd.get(), perf.data(), perf.size());
   return util::OkStatus();
 }
 
@@ -659,6 +710,7 @@ struct CommandLineOptions {
   std::string sqlite_file_path;
   std::string metric_names;
   std::string metric_output;
+  QueryOutputFormat query_output_format = QueryOutputFormat::kCsv;
   std::string trace_file_path;
   std::string port_number;
   bool launch_shell = false;
@@ -666,6 +718,10 @@ struct CommandLineOptions {
   bool wide = false;
   bool force_full_sort = false;
   std::string metatrace_path;
+  bool stream = false;
+  int64_t stream_horizon_ms = 0;
+  std::vector<std::string> arg_column_keys;
+  bool profile_ingestion = false;
 };
 
 void PrintUsage(char** argv) {
@@ -708,11 +764,34 @@ Options:
                                       specified in either proto binary, proto
                                       text format or JSON format (default: proto
                                       text).
+ --query-output=[csv|columnar]        Allows the output of -q to be specified
+                                      either as CSV (default) or as binary
+                                      QueryResult protos (trace_processor.proto)
+                                      with the values grouped by column, as
+                                      returned by the RPC interface when
+                                      RawQueryArgs.columnar is set.
  -m, --metatrace FILE                 Enables metatracing of trace processor
                                       writing the resulting trace into FILE.
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
-                                      logic.)",
+                                      logic.
+ --stream                             Reads the trace file as a stream (e.g. a
+                                      pipe or a file still being written) and
+                                      re-runs the -q queries and --run-metrics
+                                      periodically as data is parsed. Files are
+                                      followed until CTRL-C is pressed.
+ --stream-horizon-ms MS               With --stream, evicts events older than
+                                      MS milliseconds (relative to the newest
+                                      event) so memory usage stays bounded.
+ --arg-columns x,y,z                  Materializes the values of a comma
+                                      separated list of arg keys into columns
+                                      of the experimental_slice_with_args and
+                                      experimental_raw_with_args tables.
+ --profile-ingestion                  Breaks down the time taken to ingest the
+                                      trace by phase and type of data into the
+                                      experimental_ingest_profile table. With
+                                      --perf-file, the breakdown is also written
+                                      after the totals, one line per row.)",
                 argv[0]);
 }
 
@@ -722,8 +801,13 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_RUN_METRICS = 1000,
     OPT_PRE_METRICS,
     OPT_METRICS_OUTPUT,
+    OPT_QUERY_OUTPUT,
     OPT_FORCE_FULL_SORT,
     OPT_HTTP_PORT,
+    OPT_STREAM,
+    OPT_STREAM_HORIZON_MS,
+    OPT_ARG_COLUMNS,
+    OPT_PROFILE_INGESTION,
   };
 
   static const option long_options[] = {
@@ -740,8 +824,13 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"run-metrics", required_argument, nullptr, OPT_RUN_METRICS},
       {"pre-metrics", required_argument, nullptr, OPT_PRE_METRICS},
       {"metrics-output", required_argument, nullptr, OPT_METRICS_OUTPUT},
+      {"query-output", required_argument, nullptr, OPT_QUERY_OUTPUT},
       {"full-sort", no_argument, nullptr, OPT_FORCE_FULL_SORT},
       {"http-port", required_argument, nullptr, OPT_HTTP_PORT},
+      {"stream", no_argument, nullptr, OPT_STREAM},
+      {"stream-horizon-ms", required_argument, nullptr, OPT_STREAM_HORIZON_MS},
+      {"arg-columns", required_argument, nullptr, OPT_ARG_COLUMNS},
+      {"profile-ingestion", no_argument, nullptr, OPT_PROFILE_INGESTION},
       {nullptr, 0, nullptr, 0}};
 
   bool explicit_interactive = false;
@@ -816,6 +905,16 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_QUERY_OUTPUT) {
+      if (strcmp(optarg, "columnar") == 0) {
+        command_line_options.query_output_format = QueryOutputFormat::kColumnar;
+      } else if (strcmp(optarg, "csv") != 0) {
+        PERFETTO_ELOG("Invalid --query-output: %s", optarg);
+        exit(1);
+      }
+      continue;
+    }
+
     if (option == OPT_FORCE_FULL_SORT) {
       command_line_options.force_full_sort = true;
       continue;
@@ -826,6 +925,32 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_STREAM) {
+      command_line_options.stream = true;
+      continue;
+    }
+
+    if (option == OPT_STREAM_HORIZON_MS) {
+      base::Optional<int64_t> horizon_ms = base::CStringToInt64(optarg);
+      if (!horizon_ms || *horizon_ms <= 0) {
+        PERFETTO_ELOG("Invalid --stream-horizon-ms: %s", optarg);
+        exit(1);
+      }
+      command_line_options.stream_horizon_ms = *horizon_ms;
+      continue;
+    }
+
+    if (option == OPT_ARG_COLUMNS) {
+      for (base::StringSplitter ss(optarg, ','); ss.Next();)
+        command_line_options.arg_column_keys.emplace_back(ss.cur_token());
+      continue;
+    }
+
+    if (option == OPT_PROFILE_INGESTION) {
+      command_line_options.profile_ingestion = true;
+      continue;
+    }
+
     PrintUsage(argv);
     exit(option == 'h' ? 0 : 1);
   }
@@ -843,6 +968,17 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     exit(1);
   }
 
+  // Streaming only makes sense with queries or metrics to re-run.
+  if (command_line_options.stream && command_line_options.launch_shell) {
+    PrintUsage(argv);
+    exit(1);
+  }
+  if (command_line_options.stream_horizon_ms > 0 &&
+      !command_line_options.stream) {
+    PrintUsage(argv);
+    exit(1);
+  }
+
   // The only case where we allow omitting the trace file path is when running
   // in --http mode. In all other cases, the last argument must be the trace
   // file.
@@ -913,7 +1049,8 @@ util::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
 }
 
 util::Status RunQueries(const std::string& query_file_path,
-                        bool expect_output) {
+                        bool expect_output,
+                        QueryOutputFormat format = QueryOutputFormat::kCsv) {
   std::vector<std::string> queries;
   base::ScopedFstream file(fopen(query_file_path.c_str(), "r"));
   if (!file) {
@@ -924,7 +1061,7 @@ util::Status RunQueries(const std::string& query_file_path,
 
   util::Status status;
   if (expect_output) {
-    status = RunQueriesAndPrintResult(queries, stdout);
+    status = RunQueriesAndPrintResult(queries, format, stdout);
   } else {
     status = RunQueriesWithoutOutput(queries);
   }
@@ -935,18 +1072,20 @@ util::Status RunQueries(const std::string& query_file_path,
   return util::OkStatus();
 }
 
-util::Status RunMetrics(const CommandLineOptions& options) {
-  // Descriptor pool used for printing output as textproto.
+// Registers all the metrics in |options.metric_names| which are extension
+// metrics (i.e. SQL/proto files), extending |pool| with their protos. Fills
+// |metrics| with the names of all the metrics to compute.
+util::Status RegisterMetrics(const CommandLineOptions& options,
+                             google::protobuf::DescriptorPool* pool,
+                             std::vector<std::string>* metrics_out) {
   // Building on top of generated pool so default protos in
   // google.protobuf.descriptor.proto are available.
-  google::protobuf::DescriptorPool pool(
-      google::protobuf::DescriptorPool::generated_pool());
-  ExtendPoolWithBinaryDescriptor(pool, kMetricsDescriptor.data(),
+  ExtendPoolWithBinaryDescriptor(*pool, kMetricsDescriptor.data(),
                                  kMetricsDescriptor.size());
-  ExtendPoolWithBinaryDescriptor(pool, kAllChromeMetricsDescriptor.data(),
+  ExtendPoolWithBinaryDescriptor(*pool, kAllChromeMetricsDescriptor.data(),
                                  kAllChromeMetricsDescriptor.size());
 
-  std::vector<std::string> metrics;
+  std::vector<std::string>& metrics = *metrics_out;
   for (base::StringSplitter ss(options.metric_names, ','); ss.Next();) {
     metrics.emplace_back(ss.cur_token());
   }
@@ -964,7 +1103,7 @@ util::Status RunMetrics(const CommandLineOptions& options) {
     std::string no_ext_name = metric_or_path.substr(0, ext_idx);
 
     // The proto must be extended before registering the metric.
-    util::Status status = ExtendMetricsProto(no_ext_name + ".proto", &pool);
+    util::Status status = ExtendMetricsProto(no_ext_name + ".proto", pool);
     if (!status.ok()) {
       return util::ErrStatus("Unable to extend metrics proto %s: %s",
                              metric_or_path.c_str(), status.c_message());
@@ -978,7 +1117,10 @@ util::Status RunMetrics(const CommandLineOptions& options) {
 
     metrics[i] = BaseName(no_ext_name);
   }
+  return util::OkStatus();
+}
 
+OutputFormat GetMetricsOutputFormat(const CommandLineOptions& options) {
   OutputFormat format;
   if (!options.query_file_path.empty()) {
     format = OutputFormat::kNone;
@@ -989,7 +1131,97 @@ util::Status RunMetrics(const CommandLineOptions& options) {
   } else {
     format = OutputFormat::kTextProto;
   }
-  return RunMetrics(std::move(metrics), format, pool);
+  return format;
+}
+
+util::Status RunMetrics(const CommandLineOptions& options) {
+  // Descriptor pool used for printing output as textproto.
+  google::protobuf::DescriptorPool pool(
+      google::protobuf::DescriptorPool::generated_pool());
+  std::vector<std::string> metrics;
+  RETURN_IF_ERROR(RegisterMetrics(options, &pool, &metrics));
+  return RunMetrics(metrics, GetMetricsOutputFormat(options), pool);
+}
+
+#if PERFETTO_HAS_SIGNAL_H()
+// Set by the CTRL-C signal handler to stop following a streamed trace.
+std::atomic<bool> g_stream_interrupted{false};
+#endif
+
+// Parses the trace at |options.trace_file_path| as a stream: the queries and
+// metrics in |options| are re-run every |kRefreshInterval| as long as new
+// data is being parsed. Regular files are followed (as with tail -f) until
+// CTRL-C is pressed while pipes are read until EOF.
+util::Status StreamTrace(const CommandLineOptions& options) {
+  constexpr size_t kChunkSize = 1024 * 1024;
+  constexpr base::TimeMillis kRefreshInterval(1000);
+  constexpr unsigned kPollIntervalUs = 100 * 1000;
+
+  base::ScopedFile fd(base::OpenFile(options.trace_file_path, O_RDONLY));
+  if (!fd) {
+    return util::ErrStatus("Could not open trace file (path: %s)",
+                           options.trace_file_path.c_str());
+  }
+  struct stat stat_buf {};
+  bool follow = fstat(*fd, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode);
+
+  if (!options.pre_metrics_path.empty()) {
+    RETURN_IF_ERROR(RunQueries(options.pre_metrics_path, false));
+  }
+
+  google::protobuf::DescriptorPool pool(
+      google::protobuf::DescriptorPool::generated_pool());
+  std::vector<std::string> metrics;
+  if (!options.metric_names.empty()) {
+    RETURN_IF_ERROR(RegisterMetrics(options, &pool, &metrics));
+  }
+  OutputFormat format = GetMetricsOutputFormat(options);
+
+  auto refresh = [&]() -> util::Status {
+    if (!metrics.empty()) {
+      RETURN_IF_ERROR(RunMetrics(metrics, format, pool));
+    }
+    if (!options.query_file_path.empty()) {
+      RETURN_IF_ERROR(RunQueries(options.query_file_path, true,
+                                 options.query_output_format));
+    }
+    fflush(stdout);
+    return util::OkStatus();
+  };
+
+  bool has_new_data = false;
+  base::TimeMillis last_refresh = base::GetWallTimeMs();
+  for (;;) {
+#if PERFETTO_HAS_SIGNAL_H()
+    if (g_stream_interrupted)
+      break;
+#endif
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[kChunkSize]);
+    auto rsize = base::Read(*fd, buf.get(), kChunkSize);
+    if (rsize < 0) {
+      return util::ErrStatus("Reading trace file failed (errno: %d, %s)", errno,
+                             strerror(errno));
+    }
+    if (rsize > 0) {
+      RETURN_IF_ERROR(g_tp->Parse(std::move(buf), static_cast<size_t>(rsize)));
+      has_new_data = true;
+    } else if (!follow) {
+      break;
+    }
+
+    base::TimeMillis now = base::GetWallTimeMs();
+    if (has_new_data && now - last_refresh >= kRefreshInterval) {
+      RETURN_IF_ERROR(refresh());
+      has_new_data = false;
+      last_refresh = now;
+    }
+    if (rsize == 0)
+      base::SleepMicroseconds(kPollIntervalUs);
+  }
+
+  // Flush any data still buffered in the sorter and run a final time.
+  g_tp->NotifyEndOfFile();
+  return refresh();
 }
 
 void PrintShellUsage() {
@@ -1051,6 +1283,15 @@ util::Status TraceProcessorMain(int argc, char** argv) {
   config.sorting_mode = options.force_full_sort
                             ? SortingMode::kForceFullSort
                             : SortingMode::kDefaultHeuristics;
+  if (options.stream) {
+    // When streaming, data needs to be flushed out of the sorter regularly
+    // rather than at the end of the trace.
+    if (!options.force_full_sort)
+      config.sorting_mode = SortingMode::kForceFlushPeriodWindowedSort;
+    config.streaming_horizon_ns = options.stream_horizon_ms * 1000 * 1000;
+  }
+  config.materialized_arg_keys = options.arg_column_keys;
+  config.profile_ingestion = options.profile_ingestion;
 
   std::unique_ptr<TraceProcessor> tp = TraceProcessor::CreateInstance(config);
   g_tp = tp.get();
@@ -1060,6 +1301,13 @@ util::Status TraceProcessorMain(int argc, char** argv) {
     tp->EnableMetatrace();
   }
 
+  if (options.stream) {
+#if PERFETTO_HAS_SIGNAL_H()
+    signal(SIGINT, [](int) { g_stream_interrupted = true; });
+#endif
+    return StreamTrace(options);
+  }
+
   base::TimeNanos t_load{};
   if (!options.trace_file_path.empty()) {
     base::TimeNanos t_load_start = base::GetWallTimeNs();
@@ -1095,7 +1343,8 @@ util::Status TraceProcessorMain(int argc, char** argv) {
   }
 
   if (!options.query_file_path.empty()) {
-    RETURN_IF_ERROR(RunQueries(options.query_file_path, true));
+    RETURN_IF_ERROR(RunQueries(options.query_file_path, true,
+                               options.query_output_format));
   }
   base::TimeNanos t_query = base::GetWallTimeNs() - t_query_start;
 
@@ -1106,7 +1355,8 @@ util::Status TraceProcessorMain(int argc, char** argv) {
   if (options.launch_shell) {
     RETURN_IF_ERROR(StartInteractiveShell(options.wide ? 40 : 20));
   } else if (!options.perf_file_path.empty()) {
-    RETURN_IF_ERROR(PrintPerfFile(options.perf_file_path, t_load, t_query));
+    RETURN_IF_ERROR(PrintPerfFile(options.perf_file_path, t_load, t_query,
+                                  options.profile_ingestion));
   }
 
   if (!options.metatrace_path.empty()) {
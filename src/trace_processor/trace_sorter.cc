@@ -116,8 +116,17 @@ void TraceSorter::SortAndExtractEventsBeyondWindow(int64_t window_size_ns) {
 
     Queue& queue = queues_[min_queue_idx];
     auto& events = queue.events_;
-    if (queue.needs_sorting())
-      queue.Sort();
+    if (queue.needs_sorting()) {
+      if (PERFETTO_UNLIKELY(ingest_profile_)) {
+        base::TimeNanos sort_start_ns = base::GetWallTimeNs();
+        queue.Sort();
+        ingest_profile_->Add(IngestProfile::Phase::kSort, min_queue_idx,
+                             1 /* count */, 0 /* size */,
+                             (base::GetWallTimeNs() - sort_start_ns).count());
+      } else {
+        queue.Sort();
+      }
+    }
     PERFETTO_DCHECK(queue.min_ts_ == events.front().timestamp);
     PERFETTO_DCHECK(queue.min_ts_ == global_min_ts_);
 
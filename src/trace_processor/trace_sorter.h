@@ -148,6 +148,14 @@ class TraceSorter {
     MaybeExtractEvents(queue);
   }
 
+  inline void PushInlineTrackEvent(int64_t timestamp,
+                                   InlineTrackEvent inline_track_event) {
+    auto* queue = GetQueue(0);
+    queue->Append(
+        TimestampedTracePiece(timestamp, packet_idx_++, inline_track_event));
+    MaybeExtractEvents(queue);
+  }
+
   inline void FinalizeFtraceEventBatch(uint32_t cpu) {
     DCHECK_ftrace_batch_cpu(cpu);
     set_ftrace_batch_cpu_for_DCHECK(kNoBatch);
@@ -179,6 +187,10 @@ class TraceSorter {
 
   int64_t max_timestamp() const { return global_max_ts_; }
 
+  // Sets the profile into which the time taken to sort the queues is
+  // recorded; can be null.
+  void set_ingest_profile(IngestProfile* profile) { ingest_profile_ = profile; }
+
  private:
   static constexpr uint32_t kNoBatch = std::numeric_limits<uint32_t>::max();
 
@@ -263,6 +275,8 @@ class TraceSorter {
   // Used for performance tests. True when setting TRACE_PROCESSOR_SORT_ONLY=1.
   bool bypass_next_stage_for_testing_ = false;
 
+  IngestProfile* ingest_profile_ = nullptr;
+
 #if PERFETTO_DCHECK_IS_ON()
   // Used only for DCHECK-ing that FinalizeFtraceEventBatch() is called.
   uint32_t ftrace_batch_cpu_ = kNoBatch;
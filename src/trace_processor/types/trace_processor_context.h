@@ -47,6 +47,7 @@ class FlowTracker;
 class TraceParser;
 class TraceSorter;
 class TraceStorage;
+class TrackEventModule;
 class TrackTracker;
 class JsonTracker;
 class DescriptorPool;
@@ -118,6 +119,7 @@ class TraceProcessorContext {
   std::vector<std::vector<ProtoImporterModule*>> modules_by_field;
   std::vector<std::unique_ptr<ProtoImporterModule>> modules;
   FtraceModule* ftrace_module = nullptr;
+  TrackEventModule* track_event_module = nullptr;
 };
 
 }  // namespace trace_processor
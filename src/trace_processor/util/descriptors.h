@@ -25,6 +25,7 @@
 
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
 #include "protos/perfetto/common/descriptor.pbzero.h"
 
 namespace protozero {
@@ -81,7 +82,15 @@ class ProtoDescriptor {
 
   void AddField(FieldDescriptor descriptor) {
     PERFETTO_DCHECK(type_ == Type::kMessage);
-    fields_.emplace(descriptor.number(), std::move(descriptor));
+    uint32_t number = descriptor.number();
+    std::string name = descriptor.name();
+    if (!fields_.emplace(number, std::move(descriptor)).second)
+      return;
+    auto it = std::lower_bound(
+        field_numbers_by_name_.begin(), field_numbers_by_name_.end(), name,
+        [](const std::pair<std::string, uint32_t>& entry,
+           const std::string& n) { return entry.first < n; });
+    field_numbers_by_name_.emplace(it, std::move(name), number);
   }
 
   void AddEnumValue(int32_t integer_representation,
@@ -90,17 +99,21 @@ class ProtoDescriptor {
     enum_values_[integer_representation] = std::move(string_representation);
   }
 
-  const FieldDescriptor* FindFieldByName(const std::string& name) const {
+  // Looks up a field by name using a binary search on the sorted names of the
+  // fields: this is called for every field of every proto built by metrics so
+  // it must not allocate or scan all the fields.
+  const FieldDescriptor* FindFieldByName(base::StringView name) const {
     PERFETTO_DCHECK(type_ == Type::kMessage);
-    auto it =
-        std::find_if(fields_.begin(), fields_.end(),
-                     [name](std::pair<int32_t, const FieldDescriptor&> p) {
-                       return p.second.name() == name;
-                     });
-    if (it == fields_.end()) {
+    auto it = std::lower_bound(
+        field_numbers_by_name_.begin(), field_numbers_by_name_.end(), name,
+        [](const std::pair<std::string, uint32_t>& entry, base::StringView n) {
+          return base::StringView(entry.first) < n;
+        });
+    if (it == field_numbers_by_name_.end() ||
+        base::StringView(it->first) != name) {
       return nullptr;
     }
-    return &it->second;
+    return FindFieldByTag(it->second);
   }
 
   const FieldDescriptor* FindFieldByTag(const uint32_t tag_number) const {
@@ -130,6 +143,12 @@ class ProtoDescriptor {
   const std::unordered_map<uint32_t, FieldDescriptor>& fields() const {
     return fields_;
   }
+  const std::unordered_map<int32_t, std::string>& enum_values() const {
+    PERFETTO_DCHECK(type_ == Type::kEnum);
+    return enum_values_;
+  }
+  // Note: fields must only be added with |AddField| to keep the index used by
+  // |FindFieldByName| up to date.
   std::unordered_map<uint32_t, FieldDescriptor>* mutable_fields() {
     return &fields_;
   }
@@ -141,6 +160,8 @@ class ProtoDescriptor {
   const Type type_;
   base::Optional<uint32_t> parent_id_;
   std::unordered_map<uint32_t, FieldDescriptor> fields_;
+  // The (name, number) of all the fields in |fields_| sorted by name.
+  std::vector<std::pair<std::string, uint32_t>> field_numbers_by_name_;
   std::unordered_map<int32_t, std::string> enum_values_;
 };
 
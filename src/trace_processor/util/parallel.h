@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_PARALLEL_H_
+#define SRC_TRACE_PROCESSOR_UTIL_PARALLEL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+
+// Calls |fn| with a pointer to each of |items|. If |use_threads| is true, the
+// calls are spread over as many threads as there are cores (the calling
+// thread included) so |fn| must only touch the state of the item it is given.
+// Callers should only set |use_threads| if there is enough work to make up
+// for starting the threads. WASM builds have no threads so the calls are
+// always made on the calling thread.
+//
+// The items are handed out one at a time, as the threads become free, so that
+// items of very different sizes are still spread evenly.
+template <typename T, typename Fn>
+void ForEachInParallel(std::vector<T>* items, bool use_threads, const Fn& fn) {
+  size_t thread_count = 1;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (use_threads) {
+    thread_count =
+        std::min(items->size(),
+                 static_cast<size_t>(std::thread::hardware_concurrency()));
+  }
+#else
+  base::ignore_result(use_threads);
+#endif
+  if (thread_count <= 1) {
+    for (T& item : *items)
+      fn(&item);
+    return;
+  }
+
+  std::atomic<size_t> next_item{0};
+  auto worker = [items, &fn, &next_item] {
+    for (size_t i = next_item++; i < items->size(); i = next_item++)
+      fn(&(*items)[i]);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_PARALLEL_H_
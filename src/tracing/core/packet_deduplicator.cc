@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_deduplicator.h"
+
+#include <string.h>
+
+#include "perfetto/ext/base/hash.h"
+
+namespace perfetto {
+
+namespace {
+
+// Returns true if the concatenation of |slices| is equal to |packet|.
+bool SlicesEqual(const Slices& slices, const std::string& packet) {
+  size_t offset = 0;
+  for (const Slice& slice : slices) {
+    if (slice.size > packet.size() - offset ||
+        memcmp(slice.start, packet.data() + offset, slice.size) != 0) {
+      return false;
+    }
+    offset += slice.size;
+  }
+  return offset == packet.size();
+}
+
+}  // namespace
+
+constexpr size_t PacketDeduplicator::kMinPacketSize;
+
+PacketDeduplicator::PacketDeduplicator(size_t max_bytes)
+    : max_bytes_(max_bytes) {}
+
+PacketDeduplicator::~PacketDeduplicator() = default;
+
+PacketDeduplicator::Result PacketDeduplicator::Process(uint32_t sequence_id,
+                                                       const Slices& slices) {
+  size_t size = 0;
+  for (const Slice& slice : slices)
+    size += slice.size;
+  if (size < kMinPacketSize)
+    return Result();
+
+  base::Hash hash;
+  hash.Update(sequence_id);
+  for (const Slice& slice : slices)
+    hash.Update(static_cast<const char*>(slice.start), slice.size);
+  const uint64_t key = hash.digest();
+
+  Result result;
+  auto it = packets_.find(key);
+  if (it != packets_.end()) {
+    const Entry& entry = it->second;
+    // On a hash collision the packet is emitted in full. This is not worth
+    // handling, as it can only cause missed deduplications.
+    if (entry.sequence_id == sequence_id && SlicesEqual(slices, entry.packet)) {
+      result.action = Result::kReplace;
+      result.dedup_id = entry.dedup_id;
+    }
+    return result;
+  }
+
+  if (bytes_used_ + size > max_bytes_)
+    return result;
+
+  Entry entry;
+  entry.sequence_id = sequence_id;
+  entry.dedup_id = ++last_dedup_id_;
+  entry.packet.reserve(size);
+  for (const Slice& slice : slices)
+    entry.packet.append(static_cast<const char*>(slice.start), slice.size);
+  bytes_used_ += size;
+
+  result.action = Result::kTag;
+  result.dedup_id = entry.dedup_id;
+  packets_.emplace(key, std::move(entry));
+  return result;
+}
+
+}  // namespace perfetto
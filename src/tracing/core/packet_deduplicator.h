@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_PACKET_DEDUPLICATOR_H_
+#define SRC_TRACING_CORE_PACKET_DEDUPLICATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "perfetto/ext/tracing/core/slice.h"
+
+namespace perfetto {
+
+// Finds the packets that are exact copies of an earlier packet of the same
+// sequence, e.g. the descriptors and interned data that producers re-emit
+// every time their incremental state is cleared. Used by the service when
+// TraceConfig.packet_dedup_kb is set: the first copy of a packet is tagged
+// with TracePacket.dedup_id and the following copies are replaced by a packet
+// with just TracePacket.duplicate_of, which trace processor expands back.
+//
+// Only packets of at least kMinPacketSize bytes are considered. The packets
+// are remembered, to compare them byte by byte, up to |max_bytes| in total;
+// after that new packets are passed through untouched, while the ones already
+// remembered keep being deduplicated.
+class PacketDeduplicator {
+ public:
+  static constexpr size_t kMinPacketSize = 64;
+
+  struct Result {
+    enum Action {
+      // Emit the packet as-is.
+      kPassThrough,
+      // Emit the packet setting TracePacket.dedup_id = |dedup_id|.
+      kTag,
+      // Drop the payload of the packet and emit a TracePacket with
+      // duplicate_of = |dedup_id| instead.
+      kReplace,
+    };
+
+    Action action = kPassThrough;
+    uint64_t dedup_id = 0;
+  };
+
+  explicit PacketDeduplicator(size_t max_bytes);
+  ~PacketDeduplicator();
+
+  // |sequence_id| is the trusted_packet_sequence_id of the packet and
+  // |slices| its payload, as written by the producer.
+  Result Process(uint32_t sequence_id, const Slices& slices);
+
+  size_t bytes_used() const { return bytes_used_; }
+
+ private:
+  struct Entry {
+    uint32_t sequence_id;
+    uint64_t dedup_id;
+    std::string packet;
+  };
+
+  const size_t max_bytes_;
+  size_t bytes_used_ = 0;
+  uint64_t last_dedup_id_ = 0;
+
+  // Keyed by the hash of the sequence id and packet contents.
+  std::unordered_map<uint64_t, Entry> packets_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_PACKET_DEDUPLICATOR_H_
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_deduplicator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using Result = PacketDeduplicator::Result;
+
+// Returns the slices of |packet|, split in chunks of |slice_size| bytes.
+Slices ToSlices(const std::string& packet, size_t slice_size = 1024) {
+  Slices slices;
+  for (size_t i = 0; i < packet.size(); i += slice_size) {
+    slices.emplace_back(Slice::Allocate(
+        std::min(slice_size, packet.size() - i)));
+    memcpy(slices.back().own_data(), &packet[i], slices.back().size);
+  }
+  return slices;
+}
+
+TEST(PacketDeduplicatorTest, SmallPacketsPassThrough) {
+  PacketDeduplicator dedup(4096);
+  std::string packet(PacketDeduplicator::kMinPacketSize - 1, 'a');
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet)).action, Result::kPassThrough);
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet)).action, Result::kPassThrough);
+  EXPECT_EQ(dedup.bytes_used(), 0u);
+}
+
+TEST(PacketDeduplicatorTest, TagThenReplace) {
+  PacketDeduplicator dedup(4096);
+  std::string packet_a(100, 'a');
+  std::string packet_b(100, 'b');
+
+  Result res_a = dedup.Process(1, ToSlices(packet_a));
+  EXPECT_EQ(res_a.action, Result::kTag);
+  Result res_b = dedup.Process(1, ToSlices(packet_b));
+  EXPECT_EQ(res_b.action, Result::kTag);
+  EXPECT_NE(res_a.dedup_id, res_b.dedup_id);
+  EXPECT_EQ(dedup.bytes_used(), 200u);
+
+  // The duplicates are found regardless of how the packet is fragmented.
+  Result res = dedup.Process(1, ToSlices(packet_a, 7));
+  EXPECT_EQ(res.action, Result::kReplace);
+  EXPECT_EQ(res.dedup_id, res_a.dedup_id);
+  res = dedup.Process(1, ToSlices(packet_b));
+  EXPECT_EQ(res.action, Result::kReplace);
+  EXPECT_EQ(res.dedup_id, res_b.dedup_id);
+  EXPECT_EQ(dedup.bytes_used(), 200u);
+}
+
+TEST(PacketDeduplicatorTest, SequencesAreIndependent) {
+  PacketDeduplicator dedup(4096);
+  std::string packet(100, 'a');
+  Result res1 = dedup.Process(1, ToSlices(packet));
+  Result res2 = dedup.Process(2, ToSlices(packet));
+  EXPECT_EQ(res1.action, Result::kTag);
+  EXPECT_EQ(res2.action, Result::kTag);
+  EXPECT_NE(res1.dedup_id, res2.dedup_id);
+  EXPECT_EQ(dedup.Process(2, ToSlices(packet)).dedup_id, res2.dedup_id);
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet)).dedup_id, res1.dedup_id);
+}
+
+TEST(PacketDeduplicatorTest, MaxBytes) {
+  PacketDeduplicator dedup(250);
+  std::string packet_a(100, 'a');
+  std::string packet_b(100, 'b');
+  std::string packet_c(100, 'c');
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet_a)).action, Result::kTag);
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet_b)).action, Result::kTag);
+
+  // Over budget: neither remembered nor deduplicated.
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet_c)).action, Result::kPassThrough);
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet_c)).action, Result::kPassThrough);
+  EXPECT_EQ(dedup.bytes_used(), 200u);
+
+  // The packets remembered before keep being deduplicated.
+  EXPECT_EQ(dedup.Process(1, ToSlices(packet_a)).action, Result::kReplace);
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -38,6 +38,8 @@ const uint32_t kReservedFieldIds[] = {
     protos::pbzero::TracePacket::kTraceStatsFieldNumber,
     protos::pbzero::TracePacket::kCompressedPacketsFieldNumber,
     protos::pbzero::TracePacket::kSynchronizationMarkerFieldNumber,
+    protos::pbzero::TracePacket::kDedupIdFieldNumber,
+    protos::pbzero::TracePacket::kDuplicateOfFieldNumber,
 };
 
 // This translation unit is quite subtle and perf-sensitive. Remember to check
@@ -98,10 +98,23 @@ bool TraceBuffer::Initialize(size_t size) {
   wptr_ = begin();
   index_.clear();
   last_chunk_id_written_.clear();
+  last_released_chunk_.clear();
+  retention_queue_.clear();
   read_iter_ = GetReadIterForSequence(index_.end());
   return true;
 }
 
+void TraceBuffer::SetProducerQuota(size_t quota_bytes) {
+  PERFETTO_DCHECK(index_.empty());
+  producer_quota_ = quota_bytes;
+}
+
+void TraceBuffer::SetMaxRetention(base::TimeMillis max_retention) {
+  max_retention_ns_ = base::TimeNanos(max_retention).count();
+  if (!max_retention_ns_)
+    retention_queue_.clear();
+}
+
 // Note: |src| points to a shmem region that is shared with the producer. Assume
 // that the producer is malicious and will change the content of |src|
 // while we execute here. Don't do any processing on it other than memcpy().
@@ -126,6 +139,12 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
 
   TRACE_BUFFER_DLOG("CopyChunk @ %lu, size=%zu", wptr_ - begin(), record_size);
 
+  int64_t copy_time_ns = 0;
+  if (PERFETTO_UNLIKELY(max_retention_ns_)) {
+    copy_time_ns = GetBootTimeNs();
+    EvictExpiredChunks(copy_time_ns);
+  }
+
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = true;
 #endif
@@ -226,19 +245,85 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     WriteChunkRecord(wptr, record, src, size);
     TRACE_BUFFER_DLOG("Chunk raw: %s", HexDump(wptr, record_size).c_str());
     stats_.set_chunks_rewritten(stats_.chunks_rewritten() + 1);
+    if (PERFETTO_UNLIKELY(max_retention_ns_)) {
+      // The previous entry in |retention_queue_| becomes stale.
+      record_meta->copy_time_ns = copy_time_ns;
+      retention_queue_.emplace_back(key, copy_time_ns);
+    }
     return;
   }
 
   if (PERFETTO_UNLIKELY(discard_writes_))
     return DiscardWrite();
 
+  if (PERFETTO_UNLIKELY(producer_quota_))
+    relocation_budget_ = record_size;
+
+  ssize_t del_res = MakeRoomForRecord(record_size);
+  if (del_res == -1)
+    return DiscardWrite();
+  size_t padding_size = static_cast<size_t>(del_res);
+
+  // Now first insert the new chunk. At the end, if necessary, add the padding.
+  stats_.set_chunks_written(stats_.chunks_written() + 1);
+  stats_.set_bytes_written(stats_.bytes_written() + record_size);
+  auto it_and_inserted = index_.emplace(
+      key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
+                     chunk_flags, producer_uid_trusted));
+  PERFETTO_DCHECK(it_and_inserted.second);
+  if (PERFETTO_UNLIKELY(max_retention_ns_)) {
+    it_and_inserted.first->second.copy_time_ns = copy_time_ns;
+    retention_queue_.emplace_back(key, copy_time_ns);
+  }
+  TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
+                    uintptr_t(wptr_ - begin()) + record_size, record_size);
+  WriteChunkRecord(wptr_, record, src, size);
+  TRACE_BUFFER_DLOG("Chunk raw: %s", HexDump(wptr_, record_size).c_str());
+  AdvanceWritePointer(record_size, padding_size);
+  if (PERFETTO_UNLIKELY(producer_quota_)) {
+    ProducerUsage& usage = GetProducerUsage(producer_id_trusted);
+    usage.bytes_in_buffer += record_size;
+    TraceStats::BufferStats::ProducerStats& producer_stats =
+        (*stats_.mutable_producer_stats())[usage.stats_index];
+    producer_stats.set_bytes_written(producer_stats.bytes_written() +
+                                     record_size);
+  }
+
+  // Chunks may be received out of order, so only update last_chunk_id if the
+  // new chunk_id is larger. But take into account overflows by only selecting
+  // the new ID if its distance to the latest ID is smaller than half the number
+  // space.
+  //
+  // This accounts for both the case where the new ID has just overflown and
+  // last_chunk_id be updated even though it's smaller (e.g. |chunk_id| = 1 and
+  // |last_chunk_id| = kMaxChunkId; chunk_id - last_chunk_id = 0) and the case
+  // where the new ID is an out-of-order ID right after an overflow and
+  // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
+  // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
+  // kMaxChunkId - 1).
+  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
+  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
+                "This code assumes that ChunkID wraps at kMaxChunkID");
+  if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
+    last_chunk_id = chunk_id;
+  } else {
+    stats_.set_chunks_committed_out_of_order(
+        stats_.chunks_committed_out_of_order() + 1);
+  }
+
+  if (PERFETTO_UNLIKELY(!chunks_to_relocate_.empty()))
+    RelocateChunks();
+}
+
+ssize_t TraceBuffer::MakeRoomForRecord(size_t record_size) {
   // If there isn't enough room from the given write position. Write a padding
   // record to clear the end of the buffer and wrap back.
   const size_t cached_size_to_end = size_to_end();
   if (PERFETTO_UNLIKELY(record_size > cached_size_to_end)) {
     ssize_t res = DeleteNextChunksFor(cached_size_to_end);
     if (res == -1)
-      return DiscardWrite();
+      return -1;
     PERFETTO_DCHECK(static_cast<size_t>(res) <= cached_size_to_end);
     AddPaddingRecord(cached_size_to_end);
     wptr_ = begin();
@@ -266,22 +351,11 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // +---------------------------------+---------------+--------------------+
 
   // Deletes all chunks from |wptr_| to |wptr_| + |record_size|.
-  ssize_t del_res = DeleteNextChunksFor(record_size);
-  if (del_res == -1)
-    return DiscardWrite();
-  size_t padding_size = static_cast<size_t>(del_res);
+  return DeleteNextChunksFor(record_size);
+}
 
-  // Now first insert the new chunk. At the end, if necessary, add the padding.
-  stats_.set_chunks_written(stats_.chunks_written() + 1);
-  stats_.set_bytes_written(stats_.bytes_written() + record_size);
-  auto it_and_inserted = index_.emplace(
-      key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
-                     chunk_flags, producer_uid_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
-  TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
-                    uintptr_t(wptr_ - begin()) + record_size, record_size);
-  WriteChunkRecord(wptr_, record, src, size);
-  TRACE_BUFFER_DLOG("Chunk raw: %s", HexDump(wptr_, record_size).c_str());
+void TraceBuffer::AdvanceWritePointer(size_t record_size,
+                                      size_t padding_size) {
   wptr_ += record_size;
   if (wptr_ >= end()) {
     PERFETTO_DCHECK(padding_size == 0);
@@ -289,32 +363,58 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     stats_.set_write_wrap_count(stats_.write_wrap_count() + 1);
   }
   DcheckIsAlignedAndWithinBounds(wptr_);
+  if (padding_size)
+    AddPaddingRecord(padding_size);
+}
 
-  // Chunks may be received out of order, so only update last_chunk_id if the
-  // new chunk_id is larger. But take into account overflows by only selecting
-  // the new ID if its distance to the latest ID is smaller than half the number
-  // space.
-  //
-  // This accounts for both the case where the new ID has just overflown and
-  // last_chunk_id be updated even though it's smaller (e.g. |chunk_id| = 1 and
-  // |last_chunk_id| = kMaxChunkId; chunk_id - last_chunk_id = 0) and the case
-  // where the new ID is an out-of-order ID right after an overflow and
-  // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
-  // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
-  // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
-  static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
-                "This code assumes that ChunkID wraps at kMaxChunkID");
-  if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
-    last_chunk_id = chunk_id;
-  } else {
-    stats_.set_chunks_committed_out_of_order(
-        stats_.chunks_committed_out_of_order() + 1);
+void TraceBuffer::RelocateChunks() {
+  PERFETTO_DCHECK(overwrite_policy_ == kOverwrite);
+  // Making room for a relocated chunk can queue further chunks. This
+  // terminates because DeleteNextChunksFor() stops relocating chunks once
+  // |relocation_budget_| is exhausted.
+  while (!chunks_to_relocate_.empty()) {
+    RelocatedChunk chunk = std::move(chunks_to_relocate_.front());
+    chunks_to_relocate_.pop_front();
+    const size_t record_size = chunk.record.size();
+    ssize_t del_res = MakeRoomForRecord(record_size);
+    PERFETTO_CHECK(del_res >= 0);
+
+    const ChunkRecord* record =
+        reinterpret_cast<const ChunkRecord*>(chunk.record.data());
+    const ChunkMeta& old_meta = chunk.meta;
+    ChunkRecord* new_record = GetChunkRecordAt(wptr_);
+    TRACE_BUFFER_DLOG("  relocating {%" PRIu32 ",%" PRIu32 ",%u} @ %lu",
+                      chunk.key.producer_id, chunk.key.writer_id,
+                      chunk.key.chunk_id, wptr_ - begin());
+    WriteChunkRecord(wptr_, *record, chunk.record.data() + sizeof(ChunkRecord),
+                     record_size - sizeof(ChunkRecord));
+
+    // Carry over the read state of the chunk.
+    ChunkMeta meta(new_record, old_meta.num_fragments, old_meta.is_complete(),
+                   old_meta.flags, old_meta.trusted_uid);
+    meta.index_flags = old_meta.index_flags;
+    meta.num_fragments_read = old_meta.num_fragments_read;
+    meta.cur_fragment_offset = old_meta.cur_fragment_offset;
+    meta.copy_time_ns = old_meta.copy_time_ns;
+    auto it_and_inserted = index_.emplace(chunk.key, meta);
+    PERFETTO_DCHECK(it_and_inserted.second);
+
+    AdvanceWritePointer(record_size, static_cast<size_t>(del_res));
+    GetProducerUsage(chunk.key.producer_id).bytes_in_buffer += record_size;
+    stats_.set_chunks_relocated(stats_.chunks_relocated() + 1);
+    stats_.set_bytes_relocated(stats_.bytes_relocated() + record_size);
   }
+}
 
-  if (padding_size)
-    AddPaddingRecord(padding_size);
+TraceBuffer::ProducerUsage& TraceBuffer::GetProducerUsage(
+    ProducerID producer_id) {
+  auto it_and_inserted = producer_usage_.emplace(producer_id, ProducerUsage());
+  ProducerUsage& usage = it_and_inserted.first->second;
+  if (it_and_inserted.second) {
+    usage.stats_index = stats_.producer_stats().size();
+    stats_.add_producer_stats()->set_producer_id(producer_id);
+  }
+  return usage;
 }
 
 ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
@@ -361,8 +461,14 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
         if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
-          chunks_overwritten++;
-          bytes_overwritten += next_chunk.size;
+          if (PERFETTO_UNLIKELY(producer_quota_) && MaybeRelocate(*it)) {
+            // The chunk will be copied again after the write pointer.
+          } else {
+            chunks_overwritten++;
+            bytes_overwritten += next_chunk.size;
+            if (PERFETTO_UNLIKELY(producer_quota_))
+              RecordOverwrite(key.producer_id, next_chunk.size);
+          }
         }
         index_delete.push_back(it);
         will_remove = true;
@@ -388,6 +494,10 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
 
   // Remove from the index.
   for (auto it : index_delete) {
+    if (PERFETTO_UNLIKELY(producer_quota_)) {
+      GetProducerUsage(it->first.producer_id).bytes_in_buffer -=
+          it->second.chunk_record->size;
+    }
     index_.erase(it);
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
@@ -398,6 +508,170 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   return static_cast<ssize_t>(next_chunk_ptr - search_end);
 }
 
+bool TraceBuffer::MaybeRelocate(const ChunkMap::value_type& entry) {
+  const ChunkRecord* record = entry.second.chunk_record;
+  if (relocation_budget_ == 0 ||
+      GetProducerUsage(entry.first.producer_id).bytes_in_buffer >
+          producer_quota_) {
+    return false;
+  }
+  relocation_budget_ -= std::min<size_t>(relocation_budget_, record->size);
+  const uint8_t* record_begin = reinterpret_cast<const uint8_t*>(record);
+  chunks_to_relocate_.emplace_back(
+      entry.first, entry.second,
+      std::vector<uint8_t>(record_begin, record_begin + record->size));
+  return true;
+}
+
+void TraceBuffer::RecordOverwrite(ProducerID producer_id, size_t size) {
+  TraceStats::BufferStats::ProducerStats& producer_stats =
+      (*stats_.mutable_producer_stats())[GetProducerUsage(producer_id)
+                                             .stats_index];
+  producer_stats.set_chunks_overwritten(producer_stats.chunks_overwritten() +
+                                        1);
+  producer_stats.set_bytes_overwritten(producer_stats.bytes_overwritten() +
+                                       size);
+}
+
+void TraceBuffer::EvictExpiredChunks(int64_t now_ns) {
+  const int64_t min_copy_time_ns = now_ns - max_retention_ns_;
+  uint64_t chunks_evicted = stats_.chunks_evicted();
+  uint64_t bytes_evicted = stats_.bytes_evicted();
+  while (!retention_queue_.empty()) {
+    const RetentionEntry& entry = retention_queue_.front();
+    auto it = index_.find(entry.key);
+    bool is_stale =
+        it == index_.end() || it->second.copy_time_ns != entry.copy_time_ns;
+    if (!is_stale) {
+      // The queue is sorted by copy time, all the following chunks are newer.
+      if (entry.copy_time_ns >= min_copy_time_ns)
+        break;
+
+      ChunkMeta& meta = it->second;
+      ChunkRecord* chunk_record = meta.chunk_record;
+      TRACE_BUFFER_DLOG("  evict {%" PRIu32 ",%" PRIu32 ",%u} @ %lu",
+                        entry.key.producer_id, entry.key.writer_id,
+                        entry.key.chunk_id,
+                        reinterpret_cast<uint8_t*>(chunk_record) - begin());
+      if (meta.num_fragments_read < meta.num_fragments) {
+        chunks_evicted++;
+        bytes_evicted += chunk_record->size;
+      }
+
+      // The record stays in the buffer, to keep the ChunkRecord chain intact,
+      // but is skipped as padding from now on.
+      chunk_record->is_padding = 1;
+      if (PERFETTO_UNLIKELY(producer_quota_))
+        GetProducerUsage(entry.key.producer_id).bytes_in_buffer -=
+            chunk_record->size;
+      index_.erase(it);
+    }
+    retention_queue_.pop_front();
+  }
+  stats_.set_chunks_evicted(chunks_evicted);
+  stats_.set_bytes_evicted(bytes_evicted);
+}
+
+size_t TraceBuffer::ReleaseReadChunks() {
+  // Walk the ChunkRecord chain and release the runs of consecutive records
+  // that can be removed. A run must not span |wptr_|, which has to stay at a
+  // record boundary, and runs that contain only padding were already released
+  // by a previous call.
+  size_t bytes_released = 0;
+  uint8_t* run_begin = nullptr;
+  bool run_has_chunks = false;
+  for (uint8_t* ptr = begin();;) {
+    const ChunkRecord* record = ptr < end() ? GetChunkRecordAt(ptr) : nullptr;
+
+    // The chain ends at end() or, before the first wrap, at the untouched
+    // (zeroed) part of the buffer.
+    const bool is_valid = record && record->is_valid();
+    const bool releasable = is_valid && IsReleasable(*record);
+    if (run_begin && (!releasable || ptr == wptr_)) {
+      if (run_has_chunks)
+        bytes_released += ReleaseRecords(run_begin, ptr);
+      run_begin = nullptr;
+      run_has_chunks = false;
+    }
+    if (!is_valid)
+      break;
+    if (releasable) {
+      if (!run_begin)
+        run_begin = ptr;
+      if (!record->is_padding) {
+        run_has_chunks = true;
+        ChunkMeta::Key key(*record);
+        auto it = index_.find(key);
+        PERFETTO_DCHECK(it != index_.end());
+        ReleasedChunk released{key.chunk_id,
+                               it->second.last_read_packet_skipped()};
+        auto it_and_inserted = last_released_chunk_.emplace(
+            std::make_pair(key.producer_id, key.writer_id), released);
+        ReleasedChunk& last = it_and_inserted.first->second;
+        if (key.chunk_id - last.chunk_id < kMaxChunkID / 2)
+          last = released;
+        if (PERFETTO_UNLIKELY(producer_quota_))
+          GetProducerUsage(key.producer_id).bytes_in_buffer -= record->size;
+        index_.erase(it);
+      }
+    }
+    ptr += record->size;
+  }
+#if PERFETTO_DCHECK_IS_ON()
+  changed_since_last_read_ = true;
+#endif
+  return bytes_released;
+}
+
+bool TraceBuffer::IsReleasable(const ChunkRecord& record) {
+  if (record.is_padding)
+    return true;
+  auto it = index_.find(ChunkMeta::Key(record));
+  if (it == index_.end())
+    return false;
+  const ChunkMeta& meta = it->second;
+
+  // Empty chunks are "read" even if the reader hasn't reached them yet, e.g.
+  // because of a missing chunk before them. Removing them would leave a hole
+  // in the sequence and stall it.
+  return meta.num_fragments > 0 &&
+         meta.num_fragments_read == meta.num_fragments && meta.is_complete() &&
+         !(meta.flags & kChunkNeedsPatching);
+}
+
+size_t TraceBuffer::ReleaseRecords(uint8_t* run_begin, uint8_t* run_end) {
+  static constexpr size_t kMaxPaddingSize =
+      ChunkRecord::kMaxSize & ~(sizeof(ChunkRecord) - 1);
+  const size_t page_size = base::GetSysPageSize();
+  size_t bytes_released = 0;
+  for (uint8_t* ptr = run_begin; ptr < run_end;) {
+    const size_t size =
+        std::min(static_cast<size_t>(run_end - ptr), kMaxPaddingSize);
+    ChunkRecord record(size);
+    record.is_padding = 1;
+    *GetChunkRecordAt(ptr) = record;
+
+    // Release the pages after the header of the padding record.
+    const uintptr_t header_end =
+        reinterpret_cast<uintptr_t>(ptr) + sizeof(ChunkRecord);
+    const uintptr_t release_begin =
+        (header_end + page_size - 1) / page_size * page_size;
+    const uintptr_t release_end =
+        reinterpret_cast<uintptr_t>(ptr + size) / page_size * page_size;
+    if (release_end > release_begin) {
+      size_t release_size = release_end - release_begin;
+      if (data_.AdviseDontNeed(reinterpret_cast<void*>(release_begin),
+                               release_size)) {
+        bytes_released += release_size;
+      }
+    }
+    ptr += size;
+  }
+  TRACE_BUFFER_DLOG("Released [%lu - %lu], %zu bytes", run_begin - begin(),
+                    run_end - begin(), bytes_released);
+  return bytes_released;
+}
+
 void TraceBuffer::AddPaddingRecord(size_t size) {
   PERFETTO_DCHECK(size >= sizeof(ChunkRecord) && size <= ChunkRecord::kMaxSize);
   ChunkRecord record(size);
@@ -473,6 +747,8 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
 }
 
 void TraceBuffer::BeginRead() {
+  if (PERFETTO_UNLIKELY(max_retention_ns_))
+    EvictExpiredChunks(GetBootTimeNs());
   read_iter_ = GetReadIterForSequence(index_.begin());
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
@@ -630,8 +906,16 @@ bool TraceBuffer::ReadNextTracePacket(
     // If we didn't read any packets from this chunk, the last packet was from
     // the previous chunk we iterated over; so don't update
     // |previous_packet_dropped| in this case.
-    if (chunk_meta->num_fragments_read > 0)
+    if (chunk_meta->num_fragments_read > 0) {
       previous_packet_dropped = chunk_meta->last_read_packet_skipped();
+    } else if (PERFETTO_UNLIKELY(!last_released_chunk_.empty())) {
+      // The previous chunk might have been removed by ReleaseReadChunks().
+      auto it = last_released_chunk_.find({trusted_producer_id, writer_id});
+      if (it != last_released_chunk_.end() &&
+          it->second.chunk_id + 1 == read_iter_.chunk_id()) {
+        previous_packet_dropped = it->second.last_read_packet_skipped;
+      }
+    }
 
     while (chunk_meta->num_fragments_read < chunk_meta->num_fragments) {
       enum { kSkip = 0, kReadOnePacket, kTryReadAhead } action;
@@ -21,11 +21,15 @@
 #include <string.h>
 
 #include <array>
+#include <deque>
 #include <limits>
 #include <map>
 #include <tuple>
+#include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/circular_queue.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/thread_annotations.h"
 #include "perfetto/ext/base/utils.h"
@@ -76,6 +80,35 @@ class TracePacket;
 // as-is, but their header is not and is repacked in order to keep the
 // ProducerID around.
 //
+// Optionally, on top of the size-based eviction above, chunks can be evicted
+// by age (see SetMaxRetention()). Producers' chunks don't carry a timestamp,
+// so the age of a chunk is measured from the last time it was copied into the
+// buffer, which is an upper bound of the timestamps of the packets it
+// contains. Expired chunks are removed from the index and turned into padding
+// records, exactly as if they had been overwritten.
+//
+// Producer quotas
+// ---------------
+// With a plain ring buffer a single chatty producer can overwrite the data of
+// all the other producers, even if they write very little. When a producer
+// quota is set (see SetProducerQuota()), the unread chunks that the write
+// pointer is about to overwrite are instead moved after the new chunk if
+// their producer takes less than the quota in the buffer. The effect is that
+// the data of the producers that exceed their quota, i.e. the heaviest
+// writers, is overwritten first. The number of bytes moved for each write is
+// bounded by the size of the chunk being written.
+//
+// Memory usage
+// ------------
+// The buffer is only reserved upfront: its pages are committed by the OS the
+// first time they are written, so the resident size grows with the write
+// pointer rather than with the configured size. Once wrapped, a buffer stays
+// fully resident, unless ReleaseReadChunks() is called after reading: this
+// turns the chunks that have been read entirely into padding records and
+// gives the pages they span back to the OS. This is what keeps the memory
+// usage of kDiscard buffers that are periodically drained (write_into_file)
+// proportional to the data not read yet.
+//
 // Chunks are stored in the buffer next to each other. Each chunk is prefixed by
 // an inline header (ChunkRecord), which contains most of the fields of the
 // SharedMemoryABI ChunkHeader + the ProducerID + the size of the payload.
@@ -259,11 +292,32 @@ class TraceBuffer {
                            PacketSequenceProperties* sequence_properties,
                            bool* previous_packet_on_sequence_dropped);
 
+  // Reserves |quota_bytes| of the buffer to each producer, see "Producer
+  // quotas" above. Zero (the default) disables quotas. Has no effect with
+  // kDiscard, which never overwrites chunks. Must be called before any chunk
+  // is copied.
+  void SetProducerQuota(size_t quota_bytes);
+
+  // Sets the max age of the chunks in the buffer. Chunks copied more than
+  // |max_retention| ago are evicted, even if the buffer isn't full yet, the
+  // next time a chunk is copied or BeginRead() is called. Zero (the default)
+  // disables time-based eviction.
+  void SetMaxRetention(base::TimeMillis max_retention);
+
+  // Removes from the buffer the chunks that have been read entirely and
+  // releases the memory pages they span (see "Memory usage" above). The
+  // ChunkRecord chain is kept intact by replacing them with padding records,
+  // whose headers stay resident. Must be called outside of a read pass, once
+  // the packets returned by ReadNextTracePacket() are no longer in use, as
+  // their slices point into the buffer. Returns the number of bytes released.
+  size_t ReleaseReadChunks();
+
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
 
  private:
   friend class TraceBufferTest;
+  friend class TracingServiceImplTest;
 
   // ChunkRecord is a Chunk header stored inline in the |data_| buffer, before
   // the chunk payload (the packets' data). The |data_| buffer looks like this:
@@ -425,10 +479,51 @@ class TraceBuffer {
     // payload (the 1st fragment starts at |chunk_record| +
     // sizeof(ChunkRecord)).
     uint16_t cur_fragment_offset = 0;
+
+    // Boot time of the last CopyChunkUntrusted() of this chunk. Only set when
+    // a max retention is configured.
+    int64_t copy_time_ns = 0;
   };
 
   using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
 
+  // A chunk that is about to be overwritten and has to be moved after the
+  // write pointer instead, see SetProducerQuota().
+  struct RelocatedChunk {
+    RelocatedChunk(const ChunkMeta::Key& k,
+                   const ChunkMeta& m,
+                   std::vector<uint8_t> r)
+        : key(k), meta(m), record(std::move(r)) {}
+
+    ChunkMeta::Key key;
+    ChunkMeta meta;               // |meta.chunk_record| is dangling.
+    std::vector<uint8_t> record;  // Copy of the ChunkRecord and its payload.
+  };
+
+  // Per-producer bookkeeping, only maintained when a quota is set.
+  struct ProducerUsage {
+    size_t bytes_in_buffer = 0;
+
+    // Index of the producer in |stats_.producer_stats()|.
+    size_t stats_index = 0;
+  };
+
+  // Read state of the last chunk of a sequence removed by
+  // ReleaseReadChunks(), carried over to the next chunk of the sequence.
+  struct ReleasedChunk {
+    ChunkID chunk_id = 0;
+    bool last_read_packet_skipped = false;
+  };
+
+  // Entry of |retention_queue_|.
+  struct RetentionEntry {
+    RetentionEntry(const ChunkMeta::Key& k, int64_t t)
+        : key(k), copy_time_ns(t) {}
+
+    ChunkMeta::Key key;
+    int64_t copy_time_ns;
+  };
+
   // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
   // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
   // of ChunkID. Instances are valid only as long as the |index_| is not altered
@@ -527,6 +622,46 @@ class TraceBuffer {
   // packets.
   ReadAheadResult ReadAhead(TracePacket*);
 
+  // Makes room for a record of |record_size| bytes at |wptr_|, wrapping over
+  // if needed. Returns the result of the final DeleteNextChunksFor(), i.e. the
+  // size of the padding record to add after the new record, or -1 if the
+  // write must be discarded.
+  ssize_t MakeRoomForRecord(size_t record_size);
+
+  // Moves |wptr_| past a record of |record_size| bytes that has just been
+  // written and adds the padding record returned by MakeRoomForRecord().
+  void AdvanceWritePointer(size_t record_size, size_t padding_size);
+
+  // Queues the chunk in |chunks_to_relocate_| if its producer is within its
+  // quota and the relocation budget for the current write allows it. Returns
+  // false if the chunk should be overwritten.
+  bool MaybeRelocate(const ChunkMap::value_type&);
+
+  // Copies back the chunks queued by MaybeRelocate() at |wptr_|.
+  void RelocateChunks();
+
+  ProducerUsage& GetProducerUsage(ProducerID);
+  void RecordOverwrite(ProducerID, size_t size);
+
+  // Returns true if |record| can be removed by ReleaseReadChunks(), i.e. if
+  // it's padding or a chunk that has been read entirely.
+  bool IsReleasable(const ChunkRecord& record);
+
+  // Rewrites the records in [|run_begin|, |run_end|) as padding records and
+  // releases the pages between their headers. Returns the bytes released.
+  size_t ReleaseRecords(uint8_t* run_begin, uint8_t* run_end);
+
+  // Evicts the chunks copied before |now_ns| - |max_retention_ns_|, see
+  // SetMaxRetention().
+  void EvictExpiredChunks(int64_t now_ns);
+
+  // Returns the current boot time, unless faked by tests.
+  int64_t GetBootTimeNs() const {
+    if (PERFETTO_UNLIKELY(fake_boot_time_ns_for_testing_))
+      return fake_boot_time_ns_for_testing_;
+    return base::GetBootTimeNs().count();
+  }
+
   // Deletes (by marking the record invalid and removing form the index) all
   // chunks from |wptr_| to |wptr_| + |bytes_to_clear|.
   // Returns:
@@ -647,6 +782,29 @@ class TraceBuffer {
   // many producers/writers within the same trace session).
   std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
 
+  // See SetProducerQuota(). Zero if quotas are disabled.
+  size_t producer_quota_ = 0;
+  std::map<ProducerID, ProducerUsage> producer_usage_;
+  std::deque<RelocatedChunk> chunks_to_relocate_;
+
+  // Max number of bytes that can still be relocated in the current
+  // CopyChunkUntrusted() call.
+  size_t relocation_budget_ = 0;
+
+  // Keyed by {ProducerID, WriterID}, see ReleaseReadChunks().
+  std::map<std::pair<ProducerID, WriterID>, ReleasedChunk>
+      last_released_chunk_;
+
+  // See SetMaxRetention(). Zero if time-based eviction is disabled.
+  int64_t max_retention_ns_ = 0;
+
+  // The chunks in the order in which they were (re)written, with the time of
+  // the copy. Re-copying a chunk appends a new entry, so entries whose
+  // |copy_time_ns| doesn't match the ChunkMeta's one are stale, as are the
+  // ones of chunks that have been overwritten in the meantime. Stale entries
+  // are dropped lazily when they reach the front of the queue.
+  base::CircularQueue<RetentionEntry> retention_queue_;
+
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
 
@@ -658,6 +816,9 @@ class TraceBuffer {
   // bugs in the producers. This is for tests that feed malicious inputs and
   // hence mimic a buggy producer.
   bool suppress_client_dchecks_for_testing_ = false;
+
+  // When non-zero, used instead of the actual boot time for the max retention.
+  int64_t fake_boot_time_ns_for_testing_ = 0;
 };
 
 }  // namespace perfetto
@@ -21,11 +21,13 @@
 #include <sstream>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/shared_memory_abi.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "src/base/test/vm_test_utils.h"
 #include "src/tracing/core/trace_buffer.h"
 #include "src/tracing/test/fake_packet.h"
 #include "test/gtest_and_gmock.h"
@@ -138,6 +140,11 @@ class TraceBufferTest : public testing::Test {
 
   TraceBuffer* trace_buffer() { return trace_buffer_.get(); }
   size_t size_to_end() { return trace_buffer_->size_to_end(); }
+  uint8_t* buffer_begin() { return trace_buffer_->begin(); }
+
+  void SetBootTimeMs(int64_t ms) {
+    trace_buffer_->fake_boot_time_ns_for_testing_ = ms * 1000000;
+  }
 
  private:
   std::unique_ptr<TraceBuffer> trace_buffer_;
@@ -1833,6 +1840,310 @@ TEST_F(TraceBufferTest, MissingPacketsOnSequence) {
   ASSERT_TRUE(previous_packet_dropped);
 }
 
+TEST_F(TraceBufferTest, MaxRetention_EvictsExpiredChunks) {
+  ResetBuffer(4096);
+  trace_buffer()->SetMaxRetention(base::TimeMillis(1000));
+
+  SetBootTimeMs(1000);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(64 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(64 - 16, 'b')
+      .CopyIntoTraceBuffer();
+  SetBootTimeMs(1500);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(64 - 16, 'c')
+      .CopyIntoTraceBuffer();
+
+  // Reading doesn't evict anything yet, the oldest chunk is 500 ms old.
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(64 - 16, 'a')));
+
+  // Copying a chunk 1200 ms after the first ones evicts them, but the one
+  // that has been read already doesn't count as data loss.
+  SetBootTimeMs(2200);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(2))
+      .AddPacket(64 - 16, 'd')
+      .CopyIntoTraceBuffer();
+  ASSERT_THAT(GetIndex(), ElementsAre(ChunkMetaKey(1, 1, 1),
+                                      ChunkMetaKey(1, 1, 2)));
+  ASSERT_EQ(1u, trace_buffer()->stats().chunks_evicted());
+  ASSERT_EQ(64u, trace_buffer()->stats().bytes_evicted());
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(64 - 16, 'c')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(64 - 16, 'd')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // BeginRead() evicts expired chunks too, even if nothing is written.
+  SetBootTimeMs(5000);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(GetIndex(), IsEmpty());
+  ASSERT_EQ(1u, trace_buffer()->stats().chunks_evicted());
+}
+
+TEST_F(TraceBufferTest, MaxRetention_EvictedFragmentIsDropped) {
+  ResetBuffer(4096);
+  trace_buffer()->SetMaxRetention(base::TimeMillis(1000));
+
+  SetBootTimeMs(1000);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(20, 'b', kContOnNextChunk)
+      .CopyIntoTraceBuffer();
+  SetBootTimeMs(1800);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(30, 'b', kContFromPrevChunk)
+      .AddPacket(40, 'c')
+      .CopyIntoTraceBuffer();
+
+  SetBootTimeMs(2500);
+  trace_buffer()->BeginRead();
+  bool previous_packet_dropped = false;
+  ASSERT_THAT(ReadPacket(nullptr, &previous_packet_dropped),
+              ElementsAre(FakePacketFragment(40, 'c')));
+  ASSERT_TRUE(previous_packet_dropped);
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, MaxRetention_RecommitRefreshesAge) {
+  ResetBuffer(4096);
+  trace_buffer()->SetMaxRetention(base::TimeMillis(1000));
+
+  SetBootTimeMs(1000);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(20, 'b')
+      .CopyIntoTraceBuffer(/*chunk_complete=*/false);
+  SetBootTimeMs(1800);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(20, 'b')
+      .CopyIntoTraceBuffer(/*chunk_complete=*/true);
+
+  // The stale entry of the first copy must not evict the chunk.
+  SetBootTimeMs(2500);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(20, 'b')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  SetBootTimeMs(2900);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(GetIndex(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, MaxRetention_EvictedChunksFreeDiscardBuffer) {
+  ResetBuffer(4096, TraceBuffer::kDiscard);
+  trace_buffer()->SetMaxRetention(base::TimeMillis(1000));
+
+  SetBootTimeMs(1000);
+  for (ChunkID i = 0; i < 4; i++) {
+    CreateChunk(ProducerID(1), WriterID(1), i)
+        .AddPacket(1024 - 16, static_cast<char>('a' + i))
+        .CopyIntoTraceBuffer();
+  }
+
+  // The buffer is full of unread chunks but they have all expired, so the
+  // next write wraps over them instead of being discarded.
+  SetBootTimeMs(2500);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(4))
+      .AddPacket(512 - 16, 'e')
+      .CopyIntoTraceBuffer();
+  ASSERT_EQ(0u, trace_buffer()->stats().chunks_discarded());
+  ASSERT_EQ(4u, trace_buffer()->stats().chunks_evicted());
+  ASSERT_EQ(4096u, trace_buffer()->stats().bytes_evicted());
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'e')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_HeaviestProducerIsOverwritten) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(1024);
+
+  // Producer 2 writes a single chunk, of which only the first packet is read.
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(256 - 16, 'a')
+      .AddPacket(256, 'b')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(256 - 16, 'a')));
+
+  // Producer 1 then writes twice the size of the buffer.
+  for (ChunkID i = 0; i < 16; i++) {
+    CreateChunk(ProducerID(1), WriterID(1), i)
+        .AddPacket(512 - 16, static_cast<char>('c' + i))
+        .CopyIntoTraceBuffer();
+  }
+
+  // The chunk of producer 2 has been moved twice, keeping its read state,
+  // while producer 1 overwrote its own oldest chunks.
+  trace_buffer()->BeginRead();
+  for (ChunkID i = 9; i < 16; i++) {
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(
+                                  512 - 16, static_cast<char>('c' + i))));
+  }
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(256, 'b')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  const TraceStats::BufferStats& stats = trace_buffer()->stats();
+  ASSERT_EQ(2u, stats.chunks_relocated());
+  ASSERT_EQ(1024u, stats.bytes_relocated());
+  ASSERT_EQ(9u, stats.chunks_overwritten());
+  ASSERT_EQ(2, stats.producer_stats_size());
+  ASSERT_EQ(2, stats.producer_stats()[0].producer_id());
+  ASSERT_EQ(512u, stats.producer_stats()[0].bytes_written());
+  ASSERT_EQ(0u, stats.producer_stats()[0].chunks_overwritten());
+  ASSERT_EQ(1, stats.producer_stats()[1].producer_id());
+  ASSERT_EQ(16u * 512, stats.producer_stats()[1].bytes_written());
+  ASSERT_EQ(9u, stats.producer_stats()[1].chunks_overwritten());
+  ASSERT_EQ(9u * 512, stats.producer_stats()[1].bytes_overwritten());
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_RelocationIsBounded) {
+  ResetBuffer(4096);
+  // A quota as big as the buffer would protect every chunk.
+  trace_buffer()->SetProducerQuota(4096);
+
+  for (ProducerID p = 1; p <= 8; p++) {
+    CreateChunk(p, WriterID(1), ChunkID(0))
+        .AddPacket(512 - 16, static_cast<char>('a' + p))
+        .CopyIntoTraceBuffer();
+  }
+  CreateChunk(ProducerID(9), WriterID(1), ChunkID(0))
+      .AddPacket(512 - 16, 'z')
+      .CopyIntoTraceBuffer();
+
+  // Only as many bytes as the new chunk are relocated: the chunk of producer
+  // 1 is moved and the one of producer 2 overwritten to make room for it.
+  ASSERT_EQ(1u, trace_buffer()->stats().chunks_relocated());
+  ASSERT_EQ(1u, trace_buffer()->stats().chunks_overwritten());
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'b')));
+  for (ProducerID p = 3; p <= 8; p++) {
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(
+                                  512 - 16, static_cast<char>('a' + p))));
+  }
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'z')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, ReleaseReadChunks_ReleasesOnlyReadChunks) {
+  ResetBuffer(256 * 1024, TraceBuffer::kDiscard);
+  for (ChunkID i = 0; i < 32; i++) {
+    CreateChunk(ProducerID(1), WriterID(1), i)
+        .AddPacket(4096 - 16, static_cast<char>('a' + i))
+        .CopyIntoTraceBuffer();
+  }
+
+  // Read only the first 24 chunks.
+  trace_buffer()->BeginRead();
+  for (ChunkID i = 0; i < 24; i++) {
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(
+                                  4096 - 16, static_cast<char>('a' + i))));
+  }
+
+  // The 96KB read are turned into two padding records of ~64KB and ~32KB: all
+  // the pages but the two holding their headers are released.
+  size_t released = trace_buffer()->ReleaseReadChunks();
+  ASSERT_EQ(8u, GetIndex().size());
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  const size_t page_size = base::GetSysPageSize();
+  ASSERT_EQ(24u * 4096 - 2 * page_size, released);
+  ASSERT_FALSE(base::vm_test_utils::IsMapped(buffer_begin() + page_size,
+                                             page_size));
+  ASSERT_TRUE(base::vm_test_utils::IsMapped(buffer_begin() + 24 * 4096,
+                                            8 * 4096));
+#else
+  base::ignore_result(released);
+#endif
+
+  // Releasing again is a no-op.
+  ASSERT_EQ(0u, trace_buffer()->ReleaseReadChunks());
+
+  // The remaining chunks can still be read and the sequence doesn't look
+  // broken.
+  trace_buffer()->BeginRead();
+  for (ChunkID i = 24; i < 32; i++) {
+    bool previous_packet_dropped = true;
+    ASSERT_THAT(ReadPacket(nullptr, &previous_packet_dropped),
+                ElementsAre(FakePacketFragment(4096 - 16,
+                                               static_cast<char>('a' + i))));
+    ASSERT_FALSE(previous_packet_dropped);
+  }
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, ReleaseReadChunks_KeepsUnreadAndIncompleteChunks) {
+  ResetBuffer(4096, TraceBuffer::kDiscard);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(512 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(512 - 16, 'b')
+      .AddPacket(256, 'c', kContOnNextChunk)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(512 - 16, 'd')
+      .CopyIntoTraceBuffer(/*chunk_complete=*/false);
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // Only the first chunk has been read entirely.
+  trace_buffer()->ReleaseReadChunks();
+  ASSERT_THAT(GetIndex(), ElementsAre(ChunkMetaKey(1, 1, 1),
+                                      ChunkMetaKey(2, 1, 0)));
+
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(2))
+      .AddPacket(256, 'c', kContFromPrevChunk)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(512 - 16, 'd')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(256, 'c'),
+                                        FakePacketFragment(256, 'c')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'd')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+// A drained kDiscard buffer keeps accepting chunks after wrapping over the
+// released records.
+TEST_F(TraceBufferTest, ReleaseReadChunks_WrapOverReleasedChunks) {
+  ResetBuffer(64 * 1024, TraceBuffer::kDiscard);
+  ChunkID chunk_id = 0;
+  for (int pass = 0; pass < 4; pass++) {
+    // Each pass writes 3/4 of the buffer, so the writes wrap.
+    const ChunkID first_chunk_id = chunk_id;
+    for (int i = 0; i < 12; i++, chunk_id++) {
+      CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+          .AddPacket(4096 - 16, static_cast<char>(chunk_id))
+          .CopyIntoTraceBuffer();
+    }
+    trace_buffer()->BeginRead();
+    for (ChunkID i = first_chunk_id; i < chunk_id; i++) {
+      bool previous_packet_dropped = false;
+      ASSERT_THAT(ReadPacket(nullptr, &previous_packet_dropped),
+                  ElementsAre(FakePacketFragment(4096 - 16,
+                                                 static_cast<char>(i))));
+      ASSERT_EQ(i == 0, previous_packet_dropped);
+    }
+    ASSERT_THAT(ReadPacket(), IsEmpty());
+    trace_buffer()->ReleaseReadChunks();
+    ASSERT_THAT(GetIndex(), IsEmpty());
+  }
+  ASSERT_EQ(0u, trace_buffer()->stats().chunks_discarded());
+  ASSERT_EQ(48u, trace_buffer()->stats().chunks_read());
+  ASSERT_EQ(3u, trace_buffer()->stats().write_wrap_count());
+}
+
 // TODO(primiano): test stats().
 // TODO(primiano): test multiple streams interleaved.
 // TODO(primiano): more testing on packet merging.
@@ -75,6 +75,7 @@
 #include "perfetto/tracing/core/tracing_service_state.h"
 #include "src/android_stats/statsd_logging_helper.h"
 #include "src/protozero/filtering/message_filter.h"
+#include "src/tracing/core/packet_deduplicator.h"
 #include "src/tracing/core/packet_stream_validator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_buffer.h"
@@ -286,6 +287,18 @@ bool ShouldLogEvent(const TraceConfig& cfg) {
   PERFETTO_FATAL("For GCC");
 }
 
+// Returns whether |filter| lets through the fields that the service adds to
+// deduplicated packets. If it doesn't, the copies of a packet would reach the
+// consumer as empty packets which can't be expanded back.
+bool FilterAllowsDedupFields(protozero::MessageFilter* filter) {
+  protozero::HeapBuffered<protos::pbzero::TracePacket> packet;
+  packet->set_dedup_id(1);
+  packet->set_duplicate_of(1);
+  std::vector<uint8_t> data = packet.SerializeAsArray();
+  auto filtered = filter->FilterMessage(data.data(), data.size());
+  return !filtered.error && filtered.size == data.size();
+}
+
 }  // namespace
 
 // These constants instead are defined in the header because are used by tests.
@@ -754,6 +767,13 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
           cfg, PerfettoStatsdAtom::kTracedEnableTracingInvalidFilter);
       return PERFETTO_SVC_ERR("Failed to set filter root.");
     }
+    if (cfg.packet_dedup_kb() && !FilterAllowsDedupFields(trace_filter.get())) {
+      MaybeLogUploadEvent(
+          cfg, PerfettoStatsdAtom::kTracedEnableTracingInvalidFilter);
+      return PERFETTO_SVC_ERR(
+          "packet_dedup_kb requires the trace_filter to allow the "
+          "TracePacket.dedup_id and duplicate_of fields");
+    }
   }
 
   const TracingSessionID tsid = ++last_tracing_session_id_;
@@ -766,6 +786,11 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
   if (trace_filter)
     tracing_session->trace_filter = std::move(trace_filter);
 
+  if (cfg.packet_dedup_kb()) {
+    tracing_session->packet_deduplicator.reset(
+        new PacketDeduplicator(cfg.packet_dedup_kb() * 1024u));
+  }
+
   if (cfg.write_into_file()) {
     if (!fd ^ !cfg.output_path().empty()) {
       tracing_sessions_.erase(tsid);
@@ -830,6 +855,9 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
       did_allocate_all_buffers = false;
       break;
     }
+    trace_buffer->SetProducerQuota(buffer_cfg.producer_quota_kb() * 1024u);
+    trace_buffer->SetMaxRetention(
+        base::TimeMillis(buffer_cfg.max_retention_ms()));
   }
 
   UpdateMemoryGuardrail();
@@ -1178,6 +1206,7 @@ void TracingServiceImpl::StartDataSourceInstance(
     tracing_session->consumer_maybe_null->OnDataSourceInstanceStateChange(
         *producer, *instance);
   }
+  instance->start_time_ns = base::GetBootTimeNs().count();
   producer->StartDataSource(instance->instance_id, instance->config);
 
   // If all data sources are started, notify the consumer.
@@ -1297,6 +1326,12 @@ void TracingServiceImpl::NotifyDataSourceStarted(
 
     ProducerEndpointImpl* producer = GetProducer(producer_id);
     PERFETTO_DCHECK(producer);
+
+    const int64_t now_ns = base::GetBootTimeNs().count();
+    tracing_session.data_source_started_events.push_back(
+        {now_ns, instance->data_source_name, producer->name_,
+         now_ns - instance->setup_time_ns, now_ns - instance->start_time_ns});
+
     if (tracing_session.consumer_maybe_null) {
       tracing_session.consumer_maybe_null->OnDataSourceInstanceStateChange(
           *producer, *instance);
@@ -1600,23 +1635,41 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
   // order to issue a flush request we have to build a map of all data source
   // instance ids enabled for each producer.
   std::map<ProducerID, std::vector<DataSourceInstanceID>> flush_map;
+  // Producers with at least one data source that needs the Flush() IPC.
+  std::set<ProducerID> producers_needing_flush;
   for (const auto& data_source_inst : tracing_session->data_source_instances) {
     const ProducerID producer_id = data_source_inst.first;
     const DataSourceInstanceID ds_inst_id = data_source_inst.second.instance_id;
     flush_map[producer_id].push_back(ds_inst_id);
+    if (!data_source_inst.second.no_flush)
+      producers_needing_flush.insert(producer_id);
   }
 
   for (const auto& kv : flush_map) {
     ProducerID producer_id = kv.first;
     ProducerEndpointImpl* producer = GetProducer(producer_id);
+
+    // If none of the data sources of the producer needs to be flushed, the
+    // chunks of its SMB are collected by CompleteFlush() by scraping. The IPC
+    // round-trip, which at the end of a session with many producers adds up
+    // to a lot of latency, is needed only to let writers commit the data
+    // they are still holding.
+    if (producer->smb_scraping_enabled_ &&
+        !producers_needing_flush.count(producer_id) &&
+        !HasUncommittedChunks(tracing_session, producer)) {
+      tracing_session->flush_ipcs_skipped++;
+      continue;
+    }
+
     const std::vector<DataSourceInstanceID>& data_sources = kv.second;
     producer->Flush(flush_request_id, data_sources);
     pending_flush.producers.insert(producer_id);
   }
 
   // If there are no producers to flush (realistically this happens only in
-  // some tests) fire OnFlushTimeout() straight away, without waiting.
-  if (flush_map.empty())
+  // some tests or when all producers can be scraped) fire OnFlushTimeout()
+  // straight away, without waiting.
+  if (pending_flush.producers.empty())
     timeout_ms = 0;
 
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
@@ -1811,6 +1864,52 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
   }
 }
 
+// Returns true if some writer of |producer| targeting the buffers of
+// |tracing_session| is holding data in the SMB which can't be scraped reliably:
+// chunks still being written, whose last packet may be incomplete, and chunks
+// waiting for patches which the producer sends only on commit.
+bool TracingServiceImpl::HasUncommittedChunks(TracingSession* tracing_session,
+                                              ProducerEndpointImpl* producer) {
+  const auto& session_buffers = tracing_session->buffers_index;
+  SharedMemoryABI* abi = &producer->shmem_abi_;
+  for (size_t page_idx = 0; page_idx < abi->num_pages(); page_idx++) {
+    uint32_t layout = abi->GetPageLayout(page_idx);
+    uint32_t used_chunks = abi->GetUsedChunks(layout);  // Returns a bitmap.
+    for (uint32_t chunk_idx = 0; used_chunks; chunk_idx++, used_chunks >>= 1) {
+      if (!(used_chunks & 1))
+        continue;
+
+      SharedMemoryABI::ChunkState state =
+          SharedMemoryABI::GetChunkStateFromLayout(layout, chunk_idx);
+      SharedMemoryABI::Chunk chunk =
+          abi->GetChunkUnchecked(page_idx, layout, chunk_idx);
+      uint16_t packet_count;
+      uint8_t flags;
+      std::tie(packet_count, flags) = chunk.GetPacketCountAndFlags();
+
+      // A chunk with no packets has no data to commit. Also its header might
+      // not be written yet, see ScrapeSharedMemoryBuffers().
+      if (packet_count == 0)
+        continue;
+      if (state == SharedMemoryABI::kChunkComplete &&
+          !(flags & SharedMemoryABI::ChunkHeader::kChunkNeedsPatching)) {
+        continue;
+      }
+
+      base::Optional<BufferID> target_buffer_id =
+          producer->buffer_id_for_writer(chunk.writer_id());
+      // Be conservative with writers we don't know about yet: they might be
+      // writing into the session.
+      if (!target_buffer_id ||
+          std::find(session_buffers.begin(), session_buffers.end(),
+                    *target_buffer_id) != session_buffers.end()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void TracingServiceImpl::FlushAndDisableTracing(TracingSessionID tsid) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Triggering final flush for %" PRIu64, tsid);
@@ -2001,6 +2100,11 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
   if (!tracing_session->config.builtin_data_sources().disable_service_events())
     EmitLifecycleEvents(tracing_session, &packets);
 
+  // The packets returned by the previous call, whose slices point into the
+  // buffers, have been consumed by now.
+  if (consumer)
+    ReleaseReadBufferMemory(tracing_session);
+
   size_t packets_bytes = 0;  // SUM(slice.size() for each slice in |packets|).
   size_t total_slices = 0;   // SUM(#slices in |packets|).
 
@@ -2062,17 +2166,38 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
       // truncated packets are also rejected, so the producer can't give us a
       // partial packet (e.g., a truncated string) which only becomes valid when
       // the trusted data is appended here.
-      Slice slice = Slice::Allocate(32);
+      const PacketSequenceID sequence_id = tracing_session->GetPacketSequenceID(
+          sequence_properties.producer_id_trusted,
+          sequence_properties.writer_id);
+      PacketDeduplicator::Result dedup;
+      if (tracing_session->packet_deduplicator) {
+        dedup = tracing_session->packet_deduplicator->Process(sequence_id,
+                                                              packet.slices());
+        if (dedup.action == PacketDeduplicator::Result::kReplace) {
+          tracing_session->deduplicated_packets++;
+          tracing_session->deduplicated_bytes += packet.size();
+          packet = TracePacket();
+        }
+      }
+
+      // The dedup fields take up to 12 more bytes.
+      Slice slice = Slice::Allocate(dedup.dedup_id ? 48 : 32);
       protozero::StaticBuffered<protos::pbzero::TracePacket> trusted_packet(
           slice.own_data(), slice.size);
       trusted_packet->set_trusted_uid(
           static_cast<int32_t>(sequence_properties.producer_uid_trusted));
-      trusted_packet->set_trusted_packet_sequence_id(
-          tracing_session->GetPacketSequenceID(
-              sequence_properties.producer_id_trusted,
-              sequence_properties.writer_id));
-      if (previous_packet_dropped)
+      trusted_packet->set_trusted_packet_sequence_id(sequence_id);
+      if (dedup.action == PacketDeduplicator::Result::kReplace) {
+        // Set previous_packet_dropped explicitly, as it must override the one
+        // of the original packet when trace processor expands the reference.
         trusted_packet->set_previous_packet_dropped(previous_packet_dropped);
+        trusted_packet->set_duplicate_of(dedup.dedup_id);
+      } else {
+        if (previous_packet_dropped)
+          trusted_packet->set_previous_packet_dropped(previous_packet_dropped);
+        if (dedup.action == PacketDeduplicator::Result::kTag)
+          trusted_packet->set_dedup_id(dedup.dedup_id);
+      }
       slice.size = trusted_packet.Finalize();
       packet.AddSlice(std::move(slice));
 
@@ -2219,6 +2344,7 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     }
 
     tracing_session->bytes_written_into_file += total_wr_size;
+    ReleaseReadBufferMemory(tracing_session);
 
     PERFETTO_DLOG("Draining into file, written: %" PRIu64 " KB, stop: %d",
                   (total_wr_size + 1023) / 1024, stop_writing_into_file);
@@ -2473,7 +2599,8 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
           data_source.descriptor.name(),
           data_source.descriptor.will_notify_on_start(),
           data_source.descriptor.will_notify_on_stop(),
-          data_source.descriptor.handles_incremental_state_clear()));
+          data_source.descriptor.handles_incremental_state_clear(),
+          data_source.descriptor.no_flush()));
   DataSourceInstance* ds_instance = &insert_iter->second;
 
   // New data source instance starts out in CONFIGURED state.
@@ -2553,6 +2680,7 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
     producer->SetupSharedMemory(std::move(shared_memory), page_size,
                                 /*provided_by_producer=*/false);
   }
+  ds_instance->setup_time_ns = base::GetBootTimeNs().count();
   producer->SetupDataSource(inst_id, ds_config);
   return ds_instance;
 }
@@ -2724,6 +2852,24 @@ TraceBuffer* TracingServiceImpl::GetBufferByID(BufferID buffer_id) {
   return &*buf_iter->second;
 }
 
+// Gives back to the OS the memory of the chunks that have been read from the
+// DISCARD buffers of the session, see TraceBuffer::ReleaseReadChunks(). Ring
+// buffers are left alone, as they are normally read only once at the end of
+// the trace and the chunks read are overwritten anyway.
+void TracingServiceImpl::ReleaseReadBufferMemory(
+    TracingSession* tracing_session) {
+  for (size_t buf_idx = 0; buf_idx < tracing_session->num_buffers();
+       buf_idx++) {
+    if (tracing_session->config.buffers()[buf_idx].fill_policy() !=
+        TraceConfig::BufferConfig::DISCARD) {
+      continue;
+    }
+    TraceBuffer* tbuf = GetBufferByID(tracing_session->buffers_index[buf_idx]);
+    if (tbuf)
+      tbuf->ReleaseReadChunks();
+  }
+}
+
 void TracingServiceImpl::OnStartTriggersTimeout(TracingSessionID tsid) {
   // Skip entirely the flush if the trace session doesn't exist anymore.
   // This is to prevent misleading error messages to be logged.
@@ -3017,6 +3163,13 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     filt_stats->set_errors(tracing_session->filter_errors);
   }
 
+  trace_stats.set_flush_ipcs_skipped(tracing_session->flush_ipcs_skipped);
+
+  if (tracing_session->packet_deduplicator) {
+    trace_stats.set_deduplicated_packets(tracing_session->deduplicated_packets);
+    trace_stats.set_deduplicated_bytes(tracing_session->deduplicated_bytes);
+  }
+
   for (BufferID buf_id : tracing_session->buffers_index) {
     TraceBuffer* buf = GetBufferByID(buf_id);
     if (!buf) {
@@ -3096,6 +3249,24 @@ void TracingServiceImpl::EmitLifecycleEvents(
     event.timestamps.clear();
   }
 
+  for (const auto& event : tracing_session->data_source_started_events) {
+    protozero::HeapBuffered<protos::pbzero::TracePacket> packet;
+    packet->set_timestamp(static_cast<uint64_t>(event.timestamp));
+    packet->set_trusted_uid(static_cast<int32_t>(uid_));
+    packet->set_trusted_packet_sequence_id(kServicePacketSequenceID);
+
+    auto* started = packet->set_service_event()->set_data_source_started();
+    started->set_data_source_name(event.data_source_name);
+    started->set_producer_name(event.producer_name);
+    started->set_setup_to_started_ns(
+        static_cast<uint64_t>(event.setup_to_started_ns));
+    started->set_start_to_started_ns(
+        static_cast<uint64_t>(event.start_to_started_ns));
+    timestamped_packets.emplace_back(event.timestamp,
+                                     packet.SerializeAsArray());
+  }
+  tracing_session->data_source_started_events.clear();
+
   // We sort by timestamp here to ensure that the "sequence" of lifecycle
   // packets has monotonic timestamps like other sequences in the trace.
   // Note that these events could still be out of order with respect to other
@@ -58,6 +58,7 @@ class TaskRunner;
 }  // namespace base
 
 class Consumer;
+class PacketDeduplicator;
 class Producer;
 class SharedMemory;
 class SharedMemoryArbiterImpl;
@@ -337,14 +338,16 @@ class TracingServiceImpl : public TracingService {
                        const std::string& ds_name,
                        bool notify_on_start,
                        bool notify_on_stop,
-                       bool handles_incremental_state_invalidation)
+                       bool handles_incremental_state_invalidation,
+                       bool no_flush_needed)
         : instance_id(id),
           config(cfg),
           data_source_name(ds_name),
           will_notify_on_start(notify_on_start),
           will_notify_on_stop(notify_on_stop),
           handles_incremental_state_clear(
-              handles_incremental_state_invalidation) {}
+              handles_incremental_state_invalidation),
+          no_flush(no_flush_needed) {}
     DataSourceInstance(const DataSourceInstance&) = delete;
     DataSourceInstance& operator=(const DataSourceInstance&) = delete;
 
@@ -354,6 +357,11 @@ class TracingServiceImpl : public TracingService {
     bool will_notify_on_start;
     bool will_notify_on_stop;
     bool handles_incremental_state_clear;
+    bool no_flush;
+
+    // Boot time of the SetupDataSource() and StartDataSource() requests.
+    int64_t setup_time_ns = 0;
+    int64_t start_time_ns = 0;
 
     enum DataSourceInstanceState {
       CONFIGURED,
@@ -437,11 +445,16 @@ class TracingServiceImpl : public TracingService {
       return nullptr;
     }
 
+    // With TraceConfig.no_wait_for_start_acks, the data sources waiting to
+    // ack the start request count as started.
     bool AllDataSourceInstancesStarted() {
+      const bool wait_for_acks = !config.no_wait_for_start_acks();
       return std::all_of(
           data_source_instances.begin(), data_source_instances.end(),
-          [](decltype(data_source_instances)::const_reference x) {
-            return x.second.state == DataSourceInstance::STARTED;
+          [wait_for_acks](decltype(data_source_instances)::const_reference x) {
+            return x.second.state == DataSourceInstance::STARTED ||
+                   (!wait_for_acks &&
+                    x.second.state == DataSourceInstance::STARTING);
           });
     }
 
@@ -544,6 +557,16 @@ class TracingServiceImpl : public TracingService {
     };
     std::vector<LifecycleEvent> lifecycle_events;
 
+    // The TracingServiceEvent.data_source_started events not emitted yet.
+    struct DataSourceStartedEvent {
+      int64_t timestamp;
+      std::string data_source_name;
+      std::string producer_name;
+      int64_t setup_to_started_ns;
+      int64_t start_to_started_ns;
+    };
+    std::vector<DataSourceStartedEvent> data_source_started_events;
+
     using ClockSnapshotData =
         std::vector<std::pair<uint32_t /*clock_id*/, uint64_t /*ts*/>>;
 
@@ -588,6 +611,15 @@ class TracingServiceImpl : public TracingService {
     uint64_t filter_input_bytes = 0;
     uint64_t filter_output_bytes = 0;
     uint64_t filter_errors = 0;
+
+    // When non-NULL the packets are deduplicated, see
+    // TraceConfig.packet_dedup_kb.
+    std::unique_ptr<PacketDeduplicator> packet_deduplicator;
+    uint64_t deduplicated_packets = 0;
+    uint64_t deduplicated_bytes = 0;
+
+    // Producers not sent a Flush() IPC, see DataSourceDescriptor.no_flush.
+    uint64_t flush_ipcs_skipped = 0;
   };
 
   TracingServiceImpl(const TracingServiceImpl&) = delete;
@@ -647,8 +679,10 @@ class TracingServiceImpl : public TracingService {
                      ConsumerEndpoint::FlushCallback callback,
                      bool success);
   void ScrapeSharedMemoryBuffers(TracingSession*, ProducerEndpointImpl*);
+  bool HasUncommittedChunks(TracingSession*, ProducerEndpointImpl*);
   void PeriodicClearIncrementalStateTask(TracingSessionID, bool post_next_only);
   TraceBuffer* GetBufferByID(BufferID);
+  void ReleaseReadBufferMemory(TracingSession*);
   void OnStartTriggersTimeout(TracingSessionID tsid);
   void MaybeLogUploadEvent(const TraceConfig&,
                            PerfettoStatsdAtom atom,
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/tracing/core/consumer.h"
+#include "perfetto/ext/tracing/core/producer.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/ext/tracing/core/tracing_service.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "perfetto/tracing/core/data_source_descriptor.h"
+#include "perfetto/tracing/core/trace_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/tracing/test/test_shared_memory.h"
+
+// Measures the time from StartTracing() to the ALL_DATA_SOURCES_STARTED
+// notification for sessions with many producers, a few of which are slow to
+// ack the start of their data source (e.g. because of heavy work on setup).
+
+namespace {
+
+using namespace perfetto;
+
+constexpr char kDataSourceName[] = "benchmark_data_source";
+
+// One producer every kSlowProducerInterval acks the start after
+// kSlowAckDelayMs, the others ack it straight away.
+constexpr int kSlowProducerInterval = 16;
+constexpr uint32_t kSlowAckDelayMs = 20;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"producers", "no_wait_for_acks"});
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Args({16, 0});
+    b->Args({16, 1});
+  } else {
+    for (int no_wait : {0, 1}) {
+      for (int producers : {16, 64, 256})
+        b->Args({producers, no_wait});
+    }
+  }
+}
+
+class FakeProducer : public Producer {
+ public:
+  FakeProducer(base::TestTaskRunner* task_runner, uint32_t ack_delay_ms)
+      : task_runner_(task_runner), ack_delay_ms_(ack_delay_ms) {}
+
+  void Connect(TracingService* svc, const std::string& name) {
+    endpoint_ = svc->ConnectProducer(this, /*uid=*/0, name);
+  }
+
+  // Producer implementation.
+  void OnConnect() override {
+    DataSourceDescriptor descriptor;
+    descriptor.set_name(kDataSourceName);
+    descriptor.set_will_notify_on_start(true);
+    endpoint_->RegisterDataSource(descriptor);
+  }
+  void OnDisconnect() override {}
+  void OnTracingSetup() override {}
+  void SetupDataSource(DataSourceInstanceID,
+                       const DataSourceConfig&) override {}
+  void StartDataSource(DataSourceInstanceID id,
+                       const DataSourceConfig&) override {
+    if (!ack_delay_ms_) {
+      endpoint_->NotifyDataSourceStarted(id);
+      return;
+    }
+    pending_acks_++;
+    task_runner_->PostDelayedTask(
+        [this, id] {
+          pending_acks_--;
+          endpoint_->NotifyDataSourceStarted(id);
+        },
+        ack_delay_ms_);
+  }
+  void StopDataSource(DataSourceInstanceID) override {}
+  void Flush(FlushRequestID, const DataSourceInstanceID*, size_t) override {}
+  void ClearIncrementalState(const DataSourceInstanceID*, size_t) override {}
+
+  int pending_acks() const { return pending_acks_; }
+
+ private:
+  base::TestTaskRunner* const task_runner_;
+  const uint32_t ack_delay_ms_;
+  int pending_acks_ = 0;
+  std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
+};
+
+class FakeConsumer : public Consumer {
+ public:
+  explicit FakeConsumer(std::function<void()> on_all_started)
+      : on_all_started_(std::move(on_all_started)) {}
+
+  void Connect(TracingService* svc) {
+    endpoint_ = svc->ConnectConsumer(this, /*uid=*/0);
+  }
+  TracingService::ConsumerEndpoint* endpoint() { return endpoint_.get(); }
+
+  // Consumer implementation.
+  void OnConnect() override {
+    endpoint_->ObserveEvents(ObservableEvents::TYPE_ALL_DATA_SOURCES_STARTED);
+  }
+  void OnDisconnect() override {}
+  void OnTracingDisabled(const std::string&) override {}
+  void OnTraceData(std::vector<TracePacket>, bool) override {}
+  void OnDetach(bool) override {}
+  void OnAttach(bool, const TraceConfig&) override {}
+  void OnTraceStats(bool, const TraceStats&) override {}
+  void OnObservableEvents(const ObservableEvents& events) override {
+    if (events.all_data_sources_started())
+      on_all_started_();
+  }
+
+ private:
+  std::function<void()> on_all_started_;
+  std::unique_ptr<TracingService::ConsumerEndpoint> endpoint_;
+};
+
+}  // namespace
+
+static void BM_TracingServiceStartTracing(benchmark::State& state) {
+  const int num_producers = static_cast<int>(state.range(0));
+  const bool no_wait_for_acks = state.range(1) != 0;
+
+  for (auto _ : state) {
+    base::TestTaskRunner task_runner;
+    std::unique_ptr<TracingService> svc = TracingService::CreateInstance(
+        std::unique_ptr<SharedMemory::Factory>(new TestSharedMemory::Factory()),
+        &task_runner);
+
+    std::vector<std::unique_ptr<FakeProducer>> producers;
+    for (int i = 0; i < num_producers; i++) {
+      uint32_t ack_delay_ms =
+          i % kSlowProducerInterval == 0 ? kSlowAckDelayMs : 0;
+      producers.emplace_back(new FakeProducer(&task_runner, ack_delay_ms));
+      producers.back()->Connect(svc.get(), "producer_" + std::to_string(i));
+    }
+    FakeConsumer consumer(task_runner.CreateCheckpoint("all_started"));
+    consumer.Connect(svc.get());
+    task_runner.RunUntilIdle();
+
+    TraceConfig trace_config;
+    trace_config.add_buffers()->set_size_kb(64);
+    trace_config.add_data_sources()->mutable_config()->set_name(
+        kDataSourceName);
+    trace_config.set_deferred_start(true);
+    trace_config.set_no_wait_for_start_acks(no_wait_for_acks);
+    consumer.endpoint()->EnableTracing(trace_config);
+    task_runner.RunUntilIdle();
+
+    auto start = std::chrono::steady_clock::now();
+    consumer.endpoint()->StartTracing();
+    task_runner.RunUntilCheckpoint("all_started");
+    auto end = std::chrono::steady_clock::now();
+    state.SetIterationTime(
+        std::chrono::duration_cast<std::chrono::duration<double>>(end - start)
+            .count());
+
+    // Let the slow producers ack before tearing everything down.
+    for (const auto& producer : producers) {
+      while (producer->pending_acks())
+        task_runner.RunUntilIdle();
+    }
+    consumer.endpoint()->DisableTracing();
+    task_runner.RunUntilIdle();
+  }
+}
+
+BENCHMARK(BM_TracingServiceStartTracing)->Apply(BenchmarkArgs)->UseManualTime();
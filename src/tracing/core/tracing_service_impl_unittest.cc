@@ -18,6 +18,9 @@
 
 #include <string.h>
 
+#include <set>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
@@ -30,7 +33,10 @@
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "src/base/test/test_task_runner.h"
+#include "src/base/test/vm_test_utils.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
+#include "src/tracing/core/trace_buffer.h"
 #include "src/tracing/core/trace_writer_impl.h"
 #include "src/tracing/test/mock_consumer.h"
 #include "src/tracing/test/mock_producer.h"
@@ -41,6 +47,7 @@
 #include "protos/perfetto/trace/test_event.gen.h"
 #include "protos/perfetto/trace/test_event.pbzero.h"
 #include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.gen.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 #include "protos/perfetto/trace/trigger.gen.h"
@@ -53,6 +60,7 @@ using ::testing::Contains;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::ExplainMatchResult;
+using ::testing::HasSubstr;
 using ::testing::InSequence;
 using ::testing::Invoke;
 using ::testing::InvokeWithoutArgs;
@@ -136,6 +144,20 @@ class TracingServiceImplTest : public testing::Test {
     return GetTracingSession(GetTracingSessionID());
   }
 
+  // Returns the size of the resident pages of the |buf_idx|-th buffer of the
+  // tracing session.
+  size_t GetBufferResidentSize(size_t buf_idx) {
+    TraceBuffer* buf =
+        svc->GetBufferByID(tracing_session()->buffers_index[buf_idx]);
+    const size_t page_size = base::GetSysPageSize();
+    size_t resident_size = 0;
+    for (size_t offset = 0; offset < buf->size(); offset += page_size) {
+      if (base::vm_test_utils::IsMapped(buf->begin() + offset, page_size))
+        resident_size += page_size;
+    }
+    return resident_size;
+  }
+
   TracingSessionID GetTracingSessionID() {
     return svc->last_tracing_session_id_;
   }
@@ -1597,6 +1619,78 @@ TEST_F(TracingServiceImplTest, ProducerIDWrapping) {
   ASSERT_EQ(6u, connect_producer_and_get_id("6"));
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// The memory of a DISCARD buffer is committed only as it is written and is
+// given back once the data has been read.
+TEST_F(TracingServiceImplTest, DiscardBufferMemoryTracksUnreadData) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  auto* buf_config = trace_config.add_buffers();
+  buf_config->set_size_kb(4096);
+  buf_config->set_fill_policy(TraceConfig::BufferConfig::DISCARD);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Nothing has been written yet.
+  static constexpr size_t kMaxIdleResidentSize = 64 * 1024;
+  EXPECT_LT(GetBufferResidentSize(0), kMaxIdleResidentSize);
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  static constexpr size_t kNumPackets = 2048;
+  std::string payload(1000, 'x');
+  for (size_t i = 0; i < kNumPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str(payload.c_str(), payload.size());
+  }
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // ~2MB have been written out of the 4MB of the buffer.
+  size_t resident_size = GetBufferResidentSize(0);
+  EXPECT_GE(resident_size, kNumPackets * payload.size());
+  EXPECT_LT(resident_size, 3u * 1024 * 1024);
+
+  // The data is read in several passes and the pages read in each pass are
+  // released at the beginning of the next one. Only the pages holding the
+  // headers of the padding records, one every 64KB, stay resident.
+  EXPECT_GE(consumer->ReadBuffers().size(), kNumPackets);
+  EXPECT_LT(GetBufferResidentSize(0), resident_size / 8);
+
+  // The buffer keeps working after that.
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("after_release");
+  }
+  flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+  EXPECT_THAT(consumer->ReadBuffers(),
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str,
+                           Eq("after_release")))));
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||
+        // PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+
 // Note: file_write_period_ms is set to a large enough to have exactly one flush
 // of the tracing buffers (and therefore at most one synchronization section),
 // unless the test runs unrealistically slowly, or the implementation of the
@@ -2516,6 +2610,158 @@ TEST_F(TracingServiceImplTest, ProducerUIDsAndPacketSequenceIDs) {
                    Eq(4u)))));
 }
 
+TEST_F(TracingServiceImplTest, PacketDeduplication) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+  trace_config.set_packet_dedup_kb(64);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Too small to be deduplicated.
+  const std::string small_payload = "small";
+  const std::string big_payload(128, 'x');
+  std::unique_ptr<TraceWriter> writer1 =
+      producer->CreateTraceWriter("data_source");
+  std::unique_ptr<TraceWriter> writer2 =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < 3; i++) {
+    writer1->NewTracePacket()->set_for_testing()->set_str(big_payload);
+    writer1->NewTracePacket()->set_for_testing()->set_str(small_payload);
+  }
+  // Packets are deduplicated only within a sequence.
+  writer2->NewTracePacket()->set_for_testing()->set_str(big_payload);
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush({writer1.get(), writer2.get()});
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<protos::gen::TracePacket> big_packets;
+  std::vector<protos::gen::TracePacket> duplicates;
+  size_t small_packets = 0;
+  for (const auto& packet : consumer->ReadBuffers()) {
+    if (packet.has_duplicate_of()) {
+      EXPECT_FALSE(packet.has_for_testing());
+      duplicates.push_back(packet);
+    } else if (packet.for_testing().str() == big_payload) {
+      EXPECT_TRUE(packet.has_dedup_id());
+      big_packets.push_back(packet);
+    } else if (packet.for_testing().str() == small_payload) {
+      EXPECT_FALSE(packet.has_dedup_id());
+      small_packets++;
+    }
+  }
+  EXPECT_EQ(small_packets, 3u);
+  ASSERT_EQ(big_packets.size(), 2u);
+  EXPECT_NE(big_packets[0].trusted_packet_sequence_id(),
+            big_packets[1].trusted_packet_sequence_id());
+  EXPECT_NE(big_packets[0].dedup_id(), big_packets[1].dedup_id());
+  ASSERT_EQ(duplicates.size(), 2u);
+  const uint32_t writer1_seq_id = duplicates[0].trusted_packet_sequence_id();
+  const auto& original =
+      big_packets[0].trusted_packet_sequence_id() == writer1_seq_id
+          ? big_packets[0]
+          : big_packets[1];
+  EXPECT_EQ(original.trusted_packet_sequence_id(), writer1_seq_id);
+  for (const auto& duplicate : duplicates) {
+    EXPECT_EQ(duplicate.trusted_packet_sequence_id(), writer1_seq_id);
+    EXPECT_EQ(duplicate.duplicate_of(), original.dedup_id());
+    EXPECT_TRUE(duplicate.has_previous_packet_dropped());
+  }
+}
+
+// Tracing fails to start if the trace filter would strip the dedup fields, as
+// the copies of a packet would otherwise become empty packets.
+TEST_F(TracingServiceImplTest, PacketDeduplicationWithTraceFilter) {
+  for (bool filter_allows_dedup : {false, true}) {
+    SCOPED_TRACE(filter_allows_dedup);
+    std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+    consumer->Connect(svc.get());
+
+    std::unique_ptr<MockProducer> producer = CreateMockProducer();
+    producer->Connect(svc.get(),
+                      "mock_producer" + std::to_string(filter_allows_dedup));
+    producer->RegisterDataSource("data_source");
+
+    // Trace.packet lets through all the simple fields of TracePacket up to
+    // (and, if |filter_allows_dedup|, including) the dedup fields, and
+    // for_testing.
+    protozero::FilterBytecodeGenerator filter;
+    filter.AddNestedField(protos::pbzero::Trace::kPacketFieldNumber, 1);
+    filter.EndMessage();
+    filter.AddSimpleFieldRange(
+        1, protos::pbzero::TracePacket::kDedupIdFieldNumber -
+               (filter_allows_dedup ? 0 : 1));
+    if (filter_allows_dedup) {
+      filter.AddSimpleField(
+          protos::pbzero::TracePacket::kDuplicateOfFieldNumber);
+    }
+    filter.AddSimpleField(protos::pbzero::TracePacket::kForTestingFieldNumber);
+    filter.EndMessage();
+
+    TraceConfig trace_config;
+    trace_config.add_buffers()->set_size_kb(128);
+    trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+    trace_config.set_packet_dedup_kb(64);
+    trace_config.mutable_trace_filter()->set_bytecode(filter.Serialize());
+
+    if (!filter_allows_dedup) {
+      auto on_fail = task_runner.CreateCheckpoint("dedup_filter_rejected");
+      EXPECT_CALL(*consumer, OnTracingDisabled(HasSubstr("packet_dedup_kb")))
+          .WillOnce(InvokeWithoutArgs(on_fail));
+      consumer->EnableTracing(trace_config);
+      task_runner.RunUntilCheckpoint("dedup_filter_rejected");
+      continue;
+    }
+
+    consumer->EnableTracing(trace_config);
+    producer->WaitForTracingSetup();
+    producer->WaitForDataSourceSetup("data_source");
+    producer->WaitForDataSourceStart("data_source");
+
+    const std::string payload(128, 'x');
+    std::unique_ptr<TraceWriter> writer =
+        producer->CreateTraceWriter("data_source");
+    for (int i = 0; i < 3; i++)
+      writer->NewTracePacket()->set_for_testing()->set_str(payload);
+
+    auto flush_request = consumer->Flush();
+    producer->WaitForFlush(writer.get());
+    ASSERT_TRUE(flush_request.WaitForReply());
+
+    consumer->DisableTracing();
+    producer->WaitForDataSourceStop("data_source");
+    consumer->WaitForTracingDisabled();
+
+    size_t full_packets = 0;
+    size_t duplicates = 0;
+    for (const auto& packet : consumer->ReadBuffers()) {
+      if (packet.has_duplicate_of()) {
+        duplicates++;
+      } else if (packet.for_testing().str() == payload) {
+        EXPECT_TRUE(packet.has_dedup_id());
+        full_packets++;
+      }
+    }
+    EXPECT_EQ(full_packets, 1u);
+    EXPECT_EQ(duplicates, 2u);
+  }
+}
+
 TEST_F(TracingServiceImplTest, AllowedBuffers) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -2821,6 +3067,65 @@ TEST_F(TracingServiceImplTest, ScrapeBuffersOnFlush) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, NoFlushDataSourcesAreScraped) {
+  svc->SetSMBScrapingEnabled(true);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  ProducerID producer_id = *last_producer_id();
+  producer->RegisterDataSource("data_source", /*ack_stop=*/false,
+                               /*ack_start=*/false,
+                               /*handle_incremental_state_clear=*/false,
+                               /*no_flush=*/true);
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer = producer->endpoint()->CreateTraceWriter(
+      tracing_session()->buffers_index[0]);
+  WaitForTraceWritersChanged(producer_id);
+
+  // Nothing written yet: the flush completes without any IPC.
+  EXPECT_CALL(*producer, Flush(_, _, _)).Times(0);
+  auto flush_request = consumer->Flush();
+  ASSERT_TRUE(flush_request.WaitForReply());
+  Mock::VerifyAndClearExpectations(producer.get());
+
+  // The writer holds a chunk being written: the producer has to be flushed.
+  writer->NewTracePacket()->set_for_testing()->set_str("payload1");
+  flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // The chunk has been returned to the service: no more IPCs, and the
+  // packets written so far are in the buffer.
+  EXPECT_CALL(*producer, Flush(_, _, _)).Times(0);
+  flush_request = consumer->Flush();
+  ASSERT_TRUE(flush_request.WaitForReply());
+  Mock::VerifyAndClearExpectations(producer.get());
+
+  EXPECT_THAT(consumer->ReadBuffers(),
+              Contains(Property(&protos::gen::TracePacket::for_testing,
+                                Property(&protos::gen::TestEvent::str,
+                                         Eq("payload1")))));
+  EXPECT_EQ(tracing_session()->flush_ipcs_skipped, 2u);
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
 TEST_F(TracingServiceImplTest, ScrapeBuffersFromAnotherThread) {
   // This test verifies that there are no reported TSAN races while scraping
   // buffers from a producer which is actively writing more trace data
@@ -3414,6 +3719,71 @@ TEST_F(TracingServiceImplTest, ObserveAllDataSourceStartedNoAck) {
   }
 }
 
+// With |no_wait_for_start_acks| the TYPE_ALL_DATA_SOURCES_STARTED notification
+// is sent without waiting for the data sources to ack the start. The start
+// latency of each data source is reported when the ack comes.
+TEST_F(TracingServiceImplTest, ObserveAllDataSourceStartedNoWaitForAcks) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds1", /*ack_stop=*/false, /*ack_start=*/true);
+  producer->RegisterDataSource("ds2", /*ack_stop=*/false, /*ack_start=*/true);
+
+  TraceConfig trace_config;
+  trace_config.set_deferred_start(true);
+  trace_config.set_no_wait_for_start_acks(true);
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("ds1");
+  ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("ds2");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds1");
+  producer->WaitForDataSourceSetup("ds2");
+  task_runner.RunUntilIdle();
+
+  consumer->ObserveEvents(ObservableEvents::TYPE_ALL_DATA_SOURCES_STARTED);
+  consumer->StartTracing();
+  producer->WaitForDataSourceStart("ds1");
+  producer->WaitForDataSourceStart("ds2");
+
+  // Neither data source has acked yet.
+  auto events = consumer->WaitForObservableEvents();
+  EXPECT_TRUE(events.all_data_sources_started());
+
+  producer->endpoint()->NotifyDataSourceStarted(
+      producer->GetDataSourceInstanceId("ds1"));
+  producer->endpoint()->NotifyDataSourceStarted(
+      producer->GetDataSourceInstanceId("ds2"));
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("ds1");
+  producer->WaitForDataSourceStop("ds2");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  std::set<std::string> started_data_sources;
+  for (const auto& packet : packets) {
+    if (!packet.service_event().has_data_source_started())
+      continue;
+    const auto& started = packet.service_event().data_source_started();
+    EXPECT_EQ(started.producer_name(), "mock_producer");
+    EXPECT_GE(started.setup_to_started_ns(), started.start_to_started_ns());
+    started_data_sources.insert(started.data_source_name());
+  }
+  EXPECT_THAT(started_data_sources, ElementsAreArray({"ds1", "ds2"}));
+  EXPECT_THAT(
+      packets,
+      Contains(Property(
+          &protos::gen::TracePacket::service_event,
+          Property(&protos::gen::TracingServiceEvent::all_data_sources_started,
+                   Eq(true)))));
+}
+
 TEST_F(TracingServiceImplTest, LifecycleEventSmoke) {
   using TracingServiceEvent = protos::gen::TracingServiceEvent;
   using TracingServiceEventFnPtr = bool (TracingServiceEvent::*)() const;
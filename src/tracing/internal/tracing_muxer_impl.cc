@@ -1170,6 +1170,9 @@ void TracingMuxerImpl::UpdateDataSourcesOnAllBackends() {
       rds.descriptor.set_will_notify_on_start(true);
       rds.descriptor.set_will_notify_on_stop(true);
       rds.descriptor.set_handles_incremental_state_clear(true);
+      // Flush is not plumbed to the data sources (see ProducerImpl::Flush()),
+      // their data can be collected by scraping the SMB.
+      rds.descriptor.set_no_flush(true);
       backend.producer->service_->RegisterDataSource(rds.descriptor);
       backend.producer->registered_data_sources_.set(rds.static_state->index);
     }
@@ -53,7 +53,8 @@ class MockProducer : public Producer {
   void RegisterDataSource(const std::string& name,
                           bool ack_stop = false,
                           bool ack_start = false,
-                          bool handle_incremental_state_clear = false);
+                          bool handle_incremental_state_clear = false,
+                          bool no_flush = false);
   void UnregisterDataSource(const std::string& name);
   void RegisterTraceWriter(uint32_t writer_id, uint32_t target_buffer);
   void UnregisterTraceWriter(uint32_t writer_id);
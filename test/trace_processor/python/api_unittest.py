@@ -13,6 +13,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import struct
 import unittest
 
 from trace_processor.api import TraceProcessor, TraceProcessorException
@@ -290,3 +291,102 @@ class TestQueryResultIterator(unittest.TestCase):
     # so we should raise a TraceProcessorException.
     with self.assertRaises(TraceProcessorException):
       qr_df = qr_iterator.as_pandas_dataframe()
+
+
+class TestQueryResultColumns(unittest.TestCase):
+  Column = ProtoFactory().ColumnsBatchColumn
+
+  def test_typed_columns(self):
+    batch = ProtoFactory().ColumnsBatch()
+    batch.row_count = 3
+    batch.is_last_batch = True
+
+    longs = batch.columns.add()
+    longs.type = TestQueryResultColumns.Column.TYPE_LONG
+    longs.long_values = struct.pack('<3q', 1, 0, -3)
+    longs.nulls = bytes([0, 1, 0])
+
+    doubles = batch.columns.add()
+    doubles.type = TestQueryResultColumns.Column.TYPE_DOUBLE
+    doubles.double_values = struct.pack('<3d', 1.5, 2.5, 3.5)
+
+    strings = batch.columns.add()
+    strings.type = TestQueryResultColumns.Column.TYPE_STRING
+    strings.string_values = b'foo\0\0'
+    strings.nulls = bytes([0, 0, 1])
+
+    blobs = batch.columns.add()
+    blobs.type = TestQueryResultColumns.Column.TYPE_BLOB
+    blobs.blob_values.extend([b'a\0', b'', b'c'])
+
+    qr_df = TraceProcessor.QueryResultColumns(
+        ['foo_long', 'foo_double', 'foo_str', 'foo_blob'],
+        [batch]).as_pandas_dataframe()
+
+    self.assertEqual(list(qr_df['foo_long'].isna()), [False, True, False])
+    self.assertEqual(qr_df['foo_long'][0], 1)
+    self.assertEqual(qr_df['foo_long'][2], -3)
+    self.assertEqual(list(qr_df['foo_double']), [1.5, 2.5, 3.5])
+    self.assertEqual(list(qr_df['foo_str'][:2]), ['foo', ''])
+    self.assertTrue(qr_df['foo_str'].isna()[2])
+    self.assertEqual(list(qr_df['foo_blob']), [b'a\0', b'', b'c'])
+
+  def test_mixed_column(self):
+    batch = ProtoFactory().ColumnsBatch()
+    batch.row_count = 4
+    batch.is_last_batch = True
+
+    mixed = batch.columns.add()
+    mixed.type = TestQueryResultColumns.Column.TYPE_MIXED
+    mixed.cell_types = bytes([
+        TestQueryResultIterator.CELL_VARINT,
+        TestQueryResultIterator.CELL_STRING,
+        ProtoFactory().CellsBatch().CELL_NULL,
+        ProtoFactory().CellsBatch().CELL_FLOAT64
+    ])
+    mixed.nulls = bytes([0, 0, 1, 0])
+    mixed.long_values = struct.pack('<4q', 42, 0, 0, 0)
+    mixed.double_values = struct.pack('<4d', 0, 0, 0, 0.5)
+    mixed.string_values = b'bar\0'
+
+    qr_df = TraceProcessor.QueryResultColumns(['foo'],
+                                              [batch]).as_pandas_dataframe()
+    self.assertEqual(qr_df['foo'][0], 42)
+    self.assertEqual(qr_df['foo'][1], 'bar')
+    self.assertTrue(qr_df['foo'].isna()[2])
+    self.assertEqual(qr_df['foo'][3], 0.5)
+
+  def test_many_batches(self):
+    batches = []
+    for values in [[100, 200], [300]]:
+      batch = ProtoFactory().ColumnsBatch()
+      batch.row_count = len(values)
+      column = batch.columns.add()
+      column.type = TestQueryResultColumns.Column.TYPE_LONG
+      column.long_values = struct.pack('<%dq' % len(values), *values)
+      batches.append(batch)
+    batches[-1].is_last_batch = True
+
+    qr_df = TraceProcessor.QueryResultColumns(['foo_num'],
+                                              batches).as_pandas_dataframe()
+    self.assertEqual(list(qr_df['foo_num']), [100, 200, 300])
+
+  def test_empty_result(self):
+    batch = ProtoFactory().ColumnsBatch()
+    batch.is_last_batch = True
+    batch.columns.add().type = TestQueryResultColumns.Column.TYPE_NULL
+
+    qr_df = TraceProcessor.QueryResultColumns(['foo'],
+                                              [batch]).as_pandas_dataframe()
+    self.assertEqual(list(qr_df.columns), ['foo'])
+    self.assertEqual(len(qr_df), 0)
+
+  def test_incorrect_columns_batch(self):
+    batch = ProtoFactory().ColumnsBatch()
+    batch.row_count = 1
+    batch.is_last_batch = True
+    batch.columns.add().type = TestQueryResultColumns.Column.TYPE_NULL
+
+    with self.assertRaises(TraceProcessorException):
+      TraceProcessor.QueryResultColumns(['foo', 'bar'],
+                                        [batch]).as_pandas_dataframe()
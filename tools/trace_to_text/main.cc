@@ -48,6 +48,9 @@ int Usage(const char* argv0) {
           "options:\n"
           "  [--truncate start|end]\n"
           "  [--full-sort]\n"
+          "\"systrace\" and \"ctrace\" mode options:\n"
+          "  [--streaming] convert ftrace events without loading the whole "
+          "trace in memory\n"
           "\"profile\" mode options:\n"
           "  [--perf] generate a perf profile instead of a heap profile\n"
           "  [--no-annotations] do not suffix frame names with derived "
@@ -75,6 +78,7 @@ int Main(int argc, char** argv) {
   uint64_t pid = 0;
   std::vector<uint64_t> timestamps;
   bool full_sort = false;
+  bool streaming = false;
   bool perf_profile = false;
   bool profile_no_annotations = false;
   for (int i = 1; i < argc; i++) {
@@ -109,6 +113,8 @@ int Main(int argc, char** argv) {
       profile_no_annotations = true;
     } else if (strcmp(argv[i], "--full-sort") == 0) {
       full_sort = true;
+    } else if (strcmp(argv[i], "--streaming") == 0) {
+      streaming = true;
     } else {
       positional_args.push_back(argv[i]);
     }
@@ -163,10 +169,25 @@ int Main(int argc, char** argv) {
     return 1;
   }
 
+  if (streaming && format != "systrace" && format != "ctrace") {
+    PERFETTO_ELOG("--streaming requires systrace or ctrace format.");
+    return 1;
+  }
+  if (streaming && full_sort) {
+    PERFETTO_ELOG("--streaming is incompatible with --full-sort.");
+    return 1;
+  }
+
   if (format == "json")
     return TraceToJson(input_stream, output_stream, /*compress=*/false,
                        truncate_keep, full_sort);
 
+  if (streaming) {
+    return TraceToSystraceStreaming(input_stream, output_stream,
+                                    /*ctrace=*/format == "ctrace",
+                                    truncate_keep);
+  }
+
   if (format == "systrace")
     return TraceToSystrace(input_stream, output_stream, /*ctrace=*/false,
                            truncate_keep, full_sort);
@@ -25,8 +25,11 @@
 #include <inttypes.h>
 
 #include <algorithm>
+#include <deque>
+#include <functional>
 #include <map>
-#include <set>
+#include <memory>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -54,10 +57,13 @@
 //
 // To build one or more profiles, first the callstack information is queried
 // from the SQL tables, and converted into an in-memory representation by
-// |PreprocessLocations|. Then an instance of |GProfileBuilder| is used to
-// accumulate samples for that profile, and emit all additional information as a
+// |PreprocessLocations| and |PreprocessMappings|. Then the samples of each
+// profile are queried and handed to a |ProfileBuildQueue|, which builds the
+// profiles on worker threads: an instance of |GProfileBuilder| accumulates
+// the samples for one profile, and emits all additional information as a
 // serialized proto. Only the entities referenced by that particular
-// |GProfileBuilder| instance are emitted.
+// |GProfileBuilder| instance are emitted. Trace processor is only ever queried
+// from the calling thread; the workers only read the preprocessed data.
 //
 // See protos/third_party/pprof/profile.proto for the meaning of terms like
 // function/location/line.
@@ -195,69 +201,107 @@ base::Optional<int64_t> GetStatsEntry(
   return base::make_optional(it.Get(0).AsLong());
 }
 
+// Deduplicates values by content. The values are stored in a vector indexed
+// by their id, and the ids are found through an open addressing hash table,
+// which avoids a heap allocation per value.
+template <typename T>
+class FlatInterner {
+ public:
+  int64_t Intern(T value) {
+    if ((values_.size() + 1) * 2 > slots_.size())
+      Grow();
+    size_t hash = std::hash<T>()(value);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      int64_t id = slots_[i];
+      if (id == kEmptySlot) {
+        id = static_cast<int64_t>(values_.size());
+        slots_[i] = id;
+        values_.emplace_back(std::move(value));
+        hashes_.push_back(hash);
+        return id;
+      }
+      if (values_[static_cast<size_t>(id)] == value)
+        return id;
+    }
+  }
+
+  const std::vector<T>& values() const { return values_; }
+
+ private:
+  static constexpr int64_t kEmptySlot = -1;
+
+  void Grow() {
+    slots_.assign(std::max<size_t>(16, slots_.size() * 2), kEmptySlot);
+    size_t mask = slots_.size() - 1;
+    for (size_t id = 0; id < values_.size(); ++id) {
+      size_t i = hashes_[id] & mask;
+      while (slots_[i] != kEmptySlot)
+        i = (i + 1) & mask;
+      slots_[i] = static_cast<int64_t>(id);
+    }
+  }
+
+  std::vector<T> values_;
+  std::vector<size_t> hashes_;  // Indexed by id, to rehash without |values_|.
+  std::vector<int64_t> slots_;  // Power of two size.
+};
+
 // Interns Locations, Lines, and Functions. Interning is done by the entity's
 // contents, and has no relation to the row ids in the SQL tables.
 // Contains all data for the trace, so can be reused when emitting multiple
+// profiles. Read-only once built, so can be shared by the threads building the
 // profiles.
-//
-// TODO(rsavitski): consider moving mappings into here as well. For now, they're
-// still emitted in a single scan during profile building. Mappings should be
-// unique-enough already in the SQL tables, with only incremental state clearing
-// duplicating entries.
 class LocationTracker {
  public:
   int64_t InternLocation(Location loc) {
-    auto it = locations_.find(loc);
-    if (it == locations_.end()) {
-      bool inserted = false;
-      std::tie(it, inserted) = locations_.emplace(
-          std::move(loc), static_cast<int64_t>(locations_.size()));
-      PERFETTO_DCHECK(inserted);
-    }
-    return it->second;
+    return locations_.Intern(std::move(loc));
   }
 
   int64_t InternFunction(Function func) {
-    auto it = functions_.find(func);
-    if (it == functions_.end()) {
-      bool inserted = false;
-      std::tie(it, inserted) =
-          functions_.emplace(func, static_cast<int64_t>(functions_.size()));
-      PERFETTO_DCHECK(inserted);
-    }
-    return it->second;
+    return functions_.Intern(std::move(func));
   }
 
+  void SetMaxCallsiteId(int64_t max_callstack_id) {
+    callsite_to_locations_.resize(static_cast<size_t>(max_callstack_id) + 1);
+  }
+
+  // A processed callsite has at least one location: its own frame.
   bool IsCallsiteProcessed(int64_t callstack_id) const {
-    return callsite_to_locations_.find(callstack_id) !=
-           callsite_to_locations_.end();
+    return !LocationsForCallstack(callstack_id).empty();
   }
 
   void MaybeSetCallsiteLocations(int64_t callstack_id,
                                  const std::vector<int64_t>& locs) {
+    std::vector<int64_t>* cs_locs =
+        &callsite_to_locations_[static_cast<size_t>(callstack_id)];
     // nop if already set
-    callsite_to_locations_.emplace(callstack_id, locs);
+    if (cs_locs->empty())
+      *cs_locs = locs;
   }
 
   const std::vector<int64_t>& LocationsForCallstack(
       int64_t callstack_id) const {
-    auto it = callsite_to_locations_.find(callstack_id);
-    PERFETTO_CHECK(callstack_id >= 0 && it != callsite_to_locations_.end());
-    return it->second;
+    PERFETTO_CHECK(callstack_id >= 0 &&
+                   static_cast<size_t>(callstack_id) <
+                       callsite_to_locations_.size());
+    return callsite_to_locations_[static_cast<size_t>(callstack_id)];
   }
 
-  const std::unordered_map<Location, int64_t>& AllLocations() const {
-    return locations_;
+  // Indexed by interned Location id.
+  const std::vector<Location>& AllLocations() const {
+    return locations_.values();
   }
-  const std::unordered_map<Function, int64_t>& AllFunctions() const {
-    return functions_;
+  // Indexed by interned Function id.
+  const std::vector<Function>& AllFunctions() const {
+    return functions_.values();
   }
 
  private:
-  // Root-first location ids for a given callsite id.
-  std::unordered_map<int64_t, std::vector<int64_t>> callsite_to_locations_;
-  std::unordered_map<Location, int64_t> locations_;
-  std::unordered_map<Function, int64_t> functions_;
+  // Root-first location ids, indexed by callsite id.
+  std::vector<std::vector<int64_t>> callsite_to_locations_;
+  FlatInterner<Location> locations_;
+  FlatInterner<Function> functions_;
 };
 
 struct PreprocessedInline {
@@ -330,8 +374,13 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
   // for all parent callsites.
   Iterator cid_it = tp->ExecuteQuery(
       "select id from stack_profile_callsite order by id desc;");
+  bool first_cid = true;
   while (cid_it.Next()) {
     int64_t query_cid = cid_it.Get(0).AsLong();
+    if (first_cid) {
+      tracker.SetMaxCallsiteId(query_cid);
+      first_cid = false;
+    }
 
     // If the leaf has been processed, the rest of the stack is already known.
     if (tracker.IsCallsiteProcessed(query_cid))
@@ -421,26 +470,77 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
   return tracker;
 }
 
-// Builds the |perftools.profiles.Profile| proto.
+// In-memory representation of a Profile.Mapping.
+struct Mapping {
+  bool valid = false;
+  uint64_t file_offset = 0;
+  uint64_t memory_start = 0;
+  uint64_t memory_limit = 0;
+  StringId filename_id = StringId::Null();
+};
+
+// Returns the mappings indexed by their sqlite row id.
+std::vector<Mapping> PreprocessMappings(trace_processor::TraceProcessor* tp,
+                                        trace_processor::StringPool* interner) {
+  std::vector<Mapping> mappings;
+  Iterator mapping_it = tp->ExecuteQuery(
+      "SELECT id, exact_offset, start, end, name "
+      "FROM stack_profile_mapping;");
+  while (mapping_it.Next()) {
+    auto id = static_cast<size_t>(mapping_it.Get(0).AsLong());
+    if (id >= mappings.size())
+      mappings.resize(id + 1);
+    Mapping& mapping = mappings[id];
+    mapping.valid = true;
+    mapping.file_offset = static_cast<uint64_t>(mapping_it.Get(1).AsLong());
+    mapping.memory_start = static_cast<uint64_t>(mapping_it.Get(2).AsLong());
+    mapping.memory_limit = static_cast<uint64_t>(mapping_it.Get(3).AsLong());
+    mapping.filename_id = interner->InternString(mapping_it.Get(4).AsString());
+  }
+  if (!mapping_it.Status().ok()) {
+    PERFETTO_DFATAL_OR_ELOG("Invalid mapping iterator: %s",
+                            mapping_it.Status().message().c_str());
+    return {};
+  }
+  return mappings;
+}
+
+using SampleTypes = std::vector<std::pair<StringId, StringId>>;
+
+SampleTypes InternSampleTypes(
+    const std::vector<std::pair<std::string, std::string>>& sample_types,
+    trace_processor::StringPool* interner) {
+  SampleTypes interned;
+  for (const auto& st : sample_types) {
+    interned.emplace_back(interner->InternString(base::StringView(st.first)),
+                          interner->InternString(base::StringView(st.second)));
+  }
+  return interned;
+}
+
+// Builds the |perftools.profiles.Profile| proto. Only reads the shared
+// preprocessed data, so instances for different profiles can run on different
+// threads.
 class GProfileBuilder {
  public:
   GProfileBuilder(const LocationTracker& locations,
-                  trace_processor::StringPool* interner)
-      : locations_(locations), interner_(interner) {
+                  const std::vector<Mapping>& mappings,
+                  const trace_processor::StringPool& interner)
+      : locations_(locations),
+        mappings_(mappings),
+        interner_(interner),
+        seen_locations_(locations.AllLocations().size()) {
     // The pprof format requires the first entry in the string table to be the
     // empty string.
     int64_t empty_id = ToStringTableId(StringId::Null());
     PERFETTO_CHECK(empty_id == 0);
   }
 
-  void WriteSampleTypes(
-      const std::vector<std::pair<std::string, std::string>>& sample_types) {
+  void WriteSampleTypes(const SampleTypes& sample_types) {
     for (const auto& st : sample_types) {
       auto* sample_type = result_->add_sample_type();
-      sample_type->set_type(
-          ToStringTableId(interner_->InternString(base::StringView(st.first))));
-      sample_type->set_unit(ToStringTableId(
-          interner_->InternString(base::StringView(st.second))));
+      sample_type->set_type(ToStringTableId(st.first));
+      sample_type->set_unit(ToStringTableId(st.second));
     }
   }
 
@@ -463,20 +563,19 @@ class GProfileBuilder {
     gsample->set_location_id(packed_locs);
 
     // Remember the locations s.t. we only serialize the referenced ones.
-    seen_locations_.insert(location_ids.cbegin(), location_ids.cend());
+    for (int64_t id : location_ids)
+      seen_locations_[static_cast<size_t>(id)] = true;
     return true;
   }
 
-  std::string CompleteProfile(trace_processor::TraceProcessor* tp) {
-    std::set<int64_t> seen_mappings;
-    std::set<int64_t> seen_functions;
+  std::string CompleteProfile() {
+    std::vector<bool> seen_mappings(mappings_.size());
+    std::vector<bool> seen_functions(locations_.AllFunctions().size());
 
     if (!WriteLocations(&seen_mappings, &seen_functions))
       return {};
-    if (!WriteFunctions(seen_functions))
-      return {};
-    if (!WriteMappings(tp, seen_mappings))
-      return {};
+    WriteFunctions(seen_functions);
+    WriteMappings(seen_mappings);
 
     WriteStringTable();
     return result_.SerializeAsString();
@@ -484,124 +583,83 @@ class GProfileBuilder {
 
  private:
   // Serializes the Profile.Location entries referenced by this profile.
-  bool WriteLocations(std::set<int64_t>* seen_mappings,
-                      std::set<int64_t>* seen_functions) {
-    const std::unordered_map<Location, int64_t>& locations =
-        locations_.AllLocations();
+  bool WriteLocations(std::vector<bool>* seen_mappings,
+                      std::vector<bool>* seen_functions) {
+    const std::vector<Location>& locations = locations_.AllLocations();
 
-    size_t written_locations = 0;
-    for (const auto& loc_and_id : locations) {
-      const auto& loc = loc_and_id.first;
-      int64_t id = loc_and_id.second;
-
-      if (seen_locations_.find(id) == seen_locations_.end())
+    for (size_t id = 0; id < locations.size(); ++id) {
+      if (!seen_locations_[id])
         continue;
+      const Location& loc = locations[id];
 
-      written_locations += 1;
-      seen_mappings->emplace(loc.mapping_id);
+      if (loc.mapping_id < 0 ||
+          static_cast<size_t>(loc.mapping_id) >= mappings_.size() ||
+          !mappings_[static_cast<size_t>(loc.mapping_id)].valid) {
+        PERFETTO_DFATAL_OR_ELOG("Missing mappings.");
+        return false;
+      }
+      (*seen_mappings)[static_cast<size_t>(loc.mapping_id)] = true;
 
       auto* glocation = result_->add_location();
-      glocation->set_id(ToPprofId(id));
+      glocation->set_id(ToPprofId(static_cast<int64_t>(id)));
       glocation->set_mapping_id(ToPprofId(loc.mapping_id));
 
       if (!loc.inlined_functions.empty()) {
         for (const auto& line : loc.inlined_functions) {
-          seen_functions->insert(line.function_id);
+          (*seen_functions)[static_cast<size_t>(line.function_id)] = true;
 
           auto* gline = glocation->add_line();
           gline->set_function_id(ToPprofId(line.function_id));
           gline->set_line(line.line_no);
         }
       } else {
-        seen_functions->insert(loc.single_function_id);
+        (*seen_functions)[static_cast<size_t>(loc.single_function_id)] = true;
 
         glocation->add_line()->set_function_id(
             ToPprofId(loc.single_function_id));
       }
     }
-
-    if (written_locations != seen_locations_.size()) {
-      PERFETTO_DFATAL_OR_ELOG(
-          "Found only %zu/%zu locations during serialization.",
-          written_locations, seen_locations_.size());
-      return false;
-    }
     return true;
   }
 
   // Serializes the Profile.Function entries referenced by this profile.
-  bool WriteFunctions(const std::set<int64_t>& seen_functions) {
-    const std::unordered_map<Function, int64_t>& functions =
-        locations_.AllFunctions();
-
-    size_t written_functions = 0;
-    for (const auto& func_and_id : functions) {
-      const auto& func = func_and_id.first;
-      int64_t id = func_and_id.second;
+  void WriteFunctions(const std::vector<bool>& seen_functions) {
+    const std::vector<Function>& functions = locations_.AllFunctions();
 
-      if (seen_functions.find(id) == seen_functions.end())
+    for (size_t id = 0; id < functions.size(); ++id) {
+      if (!seen_functions[id])
         continue;
-
-      written_functions += 1;
+      const Function& func = functions[id];
 
       auto* gfunction = result_->add_function();
-      gfunction->set_id(ToPprofId(id));
+      gfunction->set_id(ToPprofId(static_cast<int64_t>(id)));
       gfunction->set_name(ToStringTableId(func.name_id));
       gfunction->set_system_name(ToStringTableId(func.system_name_id));
       if (!func.filename_id.is_null())
         gfunction->set_filename(ToStringTableId(func.filename_id));
     }
-
-    if (written_functions != seen_functions.size()) {
-      PERFETTO_DFATAL_OR_ELOG(
-          "Found only %zu/%zu functions during serialization.",
-          written_functions, seen_functions.size());
-      return false;
-    }
-    return true;
   }
 
   // Serializes the Profile.Mapping entries referenced by this profile.
-  bool WriteMappings(trace_processor::TraceProcessor* tp,
-                     const std::set<int64_t>& seen_mappings) {
-    Iterator mapping_it = tp->ExecuteQuery(
-        "SELECT id, exact_offset, start, end, name "
-        "FROM stack_profile_mapping;");
-    size_t mappings_no = 0;
-    while (mapping_it.Next()) {
-      int64_t id = mapping_it.Get(0).AsLong();
-      if (seen_mappings.find(id) == seen_mappings.end())
+  void WriteMappings(const std::vector<bool>& seen_mappings) {
+    for (size_t id = 0; id < mappings_.size(); ++id) {
+      if (!seen_mappings[id])
         continue;
-      ++mappings_no;
-      auto interned_filename = ToStringTableId(
-          interner_->InternString(mapping_it.Get(4).AsString()));
+      const Mapping& mapping = mappings_[id];
       auto* gmapping = result_->add_mapping();
-      gmapping->set_id(ToPprofId(id));
+      gmapping->set_id(ToPprofId(static_cast<int64_t>(id)));
       // Do not set the build_id here to avoid downstream services
       // trying to symbolize (e.g. b/141735056)
-      gmapping->set_file_offset(
-          static_cast<uint64_t>(mapping_it.Get(1).AsLong()));
-      gmapping->set_memory_start(
-          static_cast<uint64_t>(mapping_it.Get(2).AsLong()));
-      gmapping->set_memory_limit(
-          static_cast<uint64_t>(mapping_it.Get(3).AsLong()));
-      gmapping->set_filename(interned_filename);
-    }
-    if (!mapping_it.Status().ok()) {
-      PERFETTO_DFATAL_OR_ELOG("Invalid mapping iterator: %s",
-                              mapping_it.Status().message().c_str());
-      return false;
+      gmapping->set_file_offset(mapping.file_offset);
+      gmapping->set_memory_start(mapping.memory_start);
+      gmapping->set_memory_limit(mapping.memory_limit);
+      gmapping->set_filename(ToStringTableId(mapping.filename_id));
     }
-    if (mappings_no != seen_mappings.size()) {
-      PERFETTO_DFATAL_OR_ELOG("Missing mappings.");
-      return false;
-    }
-    return true;
   }
 
   void WriteStringTable() {
     for (StringId id : string_table_) {
-      trace_processor::NullTermStringView s = interner_->Get(id);
+      trace_processor::NullTermStringView s = interner_.Get(id);
       result_->add_string_table(s.data(), s.size());
     }
   }
@@ -622,9 +680,12 @@ class GProfileBuilder {
   // Contains all locations, lines, functions (in memory):
   const LocationTracker& locations_;
 
-  // String interner, strings referenced by LocationTracker are already
-  // interned. The new internings will come from mappings, and sample types.
-  trace_processor::StringPool* interner_;
+  // Indexed by sqlite row id.
+  const std::vector<Mapping>& mappings_;
+
+  // String interner, all strings referenced by the profile (including the
+  // sample types) are interned before the profile is built.
+  const trace_processor::StringPool& interner_;
 
   // The profile format uses the repeated string_table field's index as an
   // implicit id, so these structures remap the interned strings into sequential
@@ -637,8 +698,99 @@ class GProfileBuilder {
   protozero::HeapBuffered<third_party::perftools::profiles::pbzero::Profile>
       result_;
 
-  // Set of locations referenced by the added samples.
-  std::set<int64_t> seen_locations_;
+  // Locations referenced by the added samples, indexed by location id.
+  std::vector<bool> seen_locations_;
+};
+
+// The samples of one profile, queried from trace processor on the calling
+// thread.
+struct ProfileSamples {
+  SerializedProfile profile;
+  const SampleTypes* sample_types = nullptr;
+  std::vector<int64_t> callstack_ids;
+  // |sample_types->size()| values per callstack id.
+  std::vector<int64_t> values;
+  // If set, a sample with an unknown callstack results in an empty profile
+  // rather than being skipped.
+  bool discard_on_error = false;
+  // If unset, querying the samples failed and an empty profile is emitted.
+  bool read_ok = true;
+};
+
+// Builds the profiles on worker threads while the calling thread keeps
+// querying the samples of the next ones. Completed profiles are passed to
+// |on_profile| on the calling thread, in the order in which they were added.
+class ProfileBuildQueue {
+ public:
+  ProfileBuildQueue(const LocationTracker& locations,
+                    const std::vector<Mapping>& mappings,
+                    const trace_processor::StringPool& interner,
+                    const std::function<void(SerializedProfile)>& on_profile)
+      : locations_(locations),
+        mappings_(mappings),
+        interner_(interner),
+        on_profile_(on_profile),
+        max_jobs_(std::max(1u, std::thread::hardware_concurrency())) {}
+
+  ~ProfileBuildQueue() { Flush(); }
+
+  void Add(ProfileSamples samples) {
+    std::unique_ptr<Job> job(new Job());
+    job->samples = std::move(samples);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+    Build(job.get());
+    on_profile_(std::move(job->samples.profile));
+#else
+    if (jobs_.size() >= max_jobs_)
+      CompleteOldestJob();
+    job->thread = std::thread(&ProfileBuildQueue::Build, this, job.get());
+    jobs_.emplace_back(std::move(job));
+#endif
+  }
+
+  void Flush() {
+    while (!jobs_.empty())
+      CompleteOldestJob();
+  }
+
+ private:
+  struct Job {
+    ProfileSamples samples;
+    std::thread thread;
+  };
+
+  void Build(Job* job) const {
+    ProfileSamples& samples = job->samples;
+    if (!samples.read_ok)
+      return;
+    GProfileBuilder builder(locations_, mappings_, interner_);
+    builder.WriteSampleTypes(*samples.sample_types);
+    size_t values_per_sample = samples.sample_types->size();
+    for (size_t i = 0; i < samples.callstack_ids.size(); ++i) {
+      protozero::PackedVarInt sample_values;
+      for (size_t j = 0; j < values_per_sample; ++j)
+        sample_values.Append(samples.values[i * values_per_sample + j]);
+      if (!builder.AddSample(sample_values, samples.callstack_ids[i]) &&
+          samples.discard_on_error) {
+        return;
+      }
+    }
+    samples.profile.serialized = builder.CompleteProfile();
+  }
+
+  void CompleteOldestJob() {
+    std::unique_ptr<Job> job = std::move(jobs_.front());
+    jobs_.pop_front();
+    job->thread.join();
+    on_profile_(std::move(job->samples.profile));
+  }
+
+  const LocationTracker& locations_;
+  const std::vector<Mapping>& mappings_;
+  const trace_processor::StringPool& interner_;
+  const std::function<void(SerializedProfile)>& on_profile_;
+  const size_t max_jobs_;
+  std::deque<std::unique_ptr<Job>> jobs_;
 };
 
 namespace heap_profile {
@@ -718,8 +870,8 @@ static std::vector<Iterator> BuildViewIterators(
   return view_its;
 }
 
-static bool WriteAllocations(GProfileBuilder* builder,
-                             std::vector<Iterator>* view_its) {
+static bool ReadAllocations(std::vector<Iterator>* view_its,
+                            ProfileSamples* samples) {
   for (;;) {
     bool all_next = true;
     bool any_next = false;
@@ -740,7 +892,6 @@ static bool WriteAllocations(GProfileBuilder* builder,
       break;
     }
 
-    protozero::PackedVarInt sample_values;
     int64_t callstack_id = -1;
     for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
       if (i == 0) {
@@ -749,31 +900,39 @@ static bool WriteAllocations(GProfileBuilder* builder,
         PERFETTO_DFATAL_OR_ELOG("Wrong callstack.");
         return false;
       }
-      sample_values.Append((*view_its)[i].Get(1).AsLong());
+      samples->values.push_back((*view_its)[i].Get(1).AsLong());
     }
-
-    if (!builder->AddSample(sample_values, callstack_id))
-      return false;
+    samples->callstack_ids.push_back(callstack_id);
   }
   return true;
 }
 
-static bool TraceToHeapPprof(trace_processor::TraceProcessor* tp,
-                             std::vector<SerializedProfile>* output,
-                             bool annotate_frames,
-                             uint64_t target_pid,
-                             const std::vector<uint64_t>& target_timestamps) {
+static bool TraceToHeapPprof(
+    trace_processor::TraceProcessor* tp,
+    const std::function<void(SerializedProfile)>& on_profile,
+    bool annotate_frames,
+    uint64_t target_pid,
+    const std::vector<uint64_t>& target_timestamps) {
   trace_processor::StringPool interner;
   LocationTracker locations =
       PreprocessLocations(tp, &interner, annotate_frames);
+  std::vector<Mapping> mappings = PreprocessMappings(tp, &interner);
+
+  std::vector<std::pair<std::string, std::string>> sample_types;
+  for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
+    sample_types.emplace_back(std::string(kViews[i].type),
+                              std::string(kViews[i].unit));
+  }
+  SampleTypes interned_sample_types =
+      InternSampleTypes(sample_types, &interner);
 
+  ProfileBuildQueue queue(locations, mappings, interner, on_profile);
   bool any_fail = false;
   Iterator it = tp->ExecuteQuery(
       "select distinct hpa.upid, hpa.ts, p.pid, hpa.heap_name "
       "from heap_profile_allocation hpa, "
       "process p where p.upid = hpa.upid;");
   while (it.Next()) {
-    GProfileBuilder builder(locations, &interner);
     uint64_t upid = static_cast<uint64_t>(it.Get(0).AsLong());
     uint64_t ts = static_cast<uint64_t>(it.Get(1).AsLong());
     uint64_t profile_pid = static_cast<uint64_t>(it.Get(2).AsLong());
@@ -788,23 +947,18 @@ static bool TraceToHeapPprof(trace_processor::TraceProcessor* tp,
     if (!VerifyPIDStats(tp, profile_pid))
       any_fail = true;
 
-    std::vector<std::pair<std::string, std::string>> sample_types;
-    for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
-      sample_types.emplace_back(std::string(kViews[i].type),
-                                std::string(kViews[i].unit));
-    }
-    builder.WriteSampleTypes(sample_types);
+    ProfileSamples samples;
+    samples.profile = SerializedProfile{ProfileType::kHeapProfile,
+                                        profile_pid, "", heap_name};
+    samples.sample_types = &interned_sample_types;
+    samples.discard_on_error = true;
 
     std::vector<Iterator> view_its =
         BuildViewIterators(tp, upid, ts, heap_name);
-    std::string profile_proto;
-    if (WriteAllocations(&builder, &view_its)) {
-      profile_proto = builder.CompleteProfile(tp);
-    }
-    output->emplace_back(
-        SerializedProfile{ProfileType::kHeapProfile, profile_pid,
-                          std::move(profile_proto), heap_name});
+    samples.read_ok = ReadAllocations(&view_its, &samples);
+    queue.Add(std::move(samples));
   }
+  queue.Flush();
 
   if (!it.Status().ok()) {
     PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
@@ -899,17 +1053,22 @@ static void LogTracePerfEventIssues(trace_processor::TraceProcessor* tp) {
 // empty profile (and/or whether they should make the overall conversion
 // unsuccessful). Furthermore, clarify the return value's semantics for both
 // perf and heap profiles.
-static bool TraceToPerfPprof(trace_processor::TraceProcessor* tp,
-                             std::vector<SerializedProfile>* output,
-                             bool annotate_frames,
-                             uint64_t target_pid) {
+static bool TraceToPerfPprof(
+    trace_processor::TraceProcessor* tp,
+    const std::function<void(SerializedProfile)>& on_profile,
+    bool annotate_frames,
+    uint64_t target_pid) {
   trace_processor::StringPool interner;
   LocationTracker locations =
       PreprocessLocations(tp, &interner, annotate_frames);
+  std::vector<Mapping> mappings = PreprocessMappings(tp, &interner);
+  SampleTypes sample_types =
+      InternSampleTypes({{"samples", "count"}}, &interner);
 
   LogTracePerfEventIssues(tp);
 
   // Aggregate samples by upid when building profiles.
+  ProfileBuildQueue queue(locations, mappings, interner, on_profile);
   std::map<uint64_t, ProcessInfo> process_map = GetProcessMap(tp);
   for (const auto& p : process_map) {
     const ProcessInfo& process = p.second;
@@ -917,30 +1076,26 @@ static bool TraceToPerfPprof(trace_processor::TraceProcessor* tp,
     if (target_pid != 0 && process.pid != target_pid)
       continue;
 
-    GProfileBuilder builder(locations, &interner);
-    builder.WriteSampleTypes({{"samples", "count"}});
+    ProfileSamples samples;
+    samples.profile =
+        SerializedProfile{ProfileType::kPerfProfile, process.pid, "", ""};
+    samples.sample_types = &sample_types;
 
     std::string query = "select callsite_id from perf_sample where utid in (" +
                         AsCsvString(process.utids) +
                         ") and callsite_id is not null order by ts asc;";
 
-    protozero::PackedVarInt single_count_value;
-    single_count_value.Append(1);
-
     Iterator it = tp->ExecuteQuery(query);
     while (it.Next()) {
-      int64_t callsite_id = static_cast<int64_t>(it.Get(0).AsLong());
-      builder.AddSample(single_count_value, callsite_id);
+      samples.callstack_ids.push_back(static_cast<int64_t>(it.Get(0).AsLong()));
+      samples.values.push_back(1);
     }
     if (!it.Status().ok()) {
       PERFETTO_DFATAL_OR_ELOG("Failed to iterate over samples: %s",
                               it.Status().c_message());
       return false;
     }
-
-    std::string profile_proto = builder.CompleteProfile(tp);
-    output->emplace_back(SerializedProfile{
-        ProfileType::kPerfProfile, process.pid, std::move(profile_proto), ""});
+    queue.Add(std::move(samples));
   }
   return true;
 }
@@ -953,14 +1108,29 @@ bool TraceToPprof(trace_processor::TraceProcessor* tp,
                   uint64_t flags,
                   uint64_t pid,
                   const std::vector<uint64_t>& timestamps) {
+  return TraceToPprof(
+      tp,
+      [output](SerializedProfile profile) {
+        output->emplace_back(std::move(profile));
+      },
+      mode, flags, pid, timestamps);
+}
+
+bool TraceToPprof(trace_processor::TraceProcessor* tp,
+                  const std::function<void(SerializedProfile)>& on_profile,
+                  ConversionMode mode,
+                  uint64_t flags,
+                  uint64_t pid,
+                  const std::vector<uint64_t>& timestamps) {
   bool annotate_frames =
       flags & static_cast<uint64_t>(ConversionFlags::kAnnotateFrames);
   switch (mode) {
     case (ConversionMode::kHeapProfile):
-      return heap_profile::TraceToHeapPprof(tp, output, annotate_frames, pid,
-                                            timestamps);
+      return heap_profile::TraceToHeapPprof(tp, on_profile, annotate_frames,
+                                            pid, timestamps);
     case (ConversionMode::kPerfProfile):
-      return perf_profile::TraceToPerfPprof(tp, output, annotate_frames, pid);
+      return perf_profile::TraceToPerfPprof(tp, on_profile, annotate_frames,
+                                            pid);
   }
   PERFETTO_FATAL("unknown conversion option");  // for gcc
 }
@@ -16,9 +16,32 @@
 
 #include "tools/trace_to_text/proto_full_utils.h"
 
+#include <set>
+
+#include <google/protobuf/descriptor.pb.h>
+
+#include "src/trace_processor/util/descriptors.h"
+
 namespace perfetto {
 namespace trace_to_text {
 
+namespace {
+
+using google::protobuf::FileDescriptor;
+using google::protobuf::FileDescriptorSet;
+
+void AddToFileDescriptorSet(const FileDescriptor* file,
+                            std::set<const FileDescriptor*>* seen,
+                            FileDescriptorSet* file_set) {
+  if (!seen->insert(file).second)
+    return;
+  for (int i = 0; i < file->dependency_count(); ++i)
+    AddToFileDescriptorSet(file->dependency(i), seen, file_set);
+  file->CopyTo(file_set->add_file());
+}
+
+}  // namespace
+
 MultiFileErrorCollectorImpl::~MultiFileErrorCollectorImpl() = default;
 
 void MultiFileErrorCollectorImpl::AddError(const std::string& filename,
@@ -37,5 +60,15 @@ void MultiFileErrorCollectorImpl::AddWarning(const std::string& filename,
                 message.c_str());
 }
 
+base::Status AddToDescriptorPool(const FileDescriptor* file,
+                                 trace_processor::DescriptorPool* pool) {
+  FileDescriptorSet file_set;
+  std::set<const FileDescriptor*> seen;
+  AddToFileDescriptorSet(file, &seen, &file_set);
+  std::string serialized = file_set.SerializeAsString();
+  return pool->AddFromFileDescriptorSet(
+      reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size());
+}
+
 }  // namespace trace_to_text
 }  // namespace perfetto
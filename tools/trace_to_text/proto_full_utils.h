@@ -24,6 +24,13 @@
 #include <string>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+
+namespace perfetto {
+namespace trace_processor {
+class DescriptorPool;
+}  // namespace trace_processor
+}  // namespace perfetto
 
 namespace perfetto {
 namespace trace_to_text {
@@ -43,6 +50,12 @@ class MultiFileErrorCollectorImpl
                   const std::string& message) override;
 };
 
+// Adds the messages and enums of |file| and of all the files it imports to
+// |pool|, so that messages can be decoded with protozero rather than with
+// libprotobuf reflection.
+base::Status AddToDescriptorPool(const google::protobuf::FileDescriptor* file,
+                                 trace_processor::DescriptorPool* pool);
+
 }  // namespace trace_to_text
 }  // namespace perfetto
 
@@ -0,0 +1,610 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tools/trace_to_text/proto_text_printer.h"
+
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "protos/perfetto/common/descriptor.pbzero.h"
+
+namespace perfetto {
+namespace trace_to_text {
+
+namespace {
+
+using protos::pbzero::FieldDescriptorProto;
+using protozero::proto_utils::ProtoWireType;
+
+// Fields with a number above this are looked up in a hash map rather than in
+// a vector indexed by field number.
+constexpr uint32_t kMaxDenseFieldId = 4096;
+
+void AppendIndent(uint32_t indent, std::string* out) {
+  out->append(indent * 2, ' ');
+}
+
+void AppendUnsigned(uint64_t value, std::string* out) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* pos = end;
+  do {
+    *--pos = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  out->append(pos, static_cast<size_t>(end - pos));
+}
+
+void AppendSigned(int64_t value, std::string* out) {
+  if (value < 0) {
+    out->push_back('-');
+    // Negate as unsigned to avoid overflowing on INT64_MIN.
+    AppendUnsigned(~static_cast<uint64_t>(value) + 1, out);
+    return;
+  }
+  AppendUnsigned(static_cast<uint64_t>(value), out);
+}
+
+void AppendHex(uint64_t value, int width, std::string* out) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "0x%0*" PRIx64, width, value);
+  out->append(buf, static_cast<size_t>(len));
+}
+
+// Formats floating point numbers like SimpleDtoa() and SimpleFtoa() of
+// libprotobuf: the shortest of two precisions that round trips.
+void AppendDouble(double value, std::string* out) {
+  if (isinf(value)) {
+    out->append(value > 0 ? "inf" : "-inf");
+    return;
+  }
+  if (isnan(value)) {
+    out->append("nan");
+    return;
+  }
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.*g", DBL_DIG, value);
+  if (strtod(buf, nullptr) != value)
+    len = snprintf(buf, sizeof(buf), "%.*g", DBL_DIG + 2, value);
+  out->append(buf, static_cast<size_t>(len));
+}
+
+void AppendFloat(float value, std::string* out) {
+  if (isinf(value)) {
+    out->append(value > 0 ? "inf" : "-inf");
+    return;
+  }
+  if (isnan(value)) {
+    out->append("nan");
+    return;
+  }
+  char buf[32];
+  int len =
+      snprintf(buf, sizeof(buf), "%.*g", FLT_DIG, static_cast<double>(value));
+  if (strtof(buf, nullptr) != value) {
+    len = snprintf(buf, sizeof(buf), "%.*g", FLT_DIG + 3,
+                   static_cast<double>(value));
+  }
+  out->append(buf, static_cast<size_t>(len));
+}
+
+// Appends |data| quoted and escaped like CEscape() of libprotobuf.
+void AppendEscaped(const uint8_t* data, size_t size, std::string* out) {
+  out->push_back('"');
+  for (size_t i = 0; i < size; ++i) {
+    uint8_t c = data[i];
+    switch (c) {
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      case '\"':
+        out->append("\\\"");
+        break;
+      case '\'':
+        out->append("\\\'");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      default:
+        if (c < 0x20 || c >= 0x7f) {
+          char oct[4] = {'\\', static_cast<char>('0' + (c >> 6)),
+                         static_cast<char>('0' + ((c >> 3) & 7)),
+                         static_cast<char>('0' + (c & 7))};
+          out->append(oct, sizeof(oct));
+        } else {
+          out->push_back(static_cast<char>(c));
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+ProtoWireType WireTypeForFieldType(uint32_t type) {
+  switch (type) {
+    case FieldDescriptorProto::TYPE_DOUBLE:
+    case FieldDescriptorProto::TYPE_FIXED64:
+    case FieldDescriptorProto::TYPE_SFIXED64:
+      return ProtoWireType::kFixed64;
+    case FieldDescriptorProto::TYPE_FLOAT:
+    case FieldDescriptorProto::TYPE_FIXED32:
+    case FieldDescriptorProto::TYPE_SFIXED32:
+      return ProtoWireType::kFixed32;
+    case FieldDescriptorProto::TYPE_STRING:
+    case FieldDescriptorProto::TYPE_BYTES:
+    case FieldDescriptorProto::TYPE_MESSAGE:
+      return ProtoWireType::kLengthDelimited;
+    default:
+      return ProtoWireType::kVarInt;
+  }
+}
+
+void PrintUnknownVarInt(uint32_t field_id,
+                        uint64_t value,
+                        uint32_t indent,
+                        std::string* out) {
+  AppendIndent(indent, out);
+  AppendUnsigned(field_id, out);
+  out->append(": ");
+  AppendUnsigned(value, out);
+  out->push_back('\n');
+}
+
+// Prints the fields of a message without a descriptor, as TextFormat does
+// for unknown fields.
+bool PrintUnknownFields(protozero::ConstBytes msg,
+                        uint32_t indent,
+                        std::string* out);
+
+void PrintUnknownField(const protozero::Field& field,
+                       uint32_t indent,
+                       std::string* out) {
+  if (field.type() == ProtoWireType::kVarInt) {
+    PrintUnknownVarInt(field.id(), field.as_uint64(), indent, out);
+    return;
+  }
+  AppendIndent(indent, out);
+  AppendUnsigned(field.id(), out);
+  switch (field.type()) {
+    case ProtoWireType::kVarInt:
+      break;
+    case ProtoWireType::kFixed32:
+      out->append(": ");
+      AppendHex(field.as_uint32(), 8, out);
+      break;
+    case ProtoWireType::kFixed64:
+      out->append(": ");
+      AppendHex(field.as_uint64(), 16, out);
+      break;
+    case ProtoWireType::kLengthDelimited: {
+      // Like TextFormat, print the payload as a message if it parses as one
+      // and as a string otherwise.
+      size_t rollback_size = out->size();
+      if (field.size() > 0) {
+        out->append(" {\n");
+        if (PrintUnknownFields(field.as_bytes(), indent + 1, out)) {
+          AppendIndent(indent, out);
+          out->append("}\n");
+          return;
+        }
+        out->resize(rollback_size);
+      }
+      out->append(": ");
+      AppendEscaped(field.data(), field.size(), out);
+      break;
+    }
+  }
+  out->push_back('\n');
+}
+
+bool PrintUnknownFields(protozero::ConstBytes msg,
+                        uint32_t indent,
+                        std::string* out) {
+  protozero::ProtoDecoder decoder(msg.data, msg.size);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    PrintUnknownField(field, indent, out);
+  }
+  return decoder.bytes_left() == 0;
+}
+
+}  // namespace
+
+ProtoTextPrinter::ProtoTextPrinter(
+    const trace_processor::DescriptorPool& pool) {
+  using trace_processor::ProtoDescriptor;
+  const auto& descriptors = pool.descriptors();
+  for (uint32_t i = 0; i < descriptors.size(); ++i)
+    idx_by_name_.emplace(descriptors[i].full_name(), i);
+
+  messages_.resize(descriptors.size());
+  enums_.resize(descriptors.size());
+  for (uint32_t i = 0; i < descriptors.size(); ++i) {
+    const ProtoDescriptor& desc = descriptors[i];
+    if (desc.type() == ProtoDescriptor::Type::kEnum) {
+      enums_[i] = &desc.enum_values();
+      continue;
+    }
+    MessageInfo* message = &messages_[i];
+    for (const auto& id_and_field : desc.fields()) {
+      const trace_processor::FieldDescriptor& fd = id_and_field.second;
+      FieldInfo info;
+      info.valid = true;
+      info.repeated = fd.is_repeated();
+      info.type = fd.type();
+      info.name = fd.name();
+      if (fd.type() == FieldDescriptorProto::TYPE_MESSAGE ||
+          fd.type() == FieldDescriptorProto::TYPE_ENUM) {
+        auto it = idx_by_name_.find(fd.resolved_type_name());
+        // Fields of unresolved types are printed as unknown fields.
+        if (it == idx_by_name_.end())
+          continue;
+        info.type_idx = it->second;
+      }
+      uint32_t id = fd.number();
+      if (id > kMaxDenseFieldId) {
+        message->sparse_fields.emplace(id, std::move(info));
+        continue;
+      }
+      if (message->fields.size() <= id)
+        message->fields.resize(id + 1);
+      message->fields[id] = std::move(info);
+    }
+  }
+}
+
+ProtoTextPrinter::~ProtoTextPrinter() = default;
+
+base::Optional<uint32_t> ProtoTextPrinter::FindMessage(
+    const std::string& full_name) const {
+  auto it = idx_by_name_.find(full_name);
+  if (it == idx_by_name_.end() || enums_[it->second])
+    return base::nullopt;
+  return it->second;
+}
+
+const ProtoTextPrinter::FieldInfo* ProtoTextPrinter::FindField(
+    uint32_t message_idx,
+    uint32_t field_id) const {
+  const MessageInfo& message = messages_[message_idx];
+  if (field_id < message.fields.size()) {
+    const FieldInfo* info = &message.fields[field_id];
+    return info->valid ? info : nullptr;
+  }
+  if (message.sparse_fields.empty())
+    return nullptr;
+  auto it = message.sparse_fields.find(field_id);
+  return it == message.sparse_fields.end() ? nullptr : &it->second;
+}
+
+const ProtoTextPrinter::FieldInfo* ProtoTextPrinter::FindKnownField(
+    uint32_t message_idx,
+    const protozero::Field& field) const {
+  const FieldInfo* info = FindField(message_idx, field.id());
+  if (!info)
+    return nullptr;
+  ProtoWireType wire_type = WireTypeForFieldType(info->type);
+  if (field.type() == wire_type)
+    return info;
+  // Repeated scalars can also be packed. libprotobuf keeps fields with any
+  // other unexpected wire type as unknown fields.
+  if (info->repeated && field.type() == ProtoWireType::kLengthDelimited &&
+      wire_type != ProtoWireType::kLengthDelimited) {
+    return info;
+  }
+  return nullptr;
+}
+
+bool ProtoTextPrinter::IsKnownEnumValue(const FieldInfo& info,
+                                        uint64_t value) const {
+  const auto& values = *enums_[info.type_idx];
+  return values.count(static_cast<int32_t>(value)) > 0;
+}
+
+bool ProtoTextPrinter::PrintMessage(uint32_t message_idx,
+                                    protozero::ConstBytes msg,
+                                    uint32_t indent,
+                                    std::string* out) const {
+  // Like TextFormat, the unknown fields (and unknown enum values) are printed
+  // after the known fields, in the order in which they were encoded.
+  std::string unknown;
+  bool ok = IsInFieldNumberOrder(message_idx, msg)
+                ? PrintFieldsInWireOrder(message_idx, msg, indent, out,
+                                         &unknown)
+                : PrintFieldsSorted(message_idx, msg, indent, out, &unknown);
+  out->append(unknown);
+  return ok;
+}
+
+bool ProtoTextPrinter::IsInFieldNumberOrder(uint32_t message_idx,
+                                            protozero::ConstBytes msg) const {
+  protozero::ProtoDecoder decoder(msg.data, msg.size);
+  uint32_t last_id = 0;
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    const FieldInfo* info = FindKnownField(message_idx, field);
+    if (!info)
+      continue;
+    if (field.id() < last_id || (field.id() == last_id && !info->repeated))
+      return false;
+    last_id = field.id();
+  }
+  return true;
+}
+
+bool ProtoTextPrinter::PrintFieldsInWireOrder(uint32_t message_idx,
+                                              protozero::ConstBytes msg,
+                                              uint32_t indent,
+                                              std::string* out,
+                                              std::string* unknown) const {
+  protozero::ProtoDecoder decoder(msg.data, msg.size);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    const FieldInfo* info = FindKnownField(message_idx, field);
+    if (!info) {
+      PrintUnknownField(field, indent, unknown);
+      continue;
+    }
+    if (!PrintField(*info, field, indent, out, unknown))
+      return false;
+  }
+  return decoder.bytes_left() == 0;
+}
+
+bool ProtoTextPrinter::PrintFieldsSorted(uint32_t message_idx,
+                                         protozero::ConstBytes msg,
+                                         uint32_t indent,
+                                         std::string* out,
+                                         std::string* unknown) const {
+  struct KnownField {
+    const FieldInfo* info;
+    protozero::Field field;
+  };
+  std::vector<KnownField> known;
+  protozero::ProtoDecoder decoder(msg.data, msg.size);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    const FieldInfo* info = FindKnownField(message_idx, field);
+    if (!info) {
+      PrintUnknownField(field, indent, unknown);
+      continue;
+    }
+    if (info->type == FieldDescriptorProto::TYPE_ENUM) {
+      // The unknown enum values go with the unknown fields right away, so
+      // that they stay in wire order, and they do not replace the value of a
+      // singular field.
+      bool ok = ForEachValue(*info, field, [&](uint64_t value) {
+        if (!IsKnownEnumValue(*info, value))
+          PrintUnknownVarInt(field.id(), value, indent, unknown);
+      });
+      if (!ok)
+        return false;
+      if (!info->repeated && !IsKnownEnumValue(*info, field.as_uint64()))
+        continue;
+    }
+    known.push_back(KnownField{info, field});
+  }
+
+  std::stable_sort(known.begin(), known.end(),
+                   [](const KnownField& a, const KnownField& b) {
+                     return a.field.id() < b.field.id();
+                   });
+  for (size_t i = 0; i < known.size();) {
+    size_t end = i + 1;
+    while (end < known.size() && known[end].field.id() == known[i].field.id())
+      end++;
+    const FieldInfo& info = *known[i].info;
+    if (info.repeated) {
+      for (; i < end; i++) {
+        if (!PrintField(info, known[i].field, indent, out, nullptr))
+          return false;
+      }
+      continue;
+    }
+    if (info.type == FieldDescriptorProto::TYPE_MESSAGE && end - i > 1) {
+      // The occurrences of a singular message are merged, which is the same
+      // as parsing their concatenation.
+      std::string merged;
+      for (; i < end; i++)
+        merged.append(reinterpret_cast<const char*>(known[i].field.data()),
+                      known[i].field.size());
+      protozero::ConstBytes bytes{
+          reinterpret_cast<const uint8_t*>(merged.data()), merged.size()};
+      if (!PrintNestedMessage(info, bytes, indent, out))
+        return false;
+      continue;
+    }
+    // The last occurrence of any other singular field wins.
+    if (!PrintField(info, known[end - 1].field, indent, out, nullptr))
+      return false;
+    i = end;
+  }
+  return decoder.bytes_left() == 0;
+}
+
+bool ProtoTextPrinter::PrintNestedMessage(const FieldInfo& info,
+                                          protozero::ConstBytes msg,
+                                          uint32_t indent,
+                                          std::string* out) const {
+  AppendIndent(indent, out);
+  out->append(info.name);
+  out->append(" {\n");
+  if (!PrintMessage(info.type_idx, msg, indent + 1, out))
+    return false;
+  AppendIndent(indent, out);
+  out->append("}\n");
+  return true;
+}
+
+bool ProtoTextPrinter::PrintField(const FieldInfo& info,
+                                  const protozero::Field& field,
+                                  uint32_t indent,
+                                  std::string* out,
+                                  std::string* unknown) const {
+  switch (info.type) {
+    case FieldDescriptorProto::TYPE_MESSAGE:
+      return PrintNestedMessage(info, field.as_bytes(), indent, out);
+    case FieldDescriptorProto::TYPE_STRING:
+    case FieldDescriptorProto::TYPE_BYTES:
+      AppendIndent(indent, out);
+      out->append(info.name);
+      out->append(": ");
+      AppendEscaped(field.data(), field.size(), out);
+      out->push_back('\n');
+      return true;
+    default:
+      return ForEachValue(info, field, [&](uint64_t value) {
+        PrintScalar(info, value, field.id(), indent, out, unknown);
+      });
+  }
+}
+
+template <typename Fn>
+bool ProtoTextPrinter::ForEachValue(const FieldInfo& info,
+                                    const protozero::Field& field,
+                                    const Fn& fn) const {
+  ProtoWireType wire_type = WireTypeForFieldType(info.type);
+  if (field.type() == wire_type) {
+    fn(field.as_uint64());
+    return true;
+  }
+
+  // The field is packed.
+  const uint8_t* pos = field.data();
+  const uint8_t* end = pos + field.size();
+  switch (wire_type) {
+    case ProtoWireType::kVarInt:
+      while (pos < end) {
+        uint64_t value = 0;
+        const uint8_t* next =
+            protozero::proto_utils::ParseVarInt(pos, end, &value);
+        if (next == pos)
+          return false;
+        pos = next;
+        fn(value);
+      }
+      return true;
+    case ProtoWireType::kFixed32:
+      if (field.size() % sizeof(uint32_t))
+        return false;
+      for (; pos < end; pos += sizeof(uint32_t)) {
+        uint32_t value;
+        memcpy(&value, pos, sizeof(value));
+        fn(value);
+      }
+      return true;
+    case ProtoWireType::kFixed64:
+      if (field.size() % sizeof(uint64_t))
+        return false;
+      for (; pos < end; pos += sizeof(uint64_t)) {
+        uint64_t value;
+        memcpy(&value, pos, sizeof(value));
+        fn(value);
+      }
+      return true;
+    case ProtoWireType::kLengthDelimited:
+      break;
+  }
+  PERFETTO_FATAL("Not a packable field type");  // For GCC.
+}
+
+void ProtoTextPrinter::PrintScalar(const FieldInfo& info,
+                                   uint64_t value,
+                                   uint32_t field_id,
+                                   uint32_t indent,
+                                   std::string* out,
+                                   std::string* unknown) const {
+  size_t rollback_size = out->size();
+  AppendIndent(indent, out);
+  out->append(info.name);
+  out->append(": ");
+  switch (info.type) {
+    case FieldDescriptorProto::TYPE_INT32:
+    case FieldDescriptorProto::TYPE_SFIXED32:
+      AppendSigned(static_cast<int32_t>(value), out);
+      break;
+    case FieldDescriptorProto::TYPE_INT64:
+    case FieldDescriptorProto::TYPE_SFIXED64:
+      AppendSigned(static_cast<int64_t>(value), out);
+      break;
+    case FieldDescriptorProto::TYPE_UINT32:
+    case FieldDescriptorProto::TYPE_FIXED32:
+      AppendUnsigned(static_cast<uint32_t>(value), out);
+      break;
+    case FieldDescriptorProto::TYPE_UINT64:
+    case FieldDescriptorProto::TYPE_FIXED64:
+      AppendUnsigned(value, out);
+      break;
+    case FieldDescriptorProto::TYPE_SINT32:
+      AppendSigned(
+          protozero::proto_utils::ZigZagDecode(static_cast<uint32_t>(value)),
+          out);
+      break;
+    case FieldDescriptorProto::TYPE_SINT64:
+      AppendSigned(protozero::proto_utils::ZigZagDecode(value), out);
+      break;
+    case FieldDescriptorProto::TYPE_BOOL:
+      out->append(value ? "true" : "false");
+      break;
+    case FieldDescriptorProto::TYPE_DOUBLE: {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      AppendDouble(d, out);
+      break;
+    }
+    case FieldDescriptorProto::TYPE_FLOAT: {
+      uint32_t value32 = static_cast<uint32_t>(value);
+      float f;
+      memcpy(&f, &value32, sizeof(f));
+      AppendFloat(f, out);
+      break;
+    }
+    case FieldDescriptorProto::TYPE_ENUM: {
+      const auto& values = *enums_[info.type_idx];
+      auto it = values.find(static_cast<int32_t>(value));
+      if (it == values.end()) {
+        // libprotobuf keeps unknown values of proto2 enums as unknown fields.
+        // They are not printed if |unknown| is null, in which case the caller
+        // already did.
+        out->resize(rollback_size);
+        if (unknown)
+          PrintUnknownVarInt(field_id, value, indent, unknown);
+        return;
+      }
+      out->append(it->second);
+      break;
+    }
+    default:
+      PERFETTO_DFATAL("Unexpected field type %u", info.type);
+  }
+  out->push_back('\n');
+}
+
+}  // namespace trace_to_text
+}  // namespace perfetto
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TOOLS_TRACE_TO_TEXT_PROTO_TEXT_PRINTER_H_
+#define TOOLS_TRACE_TO_TEXT_PROTO_TEXT_PRINTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/protozero/field.h"
+#include "src/trace_processor/util/descriptors.h"
+
+namespace perfetto {
+namespace trace_to_text {
+
+// Prints protozero-encoded messages in the text format of
+// google::protobuf::TextFormat::Printer, using the descriptors of a
+// trace_processor DescriptorPool instead of libprotobuf reflection. Messages
+// are decoded field by field straight into the output string, without
+// materializing them first.
+//
+// The output is the same as the one of TextFormat, which prints the message
+// libprotobuf would parse: the known fields sorted by field number, then the
+// unknown fields; only the last value of a singular field, and the merge of
+// all the values of a singular message. Messages whose fields are encoded in
+// field number order, as most are, are printed while they are decoded; the
+// others are decoded first. The only differences are:
+//  * if several fields of a oneof are set, all of them are printed while
+//    libprotobuf only keeps the last one.
+//  * extensions are printed with their field name, without the
+//    "[package.scope.name]" syntax.
+//
+// The lookup tables are built once in the constructor; after that the printer
+// is immutable and can be shared by several threads.
+class ProtoTextPrinter {
+ public:
+  // |pool| must outlive the printer.
+  explicit ProtoTextPrinter(const trace_processor::DescriptorPool& pool);
+  ~ProtoTextPrinter();
+
+  // Returns the index of the message with the given fully qualified name
+  // (e.g. ".perfetto.protos.TracePacket"), to be passed to PrintMessage().
+  base::Optional<uint32_t> FindMessage(const std::string& full_name) const;
+
+  // Appends the fields of the message |msg| of type |message_idx| to |out|,
+  // each line indented by |indent| levels. Returns false if |msg| is not a
+  // valid encoded proto; in that case |out| contains a partial output.
+  bool PrintMessage(uint32_t message_idx,
+                    protozero::ConstBytes msg,
+                    uint32_t indent,
+                    std::string* out) const;
+
+ private:
+  struct FieldInfo {
+    bool valid = false;
+    bool repeated = false;
+    uint32_t type = 0;
+    // The message or enum descriptor of TYPE_MESSAGE and TYPE_ENUM fields.
+    uint32_t type_idx = 0;
+    std::string name;
+  };
+
+  struct MessageInfo {
+    // Indexed by field number, for the fields with small numbers.
+    std::vector<FieldInfo> fields;
+    std::unordered_map<uint32_t, FieldInfo> sparse_fields;
+  };
+
+  const FieldInfo* FindField(uint32_t message_idx, uint32_t field_id) const;
+  // Returns null if libprotobuf would keep |field| as an unknown field.
+  const FieldInfo* FindKnownField(uint32_t message_idx,
+                                  const protozero::Field& field) const;
+  bool IsKnownEnumValue(const FieldInfo&, uint64_t value) const;
+
+  // Returns true if the known fields of |msg| are sorted by field number and
+  // no singular field is repeated, so that they can be printed as they are
+  // decoded.
+  bool IsInFieldNumberOrder(uint32_t message_idx,
+                            protozero::ConstBytes msg) const;
+  // The unknown fields are appended to |unknown| rather than to |out|.
+  bool PrintFieldsInWireOrder(uint32_t message_idx,
+                              protozero::ConstBytes msg,
+                              uint32_t indent,
+                              std::string* out,
+                              std::string* unknown) const;
+  bool PrintFieldsSorted(uint32_t message_idx,
+                         protozero::ConstBytes msg,
+                         uint32_t indent,
+                         std::string* out,
+                         std::string* unknown) const;
+  bool PrintNestedMessage(const FieldInfo&,
+                          protozero::ConstBytes msg,
+                          uint32_t indent,
+                          std::string* out) const;
+  bool PrintField(const FieldInfo&,
+                  const protozero::Field&,
+                  uint32_t indent,
+                  std::string* out,
+                  std::string* unknown) const;
+  // Calls |fn| with each value of a scalar field, which may be packed.
+  // Returns false if a packed field is malformed.
+  template <typename Fn>
+  bool ForEachValue(const FieldInfo&,
+                    const protozero::Field&,
+                    const Fn& fn) const;
+  void PrintScalar(const FieldInfo&,
+                   uint64_t value,
+                   uint32_t field_id,
+                   uint32_t indent,
+                   std::string* out,
+                   std::string* unknown) const;
+
+  // Indexed by descriptor index; empty for enums.
+  std::vector<MessageInfo> messages_;
+  // Indexed by descriptor index; empty for messages.
+  std::vector<const std::unordered_map<int32_t, std::string>*> enums_;
+  std::unordered_map<std::string, uint32_t> idx_by_name_;
+};
+
+}  // namespace trace_to_text
+}  // namespace perfetto
+
+#endif  // TOOLS_TRACE_TO_TEXT_PROTO_TEXT_PRINTER_H_
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <google/protobuf/compiler/importer.h>
+#include <google/protobuf/dynamic_message.h>
+#include <google/protobuf/text_format.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/util/descriptors.h"
+#include "tools/trace_to_text/proto_full_utils.h"
+#include "tools/trace_to_text/proto_text_printer.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
+// Compares the throughput of `traceconv text` with libprotobuf's TextFormat
+// against the protozero based ProtoTextPrinter. Like `traceconv text`, the
+// descriptors are imported from the .proto files, so this has to run from
+// the root of the checkout.
+
+namespace {
+
+using google::protobuf::DynamicMessageFactory;
+using google::protobuf::FileDescriptor;
+using google::protobuf::Message;
+using google::protobuf::TextFormat;
+using google::protobuf::compiler::DiskSourceTree;
+using google::protobuf::compiler::Importer;
+using perfetto::trace_to_text::MultiFileErrorCollectorImpl;
+using perfetto::trace_to_text::ProtoTextPrinter;
+
+constexpr char kTracePacketProto[] = "protos/perfetto/trace/trace_packet.proto";
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(16);
+  } else {
+    b->RangeMultiplier(8)->Range(64, 64 * 512);
+  }
+}
+
+// Creates |num_packets| packets alternating between ftrace event bundles and
+// track events with debug annotations.
+std::vector<std::string> CreatePackets(int64_t num_packets) {
+  std::vector<std::string> packets;
+  for (int64_t i = 0; i < num_packets; ++i) {
+    protozero::HeapBuffered<perfetto::protos::pbzero::TracePacket> packet;
+    packet->set_timestamp(static_cast<uint64_t>(1000 + i));
+    if (i % 2 == 0) {
+      auto* bundle = packet->set_ftrace_events();
+      bundle->set_cpu(static_cast<uint32_t>(i % 8));
+      for (int j = 0; j < 32; ++j) {
+        auto* event = bundle->add_event();
+        event->set_timestamp(static_cast<uint64_t>(1000 + i * 32 + j));
+        event->set_pid(static_cast<uint32_t>(j));
+        auto* sched_switch = event->set_sched_switch();
+        sched_switch->set_prev_comm("surfaceflinger");
+        sched_switch->set_prev_pid(j);
+        sched_switch->set_prev_prio(120);
+        sched_switch->set_prev_state(1);
+        sched_switch->set_next_comm("RenderThread");
+        sched_switch->set_next_pid(j + 1);
+        sched_switch->set_next_prio(110);
+      }
+    } else {
+      packet->set_trusted_packet_sequence_id(1);
+      auto* event = packet->set_track_event();
+      event->set_type(perfetto::protos::pbzero::TrackEvent::TYPE_SLICE_BEGIN);
+      event->set_track_uuid(static_cast<uint64_t>(i % 16));
+      event->set_name("MessageLoop::RunTask");
+      event->add_categories("toplevel");
+      auto* annotation = event->add_debug_annotations();
+      annotation->set_name("posted_from");
+      annotation->set_string_value("content/browser/renderer_host.cc");
+      annotation = event->add_debug_annotations();
+      annotation->set_name("delay_ms");
+      annotation->set_double_value(static_cast<double>(i) / 3);
+    }
+    packets.emplace_back(packet.SerializeAsString());
+  }
+  return packets;
+}
+
+int64_t TotalSize(const std::vector<std::string>& packets) {
+  int64_t size = 0;
+  for (const std::string& packet : packets)
+    size += static_cast<int64_t>(packet.size());
+  return size;
+}
+
+class TracePacketImporter {
+ public:
+  TracePacketImporter() : importer_(&source_tree_, &error_collector_) {
+    source_tree_.MapPath("", "");
+    file_ = importer_.Import(kTracePacketProto);
+    PERFETTO_CHECK(file_);
+  }
+
+  const FileDescriptor* file() const { return file_; }
+
+ private:
+  DiskSourceTree source_tree_;
+  MultiFileErrorCollectorImpl error_collector_;
+  Importer importer_;
+  const FileDescriptor* file_ = nullptr;
+};
+
+class TextFormatPacketPrinter {
+ public:
+  explicit TextFormatPacketPrinter(const TracePacketImporter& importer)
+      : msg_(factory_.GetPrototype(importer.file()->message_type(0))->New()) {
+    printer_.SetInitialIndentLevel(1);
+  }
+
+  std::string Print(const std::vector<std::string>& packets) {
+    std::string text;
+    for (const std::string& packet : packets) {
+      PERFETTO_CHECK(msg_->ParseFromString(packet));
+      std::string packet_text;
+      printer_.PrintToString(*msg_, &packet_text);
+      text.append(packet_text);
+    }
+    return text;
+  }
+
+ private:
+  DynamicMessageFactory factory_;
+  std::unique_ptr<Message> msg_;
+  TextFormat::Printer printer_;
+};
+
+class ProtoTextPacketPrinter {
+ public:
+  explicit ProtoTextPacketPrinter(const TracePacketImporter& importer) {
+    PERFETTO_CHECK(
+        perfetto::trace_to_text::AddToDescriptorPool(importer.file(), &pool_)
+            .ok());
+    printer_.reset(new ProtoTextPrinter(pool_));
+    packet_idx_ = *printer_->FindMessage(".perfetto.protos.TracePacket");
+  }
+
+  std::string Print(const std::vector<std::string>& packets) {
+    std::string text;
+    for (const std::string& packet : packets) {
+      protozero::ConstBytes bytes{
+          reinterpret_cast<const uint8_t*>(packet.data()), packet.size()};
+      PERFETTO_CHECK(printer_->PrintMessage(packet_idx_, bytes, 1, &text));
+    }
+    return text;
+  }
+
+ private:
+  perfetto::trace_processor::DescriptorPool pool_;
+  std::unique_ptr<ProtoTextPrinter> printer_;
+  uint32_t packet_idx_ = 0;
+};
+
+}  // namespace
+
+static void BM_TraceToText_TextFormat(benchmark::State& state) {
+  TracePacketImporter importer;
+  TextFormatPacketPrinter printer(importer);
+
+  std::vector<std::string> packets = CreatePackets(state.range(0));
+  for (auto _ : state) {
+    std::string text = printer.Print(packets);
+    benchmark::DoNotOptimize(text);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * TotalSize(packets));
+}
+BENCHMARK(BM_TraceToText_TextFormat)->Apply(BenchmarkArgs);
+
+static void BM_TraceToText_ProtoTextPrinter(benchmark::State& state) {
+  TracePacketImporter importer;
+  ProtoTextPacketPrinter printer(importer);
+
+  // The two printers are only comparable if they print the same text.
+  std::vector<std::string> packets = CreatePackets(state.range(0));
+  PERFETTO_CHECK(printer.Print(packets) ==
+                 TextFormatPacketPrinter(importer).Print(packets));
+
+  for (auto _ : state) {
+    std::string text = printer.Print(packets);
+    benchmark::DoNotOptimize(text);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * TotalSize(packets));
+}
+BENCHMARK(BM_TraceToText_ProtoTextPrinter)->Apply(BenchmarkArgs);
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tools/trace_to_text/proto_text_printer.h"
+
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
+#include <google/protobuf/text_format.h>
+
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/util/descriptors.h"
+#include "test/gtest_and_gmock.h"
+#include "tools/trace_to_text/proto_full_utils.h"
+
+namespace perfetto {
+namespace trace_to_text {
+namespace {
+
+constexpr char kTestProto[] = R"(
+  name: "proto_text_printer_unittest.proto"
+  package: "perfetto.protos"
+  message_type {
+    name: "Inner"
+    field { name: "a" number: 1 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "b" number: 2 label: LABEL_OPTIONAL type: TYPE_STRING }
+    field { name: "c" number: 3 label: LABEL_REPEATED type: TYPE_INT32 }
+  }
+  message_type {
+    name: "Outer"
+    field { name: "i32" number: 1 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "s64" number: 2 label: LABEL_OPTIONAL type: TYPE_SINT64 }
+    field { name: "u64" number: 3 label: LABEL_OPTIONAL type: TYPE_UINT64 }
+    field { name: "d" number: 4 label: LABEL_OPTIONAL type: TYPE_DOUBLE }
+    field { name: "f" number: 5 label: LABEL_OPTIONAL type: TYPE_FLOAT }
+    field { name: "b" number: 6 label: LABEL_OPTIONAL type: TYPE_BOOL }
+    field { name: "s" number: 7 label: LABEL_OPTIONAL type: TYPE_STRING }
+    field { name: "by" number: 8 label: LABEL_OPTIONAL type: TYPE_BYTES }
+    field {
+      name: "color" number: 9 label: LABEL_OPTIONAL type: TYPE_ENUM
+      type_name: ".perfetto.protos.Color"
+    }
+    field {
+      name: "colors" number: 10 label: LABEL_REPEATED type: TYPE_ENUM
+      type_name: ".perfetto.protos.Color"
+    }
+    field { name: "nums" number: 11 label: LABEL_REPEATED type: TYPE_INT32 }
+    field { name: "fx" number: 12 label: LABEL_REPEATED type: TYPE_FIXED32 }
+    field {
+      name: "inner" number: 13 label: LABEL_OPTIONAL type: TYPE_MESSAGE
+      type_name: ".perfetto.protos.Inner"
+    }
+    field {
+      name: "inners" number: 14 label: LABEL_REPEATED type: TYPE_MESSAGE
+      type_name: ".perfetto.protos.Inner"
+    }
+    field { name: "sf32" number: 15 label: LABEL_OPTIONAL type: TYPE_SFIXED32 }
+  }
+  enum_type {
+    name: "Color"
+    value { name: "RED" number: 1 }
+    value { name: "GREEN" number: 2 }
+  }
+)";
+
+enum OuterFields : uint32_t {
+  kI32 = 1,
+  kS64 = 2,
+  kU64 = 3,
+  kDouble = 4,
+  kFloat = 5,
+  kBool = 6,
+  kString = 7,
+  kBytes = 8,
+  kColor = 9,
+  kColors = 10,
+  kNums = 11,
+  kFixed = 12,
+  kInner = 13,
+  kInners = 14,
+  kSfixed32 = 15,
+  kUnknown = 100,
+};
+
+class ProtoTextPrinterTest : public ::testing::Test {
+ public:
+  ProtoTextPrinterTest() {
+    google::protobuf::FileDescriptorProto file_proto;
+    PERFETTO_CHECK(
+        google::protobuf::TextFormat::ParseFromString(kTestProto, &file_proto));
+    const google::protobuf::FileDescriptor* file =
+        proto_pool_.BuildFile(file_proto);
+    PERFETTO_CHECK(file);
+    outer_ = file->FindMessageTypeByName("Outer");
+    PERFETTO_CHECK(AddToDescriptorPool(file, &pool_).ok());
+    printer_.reset(new ProtoTextPrinter(pool_));
+  }
+
+ protected:
+  // Prints |msg| as an Outer message with ProtoTextPrinter.
+  std::string Print(const std::string& msg) {
+    std::string text;
+    base::Optional<uint32_t> idx =
+        printer_->FindMessage(".perfetto.protos.Outer");
+    PERFETTO_CHECK(idx);
+    protozero::ConstBytes bytes{reinterpret_cast<const uint8_t*>(msg.data()),
+                                msg.size()};
+    EXPECT_TRUE(printer_->PrintMessage(*idx, bytes, 0, &text));
+    return text;
+  }
+
+  // Prints |msg| as an Outer message with TextFormat.
+  std::string PrintWithTextFormat(const std::string& msg) {
+    std::unique_ptr<google::protobuf::Message> message(
+        factory_.GetPrototype(outer_)->New());
+    EXPECT_TRUE(message->ParseFromString(msg));
+    std::string text;
+    google::protobuf::TextFormat::PrintToString(*message, &text);
+    return text;
+  }
+
+  google::protobuf::DescriptorPool proto_pool_;
+  google::protobuf::DynamicMessageFactory factory_;
+  const google::protobuf::Descriptor* outer_ = nullptr;
+  trace_processor::DescriptorPool pool_;
+  std::unique_ptr<ProtoTextPrinter> printer_;
+};
+
+TEST_F(ProtoTextPrinterTest, ScalarTypes) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendVarInt(kI32, -5);
+  msg->AppendSignedVarInt(kS64, int64_t{-1234567890123});
+  msg->AppendVarInt(kU64, uint64_t{18446744073709551615u});
+  msg->AppendFixed(kDouble, 0.1);
+  msg->AppendFixed(kFloat, 1.5f);
+  msg->AppendVarInt(kBool, 1);
+  msg->AppendString(kString, "quote\" newline\n tab\t \x01");
+  msg->AppendString(kBytes, std::string("\0\x7f\xff", 3));
+  msg->AppendVarInt(kColor, 2);
+  msg->AppendFixed(kSfixed32, int32_t{-7});
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: -5\n"
+            "s64: -1234567890123\n"
+            "u64: 18446744073709551615\n"
+            "d: 0.1\n"
+            "f: 1.5\n"
+            "b: true\n"
+            "s: \"quote\\\" newline\\n tab\\t \\001\"\n"
+            "by: \"\\000\\177\\377\"\n"
+            "color: GREEN\n"
+            "sf32: -7\n");
+}
+
+TEST_F(ProtoTextPrinterTest, NestedAndRepeatedFields) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  protozero::PackedVarInt nums;
+  nums.Append(1);
+  nums.Append(300);
+  msg->AppendBytes(kNums, nums.data(), nums.size());
+  msg->AppendVarInt(kNums, 3);
+  msg->AppendFixed(kFixed, uint32_t{42});
+  auto* inner = msg->BeginNestedMessage<protozero::Message>(kInner);
+  inner->AppendVarInt(1, 7);
+  inner->AppendString(2, "x");
+  for (int i = 0; i < 2; i++) {
+    inner = msg->BeginNestedMessage<protozero::Message>(kInners);
+    inner->AppendVarInt(3, i);
+  }
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "nums: 1\n"
+            "nums: 300\n"
+            "nums: 3\n"
+            "fx: 42\n"
+            "inner {\n"
+            "  a: 7\n"
+            "  b: \"x\"\n"
+            "}\n"
+            "inners {\n"
+            "  c: 0\n"
+            "}\n"
+            "inners {\n"
+            "  c: 1\n"
+            "}\n");
+}
+
+TEST_F(ProtoTextPrinterTest, FieldsSortedByNumber) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendString(kString, "s");
+  msg->AppendVarInt(kNums, 1);
+  msg->AppendVarInt(kI32, 1);
+  msg->AppendVarInt(kNums, 2);
+  msg->AppendVarInt(kColors, 1);
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: 1\n"
+            "s: \"s\"\n"
+            "colors: RED\n"
+            "nums: 1\n"
+            "nums: 2\n");
+}
+
+TEST_F(ProtoTextPrinterTest, LastValueOfSingularFieldWins) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendVarInt(kI32, 1);
+  msg->AppendString(kString, "first");
+  msg->AppendVarInt(kI32, 2);
+  msg->AppendString(kString, "second");
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: 2\n"
+            "s: \"second\"\n");
+}
+
+TEST_F(ProtoTextPrinterTest, SingularMessagesAreMerged) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  auto* inner = msg->BeginNestedMessage<protozero::Message>(kInner);
+  inner->AppendVarInt(1, 1);
+  inner->AppendVarInt(3, 10);
+  msg->AppendVarInt(kI32, 5);
+  inner = msg->BeginNestedMessage<protozero::Message>(kInner);
+  inner->AppendString(2, "b");
+  inner->AppendVarInt(1, 2);
+  inner->AppendVarInt(3, 11);
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: 5\n"
+            "inner {\n"
+            "  a: 2\n"
+            "  b: \"b\"\n"
+            "  c: 10\n"
+            "  c: 11\n"
+            "}\n");
+}
+
+TEST_F(ProtoTextPrinterTest, UnknownFieldsPrintedLast) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendVarInt(kUnknown, 1);
+  msg->AppendVarInt(kI32, 1);
+  // Wrong wire types are kept as unknown fields.
+  msg->AppendString(kU64, "not a varint");
+  msg->AppendFixed(kUnknown + 1, uint64_t{2});
+  auto* nested = msg->BeginNestedMessage<protozero::Message>(kUnknown + 2);
+  nested->AppendVarInt(1, 3);
+  msg->AppendVarInt(kColor, 1);
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: 1\n"
+            "color: RED\n"
+            "100: 1\n"
+            "3: \"not a varint\"\n"
+            "101: 0x0000000000000002\n"
+            "102 {\n"
+            "  1: 3\n"
+            "}\n");
+}
+
+TEST_F(ProtoTextPrinterTest, UnknownEnumValues) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendVarInt(kColor, 1);
+  msg->AppendVarInt(kUnknown, 1);
+  // An unknown value does not replace the known one.
+  msg->AppendVarInt(kColor, 5);
+  protozero::PackedVarInt colors;
+  colors.Append(2);
+  colors.Append(6);
+  colors.Append(1);
+  msg->AppendBytes(kColors, colors.data(), colors.size());
+  msg->AppendVarInt(kI32, 1);
+  std::string encoded = msg.SerializeAsString();
+
+  EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  EXPECT_EQ(Print(encoded),
+            "i32: 1\n"
+            "color: RED\n"
+            "colors: GREEN\n"
+            "colors: RED\n"
+            "100: 1\n"
+            "9: 5\n"
+            "10: 6\n");
+}
+
+TEST_F(ProtoTextPrinterTest, FloatingPoint) {
+  for (double d : {0.0, -0.0, 1e-300, 3.141592653589793, 1e100, 123456789.0,
+                   std::numeric_limits<double>::infinity(),
+                   std::numeric_limits<double>::quiet_NaN()}) {
+    protozero::HeapBuffered<protozero::Message> msg;
+    msg->AppendFixed(kDouble, d);
+    msg->AppendFixed(kFloat, static_cast<float>(d));
+    std::string encoded = msg.SerializeAsString();
+    EXPECT_EQ(Print(encoded), PrintWithTextFormat(encoded));
+  }
+}
+
+}  // namespace
+}  // namespace trace_to_text
+}  // namespace perfetto
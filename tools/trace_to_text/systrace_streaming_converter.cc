@@ -0,0 +1,1113 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tools/trace_to_text/systrace_streaming_converter.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/importers/ftrace/ftrace_parser.h"
+#include "src/trace_processor/importers/gzip/gzip_utils.h"
+#include "src/trace_processor/importers/systrace/systrace_parser.h"
+#include "src/trace_processor/types/gfp_flags.h"
+#include "src/trace_processor/types/softirq_action.h"
+#include "src/trace_processor/types/task_state.h"
+#include "tools/trace_to_text/utils.h"
+
+#include "protos/perfetto/trace/ftrace/binder.pbzero.h"
+#include "protos/perfetto/trace/ftrace/clk.pbzero.h"
+#include "protos/perfetto/trace/ftrace/dpu.pbzero.h"
+#include "protos/perfetto/trace/ftrace/filemap.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/g2d.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+#include "protos/perfetto/trace/ftrace/irq.pbzero.h"
+#include "protos/perfetto/trace/ftrace/power.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+#include "protos/perfetto/trace/ftrace/task.pbzero.h"
+#include "protos/perfetto/trace/ftrace/workqueue.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/perfetto/tracing_service_event.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+#include "protos/perfetto/trace/ps/process_tree.pbzero.h"
+#include "protos/perfetto/trace/system_info.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_to_text {
+
+namespace {
+
+using protos::pbzero::FtraceEvent;
+using protozero::ConstBytes;
+using protozero::proto_utils::ProtoSchemaType;
+
+// From kernel's sched.h.
+constexpr uint64_t kCloneThread = 0x00010000;
+
+// Lines are written out in chunks of this size.
+constexpr size_t kOutputChunkSize = 1024 * 1024;
+
+struct FtraceTime {
+  FtraceTime(int64_t ns)
+      : secs(ns / 1000000000LL), micros((ns - secs * 1000000000LL) / 1000) {}
+
+  const int64_t secs;
+  const int64_t micros;
+};
+
+}  // namespace
+
+SystraceStreamingConverter::SystraceStreamingConverter(
+    TraceWriter* trace_writer,
+    Keep truncate_keep,
+    uint32_t max_events)
+    : trace_writer_(trace_writer),
+      truncate_keep_(truncate_keep),
+      max_events_(max_events) {
+  output_.reserve(kOutputChunkSize + kMaxLineSize);
+}
+
+SystraceStreamingConverter::~SystraceStreamingConverter() = default;
+
+void SystraceStreamingConverter::ParsePacket(const uint8_t* data,
+                                             size_t size) {
+  protos::pbzero::TracePacket::Decoder packet(data, size);
+  if (packet.has_compressed_packets()) {
+    ParseCompressedPackets(packet.compressed_packets());
+    return;
+  }
+
+  uint32_t seq_id = packet.trusted_packet_sequence_id();
+  if (packet.incremental_state_cleared() ||
+      packet.sequence_flags() &
+          protos::pbzero::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED) {
+    kernel_symbols_.erase(seq_id);
+  }
+  if (packet.has_interned_data())
+    ParseInternedData(seq_id, packet.interned_data());
+
+  if (packet.has_service_event()) {
+    protos::pbzero::TracingServiceEvent::Decoder event(packet.service_event());
+    if (event.tracing_started() && !seen_ftrace_)
+      tracing_started_ts_ = static_cast<int64_t>(packet.timestamp());
+  }
+  if (packet.has_system_info())
+    ParseSystemInfo(packet.system_info());
+  if (packet.has_process_tree())
+    ParseProcessTree(packet.process_tree());
+  if (packet.has_ftrace_events())
+    ParseFtraceBundle(seq_id, packet.ftrace_events());
+}
+
+void SystraceStreamingConverter::NotifyEndOfFile() {
+  EmitLines(/*flush_all=*/true);
+  if (truncate_keep_ == Keep::kEnd) {
+    for (const std::string& line : last_lines_) {
+      output_.append(line);
+      output_.push_back('\n');
+      if (output_.size() >= kOutputChunkSize)
+        FlushOutput();
+    }
+    last_lines_.clear();
+  }
+  FlushOutput();
+}
+
+void SystraceStreamingConverter::ParseCompressedPackets(ConstBytes bytes) {
+  if (!trace_processor::gzip::IsGzipSupported()) {
+    PERFETTO_ELOG("Skipping compressed packets: zlib support is disabled");
+    return;
+  }
+
+  // Each compressed_packets field is a separate gzip stream containing a
+  // sequence of TracePackets.
+  trace_processor::GzipDecompressor decompressor;
+  decompressor.SetInput(bytes.data, bytes.size);
+  std::vector<uint8_t> decompressed;
+  using ResultCode = trace_processor::GzipDecompressor::ResultCode;
+  uint8_t out[4096];
+  for (auto ret = ResultCode::kOk; ret != ResultCode::kEof;) {
+    auto res = decompressor.Decompress(out, sizeof(out));
+    ret = res.ret;
+    if (ret == ResultCode::kError || ret == ResultCode::kNoProgress ||
+        ret == ResultCode::kNeedsMoreInput) {
+      PERFETTO_ELOG("Failed while decompressing packets");
+      return;
+    }
+    decompressed.insert(decompressed.end(), out, out + res.bytes_written);
+  }
+
+  protos::pbzero::Trace::Decoder trace(decompressed.data(),
+                                       decompressed.size());
+  for (auto it = trace.packet(); it; ++it)
+    ParsePacket(it->data(), it->size());
+}
+
+void SystraceStreamingConverter::ParseInternedData(uint32_t seq_id,
+                                                   ConstBytes bytes) {
+  protos::pbzero::InternedData::Decoder interned_data(bytes);
+  if (!interned_data.has_kernel_symbols())
+    return;
+  auto& symbols = kernel_symbols_[seq_id];
+  for (auto it = interned_data.kernel_symbols(); it; ++it) {
+    protos::pbzero::InternedString::Decoder symbol(*it);
+    symbols[symbol.iid()] = symbol.str().ToStdString();
+  }
+}
+
+void SystraceStreamingConverter::ParseProcessTree(ConstBytes bytes) {
+  protos::pbzero::ProcessTree::Decoder ps(bytes);
+  for (auto it = ps.processes(); it; ++it) {
+    protos::pbzero::ProcessTree::Process::Decoder proc(*it);
+    uint32_t pid = static_cast<uint32_t>(proc.pid());
+    GetOrCreateThread(pid)->tgid = pid;
+  }
+  for (auto it = ps.threads(); it; ++it) {
+    protos::pbzero::ProcessTree::Thread::Decoder thd(*it);
+    Thread* thread = GetOrCreateThread(static_cast<uint32_t>(thd.tid()));
+    thread->tgid = static_cast<uint32_t>(thd.tgid());
+    if (thd.has_name()) {
+      thread->name = thd.name().ToStdString();
+      thread->name_from_process_tree = true;
+    }
+  }
+}
+
+void SystraceStreamingConverter::ParseSystemInfo(ConstBytes bytes) {
+  protos::pbzero::SystemInfo::Decoder info(bytes);
+  if (!info.has_utsname())
+    return;
+  protos::pbzero::Utsname::Decoder utsname(info.utsname());
+
+  // Same parsing as in SystemInfoTracker.
+  kernel_version_ = base::nullopt;
+  base::StringView name = utsname.sysname();
+  base::StringView release = utsname.release();
+  if (name != "Linux" || release.empty())
+    return;
+  size_t first_dot_pos = release.find(".");
+  size_t second_dot_pos = release.find(".", first_dot_pos + 1);
+  auto major =
+      base::StringToUInt32(release.substr(0, first_dot_pos).ToStdString());
+  auto minor = base::StringToUInt32(
+      release.substr(first_dot_pos + 1, second_dot_pos - (first_dot_pos + 1))
+          .ToStdString());
+  if (major && minor)
+    kernel_version_ = trace_processor::VersionNumber{*major, *minor};
+}
+
+void SystraceStreamingConverter::ParseFtraceBundle(uint32_t seq_id,
+                                                   ConstBytes bytes) {
+  protos::pbzero::FtraceEventBundle::Decoder bundle(bytes);
+  uint32_t cpu = bundle.cpu();
+  if (!bundle.has_cpu() || cpu >= trace_processor::kMaxCpus) {
+    PERFETTO_ELOG("Skipping ftrace bundle with invalid cpu");
+    return;
+  }
+  if (cpu >= cpu_queues_.size()) {
+    cpu_queues_.resize(cpu + 1);
+    cpu_states_.resize(cpu + 1);
+  }
+
+  // The CPUs are read in order, so a bundle of a lower CPU than the previous
+  // one starts a new read round. Consecutive bundles of the same CPU can come
+  // from the same read and do not.
+  if (cpu < last_bundle_cpu_) {
+    emit_up_to_ts_ = last_round_end_ts_;
+    last_round_end_ts_ = max_event_ts_;
+  }
+  last_bundle_cpu_ = cpu;
+
+  events_.clear();
+  for (auto it = bundle.event(); it; ++it) {
+    DecodedEvent event{};
+    event.type = DecodedEvent::Type::kFtraceEvent;
+    protozero::ProtoDecoder decoder(*it);
+    for (auto fld = decoder.ReadField(); fld.valid();
+         fld = decoder.ReadField()) {
+      if (fld.id() == FtraceEvent::kTimestampFieldNumber) {
+        event.ts = static_cast<int64_t>(fld.as_uint64());
+      } else if (fld.id() == FtraceEvent::kPidFieldNumber) {
+        event.pid = fld.as_uint32();
+      } else {
+        event.event_id = fld.id();
+        event.payload = fld.as_bytes();
+      }
+    }
+    if (event.event_id != 0)
+      events_.push_back(event);
+  }
+  if (bundle.has_compact_sched())
+    DecodeCompactSched(bundle.compact_sched());
+
+  // The events of each kind are already sorted but they need to be merged
+  // as the compact ones depend on the sched_switch events before them.
+  std::stable_sort(events_.begin(), events_.end(),
+                   [](const DecodedEvent& a, const DecodedEvent& b) {
+                     return a.ts < b.ts;
+                   });
+
+  seen_ftrace_ = true;
+  for (const DecodedEvent& event : events_) {
+    max_event_ts_ = std::max(max_event_ts_, event.ts);
+    if (event.ts < tracing_started_ts_)
+      continue;
+    switch (event.type) {
+      case DecodedEvent::Type::kFtraceEvent:
+        ConvertEvent(cpu, seq_id, event);
+        break;
+      case DecodedEvent::Type::kCompactSwitch:
+        ConvertCompactSwitch(cpu, event);
+        break;
+      case DecodedEvent::Type::kCompactWaking:
+        ConvertCompactWaking(cpu, event);
+        break;
+    }
+  }
+  EmitLines(/*flush_all=*/false);
+}
+
+void SystraceStreamingConverter::DecodeCompactSched(ConstBytes bytes) {
+  protos::pbzero::FtraceEventBundle::CompactSched::Decoder compact(bytes);
+  std::vector<base::StringView> string_table;
+  for (auto it = compact.intern_table(); it; ++it)
+    string_table.push_back(*it);
+  auto comm = [&string_table](uint32_t index) {
+    return index < string_table.size() ? string_table[index]
+                                       : base::StringView();
+  };
+
+  // The fields of the events are stored as packed arrays: walk them in step
+  // to recover the individual events. Timestamps are delta encoded.
+  bool parse_error = false;
+  int64_t ts = 0;
+  auto s_ts = compact.switch_timestamp(&parse_error);
+  auto s_state = compact.switch_prev_state(&parse_error);
+  auto s_pid = compact.switch_next_pid(&parse_error);
+  auto s_prio = compact.switch_next_prio(&parse_error);
+  auto s_comm = compact.switch_next_comm_index(&parse_error);
+  for (; s_ts && s_state && s_pid && s_prio && s_comm;
+       ++s_ts, ++s_state, ++s_pid, ++s_prio, ++s_comm) {
+    ts += static_cast<int64_t>(*s_ts);
+    DecodedEvent event{};
+    event.type = DecodedEvent::Type::kCompactSwitch;
+    event.ts = ts;
+    event.prev_state = *s_state;
+    event.pid = static_cast<uint32_t>(*s_pid);
+    event.prio = *s_prio;
+    event.comm = comm(*s_comm);
+    events_.push_back(event);
+  }
+
+  ts = 0;
+  auto w_ts = compact.waking_timestamp(&parse_error);
+  auto w_pid = compact.waking_pid(&parse_error);
+  auto w_cpu = compact.waking_target_cpu(&parse_error);
+  auto w_prio = compact.waking_prio(&parse_error);
+  auto w_comm = compact.waking_comm_index(&parse_error);
+  for (; w_ts && w_pid && w_cpu && w_prio && w_comm;
+       ++w_ts, ++w_pid, ++w_cpu, ++w_prio, ++w_comm) {
+    ts += static_cast<int64_t>(*w_ts);
+    DecodedEvent event{};
+    event.type = DecodedEvent::Type::kCompactWaking;
+    event.ts = ts;
+    event.pid = static_cast<uint32_t>(*w_pid);
+    event.target_cpu = *w_cpu;
+    event.prio = *w_prio;
+    event.comm = comm(*w_comm);
+    events_.push_back(event);
+  }
+
+  if (parse_error)
+    PERFETTO_ELOG("Failed to fully decode compact sched events");
+}
+
+void SystraceStreamingConverter::ConvertEvent(uint32_t cpu,
+                                              uint32_t seq_id,
+                                              const DecodedEvent& event) {
+  base::StringView event_name;
+  if (event.event_id == FtraceEvent::kGenericFieldNumber) {
+    DecodeGenericFields(event.payload, &event_name);
+  } else {
+    if (event.event_id >= trace_processor::GetDescriptorsSize())
+      return;
+    auto* descriptor =
+        trace_processor::GetMessageDescriptorForId(event.event_id);
+    if (!descriptor->name)
+      return;
+    event_name = descriptor->name;
+    DecodeFields(seq_id, event.event_id, event.payload);
+  }
+
+  // The task which the line is attributed to is the one switched out for
+  // sched_switch and the one which emitted the event otherwise.
+  uint32_t tid = event.pid;
+  if (event.event_id == FtraceEvent::kSchedSwitchFieldNumber) {
+    using SS = protos::pbzero::SchedSwitchFtraceEvent;
+    tid = static_cast<uint32_t>(GetField(SS::kPrevPidFieldNumber).int_value);
+
+    CpuState* state = &cpu_states_[cpu];
+    state->has_last_switch = true;
+    state->last_pid =
+        static_cast<uint32_t>(GetField(SS::kNextPidFieldNumber).int_value);
+    state->last_prio =
+        static_cast<int32_t>(GetField(SS::kNextPrioFieldNumber).int_value);
+  }
+  UpdateThreadsForEvent(event.event_id, event.pid);
+
+  base::StringWriter writer(line_, sizeof(line_));
+  writer_ = &writer;
+  WritePrefix(event.ts, cpu, tid);
+  writer.AppendChar(' ');
+  if (event.event_id == FtraceEvent::kPrintFieldNumber ||
+      event.event_id == FtraceEvent::kG2dTracingMarkWriteFieldNumber ||
+      event.event_id == FtraceEvent::kDpuTracingMarkWriteFieldNumber) {
+    writer.AppendLiteral("tracing_mark_write");
+  } else {
+    writer.AppendString(event_name);
+  }
+  writer.AppendChar(':');
+  WriteArgs(event.event_id);
+  PushLine(cpu, event.ts, writer.GetStringView());
+  writer_ = nullptr;
+}
+
+void SystraceStreamingConverter::ConvertCompactSwitch(
+    uint32_t cpu,
+    const DecodedEvent& event) {
+  using SS = protos::pbzero::SchedSwitchFtraceEvent;
+
+  SetThreadNameFromFtrace(event.pid, event.comm);
+
+  // The first switch of each CPU is dropped as the task switched out is not
+  // known.
+  CpuState* state = &cpu_states_[cpu];
+  CpuState prev = *state;
+  state->has_last_switch = true;
+  state->last_pid = event.pid;
+  state->last_prio = event.prio;
+  if (!prev.has_last_switch)
+    return;
+
+  // Infer the task switched out from the previous switch on this CPU.
+  const Thread* prev_thread = GetOrCreateThread(prev.last_pid);
+  ClearFields();
+  SetField(SS::kPrevCommFieldNumber,
+           StringValue(base::StringView(prev_thread->name)));
+  SetField(SS::kPrevPidFieldNumber, IntValue(prev.last_pid));
+  SetField(SS::kPrevPrioFieldNumber, IntValue(prev.last_prio));
+  SetField(SS::kPrevStateFieldNumber, IntValue(event.prev_state));
+  SetField(SS::kNextCommFieldNumber, StringValue(event.comm));
+  SetField(SS::kNextPidFieldNumber, IntValue(event.pid));
+  SetField(SS::kNextPrioFieldNumber, IntValue(event.prio));
+
+  base::StringWriter writer(line_, sizeof(line_));
+  writer_ = &writer;
+  WritePrefix(event.ts, cpu, prev.last_pid);
+  writer.AppendLiteral(" sched_switch:");
+  WriteArgs(FtraceEvent::kSchedSwitchFieldNumber);
+  PushLine(cpu, event.ts, writer.GetStringView());
+  writer_ = nullptr;
+}
+
+void SystraceStreamingConverter::ConvertCompactWaking(
+    uint32_t cpu,
+    const DecodedEvent& event) {
+  using SW = protos::pbzero::SchedWakingFtraceEvent;
+
+  // The task which emitted the event is the one running on the CPU. Drop the
+  // event if it is not known.
+  const CpuState& state = cpu_states_[cpu];
+  if (!state.has_last_switch)
+    return;
+
+  // "success" is hardcoded as always 1 by the kernel.
+  ClearFields();
+  SetField(SW::kCommFieldNumber, StringValue(event.comm));
+  SetField(SW::kPidFieldNumber, IntValue(event.pid));
+  SetField(SW::kPrioFieldNumber, IntValue(event.prio));
+  SetField(SW::kSuccessFieldNumber, IntValue(1));
+  SetField(SW::kTargetCpuFieldNumber, IntValue(event.target_cpu));
+  SortFields();
+
+  base::StringWriter writer(line_, sizeof(line_));
+  writer_ = &writer;
+  WritePrefix(event.ts, cpu, state.last_pid);
+  writer.AppendLiteral(" sched_waking:");
+  WriteArgs(FtraceEvent::kSchedWakingFieldNumber);
+  PushLine(cpu, event.ts, writer.GetStringView());
+  writer_ = nullptr;
+}
+
+void SystraceStreamingConverter::UpdateThreadsForEvent(uint32_t event_id,
+                                                       uint32_t pid) {
+  switch (event_id) {
+    case FtraceEvent::kSchedSwitchFieldNumber: {
+      using SS = protos::pbzero::SchedSwitchFtraceEvent;
+      SetThreadNameFromFtrace(
+          static_cast<uint32_t>(GetField(SS::kNextPidFieldNumber).int_value),
+          GetField(SS::kNextCommFieldNumber).string_value);
+      SetThreadNameFromFtrace(
+          static_cast<uint32_t>(GetField(SS::kPrevPidFieldNumber).int_value),
+          GetField(SS::kPrevCommFieldNumber).string_value);
+      break;
+    }
+    case FtraceEvent::kSchedWakeupFieldNumber: {
+      using SW = protos::pbzero::SchedWakeupFtraceEvent;
+      SetThreadNameFromFtrace(
+          static_cast<uint32_t>(GetField(SW::kPidFieldNumber).int_value),
+          GetField(SW::kCommFieldNumber).string_value);
+      break;
+    }
+    case FtraceEvent::kSchedWakingFieldNumber: {
+      using SW = protos::pbzero::SchedWakingFtraceEvent;
+      SetThreadNameFromFtrace(
+          static_cast<uint32_t>(GetField(SW::kPidFieldNumber).int_value),
+          GetField(SW::kCommFieldNumber).string_value);
+      break;
+    }
+    case FtraceEvent::kTaskNewtaskFieldNumber: {
+      using TN = protos::pbzero::TaskNewtaskFtraceEvent;
+      uint32_t new_tid =
+          static_cast<uint32_t>(GetField(TN::kPidFieldNumber).int_value);
+      uint64_t clone_flags = GetField(TN::kCloneFlagsFieldNumber).uint_value;
+      uint32_t tgid = (clone_flags & kCloneThread)
+                          ? GetOrCreateThread(pid)->tgid
+                          : new_tid;
+      SetThreadNameFromFtrace(new_tid,
+                              GetField(TN::kCommFieldNumber).string_value);
+      GetOrCreateThread(new_tid)->tgid = tgid;
+      break;
+    }
+    case FtraceEvent::kPrintFieldNumber: {
+      // Atrace begin and end markers contain the tgid of the thread.
+      using P = protos::pbzero::PrintFtraceEvent;
+      using trace_processor::systrace_utils::SystraceParseResult;
+      trace_processor::systrace_utils::SystraceTracePoint point;
+      auto result = trace_processor::systrace_utils::ParseSystraceTracePoint(
+          GetField(P::kBufFieldNumber).string_value, &point);
+      if (result == SystraceParseResult::kSuccess &&
+          (point.phase == 'B' || point.phase == 'E') && point.tgid != 0) {
+        GetOrCreateThread(pid)->tgid = point.tgid;
+      }
+      break;
+    }
+    case FtraceEvent::kTaskRenameFieldNumber: {
+      using TR = protos::pbzero::TaskRenameFtraceEvent;
+      SetThreadNameFromFtrace(
+          static_cast<uint32_t>(GetField(TR::kPidFieldNumber).int_value),
+          GetField(TR::kNewcommFieldNumber).string_value);
+      break;
+    }
+  }
+}
+
+void SystraceStreamingConverter::ClearFields() {
+  for (uint32_t field_id : field_ids_)
+    fields_[field_id] = FieldValue();
+  field_ids_.clear();
+  generic_args_.clear();
+}
+
+void SystraceStreamingConverter::SetField(uint32_t field_id,
+                                          const FieldValue& value) {
+  if (fields_[field_id].type == FieldValue::Type::kNone)
+    field_ids_.push_back(field_id);
+  fields_[field_id] = value;
+}
+
+const SystraceStreamingConverter::FieldValue&
+SystraceStreamingConverter::GetField(uint32_t field_id) const {
+  PERFETTO_DCHECK(field_id < fields_.size());
+  return fields_[field_id];
+}
+
+void SystraceStreamingConverter::DecodeFields(uint32_t seq_id,
+                                              uint32_t event_id,
+                                              ConstBytes payload) {
+  ClearFields();
+  auto* descriptor = trace_processor::GetMessageDescriptorForId(event_id);
+  protozero::ProtoDecoder decoder(payload);
+  for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
+    uint32_t field_id = fld.id();
+    if (field_id >= trace_processor::kMaxFtraceEventFields)
+      continue;
+
+    if (trace_processor::FtraceParser::IsKernelFunctionField(event_id,
+                                                             field_id)) {
+      auto seq_it = kernel_symbols_.find(seq_id);
+      if (seq_it != kernel_symbols_.end()) {
+        auto sym_it = seq_it->second.find(fld.as_uint64());
+        if (sym_it != seq_it->second.end()) {
+          SetField(field_id, StringValue(base::StringView(sym_it->second)));
+          continue;
+        }
+      }
+    }
+
+    // Decode the values in the same way as FtraceParser does.
+    FieldValue value;
+    switch (descriptor->fields[field_id].type) {
+      case ProtoSchemaType::kInt32:
+      case ProtoSchemaType::kInt64:
+      case ProtoSchemaType::kSfixed32:
+      case ProtoSchemaType::kSfixed64:
+      case ProtoSchemaType::kSint32:
+      case ProtoSchemaType::kSint64:
+      case ProtoSchemaType::kBool:
+      case ProtoSchemaType::kEnum:
+        value = IntValue(fld.as_int64());
+        break;
+      case ProtoSchemaType::kUint32:
+      case ProtoSchemaType::kUint64:
+      case ProtoSchemaType::kFixed32:
+      case ProtoSchemaType::kFixed64:
+        value = UintValue(fld.as_uint64());
+        break;
+      case ProtoSchemaType::kString:
+      case ProtoSchemaType::kBytes:
+        value = StringValue(fld.as_string());
+        break;
+      case ProtoSchemaType::kDouble:
+        value.type = FieldValue::Type::kReal;
+        value.real_value = fld.as_double();
+        break;
+      case ProtoSchemaType::kFloat:
+        value.type = FieldValue::Type::kReal;
+        value.real_value = static_cast<double>(fld.as_float());
+        break;
+      case ProtoSchemaType::kUnknown:
+      case ProtoSchemaType::kGroup:
+      case ProtoSchemaType::kMessage:
+        continue;
+    }
+    SetField(field_id, value);
+  }
+  SortFields();
+}
+
+void SystraceStreamingConverter::DecodeGenericFields(
+    ConstBytes payload,
+    base::StringView* event_name) {
+  ClearFields();
+  protos::pbzero::GenericFtraceEvent::Decoder evt(payload);
+  *event_name = evt.event_name();
+  for (auto it = evt.field(); it; ++it) {
+    protos::pbzero::GenericFtraceEvent::Field::Decoder fld(*it);
+    FieldValue value;
+    if (fld.has_int_value()) {
+      value = IntValue(fld.int_value());
+    } else if (fld.has_uint_value()) {
+      value = IntValue(static_cast<int64_t>(fld.uint_value()));
+    } else if (fld.has_str_value()) {
+      value = StringValue(fld.str_value());
+    } else {
+      continue;
+    }
+    generic_args_.push_back(GenericArg{fld.name(), value});
+  }
+
+  // to_ftrace writes the args of generic events sorted by key. If a key is
+  // repeated, only the last value is kept in the args table.
+  std::stable_sort(generic_args_.begin(), generic_args_.end(),
+                   [](const GenericArg& a, const GenericArg& b) {
+                     return a.key < b.key;
+                   });
+  size_t out = 0;
+  for (size_t i = 0; i < generic_args_.size(); ++i) {
+    if (i + 1 < generic_args_.size() &&
+        generic_args_[i].key == generic_args_[i + 1].key) {
+      continue;
+    }
+    generic_args_[out++] = generic_args_[i];
+  }
+  generic_args_.resize(out);
+}
+
+void SystraceStreamingConverter::SortFields() {
+  std::sort(field_ids_.begin(), field_ids_.end());
+}
+
+SystraceStreamingConverter::FieldValue SystraceStreamingConverter::IntValue(
+    int64_t value) {
+  FieldValue field;
+  field.type = FieldValue::Type::kInt;
+  field.int_value = value;
+  field.uint_value = static_cast<uint64_t>(value);
+  return field;
+}
+
+SystraceStreamingConverter::FieldValue SystraceStreamingConverter::UintValue(
+    uint64_t value) {
+  FieldValue field;
+  field.type = FieldValue::Type::kUint;
+  field.int_value = static_cast<int64_t>(value);
+  field.uint_value = value;
+  return field;
+}
+
+SystraceStreamingConverter::FieldValue SystraceStreamingConverter::StringValue(
+    base::StringView value) {
+  FieldValue field;
+  field.type = FieldValue::Type::kString;
+  field.string_value = value;
+  return field;
+}
+
+SystraceStreamingConverter::Thread*
+SystraceStreamingConverter::GetOrCreateThread(uint32_t tid) {
+  return &threads_[tid];
+}
+
+void SystraceStreamingConverter::SetThreadNameFromFtrace(
+    uint32_t tid,
+    base::StringView name) {
+  Thread* thread = GetOrCreateThread(tid);
+  if (thread->name_from_process_tree)
+    return;
+  thread->name.assign(name.data(), name.size());
+}
+
+void SystraceStreamingConverter::WritePrefix(int64_t ts,
+                                             uint32_t cpu,
+                                             uint32_t tid) {
+  // Keep in sync with SystraceSerializer::SerializePrefix.
+  const Thread* thread = GetOrCreateThread(tid);
+  base::StringView name(thread->name);
+  if (tid == 0) {
+    name = "<idle>";
+  } else if (name.empty()) {
+    name = "<unknown>";
+  }
+
+  int64_t padding = 16 - static_cast<int64_t>(name.size());
+  if (padding > 0) {
+    writer_->AppendChar(' ', static_cast<size_t>(padding));
+  }
+  for (size_t i = 0; i < name.size(); ++i) {
+    char c = name.data()[i];
+    writer_->AppendChar(c == '-' ? '_' : c);
+  }
+  writer_->AppendChar('-');
+
+  size_t pre_pid_pos = writer_->pos();
+  writer_->AppendInt(tid);
+  size_t pid_chars = writer_->pos() - pre_pid_pos;
+  if (PERFETTO_LIKELY(pid_chars < 5)) {
+    writer_->AppendChar(' ', 5 - pid_chars);
+  }
+
+  writer_->AppendLiteral(" (");
+  if (thread->tgid == 0) {
+    writer_->AppendLiteral("-----");
+  } else {
+    writer_->AppendPaddedInt<' ', 5>(thread->tgid);
+  }
+  writer_->AppendLiteral(") [");
+  writer_->AppendPaddedInt<'0', 3>(cpu);
+  writer_->AppendLiteral("] .... ");
+
+  FtraceTime ftrace_time(ts);
+  writer_->AppendInt(ftrace_time.secs);
+  writer_->AppendChar('.');
+  writer_->AppendPaddedInt<'0', 6>(ftrace_time.micros);
+  writer_->AppendChar(':');
+}
+
+void SystraceStreamingConverter::WriteArgs(uint32_t event_id) {
+  // Keep in sync with ArgsSerializer::SerializeArgs in sqlite_raw_table.cc.
+  switch (event_id) {
+    case FtraceEvent::kSchedSwitchFieldNumber: {
+      using SS = protos::pbzero::SchedSwitchFtraceEvent;
+      WriteArgForField(event_id, SS::kPrevCommFieldNumber);
+      WriteArgForField(event_id, SS::kPrevPidFieldNumber);
+      WriteArgForField(event_id, SS::kPrevPrioFieldNumber);
+      if (WriteKeyForField(event_id, SS::kPrevStateFieldNumber)) {
+        auto state = static_cast<uint16_t>(
+            GetField(SS::kPrevStateFieldNumber).int_value);
+        writer_->AppendString(
+            trace_processor::ftrace_utils::TaskState(state, kernel_version_)
+                .ToString('|')
+                .data());
+      }
+      writer_->AppendLiteral(" ==>");
+      WriteArgForField(event_id, SS::kNextCommFieldNumber);
+      WriteArgForField(event_id, SS::kNextPidFieldNumber);
+      WriteArgForField(event_id, SS::kNextPrioFieldNumber);
+      return;
+    }
+    case FtraceEvent::kSchedWakeupFieldNumber: {
+      using SW = protos::pbzero::SchedWakeupFtraceEvent;
+      WriteArgForField(event_id, SW::kCommFieldNumber);
+      WriteArgForField(event_id, SW::kPidFieldNumber);
+      WriteArgForField(event_id, SW::kPrioFieldNumber);
+      if (WriteKeyForField(event_id, SW::kTargetCpuFieldNumber)) {
+        writer_->AppendPaddedInt<'0', 3>(
+            GetField(SW::kTargetCpuFieldNumber).int_value);
+      }
+      return;
+    }
+    case FtraceEvent::kClockSetRateFieldNumber: {
+      using CSR = protos::pbzero::ClockSetRateFtraceEvent;
+      writer_->AppendChar(' ');
+      WriteValue(GetField(CSR::kNameFieldNumber));
+      WriteArgForField(event_id, CSR::kStateFieldNumber);
+      WriteArgForField(event_id, CSR::kCpuIdFieldNumber);
+      return;
+    }
+    case FtraceEvent::kClkSetRateFieldNumber: {
+      using CSR = protos::pbzero::ClkSetRateFtraceEvent;
+      writer_->AppendChar(' ');
+      WriteValue(GetField(CSR::kNameFieldNumber));
+      writer_->AppendChar(' ');
+      WriteValue(GetField(CSR::kRateFieldNumber));
+      return;
+    }
+    case FtraceEvent::kClockEnableFieldNumber: {
+      using CE = protos::pbzero::ClockEnableFtraceEvent;
+      WriteValue(GetField(CE::kNameFieldNumber));
+      WriteArgForField(event_id, CE::kStateFieldNumber);
+      WriteArgForField(event_id, CE::kCpuIdFieldNumber);
+      return;
+    }
+    case FtraceEvent::kClockDisableFieldNumber: {
+      using CD = protos::pbzero::ClockDisableFtraceEvent;
+      WriteValue(GetField(CD::kNameFieldNumber));
+      WriteArgForField(event_id, CD::kStateFieldNumber);
+      WriteArgForField(event_id, CD::kCpuIdFieldNumber);
+      return;
+    }
+    case FtraceEvent::kBinderTransactionFieldNumber: {
+      using BT = protos::pbzero::BinderTransactionFtraceEvent;
+      writer_->AppendLiteral(" transaction=");
+      writer_->AppendUnsignedInt(
+          static_cast<uint32_t>(GetField(BT::kDebugIdFieldNumber).int_value));
+      writer_->AppendLiteral(" dest_node=");
+      writer_->AppendUnsignedInt(static_cast<uint32_t>(
+          GetField(BT::kTargetNodeFieldNumber).int_value));
+      writer_->AppendLiteral(" dest_proc=");
+      WriteValue(GetField(BT::kToProcFieldNumber));
+      writer_->AppendLiteral(" dest_thread=");
+      WriteValue(GetField(BT::kToThreadFieldNumber));
+      writer_->AppendLiteral(" reply=");
+      WriteValue(GetField(BT::kReplyFieldNumber));
+      writer_->AppendLiteral(" flags=0x");
+      writer_->AppendHexInt(GetField(BT::kFlagsFieldNumber).uint_value);
+      writer_->AppendLiteral(" code=0x");
+      writer_->AppendHexInt(GetField(BT::kCodeFieldNumber).uint_value);
+      return;
+    }
+    case FtraceEvent::kBinderTransactionAllocBufFieldNumber: {
+      using BTAB = protos::pbzero::BinderTransactionAllocBufFtraceEvent;
+      writer_->AppendLiteral(" transaction=");
+      writer_->AppendUnsignedInt(static_cast<uint32_t>(
+          GetField(BTAB::kDebugIdFieldNumber).int_value));
+      WriteArgForField(event_id, BTAB::kDataSizeFieldNumber);
+      WriteArgForField(event_id, BTAB::kOffsetsSizeFieldNumber);
+      return;
+    }
+    case FtraceEvent::kBinderTransactionReceivedFieldNumber: {
+      using BTR = protos::pbzero::BinderTransactionReceivedFtraceEvent;
+      writer_->AppendLiteral(" transaction=");
+      writer_->AppendUnsignedInt(
+          static_cast<uint32_t>(GetField(BTR::kDebugIdFieldNumber).int_value));
+      return;
+    }
+    case FtraceEvent::kMmFilemapAddToPageCacheFieldNumber: {
+      using MFA = protos::pbzero::MmFilemapAddToPageCacheFtraceEvent;
+      uint64_t dev = GetField(MFA::kSDevFieldNumber).uint_value;
+      writer_->AppendLiteral(" dev ");
+      writer_->AppendUnsignedInt(dev >> 20);
+      writer_->AppendChar(':');
+      writer_->AppendUnsignedInt(dev & ((1 << 20) - 1));
+      writer_->AppendLiteral(" ino ");
+      writer_->AppendHexInt(GetField(MFA::kIInoFieldNumber).uint_value);
+      writer_->AppendLiteral(" page=0000000000000000");
+      writer_->AppendLiteral(" pfn=");
+      WriteValue(GetField(MFA::kPfnFieldNumber));
+      writer_->AppendLiteral(" ofs=");
+      writer_->AppendUnsignedInt(GetField(MFA::kIndexFieldNumber).uint_value
+                                 << 12);
+      return;
+    }
+    case FtraceEvent::kPrintFieldNumber: {
+      using P = protos::pbzero::PrintFtraceEvent;
+      writer_->AppendChar(' ');
+      // If the last character is a newline in a print, just drop it.
+      base::StringView str = GetField(P::kBufFieldNumber).string_value;
+      if (!str.empty() && str.at(str.size() - 1) == '\n')
+        str = str.substr(0, str.size() - 1);
+      WriteString(str);
+      return;
+    }
+    case FtraceEvent::kSchedBlockedReasonFieldNumber: {
+      using SBR = protos::pbzero::SchedBlockedReasonFtraceEvent;
+      WriteArgForField(event_id, SBR::kPidFieldNumber);
+      WriteArgForField(event_id, SBR::kIoWaitFieldNumber);
+      if (WriteKeyForField(event_id, SBR::kCallerFieldNumber))
+        WriteKernelFnValue(GetField(SBR::kCallerFieldNumber));
+      return;
+    }
+    case FtraceEvent::kWorkqueueActivateWorkFieldNumber: {
+      using WAW = protos::pbzero::WorkqueueActivateWorkFtraceEvent;
+      writer_->AppendLiteral(" work struct ");
+      writer_->AppendHexInt(GetField(WAW::kWorkFieldNumber).uint_value);
+      return;
+    }
+    case FtraceEvent::kWorkqueueExecuteStartFieldNumber: {
+      using WES = protos::pbzero::WorkqueueExecuteStartFtraceEvent;
+      writer_->AppendLiteral(" work struct ");
+      writer_->AppendHexInt(GetField(WES::kWorkFieldNumber).uint_value);
+      writer_->AppendLiteral(": function ");
+      WriteKernelFnValue(GetField(WES::kFunctionFieldNumber));
+      return;
+    }
+    case FtraceEvent::kWorkqueueExecuteEndFieldNumber: {
+      using WE = protos::pbzero::WorkqueueExecuteEndFtraceEvent;
+      writer_->AppendLiteral(" work struct ");
+      writer_->AppendHexInt(GetField(WE::kWorkFieldNumber).uint_value);
+      return;
+    }
+    case FtraceEvent::kWorkqueueQueueWorkFieldNumber: {
+      using WQW = protos::pbzero::WorkqueueQueueWorkFtraceEvent;
+      writer_->AppendLiteral(" work struct=");
+      writer_->AppendHexInt(GetField(WQW::kWorkFieldNumber).uint_value);
+      if (WriteKeyForField(event_id, WQW::kFunctionFieldNumber))
+        WriteKernelFnValue(GetField(WQW::kFunctionFieldNumber));
+      if (WriteKeyForField(event_id, WQW::kWorkqueueFieldNumber))
+        writer_->AppendHexInt(GetField(WQW::kWorkqueueFieldNumber).uint_value);
+      WriteValue(GetField(WQW::kReqCpuFieldNumber));
+      WriteValue(GetField(WQW::kCpuFieldNumber));
+      return;
+    }
+    case FtraceEvent::kIrqHandlerEntryFieldNumber: {
+      using IEN = protos::pbzero::IrqHandlerEntryFtraceEvent;
+      WriteArgForField(event_id, IEN::kIrqFieldNumber);
+      WriteArgForField(event_id, IEN::kNameFieldNumber);
+      return;
+    }
+    case FtraceEvent::kIrqHandlerExitFieldNumber: {
+      using IEX = protos::pbzero::IrqHandlerExitFtraceEvent;
+      WriteArgForField(event_id, IEX::kIrqFieldNumber);
+      writer_->AppendLiteral(" ret=");
+      writer_->AppendString(GetField(IEX::kRetFieldNumber).uint_value
+                                ? "handled"
+                                : "unhandled");
+      return;
+    }
+    case FtraceEvent::kSoftirqEntryFieldNumber:
+    case FtraceEvent::kSoftirqExitFieldNumber: {
+      // The vec field has the same id in both events.
+      using SIE = protos::pbzero::SoftirqEntryFtraceEvent;
+      WriteArgForField(event_id, SIE::kVecFieldNumber);
+      writer_->AppendLiteral(" [action=");
+      uint64_t vec = GetField(SIE::kVecFieldNumber).uint_value;
+      constexpr size_t kNumActions =
+          sizeof(trace_processor::kActionNames) /
+          sizeof(*trace_processor::kActionNames);
+      if (vec < kNumActions)
+        writer_->AppendString(trace_processor::kActionNames[vec]);
+      writer_->AppendChar(']');
+      return;
+    }
+    case FtraceEvent::kDpuTracingMarkWriteFieldNumber:
+    case FtraceEvent::kG2dTracingMarkWriteFieldNumber: {
+      // The fields have the same ids in both events.
+      using TMW = protos::pbzero::DpuTracingMarkWriteFtraceEvent;
+      writer_->AppendChar(
+          static_cast<char>(GetField(TMW::kTypeFieldNumber).uint_value));
+      writer_->AppendChar('|');
+      WriteValue(GetField(TMW::kPidFieldNumber));
+      writer_->AppendChar('|');
+      WriteValue(GetField(TMW::kNameFieldNumber));
+      writer_->AppendChar('|');
+      WriteValue(GetField(TMW::kValueFieldNumber));
+      return;
+    }
+    case FtraceEvent::kGenericFieldNumber:
+      for (const GenericArg& arg : generic_args_)
+        WriteArg(arg.key, arg.value);
+      return;
+  }
+
+  auto* descriptor = trace_processor::GetMessageDescriptorForId(event_id);
+  for (uint32_t field_id : field_ids_)
+    WriteArg(descriptor->fields[field_id].name, fields_[field_id]);
+}
+
+bool SystraceStreamingConverter::WriteKeyForField(uint32_t event_id,
+                                                  uint32_t field_id) {
+  if (GetField(field_id).type == FieldValue::Type::kNone)
+    return false;
+  auto* descriptor = trace_processor::GetMessageDescriptorForId(event_id);
+  writer_->AppendChar(' ');
+  writer_->AppendString(base::StringView(descriptor->fields[field_id].name));
+  writer_->AppendChar('=');
+  return true;
+}
+
+void SystraceStreamingConverter::WriteArgForField(uint32_t event_id,
+                                                  uint32_t field_id) {
+  auto* descriptor = trace_processor::GetMessageDescriptorForId(event_id);
+  if (GetField(field_id).type == FieldValue::Type::kNone)
+    return;
+  WriteArg(descriptor->fields[field_id].name, GetField(field_id));
+}
+
+void SystraceStreamingConverter::WriteArg(base::StringView key,
+                                          const FieldValue& value) {
+  writer_->AppendChar(' ');
+  writer_->AppendString(key);
+  writer_->AppendChar('=');
+  if (key == "gfp_flags") {
+    trace_processor::WriteGfpFlag(value.uint_value, kernel_version_, writer_);
+    return;
+  }
+  WriteValue(value);
+}
+
+void SystraceStreamingConverter::WriteValue(const FieldValue& value) {
+  switch (value.type) {
+    case FieldValue::Type::kNone:
+      break;
+    case FieldValue::Type::kInt:
+      writer_->AppendInt(value.int_value);
+      break;
+    case FieldValue::Type::kUint:
+      writer_->AppendUnsignedInt(value.uint_value);
+      break;
+    case FieldValue::Type::kString:
+      WriteString(value.string_value);
+      break;
+    case FieldValue::Type::kReal:
+      writer_->AppendDouble(value.real_value);
+      break;
+  }
+}
+
+void SystraceStreamingConverter::WriteKernelFnValue(const FieldValue& value) {
+  if (value.type == FieldValue::Type::kUint) {
+    writer_->AppendHexInt(value.uint_value);
+  } else {
+    WriteValue(value);
+  }
+}
+
+void SystraceStreamingConverter::WriteString(base::StringView str) {
+  // Leave enough space for the other args of the event: the strings are the
+  // only values of unbounded size.
+  size_t available = kMaxLineSize - kLineReservedSize;
+  size_t max_size = writer_->pos() < available ? available - writer_->pos() : 0;
+  writer_->AppendString(str.data(), std::min(str.size(), max_size));
+}
+
+void SystraceStreamingConverter::PushLine(uint32_t cpu,
+                                          int64_t ts,
+                                          base::StringView line) {
+  CpuQueue* queue = &cpu_queues_[cpu];
+  PERFETTO_DCHECK(!queue->seen || ts >= queue->max_ts);
+  queue->seen = true;
+  queue->max_ts = std::max(queue->max_ts, ts);
+
+  if (queue->consumed > queue->buffer.size() / 2) {
+    queue->buffer.erase(0, queue->consumed);
+    for (PendingLine& pending : queue->lines)
+      pending.offset -= queue->consumed;
+    queue->consumed = 0;
+  }
+  queue->lines.push_back(PendingLine{ts, queue->buffer.size(), line.size()});
+  queue->buffer.append(line.data(), line.size());
+  buffered_bytes_ += line.size();
+}
+
+void SystraceStreamingConverter::EmitLines(bool flush_all) {
+  // An event can only be written out once no earlier event can arrive on
+  // any CPU, see |emit_up_to_ts_|. Only the read rounds matter, not the
+  // timestamps reached by each CPU, so that an idle CPU does not hold back
+  // the events of the others.
+  int64_t watermark =
+      flush_all ? std::numeric_limits<int64_t>::max() : emit_up_to_ts_;
+
+  for (;;) {
+    CpuQueue* min_queue = nullptr;
+    for (CpuQueue& queue : cpu_queues_) {
+      if (queue.lines.empty())
+        continue;
+      if (!min_queue || queue.lines.front().ts < min_queue->lines.front().ts)
+        min_queue = &queue;
+    }
+    if (!min_queue)
+      break;
+
+    const PendingLine& line = min_queue->lines.front();
+    if (line.ts >= watermark && buffered_bytes_ <= kMaxBufferedBytes)
+      break;
+
+    EmitLine(base::StringView(min_queue->buffer.data() + line.offset,
+                              line.size));
+    buffered_bytes_ -= line.size;
+    min_queue->consumed += line.size;
+    min_queue->lines.pop_front();
+    if (min_queue->lines.empty()) {
+      min_queue->buffer.clear();
+      min_queue->consumed = 0;
+    }
+  }
+}
+
+void SystraceStreamingConverter::EmitLine(base::StringView line) {
+  switch (truncate_keep_) {
+    case Keep::kAll:
+      break;
+    case Keep::kStart:
+      if (written_events_ >= max_events_)
+        return;
+      break;
+    case Keep::kEnd:
+      if (max_events_ == 0)
+        return;
+      if (last_lines_.size() == max_events_)
+        last_lines_.pop_front();
+      last_lines_.emplace_back(line.data(), line.size());
+      return;
+  }
+  written_events_++;
+  output_.append(line.data(), line.size());
+  output_.push_back('\n');
+  if (output_.size() >= kOutputChunkSize)
+    FlushOutput();
+}
+
+void SystraceStreamingConverter::FlushOutput() {
+  if (output_.empty())
+    return;
+  trace_writer_->Write(output_.data(), output_.size());
+  output_.clear();
+}
+
+}  // namespace trace_to_text
+}  // namespace perfetto
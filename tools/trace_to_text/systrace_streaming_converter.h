@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TOOLS_TRACE_TO_TEXT_SYSTRACE_STREAMING_CONVERTER_H_
+#define TOOLS_TRACE_TO_TEXT_SYSTRACE_STREAMING_CONVERTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <deque>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/string_writer.h"
+#include "perfetto/protozero/field.h"
+#include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/types/version_number.h"
+#include "tools/trace_to_text/trace_to_systrace.h"
+
+namespace perfetto {
+namespace trace_to_text {
+
+class TraceWriter;
+
+// Converts the ftrace events in a proto trace to systrace text without
+// loading the trace into trace processor: packets are decoded one at a time
+// with protozero, the events of each CPU are buffered and merged in timestamp
+// order and lines are written out as soon as no earlier event can arrive.
+// Memory use only depends on the number of CPUs and threads and on the amount
+// of data buffered to sort the events, not on the size of the trace.
+//
+// The lines are formatted in the same way as the to_ftrace() function of
+// trace processor with the following differences:
+//  * thread names and tgids are the ones known when an event is converted
+//    while trace processor uses the ones known at the end of the trace.
+//  * only the ftrace events are converted; other data in the trace (e.g.
+//    userspace slices) is ignored.
+class SystraceStreamingConverter {
+ public:
+  // The maximum number of bytes of formatted lines buffered to sort the
+  // events across CPUs. When exceeded, the earliest lines are written out
+  // even if an earlier event could still arrive on another CPU.
+  static constexpr size_t kMaxBufferedBytes = 64 * 1024 * 1024;
+
+  // If |truncate_keep| is not kAll, only the first or last |max_events| lines
+  // are written.
+  SystraceStreamingConverter(TraceWriter* trace_writer,
+                             Keep truncate_keep,
+                             uint32_t max_events);
+  ~SystraceStreamingConverter();
+
+  // Parses a single (possibly compressed) TracePacket.
+  void ParsePacket(const uint8_t* data, size_t size);
+
+  // Writes out all the buffered lines. Must be called once, after the last
+  // packet was parsed.
+  void NotifyEndOfFile();
+
+ private:
+  // The size of the buffer used to format a line. Strings are truncated so
+  // that at least |kLineReservedSize| bytes are left for the other fields.
+  static constexpr size_t kMaxLineSize = 16 * 1024;
+  static constexpr size_t kLineReservedSize = 4 * 1024;
+
+  struct Thread {
+    std::string name;
+    // Thread names from the process tree take precedence over the ones from
+    // ftrace events, as in trace processor.
+    bool name_from_process_tree = false;
+    uint32_t tgid = 0;
+  };
+
+  // The task running on a CPU, used to fill in the fields missing from the
+  // compact encoding of sched events.
+  struct CpuState {
+    bool has_last_switch = false;
+    uint32_t last_pid = 0;
+    int32_t last_prio = 0;
+  };
+
+  // A formatted line waiting to be merged with the ones of the other CPUs.
+  struct PendingLine {
+    int64_t ts;
+    size_t offset;
+    size_t size;
+  };
+
+  // The lines of a CPU, in timestamp order. The text of the lines is stored
+  // back to back in |buffer| to avoid an allocation per line; the first
+  // |consumed| bytes belong to lines already written out.
+  struct CpuQueue {
+    bool seen = false;
+    int64_t max_ts = 0;
+    std::deque<PendingLine> lines;
+    std::string buffer;
+    size_t consumed = 0;
+  };
+
+  // An ftrace event decoded from either an FtraceEvent message or the compact
+  // sched encoding.
+  struct DecodedEvent {
+    enum class Type { kFtraceEvent, kCompactSwitch, kCompactWaking };
+
+    Type type;
+    int64_t ts;
+
+    // kFtraceEvent: |pid| of the task which emitted the event, the field id
+    // of the event in FtraceEvent and the event payload.
+    uint32_t pid;
+    uint32_t event_id;
+    protozero::ConstBytes payload;
+
+    // kCompactSwitch and kCompactWaking: |pid| is the next or woken pid and
+    // |comm| its name.
+    int64_t prev_state;
+    int32_t prio;
+    int32_t target_cpu;
+    base::StringView comm;
+  };
+
+  // The value of an ftrace event field, typed as in the args table. As with
+  // Variadic, integers can be read as either signed or unsigned.
+  struct FieldValue {
+    enum class Type { kNone, kInt, kUint, kString, kReal };
+
+    Type type = Type::kNone;
+    int64_t int_value = 0;
+    uint64_t uint_value = 0;
+    double real_value = 0;
+    base::StringView string_value;
+  };
+
+  // A field of a generic ftrace event.
+  struct GenericArg {
+    base::StringView key;
+    FieldValue value;
+  };
+
+  static FieldValue IntValue(int64_t);
+  static FieldValue UintValue(uint64_t);
+  static FieldValue StringValue(base::StringView);
+
+  void ParseCompressedPackets(protozero::ConstBytes);
+  void ParseInternedData(uint32_t seq_id, protozero::ConstBytes);
+  void ParseProcessTree(protozero::ConstBytes);
+  void ParseSystemInfo(protozero::ConstBytes);
+  void ParseFtraceBundle(uint32_t seq_id, protozero::ConstBytes);
+  void DecodeCompactSched(protozero::ConstBytes);
+
+  void ConvertEvent(uint32_t cpu, uint32_t seq_id, const DecodedEvent&);
+  void ConvertCompactSwitch(uint32_t cpu, const DecodedEvent&);
+  void ConvertCompactWaking(uint32_t cpu, const DecodedEvent&);
+  void UpdateThreadsForEvent(uint32_t event_id, uint32_t pid);
+
+  // Decode the fields of an event into |fields_| or |generic_args_|.
+  void DecodeFields(uint32_t seq_id,
+                    uint32_t event_id,
+                    protozero::ConstBytes payload);
+  void DecodeGenericFields(protozero::ConstBytes payload,
+                           base::StringView* event_name);
+  void ClearFields();
+  void SetField(uint32_t field_id, const FieldValue&);
+  const FieldValue& GetField(uint32_t field_id) const;
+
+  // Sorts |field_ids_| in the order in which to_ftrace writes the args of
+  // typed events: by field id.
+  void SortFields();
+
+  Thread* GetOrCreateThread(uint32_t tid);
+  void SetThreadNameFromFtrace(uint32_t tid, base::StringView name);
+
+  void WritePrefix(int64_t ts, uint32_t cpu, uint32_t tid);
+  void WriteArgs(uint32_t event_id);
+  bool WriteKeyForField(uint32_t event_id, uint32_t field_id);
+  void WriteArgForField(uint32_t event_id, uint32_t field_id);
+  void WriteArg(base::StringView key, const FieldValue&);
+  void WriteValue(const FieldValue&);
+  void WriteKernelFnValue(const FieldValue&);
+  void WriteString(base::StringView);
+
+  void PushLine(uint32_t cpu, int64_t ts, base::StringView line);
+  void EmitLines(bool flush_all);
+  void EmitLine(base::StringView line);
+  void FlushOutput();
+
+  TraceWriter* const trace_writer_;
+  const Keep truncate_keep_;
+  const uint32_t max_events_;
+
+  // Interned kernel symbols, by packet sequence and interning id.
+  std::unordered_map<uint32_t, std::unordered_map<uint64_t, std::string>>
+      kernel_symbols_;
+
+  std::unordered_map<uint32_t, Thread> threads_;
+  std::vector<CpuState> cpu_states_;
+  std::vector<CpuQueue> cpu_queues_;
+
+  // The ftrace data source reads the buffers of the CPUs in turn, in order,
+  // and an empty buffer produces no bundle. Every CPU, idle or not, was read
+  // during the last finished read round, after all the events of the rounds
+  // before it had happened: no event earlier than those can arrive anymore.
+  // This does not hold for a CPU whose reads were stopped by the per period
+  // page quota of the data source; its lines can then be written out of
+  // order, as when |kMaxBufferedBytes| is exceeded.
+  uint32_t last_bundle_cpu_ = 0;
+  // The max timestamp of all the events so far, and of the events up to the
+  // end of the last finished read round.
+  int64_t max_event_ts_ = std::numeric_limits<int64_t>::min();
+  int64_t last_round_end_ts_ = std::numeric_limits<int64_t>::min();
+  // Lines before this timestamp can be written out.
+  int64_t emit_up_to_ts_ = std::numeric_limits<int64_t>::min();
+  size_t buffered_bytes_ = 0;
+
+  base::Optional<trace_processor::VersionNumber> kernel_version_;
+
+  // Ftrace events before tracing started are dropped, as in trace processor.
+  int64_t tracing_started_ts_ = 0;
+  bool seen_ftrace_ = false;
+
+  // Scratch space for the event being converted.
+  std::vector<DecodedEvent> events_;
+  std::array<FieldValue, trace_processor::kMaxFtraceEventFields> fields_;
+  std::vector<uint32_t> field_ids_;
+  std::vector<GenericArg> generic_args_;
+  char line_[kMaxLineSize];
+  base::StringWriter* writer_ = nullptr;
+
+  // Lines already merged, waiting to be written.
+  std::string output_;
+  uint32_t written_events_ = 0;
+  std::deque<std::string> last_lines_;
+};
+
+}  // namespace trace_to_text
+}  // namespace perfetto
+
+#endif  // TOOLS_TRACE_TO_TEXT_SYSTRACE_STREAMING_CONVERTER_H_
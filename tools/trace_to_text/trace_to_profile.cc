@@ -101,7 +101,6 @@ int TraceToProfile(
     uint64_t conversion_flags,
     std::string dirname_prefix,
     std::function<std::string(const SerializedProfile&)> filename_fn) {
-  std::vector<SerializedProfile> profiles;
   trace_processor::Config config;
   std::unique_ptr<trace_processor::TraceProcessor> tp =
       trace_processor::TraceProcessor::CreateInstance(config);
@@ -113,16 +112,15 @@ int TraceToProfile(
   MaybeSymbolize(tp.get());
   MaybeDeobfuscate(tp.get());
 
-  TraceToPprof(tp.get(), &profiles, conversion_mode, conversion_flags, pid,
-               timestamps);
-  if (profiles.empty()) {
-    return 0;
-  }
-
-  std::string temp_dir = GetTemp() + "/" + dirname_prefix +
-                         base::GetTimeFmt("%y%m%d%H%M%S") + GetRandomString(5);
-  PERFETTO_CHECK(base::Mkdir(temp_dir));
-  for (const auto& profile : profiles) {
+  // Write each profile as soon as it is built rather than keeping all of them
+  // in memory. The directory is only created once there is a profile.
+  std::string temp_dir;
+  auto write_profile = [&](SerializedProfile profile) {
+    if (temp_dir.empty()) {
+      temp_dir = GetTemp() + "/" + dirname_prefix +
+                 base::GetTimeFmt("%y%m%d%H%M%S") + GetRandomString(5);
+      PERFETTO_CHECK(base::Mkdir(temp_dir));
+    }
     std::string filename = temp_dir + "/" + filename_fn(profile);
     base::ScopedFile fd(base::OpenFile(filename, O_CREAT | O_WRONLY, 0700));
     if (!fd)
@@ -130,6 +128,11 @@ int TraceToProfile(
     PERFETTO_CHECK(base::WriteAll(*fd, profile.serialized.c_str(),
                                   profile.serialized.size()) ==
                    static_cast<ssize_t>(profile.serialized.size()));
+  };
+  TraceToPprof(tp.get(), write_profile, conversion_mode, conversion_flags, pid,
+               timestamps);
+  if (temp_dir.empty()) {
+    return 0;
   }
   *output << "Wrote profiles to " << temp_dir << std::endl;
   return 0;
@@ -30,6 +30,7 @@
 #include "perfetto/ext/base/string_writer.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "tools/trace_to_text/systrace_streaming_converter.h"
 #include "tools/trace_to_text/utils.h"
 
 #define FILTER_RAW_EVENTS \
@@ -83,6 +84,10 @@ const char kSystemTraceEventsFooter[] =
     "\\n<...>-12345 (-----) [000] ...1 0.000000: tracing_mark_write: "
     "trace_event_clock_sync: parent_ts=0\\n\"";
 
+// An estimate of 130b per ftrace event, allowing some space for the processes
+// and threads.
+constexpr uint32_t kMaxFtraceEvents = (140 * 1024 * 1024) / 130;
+
 inline void FormatProcess(uint32_t pid,
                           uint32_t ppid,
                           const base::StringView& name,
@@ -188,6 +193,35 @@ int TraceToSystrace(std::istream* input,
                          /*wrapped_in_json=*/false, truncate_keep);
 }
 
+int TraceToSystraceStreaming(std::istream* input,
+                             std::ostream* output,
+                             bool ctrace,
+                             Keep truncate_keep) {
+  // The streaming converter only understands proto traces: every proto trace
+  // starts with the tag of the first TracePacket (field 1, length delimited).
+  if (input->peek() != 0x0a) {
+    PERFETTO_ILOG("Not a proto trace, falling back to trace processor");
+    return TraceToSystrace(input, output, ctrace, truncate_keep,
+                           /*full_sort=*/false);
+  }
+
+  std::unique_ptr<TraceWriter> trace_writer(
+      ctrace ? new DeflateTraceWriter(output) : new TraceWriter(output));
+  if (ctrace)
+    *output << "TRACE:\n";
+  trace_writer->Write(kFtraceHeader);
+
+  SystraceStreamingConverter converter(trace_writer.get(), truncate_keep,
+                                       kMaxFtraceEvents);
+  ForEachPacketBlobInTrace(
+      input, [&converter](std::unique_ptr<char[]> buf, size_t size) {
+        converter.ParsePacket(reinterpret_cast<const uint8_t*>(buf.get()),
+                              size);
+      });
+  converter.NotifyEndOfFile();
+  return 0;
+}
+
 int ExtractSystrace(trace_processor::TraceProcessor* tp,
                     TraceWriter* trace_writer,
                     bool wrapped_in_json,
@@ -292,22 +326,18 @@ int ExtractSystrace(trace_processor::TraceProcessor* tp,
     }
   };
 
-  // An estimate of 130b per ftrace event, allowing some space for the processes
-  // and threads.
-  const uint32_t max_ftrace_events = (140 * 1024 * 1024) / 130;
-
   static const char kRawEventsQuery[] =
       "select to_ftrace(id) from raw" FILTER_RAW_EVENTS;
 
-  if (truncate_keep == Keep::kEnd && raw_events > max_ftrace_events) {
+  if (truncate_keep == Keep::kEnd && raw_events > kMaxFtraceEvents) {
     char end_truncate[150];
     sprintf(end_truncate, "%s limit %d offset %d", kRawEventsQuery,
-            max_ftrace_events, raw_events - max_ftrace_events);
+            kMaxFtraceEvents, raw_events - kMaxFtraceEvents);
     if (!q_writer.RunQuery(end_truncate, raw_callback))
       return 1;
   } else if (truncate_keep == Keep::kStart) {
     char start_truncate[150];
-    sprintf(start_truncate, "%s limit %d", kRawEventsQuery, max_ftrace_events);
+    sprintf(start_truncate, "%s limit %d", kRawEventsQuery, kMaxFtraceEvents);
     if (!q_writer.RunQuery(start_truncate, raw_callback))
       return 1;
   } else {
@@ -37,6 +37,14 @@ int TraceToSystrace(std::istream* input,
                     Keep truncate_keep,
                     bool full_sort);
 
+// Converts the ftrace events of a proto trace to systrace without loading the
+// whole trace in memory. See SystraceStreamingConverter for the differences
+// with TraceToSystrace. Non-proto traces fall back to TraceToSystrace.
+int TraceToSystraceStreaming(std::istream* input,
+                             std::ostream* output,
+                             bool ctrace,
+                             Keep truncate_keep);
+
 int ExtractSystrace(trace_processor::TraceProcessor*,
                     TraceWriter*,
                     bool wrapped_in_json,
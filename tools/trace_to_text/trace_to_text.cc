@@ -16,19 +16,24 @@
 
 #include "tools/trace_to_text/trace_to_text.h"
 
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <google/protobuf/compiler/importer.h>
-#include <google/protobuf/dynamic_message.h>
-#include <google/protobuf/io/zero_copy_stream_impl.h>
-#include <google/protobuf/text_format.h>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "src/trace_processor/util/descriptors.h"
 #include "tools/trace_to_text/proto_full_utils.h"
+#include "tools/trace_to_text/proto_text_printer.h"
 #include "tools/trace_to_text/utils.h"
 
 #include "protos/perfetto/trace/trace.pbzero.h"
-#include "protos/perfetto/trace/trace_packet.pbzero.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 #include <zlib.h>
@@ -38,36 +43,17 @@ namespace perfetto {
 namespace trace_to_text {
 
 namespace {
-using google::protobuf::Descriptor;
-using google::protobuf::DynamicMessageFactory;
-using google::protobuf::FieldDescriptor;
 using google::protobuf::FileDescriptor;
-using google::protobuf::Message;
-using google::protobuf::Reflection;
-using google::protobuf::TextFormat;
 using google::protobuf::compiler::DiskSourceTree;
 using google::protobuf::compiler::Importer;
-using google::protobuf::io::OstreamOutputStream;
-using google::protobuf::io::ZeroCopyOutputStream;
 
-inline void WriteToZeroCopyOutput(ZeroCopyOutputStream* output,
-                                  const char* str,
-                                  size_t length) {
-  if (length == 0)
-    return;
+constexpr char kTracePacketName[] = ".perfetto.protos.TracePacket";
+constexpr uint32_t kCompressedPacketsFieldId = 50;
 
-  void* data;
-  int size = 0;
-  size_t bytes_to_copy = 0;
-  while (length) {
-    output->Next(&data, &size);
-    bytes_to_copy = std::min(length, static_cast<size_t>(size));
-    memcpy(data, str, bytes_to_copy);
-    length -= bytes_to_copy;
-    str += bytes_to_copy;
-  }
-  output->BackUp(size - static_cast<int>(bytes_to_copy));
-}
+// Packets are formatted in batches of roughly this many bytes, one batch per
+// thread. The formatted text of a batch is written out in one go.
+constexpr size_t kBatchBytes = 4 * 1024 * 1024;
+constexpr uint32_t kMaxThreads = 8;
 
 constexpr char kCompressedPacketsPrefix[] = "compressed_packets {\n";
 constexpr char kCompressedPacketsSuffix[] = "}\n";
@@ -78,17 +64,44 @@ constexpr char kIndentedPacketSuffix[] = "  }\n";
 constexpr char kPacketPrefix[] = "packet {\n";
 constexpr char kPacketSuffix[] = "}\n";
 
-void PrintCompressedPackets(const std::string& packets,
-                            Message* compressed_msg_scratch,
-                            ZeroCopyOutputStream* output) {
+struct PacketBatch {
+  std::vector<std::unique_ptr<char[]>> packets;
+  std::vector<size_t> sizes;
+  size_t bytes = 0;
+  std::string text;
+};
+
+// Appends |packet| to |text| between |prefix| and |suffix|. Invalid packets
+// are skipped without leaving a partially printed message behind.
+bool PrintPacket(const ProtoTextPrinter& printer,
+                 uint32_t packet_idx,
+                 protozero::ConstBytes packet,
+                 uint32_t indent,
+                 const char* prefix,
+                 const char* suffix,
+                 std::string* text) {
+  size_t rollback_size = text->size();
+  text->append(prefix);
+  if (!printer.PrintMessage(packet_idx, packet, indent, text)) {
+    text->resize(rollback_size);
+    PERFETTO_ELOG("Skipping invalid packet");
+    return false;
+  }
+  text->append(suffix);
+  return true;
+}
+
+void PrintCompressedPackets(const ProtoTextPrinter& printer,
+                            uint32_t packet_idx,
+                            protozero::ConstBytes packets,
+                            std::string* text) {
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
   uint8_t out[4096];
   std::vector<uint8_t> data;
 
   z_stream stream{};
-  stream.next_in =
-      const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(packets.data()));
-  stream.avail_in = static_cast<unsigned int>(packets.length());
+  stream.next_in = const_cast<uint8_t*>(packets.data);
+  stream.avail_in = static_cast<unsigned int>(packets.size);
 
   if (inflateInit(&stream) != Z_OK) {
     PERFETTO_ELOG("Error when initiliazing zlib to decompress packets");
@@ -102,6 +115,7 @@ void PrintCompressedPackets(const std::string& packets,
     ret = inflate(&stream, Z_NO_FLUSH);
     if (ret != Z_STREAM_END && ret != Z_OK) {
       PERFETTO_ELOG("Error when decompressing packets");
+      inflateEnd(&stream);
       return;
     }
     data.insert(data.end(), out, out + (sizeof(out) - stream.avail_out));
@@ -109,33 +123,23 @@ void PrintCompressedPackets(const std::string& packets,
   inflateEnd(&stream);
 
   protos::pbzero::Trace::Decoder decoder(data.data(), data.size());
-  WriteToZeroCopyOutput(output, kCompressedPacketsPrefix,
-                        sizeof(kCompressedPacketsPrefix) - 1);
-  TextFormat::Printer printer;
-  printer.SetInitialIndentLevel(2);
+  text->append(kCompressedPacketsPrefix);
   for (auto it = decoder.packet(); it; ++it) {
-    protozero::ConstBytes cb = *it;
-    compressed_msg_scratch->ParseFromArray(cb.data, static_cast<int>(cb.size));
-    WriteToZeroCopyOutput(output, kIndentedPacketPrefix,
-                          sizeof(kIndentedPacketPrefix) - 1);
-    printer.Print(*compressed_msg_scratch, output);
-    WriteToZeroCopyOutput(output, kIndentedPacketSuffix,
-                          sizeof(kIndentedPacketSuffix) - 1);
+    PrintPacket(printer, packet_idx, *it, /*indent=*/2, kIndentedPacketPrefix,
+                kIndentedPacketSuffix, text);
   }
-  WriteToZeroCopyOutput(output, kCompressedPacketsSuffix,
-                        sizeof(kCompressedPacketsSuffix) - 1);
+  text->append(kCompressedPacketsSuffix);
 #else
+  base::ignore_result(printer);
+  base::ignore_result(packet_idx);
   base::ignore_result(packets);
-  base::ignore_result(compressed_msg_scratch);
   base::ignore_result(kIndentedPacketPrefix);
   base::ignore_result(kIndentedPacketSuffix);
-  WriteToZeroCopyOutput(output, kCompressedPacketsPrefix,
-                        sizeof(kCompressedPacketsPrefix) - 1);
   static const char kErrMsg[] =
       "Cannot decode compressed packets. zlib not enabled in the build config";
-  WriteToZeroCopyOutput(output, kErrMsg, sizeof(kErrMsg) - 1);
-  WriteToZeroCopyOutput(output, kCompressedPacketsSuffix,
-                        sizeof(kCompressedPacketsSuffix) - 1);
+  text->append(kCompressedPacketsPrefix);
+  text->append(kErrMsg);
+  text->append(kCompressedPacketsSuffix);
   static bool log_once = [] {
     PERFETTO_ELOG("%s", kErrMsg);
     return true;
@@ -144,6 +148,47 @@ void PrintCompressedPackets(const std::string& packets,
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 }
 
+void PrintBatch(const ProtoTextPrinter& printer,
+                uint32_t packet_idx,
+                PacketBatch* batch) {
+  // The text is usually a few times larger than the binary packets.
+  batch->text.reserve(batch->bytes * 4);
+  for (size_t i = 0; i < batch->packets.size(); ++i) {
+    protozero::ConstBytes packet{
+        reinterpret_cast<const uint8_t*>(batch->packets[i].get()),
+        batch->sizes[i]};
+    protozero::ProtoDecoder decoder(packet.data, packet.size);
+    protozero::Field compressed = decoder.FindField(kCompressedPacketsFieldId);
+    if (compressed.valid()) {
+      PrintCompressedPackets(printer, packet_idx, compressed.as_bytes(),
+                             &batch->text);
+      continue;
+    }
+    PrintPacket(printer, packet_idx, packet, /*indent=*/1, kPacketPrefix,
+                kPacketSuffix, &batch->text);
+  }
+}
+
+// Prints the batches in parallel and writes out their text in order.
+void PrintAndWriteBatches(const ProtoTextPrinter& printer,
+                          uint32_t packet_idx,
+                          std::vector<PacketBatch>* batches,
+                          std::ostream* output) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < batches->size(); ++i) {
+    threads.emplace_back(PrintBatch, std::cref(printer), packet_idx,
+                         &(*batches)[i]);
+  }
+  if (!batches->empty())
+    PrintBatch(printer, packet_idx, &(*batches)[0]);
+  for (std::thread& thread : threads)
+    thread.join();
+  for (const PacketBatch& batch : *batches)
+    output->write(batch.text.data(),
+                  static_cast<std::streamsize>(batch.text.size()));
+  batches->clear();
+}
+
 }  // namespace
 
 int TraceToText(std::istream* input, std::ostream* output) {
@@ -161,46 +206,45 @@ int TraceToText(std::istream* input, std::ostream* output) {
   dst.MapPath("", "");
   MultiFileErrorCollectorImpl mfe;
   Importer importer(&dst, &mfe);
-  const FileDescriptor* parsed_file =
-      importer.Import("protos/perfetto/trace/trace_packet.proto");
-
-  DynamicMessageFactory dmf;
-  const Descriptor* trace_descriptor = parsed_file->message_type(0);
-  const Message* root = dmf.GetPrototype(trace_descriptor);
-  OstreamOutputStream zero_copy_output(output);
-  OstreamOutputStream* zero_copy_output_ptr = &zero_copy_output;
-  Message* msg = root->New();
-
-  constexpr uint32_t kCompressedPacketFieldDescriptor = 50;
-  const Reflection* reflect = msg->GetReflection();
-  const FieldDescriptor* compressed_desc =
-      trace_descriptor->FindFieldByNumber(kCompressedPacketFieldDescriptor);
-  Message* compressed_msg_scratch = root->New();
-  std::string compressed_packet_scratch;
-
-  TextFormat::Printer printer;
-  printer.SetInitialIndentLevel(1);
+  const FileDescriptor* parsed_file = importer.Import(proto_path);
+  if (!parsed_file)
+    return 1;
+
+  // libprotobuf is only used to parse the .proto files: the packets are
+  // decoded with protozero and printed by ProtoTextPrinter.
+  trace_processor::DescriptorPool pool;
+  base::Status status = AddToDescriptorPool(parsed_file, &pool);
+  if (!status.ok()) {
+    PERFETTO_ELOG("Failed to load the trace descriptors: %s",
+                  status.c_message());
+    return 1;
+  }
+  ProtoTextPrinter printer(pool);
+  base::Optional<uint32_t> packet_idx = printer.FindMessage(kTracePacketName);
+  if (!packet_idx) {
+    PERFETTO_ELOG("Cannot find %s in %s", kTracePacketName, proto_path.c_str());
+    return 1;
+  }
+
+  uint32_t num_threads = std::max(
+      1u, std::min(kMaxThreads, std::thread::hardware_concurrency()));
+  std::vector<PacketBatch> batches(1);
   ForEachPacketBlobInTrace(
-      input, [msg, reflect, compressed_desc, zero_copy_output_ptr,
-              &compressed_packet_scratch, compressed_msg_scratch,
-              &printer](std::unique_ptr<char[]> buf, size_t size) {
-        if (!msg->ParseFromArray(buf.get(), static_cast<int>(size))) {
-          PERFETTO_ELOG("Skipping invalid packet");
+      input, [&](std::unique_ptr<char[]> buf, size_t size) {
+        PacketBatch* batch = &batches.back();
+        batch->packets.emplace_back(std::move(buf));
+        batch->sizes.emplace_back(size);
+        batch->bytes += size;
+        if (batch->bytes < kBatchBytes)
+          return;
+        if (batches.size() < num_threads) {
+          batches.emplace_back();
           return;
         }
-        if (reflect->HasField(*msg, compressed_desc)) {
-          const auto& compressed_packets = reflect->GetStringReference(
-              *msg, compressed_desc, &compressed_packet_scratch);
-          PrintCompressedPackets(compressed_packets, compressed_msg_scratch,
-                                 zero_copy_output_ptr);
-        } else {
-          WriteToZeroCopyOutput(zero_copy_output_ptr, kPacketPrefix,
-                                sizeof(kPacketPrefix) - 1);
-          printer.Print(*msg, zero_copy_output_ptr);
-          WriteToZeroCopyOutput(zero_copy_output_ptr, kPacketSuffix,
-                                sizeof(kPacketSuffix) - 1);
-        }
+        PrintAndWriteBatches(printer, *packet_idx, &batches, output);
+        batches.emplace_back();
       });
+  PrintAndWriteBatches(printer, *packet_idx, &batches, output);
   return 0;
 }
 